@@ -0,0 +1,25 @@
+// LocalNode Web UI: アップロード前の画像縮小・再エンコード
+//
+// メインスレッドを止めないよう Worker 内で OffscreenCanvas を使ってデコード →
+// 長辺 maxEdge 以下に縮小 → type / quality で再エンコードする。
+// 要求: { id, file, maxEdge, quality, type }  応答: { id, blob, width, height } | { id, error }
+
+self.onmessage = async (ev) => {
+    const { id, file, maxEdge, quality, type } = ev.data || {};
+    try {
+        // EXIF の向きを反映してからピクセルに落とす (再エンコードで EXIF は消えるため)
+        const bitmap = await createImageBitmap(file, { imageOrientation: 'from-image' });
+        const scale = Math.min(1, maxEdge / Math.max(bitmap.width, bitmap.height));
+        const width = Math.max(1, Math.round(bitmap.width * scale));
+        const height = Math.max(1, Math.round(bitmap.height * scale));
+        const canvas = new OffscreenCanvas(width, height);
+        const ctx = canvas.getContext('2d');
+        ctx.imageSmoothingQuality = 'high';
+        ctx.drawImage(bitmap, 0, 0, width, height);
+        bitmap.close();
+        const blob = await canvas.convertToBlob({ type, quality });
+        self.postMessage({ id, blob, width, height });
+    } catch (e) {
+        self.postMessage({ id, error: String((e && e.message) || e) });
+    }
+};
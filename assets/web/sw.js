@@ -0,0 +1,258 @@
+// LocalNode Web UI Service Worker
+//
+// 1. キャッシュ層
+//    - アプリシェル (index.html): stale-while-revalidate。再訪時はキャッシュから即表示。
+//    - ファイル一覧 (/api/files): stale-while-revalidate。裏で取り直して内容が変わって
+//      いればページへ 'sw-updated' を通知し、ページ側で再描画する。
+//    - /api/info: network-first、オフライン時のみキャッシュ。
+//    - サムネイル: 件数上限付きキャッシュ。一定時間を過ぎたものは ETag
+//      (If-None-Match) で裏で再検証する。
+//    401/403 を受けたら API・サムネイルのキャッシュを破棄してページへ通知する。
+//
+// 2. 分割並列ダウンロード: File System Access API が無いブラウザ向けに、
+//    ページから MessagePort で受け取ったチャンクを ReadableStream として
+//    /__dl/<token>/<filename> のレスポンスに流し込み、ブラウザの DL マネージャへ渡す。
+
+const SHELL_CACHE = 'localnode-shell-v1';
+const API_CACHE = 'localnode-api-v1';
+const THUMB_CACHE = 'localnode-thumbs-v1';
+const KNOWN_CACHES = new Set([SHELL_CACHE, API_CACHE, THUMB_CACHE]);
+const SHELL_URLS = ['/', '/index.html'];
+const THUMB_CACHE_MAX = 600;
+const THUMB_REVALIDATE_MS = 10 * 60 * 1000;
+const THUMB_TRIM_EVERY = 20;
+const CACHED_AT_HEADER = 'x-sw-cached-at';
+
+const DL_PREFIX = '/__dl/';
+const pendingDownloads = new Map(); // token -> { port, filename, size }
+
+self.addEventListener('install', (event) => {
+    event.waitUntil((async () => {
+        try {
+            const cache = await caches.open(SHELL_CACHE);
+            await cache.addAll(SHELL_URLS);
+        } catch (_) {
+            // シェルの先読みに失敗しても SW 自体は有効にする
+        }
+        await self.skipWaiting();
+    })());
+});
+
+self.addEventListener('activate', (event) => {
+    event.waitUntil((async () => {
+        const names = await caches.keys();
+        await Promise.all(names
+            .filter((n) => n.startsWith('localnode-') && !KNOWN_CACHES.has(n))
+            .map((n) => caches.delete(n)));
+        await self.clients.claim();
+    })());
+});
+
+const broadcast = async (message) => {
+    const clients = await self.clients.matchAll({ type: 'window' });
+    clients.forEach((c) => c.postMessage(message));
+};
+
+const dropPrivateCaches = async () => {
+    await Promise.all([caches.delete(API_CACHE), caches.delete(THUMB_CACHE)]);
+};
+
+self.addEventListener('message', (event) => {
+    const data = event.data || {};
+    if (data.type === 'dl-open' && event.ports[0]) {
+        pendingDownloads.set(data.token, {
+            port: event.ports[0],
+            filename: data.filename,
+            size: data.size,
+        });
+        event.ports[0].postMessage({ type: 'ready' });
+    }
+});
+
+// --- キャッシュ戦略 ---
+
+const isAuthFailure = (res) => res.status === 401 || res.status === 403;
+
+const staleWhileRevalidate = async (event, cacheName, { notify = false } = {}) => {
+    const req = event.request;
+    const cache = await caches.open(cacheName);
+    const cached = await cache.match(req);
+    const cachedText = (cached && notify) ? cached.clone().text() : null;
+
+    const revalidate = (async () => {
+        const res = await fetch(req);
+        if (isAuthFailure(res)) {
+            await dropPrivateCaches();
+            if (cached) await broadcast({ type: 'sw-auth-required' });
+            return res;
+        }
+        if (res.ok) {
+            const copy = res.clone();
+            let changed = false;
+            if (cachedText) {
+                const [before, after] = await Promise.all([cachedText, res.clone().text()]);
+                changed = before !== after;
+            }
+            await cache.put(req, copy);
+            if (changed) await broadcast({ type: 'sw-updated', url: req.url });
+        }
+        return res;
+    })();
+
+    if (cached) {
+        event.waitUntil(revalidate.catch(() => {}));
+        return cached;
+    }
+    return revalidate;
+};
+
+// 明示的な再読み込み (fetch の cache: 'no-cache' 等) はネットワーク優先で、結果をキャッシュにも反映
+const networkFirst = async (req, cacheName) => {
+    const cache = await caches.open(cacheName);
+    try {
+        const res = await fetch(req);
+        if (isAuthFailure(res)) {
+            await dropPrivateCaches();
+        } else if (res.ok) {
+            await cache.put(req, res.clone());
+        }
+        return res;
+    } catch (e) {
+        const cached = await cache.match(req);
+        if (cached) return cached;
+        throw e;
+    }
+};
+
+let thumbPutsSinceTrim = 0;
+const putThumbnail = async (cache, req, res) => {
+    const body = await res.blob();
+    const headers = new Headers(res.headers);
+    headers.set(CACHED_AT_HEADER, String(Date.now()));
+    await cache.put(req, new Response(body, { status: 200, headers }));
+    if (++thumbPutsSinceTrim < THUMB_TRIM_EVERY) return;
+    thumbPutsSinceTrim = 0;
+    // keys() は概ね挿入順なので先頭 (古いもの) から削る
+    const keys = await cache.keys();
+    if (keys.length > THUMB_CACHE_MAX) {
+        await Promise.all(keys.slice(0, keys.length - THUMB_CACHE_MAX).map((k) => cache.delete(k)));
+    }
+};
+
+const revalidateThumbnail = async (cache, req, cached) => {
+    const etag = cached.headers.get('ETag');
+    const headers = etag ? { 'If-None-Match': etag } : {};
+    const res = await fetch(req.url, { headers, credentials: 'same-origin', cache: 'no-store' });
+    if (res.status === 304) {
+        await putThumbnail(cache, req, cached);
+    } else if (res.ok) {
+        await putThumbnail(cache, req, res);
+    } else if (isAuthFailure(res)) {
+        await dropPrivateCaches();
+    } else if (res.status === 404) {
+        await cache.delete(req);
+    }
+};
+
+const thumbnailResponse = async (event) => {
+    const req = event.request;
+    const cache = await caches.open(THUMB_CACHE);
+    const cached = await cache.match(req);
+    if (cached) {
+        const age = Date.now() - Number(cached.headers.get(CACHED_AT_HEADER) || 0);
+        if (age > THUMB_REVALIDATE_MS) {
+            event.waitUntil(revalidateThumbnail(cache, req, cached.clone()).catch(() => {}));
+        }
+        return cached;
+    }
+    const res = await fetch(req);
+    if (res.ok) event.waitUntil(putThumbnail(cache, req, res.clone()).catch(() => {}));
+    return res;
+};
+
+const OFFLINE_HTML = '<!DOCTYPE html><html><head><meta charset="UTF-8">'
+    + '<title>LocalNode</title></head><body style="font-family:sans-serif;text-align:center;padding:2rem;">'
+    + '<h1>LocalNode</h1><p>サーバに接続できません (オフライン)</p></body></html>';
+
+const shellResponse = async (event) => {
+    try {
+        return await staleWhileRevalidate(event, SHELL_CACHE);
+    } catch (_) {
+        const cache = await caches.open(SHELL_CACHE);
+        const fallback = await cache.match('/');
+        return fallback || new Response(OFFLINE_HTML, {
+            status: 503,
+            headers: { 'Content-Type': 'text/html; charset=utf-8' },
+        });
+    }
+};
+
+// --- 分割並列ダウンロードのストリーム ---
+
+const streamDownloadResponse = (token) => {
+    const entry = pendingDownloads.get(token);
+    if (!entry) return new Response('Not found', { status: 404 });
+    pendingDownloads.delete(token);
+    const { port, filename, size } = entry;
+
+    // ページ側は pull 要求 1 回につき 1 チャンク送る (バックプレッシャ)
+    const stream = new ReadableStream({
+        start(controller) {
+            port.onmessage = (ev) => {
+                const m = ev.data || {};
+                if (m.type === 'chunk') {
+                    controller.enqueue(new Uint8Array(m.data));
+                } else if (m.type === 'end') {
+                    controller.close();
+                    port.close();
+                } else if (m.type === 'abort') {
+                    controller.error(new Error(m.reason || 'aborted'));
+                    port.close();
+                }
+            };
+        },
+        pull() {
+            port.postMessage({ type: 'pull' });
+        },
+        cancel(reason) {
+            port.postMessage({ type: 'cancel', reason: String(reason || '') });
+            port.close();
+        },
+    }, { highWaterMark: 4 });
+
+    const headers = {
+        'Content-Type': 'application/octet-stream',
+        'Content-Disposition':
+            `attachment; filename*=UTF-8''${encodeURIComponent(filename)}`,
+    };
+    if (Number.isFinite(size)) headers['Content-Length'] = String(size);
+    return new Response(stream, { headers });
+};
+
+self.addEventListener('fetch', (event) => {
+    const req = event.request;
+    const url = new URL(req.url);
+    if (url.origin !== self.location.origin) return;
+    if (url.pathname.startsWith(DL_PREFIX)) {
+        const token = url.pathname.slice(DL_PREFIX.length).split('/')[0];
+        event.respondWith(streamDownloadResponse(token));
+        return;
+    }
+    // Range 付き (動画・分割DL) と GET 以外はそのまま
+    if (req.method !== 'GET' || req.headers.has('Range')) return;
+
+    const fresh = req.cache === 'no-cache' || req.cache === 'reload' || req.cache === 'no-store';
+    const path = url.pathname;
+    // <a download> もナビゲーションなので、シェル扱いはパスで限定する
+    if (path === '/' || path === '/index.html') {
+        event.respondWith(fresh ? networkFirst(req, SHELL_CACHE) : shellResponse(event));
+    } else if (path === '/api/files') {
+        event.respondWith(fresh
+            ? networkFirst(req, API_CACHE)
+            : staleWhileRevalidate(event, API_CACHE, { notify: true }));
+    } else if (path === '/api/info') {
+        event.respondWith(networkFirst(req, API_CACHE));
+    } else if (path.startsWith('/api/thumbnail/') || path === '/api/thumbnail-by-path') {
+        event.respondWith(fresh ? networkFirst(req, THUMB_CACHE) : thumbnailResponse(event));
+    }
+});
@@ -7,8 +7,10 @@
 
 import 'dart:async';
 import 'dart:convert';
+import 'dart:developer' as developer;
 import 'dart:ffi';
 import 'dart:io';
+import 'dart:isolate';
 import 'dart:math';
 import 'dart:typed_data';
 
@@ -16,7 +18,17 @@ import 'package:archive/archive.dart';
 import 'package:archive/archive_io.dart';
 import 'package:args/args.dart';
 import 'package:basic_utils/basic_utils.dart';
+import 'package:crypto/crypto.dart' as crypto;
 import 'package:image/image.dart' as img;
+import 'package:localnode/src/clip_sync.dart';
+import 'package:localnode/src/clipboard_store.dart';
+import 'package:localnode/src/lnz.dart';
+import 'package:localnode/src/perf_stats.dart';
+import 'package:localnode/src/rate_limit.dart';
+import 'package:localnode/src/replica.dart';
+import 'package:localnode/src/share_token.dart';
+import 'package:localnode/src/stats_format.dart';
+import 'package:localnode/src/trace_format.dart';
 import 'package:path/path.dart' as p;
 import 'package:qr/qr.dart';
 import 'package:shelf/shelf.dart';
@@ -40,6 +52,11 @@ const Set<String> _kReservedMentionNames = {
   'list', 'run', 'to', 'run_to', 'up',
 };
 
+// index.html と一緒に webroot へ展開する補助アセット。
+//   sw.js             Service Worker (キャッシュ層 / 分割並列ダウンロードのストリーム保存)
+//   resize-worker.js  アップロード前の画像縮小 Worker
+const List<String> _kWebSideAssets = ['sw.js', 'resize-worker.js'];
+
 extension _FirstWhereOrNullExt<E> on Iterable<E> {
   E? firstWhereOrNullExt(bool Function(E) test) {
     for (final e in this) {
@@ -71,6 +88,8 @@ extension _FirstWhereOrNullExt<E> on Iterable<E> {
 //     no-token: false
 //     pin-length: 4             # 1.6.0 #206 (parsed; consumed by #206)
 //     pin-charset: digits       # 1.6.0 #206
+//     watch: false              # 共有フォルダに直接置かれたファイルも取り込む
+//     watch-settle: 2000        # 最後の変更から取り込むまでの待ち (ms)
 //
 //   mention_actions:
 //     - alias: backup
@@ -84,6 +103,19 @@ extension _FirstWhereOrNullExt<E> on Iterable<E> {
 //   clipboard:                  # 1.6.0 #227 (parsed; consumed by #227)
 //     max_items: 1000
 //     max_text_length: 10000
+//     max_blob_size: 32MB       # 貼り付け画像・長文 (blob) の 1 件あたり上限
+//
+//   api_tokens:                 # 名前付き Bearer トークン (レート・帯域・同時数の上限付き)
+//     - name: backup-cron
+//       token: xxxx
+//       rate: 2                 # リクエスト/秒 (トークンバケットの補充速度)
+//       burst: 10               # バケット容量 (省略時は rate と同じ)
+//       max_bytes_per_sec: 5MB  # リクエストボディの帯域上限
+//       max_concurrent_uploads: 1
+//
+//   storage:                    # 保存時圧縮 (シーク可能な独立フレーム形式 .lnz)
+//     compress: ["*.log", "*.txt"]
+//     frame_size: 256KB
 //
 //   children: [...]             # 1.6.0 #218 federation (parsed; consumed there)
 //   parent: {...}               # 1.6.0 #218 federation
@@ -103,6 +135,17 @@ class _LoadedPostAction {
   _LoadedPostAction(this.pattern, this.script);
 }
 
+class _LoadedApiToken {
+  final String name;
+  final String token;
+  final double? rate;
+  final int? burst;
+  final int? maxBytesPerSec;
+  final int? maxConcurrentUploads;
+  _LoadedApiToken(this.name, this.token, this.rate, this.burst,
+      this.maxBytesPerSec, this.maxConcurrentUploads);
+}
+
 class _LoadedConfig {
   // server section
   int? port;
@@ -113,6 +156,9 @@ class _LoadedConfig {
   String? name;
   String? httpsCert;
   String? httpsKey;
+  // HTTP/3 sidecar (Caddy) の実行ファイルと UDP ポート
+  String? http3Sidecar;
+  int? http3Port;
   String? token;
   bool? noPin;
   bool? noClipboard;
@@ -130,40 +176,61 @@ class _LoadedConfig {
   String? tokenFile;
   // #275: DNS rebinding guard に追加で許可するホスト名（リバースプロキシ等）
   List<String>? allowedHosts;
+  // 監視フォルダ取り込み
+  bool? watch;
+  bool? webdav;
+  // イベントループ監視
+  int? stallThresholdMs;
+  bool? stallProfile;
+  String? statsSocket;
+  String? trace;
+  String? bind;
+  int? watchSettleMs;
   // lists
   List<_LoadedMentionAction>? mentionActions;
   List<_LoadedPostAction>? postActions;
+  List<_LoadedApiToken>? apiTokens;
+  // storage section: 保存時圧縮の対象パターンとフレームサイズ
+  List<String>? compressPatterns;
+  int? compressFrameBytes;
   // future sections, parsed-but-not-consumed-yet
   Map<dynamic, dynamic>? clipboardRaw;       // #227
   List<dynamic>? childrenRaw;                // #218 federation
   Map<dynamic, dynamic>? parentRaw;          // #218 federation
 }
 
-/// Read and validate a YAML config file. Throws on fatal errors (unreadable,
-/// syntax, type mismatch). Unknown top-level keys produce a warning to stderr.
+/// config の読み込み・検証エラー。起動時は main が Error: として出して終了し、
+/// 再読み込み時は警告だけ出して現在の設定を維持する。
+class _ConfigError implements Exception {
+  final String message;
+  _ConfigError(this.message);
+  @override
+  String toString() => message;
+}
+
+/// Read and validate a YAML config file. Throws [_ConfigError] on fatal errors
+/// (unreadable, syntax, type mismatch). Unknown top-level keys produce a
+/// warning to stderr.
 _LoadedConfig _loadConfig(String path) {
   final file = File(path);
   if (!file.existsSync()) {
-    stderr.writeln('Error: Config file not found: $path');
-    exit(1);
+    throw _ConfigError('Config file not found: $path');
   }
   final dynamic doc;
   try {
     doc = loadYaml(file.readAsStringSync());
   } catch (e) {
-    stderr.writeln('Error: Failed to parse config file: $e');
-    exit(1);
+    throw _ConfigError('Failed to parse config file: $e');
   }
   if (doc == null) return _LoadedConfig();
   if (doc is! YamlMap) {
-    stderr.writeln('Error: Config file root must be a YAML mapping.');
-    exit(1);
+    throw _ConfigError('Config file root must be a YAML mapping.');
   }
 
   final cfg = _LoadedConfig();
   const knownTop = {
     'server', 'mention_actions', 'post_actions', 'clipboard',
-    'children', 'parent',
+    'children', 'parent', 'api_tokens', 'storage',
   };
   for (final key in doc.keys) {
     if (!knownTop.contains(key)) {
@@ -176,12 +243,15 @@ _LoadedConfig _loadConfig(String path) {
   if (server is YamlMap) {
     cfg.port = _yamlInt(server, 'port');
     cfg.ip = _yamlString(server, 'ip');
+    cfg.bind = _yamlString(server, 'bind');
     cfg.pin = _yamlString(server, 'pin');
     cfg.dir = _yamlString(server, 'dir');
     cfg.mode = _yamlString(server, 'mode');
     cfg.name = _yamlString(server, 'name');
     cfg.httpsCert = _yamlString(server, 'https-cert');
     cfg.httpsKey = _yamlString(server, 'https-key');
+    cfg.http3Sidecar = _yamlString(server, 'http3-sidecar');
+    cfg.http3Port = _yamlInt(server, 'http3-port');
     cfg.token = _yamlString(server, 'token');
     cfg.noPin = _yamlBool(server, 'no-pin');
     cfg.noClipboard = _yamlBool(server, 'no-clipboard');
@@ -193,17 +263,22 @@ _LoadedConfig _loadConfig(String path) {
     cfg.stateFile = _yamlString(server, 'state-file');   // #237
     cfg.pinFile = _yamlString(server, 'pin-file');       // #208
     cfg.tokenFile = _yamlString(server, 'token-file');   // #208
+    cfg.watch = _yamlBool(server, 'watch');
+    cfg.webdav = _yamlBool(server, 'webdav');
+    cfg.stallThresholdMs = _yamlInt(server, 'stall-threshold');
+    cfg.stallProfile = _yamlBool(server, 'stall-profile');
+    cfg.statsSocket = _yamlString(server, 'stats-socket');
+    cfg.trace = _yamlString(server, 'trace');
+    cfg.watchSettleMs = _yamlInt(server, 'watch-settle');
     // #275: allowed-hosts はホスト名文字列のリスト
     final ah = server['allowed-hosts'];
     if (ah is YamlList) {
       cfg.allowedHosts = ah.map((e) => e.toString()).toList();
     } else if (ah != null) {
-      stderr.writeln('Error: server.allowed-hosts must be a list of host names.');
-      exit(1);
+      throw _ConfigError('server.allowed-hosts must be a list of host names.');
     }
   } else if (server != null) {
-    stderr.writeln('Error: server section must be a mapping.');
-    exit(1);
+    throw _ConfigError('server section must be a mapping.');
   }
 
   // mention_actions
@@ -212,21 +287,18 @@ _LoadedConfig _loadConfig(String path) {
     final list = <_LoadedMentionAction>[];
     for (final entry in ma) {
       if (entry is! YamlMap) {
-        stderr.writeln('Error: mention_actions entry must be a mapping.');
-        exit(1);
+        throw _ConfigError('mention_actions entry must be a mapping.');
       }
       final alias = _yamlString(entry, 'alias');
       final script = _yamlString(entry, 'script');
       if (alias == null || alias.isEmpty || script == null || script.isEmpty) {
-        stderr.writeln('Error: mention_actions entry requires alias and script.');
-        exit(1);
+        throw _ConfigError('mention_actions entry requires alias and script.');
       }
       list.add(_LoadedMentionAction(alias, script, _yamlString(entry, 'description')));
     }
     cfg.mentionActions = list;
   } else if (ma != null) {
-    stderr.writeln('Error: mention_actions must be a list.');
-    exit(1);
+    throw _ConfigError('mention_actions must be a list.');
   }
 
   // post_actions
@@ -235,21 +307,77 @@ _LoadedConfig _loadConfig(String path) {
     final list = <_LoadedPostAction>[];
     for (final entry in pa) {
       if (entry is! YamlMap) {
-        stderr.writeln('Error: post_actions entry must be a mapping.');
-        exit(1);
+        throw _ConfigError('post_actions entry must be a mapping.');
       }
       final pattern = _yamlString(entry, 'pattern');
       final script = _yamlString(entry, 'script');
       if (pattern == null || pattern.isEmpty || script == null || script.isEmpty) {
-        stderr.writeln('Error: post_actions entry requires pattern and script.');
-        exit(1);
+        throw _ConfigError('post_actions entry requires pattern and script.');
       }
       list.add(_LoadedPostAction(pattern, script));
     }
     cfg.postActions = list;
   } else if (pa != null) {
-    stderr.writeln('Error: post_actions must be a list.');
-    exit(1);
+    throw _ConfigError('post_actions must be a list.');
+  }
+
+  // api_tokens: 名前付き Bearer トークンと、それぞれのクォータ
+  final at = doc['api_tokens'];
+  if (at is YamlList) {
+    final list = <_LoadedApiToken>[];
+    for (final entry in at) {
+      if (entry is! YamlMap) {
+        throw _ConfigError('api_tokens entry must be a mapping.');
+      }
+      final name = _yamlString(entry, 'name');
+      final token = _yamlString(entry, 'token');
+      if (name == null || name.isEmpty || token == null || token.isEmpty) {
+        throw _ConfigError('api_tokens entry requires name and token.');
+      }
+      final rateRaw = entry['rate'];
+      final rate = rateRaw == null ? null : double.tryParse(rateRaw.toString());
+      if (rateRaw != null && (rate == null || rate <= 0)) {
+        throw _ConfigError('api_tokens[$name].rate must be a positive number.');
+      }
+      final burst = _yamlInt(entry, 'burst');
+      if (entry['burst'] != null && (burst == null || burst < 1)) {
+        throw _ConfigError('api_tokens[$name].burst must be a positive integer.');
+      }
+      final bpsRaw = entry['max_bytes_per_sec'];
+      final bps = _parseSizeBytes(bpsRaw);
+      if (bpsRaw != null && (bps == null || bps <= 0)) {
+        throw _ConfigError('api_tokens[$name].max_bytes_per_sec must be a size such as 5MB.');
+      }
+      final conc = _yamlInt(entry, 'max_concurrent_uploads');
+      if (entry['max_concurrent_uploads'] != null && (conc == null || conc < 1)) {
+        throw _ConfigError('api_tokens[$name].max_concurrent_uploads must be a positive integer.');
+      }
+      list.add(_LoadedApiToken(name, token, rate, burst, bps, conc));
+    }
+    cfg.apiTokens = list;
+  } else if (at != null) {
+    throw _ConfigError('api_tokens must be a list.');
+  }
+
+  // storage: 保存時圧縮
+  final st = doc['storage'];
+  if (st is YamlMap) {
+    final cp = st['compress'];
+    if (cp is YamlList) {
+      cfg.compressPatterns = cp.map((e) => e.toString()).toList();
+    } else if (cp != null) {
+      throw _ConfigError('storage.compress must be a list of glob patterns.');
+    }
+    final fsRaw = st['frame_size'];
+    if (fsRaw != null) {
+      final fs = _parseSizeBytes(fsRaw);
+      if (fs == null || fs < 4096 || fs > 16 * 1024 * 1024) {
+        throw _ConfigError('storage.frame_size must be between 4KB and 16MB.');
+      }
+      cfg.compressFrameBytes = fs;
+    }
+  } else if (st != null) {
+    throw _ConfigError('storage section must be a mapping.');
   }
 
   // forward-compat: clipboard はまだ consume されていないので silent skip OK
@@ -265,9 +393,8 @@ _LoadedConfig _loadConfig(String path) {
     if (ch is YamlList) {
       cfg.childrenRaw = List.from(ch);
     } else {
-      stderr.writeln('Error: children must be a list of mappings '
+      throw _ConfigError('children must be a list of mappings '
           '(got: ${ch == null ? "null/empty" : ch.runtimeType}).');
-      exit(1);
     }
   }
   if (doc.containsKey('parent')) {
@@ -275,9 +402,8 @@ _LoadedConfig _loadConfig(String path) {
     if (pa2 is YamlMap) {
       cfg.parentRaw = Map.from(pa2);
     } else {
-      stderr.writeln('Error: parent must be a mapping with url / token / relation '
+      throw _ConfigError('parent must be a mapping with url / token / relation '
           '(got: ${pa2 == null ? "null/empty" : pa2.runtimeType}).');
-      exit(1);
     }
   }
 
@@ -308,125 +434,35 @@ bool? _yamlBool(YamlMap m, String key) {
   return null;
 }
 
-// =============================================================================
-// エントリポイント
-// =============================================================================
-
-Future<void> main(List<String> args) async {
-  final parser = _buildParser();
-
-  if (args.contains('--help') || args.contains('-h')) {
-    _printUsage(parser);
-    _flushWindowsInput();
-    exit(0);
-  }
-
-  final ArgResults results;
-  try {
-    results = parser.parse(args);
-  } catch (e) {
-    stderr.writeln('Error: $e');
-    stderr.writeln('');
-    _printUsage(parser);
-    exit(1);
-  }
-
-  // #185: --config が指定されていれば YAML を読み込む。
-  // 解決優先順位: CLI 引数 > config > 既定値
-  _LoadedConfig? cfg;
-  if (results.wasParsed('config')) {
-    cfg = _loadConfig(results['config'] as String);
-  }
-
-  // port: CLI > config > '8080'
-  final portStr = results.wasParsed('port')
-      ? results['port'] as String
-      : (cfg?.port?.toString() ?? results['port'] as String);
-  final port = int.tryParse(portStr);
-  if (port == null || port < 1 || port > 65535) {
-    stderr.writeln('Error: Invalid port number. Must be between 1 and 65535.');
-    exit(1);
-  }
-
-  final dir = results.wasParsed('dir')
-      ? results['dir'] as String?
-      : (cfg?.dir ?? results['dir'] as String?);
-  if (dir != null && !Directory(dir).existsSync()) {
-    stderr.writeln('Error: Directory does not exist: $dir');
-    exit(1);
-  }
-
-  final specifiedIp = results.wasParsed('ip')
-      ? results['ip'] as String?
-      : (cfg?.ip ?? results['ip'] as String?);
-  final noClipboard = results.wasParsed('no-clipboard')
-      ? results['no-clipboard'] as bool
-      : (cfg?.noClipboard ?? results['no-clipboard'] as bool);
-  final verbose = results.wasParsed('verbose')
-      ? results['verbose'] as bool
-      : (cfg?.verbose ?? results['verbose'] as bool);
-  final modeStr = results.wasParsed('mode')
-      ? results['mode'] as String
-      : (cfg?.mode ?? results['mode'] as String);
-  if (modeStr != 'normal' && modeStr != 'download-only') {
-    stderr.writeln('Error: Invalid mode: $modeStr. Must be normal or download-only.');
-    exit(1);
-  }
-  final downloadOnly = modeStr == 'download-only';
-  final noPin = results.wasParsed('no-pin')
-      ? results['no-pin'] as bool
-      : (cfg?.noPin ?? results['no-pin'] as bool);
-  final fixedPin = results.wasParsed('pin')
-      ? results['pin'] as String?
-      : (cfg?.pin ?? results['pin'] as String?);
-  // #206
-  final pinLength = () {
-    final raw = results.wasParsed('pin-length')
-        ? results['pin-length'] as String?
-        : (cfg?.pinLength?.toString());
-    if (raw == null) return 8;
-    final n = int.tryParse(raw);
-    if (n == null || n < 8 || n > 16) {
-      stderr.writeln('Error: --pin-length must be an integer 8..16 (got "$raw").');
-      exit(1);
-    }
-    return n;
-  }();
-  final pinCharset = () {
-    const allowed = {'digits', 'alnum', 'alnum_symbols'};
-    final raw = results.wasParsed('pin-charset')
-        ? results['pin-charset'] as String?
-        : (cfg?.pinCharset ?? results['pin-charset'] as String?);
-    final v = raw ?? 'digits';
-    if (!allowed.contains(v)) {
-      stderr.writeln('Error: --pin-charset must be one of ${allowed.join("/")} (got "$v").');
-      exit(1);
-    }
-    return v;
-  }();
-  final serverName = results.wasParsed('name')
-      ? results['name'] as String
-      : (cfg?.name ?? results['name'] as String);
-  final noToken = results.wasParsed('no-token')
-      ? results['no-token'] as bool
-      : (cfg?.noToken ?? results['no-token'] as bool);
-  final fixedToken = results.wasParsed('token')
-      ? results['token'] as String?
-      : (cfg?.token ?? results['token'] as String?);
-  // #262: 直接アップロードのサイズ上限
-  final maxUploadSizeStr = results.wasParsed('max-upload-size')
-      ? results['max-upload-size'] as String?
-      : (cfg?.maxUploadSize ?? results['max-upload-size'] as String?);
-  final int? maxDirectUploadBytes = _parseSizeBytes(maxUploadSizeStr);
-
-  // #208: CLI > YAML config
-  final String? pinFile = results.wasParsed('pin-file')
-      ? results['pin-file'] as String?
-      : cfg?.pinFile;
-  final String? tokenFile = results.wasParsed('token-file')
-      ? results['token-file'] as String?
-      : cfg?.tokenFile;
+/// 起動後に config の再読み込みで差し替えられる設定。
+/// post_actions / mention_actions / clipboard の上限 / federation peer。
+/// それ以外 (port, dir, HTTPS, PIN, token 等) は再起動が必要。
+class _RuntimeConfig {
+  final List<({String pattern, String script})> postActions;
+  final Map<String, ({String script, String? description})> mentionActions;
+  final int maxClipboardItems;
+  final int maxTextLength;
+  final int maxBlobBytes;
+  final List<_FederationPeer> peers;
+  _RuntimeConfig({
+    required this.postActions,
+    required this.mentionActions,
+    required this.maxClipboardItems,
+    required this.maxTextLength,
+    required this.maxBlobBytes,
+    required this.peers,
+  });
+}
 
+/// CLI 引数と config から _RuntimeConfig を組み立てて検証する。
+/// 起動時と再読み込みで共用。不正なら _ConfigError (何も適用しない)。
+_RuntimeConfig _resolveRuntimeConfig(
+  ArgResults results,
+  _LoadedConfig? cfg, {
+  required bool httpsMode,
+  required bool noToken,
+  required String? fixedToken,
+}) {
   // post_actions: CLI > config (どちらかが存在すればその全体を使う)
   final List<String> postActionRaw;
   if (results.wasParsed('post-action')) {
@@ -440,14 +476,12 @@ Future<void> main(List<String> args) async {
   for (final entry in postActionRaw) {
     final eq = entry.indexOf('=');
     if (eq <= 0) {
-      stderr.writeln('Error: --post-action must be in <pattern>=<script> format: $entry');
-      exit(1);
+      throw _ConfigError('--post-action must be in <pattern>=<script> format: $entry');
     }
     final pattern = entry.substring(0, eq).trim();
     final script = entry.substring(eq + 1).trim();
     if (pattern.isEmpty || script.isEmpty) {
-      stderr.writeln('Error: --post-action pattern and script must not be empty: $entry');
-      exit(1);
+      throw _ConfigError('--post-action pattern and script must not be empty: $entry');
     }
     postActions.add((pattern: pattern, script: script));
   }
@@ -458,19 +492,16 @@ Future<void> main(List<String> args) async {
     for (final entry in raw) {
       final eq = entry.indexOf('=');
       if (eq <= 0) {
-        stderr.writeln('Error: --mention-action must be in <alias>=<script> format: $entry');
-        exit(1);
+        throw _ConfigError('--mention-action must be in <alias>=<script> format: $entry');
       }
       final alias = entry.substring(0, eq).trim();
       final script = entry.substring(eq + 1).trim();
       if (alias.isEmpty || script.isEmpty) {
-        stderr.writeln('Error: --mention-action alias and script must not be empty: $entry');
-        exit(1);
+        throw _ConfigError('--mention-action alias and script must not be empty: $entry');
       }
       // #174 + #220: 予約名 list / run / to / run_to / up
       if (_kReservedMentionNames.contains(alias)) {
-        stderr.writeln('Error: "$alias" is a reserved mention name and cannot be used as an alias.');
-        exit(1);
+        throw _ConfigError('"$alias" is a reserved mention name and cannot be used as an alias.');
       }
       // CLI には description フィールドが無い (YAML config 専用、#224)
       mentionActions[alias] = (script: script, description: null);
@@ -478,43 +509,11 @@ Future<void> main(List<String> args) async {
   } else if (cfg?.mentionActions != null) {
     for (final m in cfg!.mentionActions!) {
       if (_kReservedMentionNames.contains(m.alias)) {
-        stderr.writeln('Error: "${m.alias}" is a reserved mention name and cannot be used as an alias.');
-        exit(1);
+        throw _ConfigError('"${m.alias}" is a reserved mention name and cannot be used as an alias.');
       }
       mentionActions[m.alias] = (script: m.script, description: m.description);
     }
   }
-  final httpsCertPath = results.wasParsed('https-cert')
-      ? results['https-cert'] as String?
-      : (cfg?.httpsCert ?? results['https-cert'] as String?);
-  final httpsKeyPath = results.wasParsed('https-key')
-      ? results['https-key'] as String?
-      : (cfg?.httpsKey ?? results['https-key'] as String?);
-  if ((httpsCertPath == null) != (httpsKeyPath == null)) {
-    stderr.writeln('Error: --https-cert and --https-key must be specified together.');
-    exit(1);
-  }
-  if (httpsCertPath != null && !File(httpsCertPath).existsSync()) {
-    stderr.writeln('Error: Certificate file does not exist: $httpsCertPath');
-    exit(1);
-  }
-  if (httpsKeyPath != null && !File(httpsKeyPath).existsSync()) {
-    stderr.writeln('Error: Key file does not exist: $httpsKeyPath');
-    exit(1);
-  }
-  final bool httpsMode = httpsCertPath != null && httpsKeyPath != null;
-
-  final authMode = noPin
-      ? _AuthMode.noPin
-      : fixedPin != null
-          ? _AuthMode.fixedPin
-          : _AuthMode.randomPin;
-
-  // #218 / §1.11: 端末識別 UUID。federation 参加時の固定 ID として使う。
-  // #237: CLI > YAML config > デフォルト
-  final statePath = results['state-file'] as String? ?? cfg?.stateFile ?? _defaultStateFilePath();
-  final deviceId = _loadOrCreateDeviceId(statePath);
-
   // #218: federation 設定 (parent / children) があるなら、構成の整合性を検証
   final hasFederation =
       (cfg?.childrenRaw?.isNotEmpty ?? false) || (cfg?.parentRaw != null);
@@ -553,6 +552,17 @@ Future<void> main(List<String> args) async {
       if (relation != 'friendly' && relation != 'equally') {
         problems.add('children[$name]: relation must be friendly or equally');
       }
+      if (entry['sync'] == true && relation != 'equally') {
+        problems.add('children[$name]: sync requires relation: equally');
+      }
+      final rep = entry['replicate'];
+      if (rep != null) {
+        if (relation != 'equally') {
+          problems.add('children[$name]: replicate requires relation: equally');
+        } else if (!_isValidReplicateFolder(rep)) {
+          problems.add('children[$name]: replicate must be a relative folder (was: $rep)');
+        }
+      }
     }
     // (d) parent エントリを検証
     final parent = cfg?.parentRaw;
@@ -569,95 +579,462 @@ Future<void> main(List<String> args) async {
       if (relation != 'friendly' && relation != 'equally') {
         problems.add('parent.relation must be friendly or equally');
       }
+      if (parent['sync'] == true && relation != 'equally') {
+        problems.add('parent.sync requires relation: equally');
+      }
+      if (parent['tee'] == true && relation != 'friendly') {
+        problems.add('parent.tee requires relation: friendly');
+      }
+      final rep = parent['replicate'];
+      if (rep != null) {
+        if (relation != 'equally') {
+          problems.add('parent.replicate requires relation: equally');
+        } else if (!_isValidReplicateFolder(rep)) {
+          problems.add('parent.replicate must be a relative folder (was: $rep)');
+        }
+      }
     }
     if (problems.isNotEmpty) {
-      stderr.writeln('Error: federation config is incomplete:');
-      for (final p in problems) {
-        stderr.writeln('  - $p');
-      }
-      exit(1);
+      throw _ConfigError('federation config is incomplete:\n'
+          '${problems.map((p) => '  - $p').join('\n')}');
     }
   }
 
-  // #177/#169: HTTPS モードで SAN→ホスト名→IP 解決フロー
-  String ipAddress;
-  String advertisedHost; // QR/URL に使うホスト名またはIP
-  if (httpsMode) {
-    final sanResult = await _resolveHttpsHost(
-        certPath: httpsCertPath!, specifiedIp: specifiedIp);
-    ipAddress = sanResult.bindIp;
-    advertisedHost = sanResult.advertisedHost;
-  } else {
-    ipAddress = specifiedIp ?? await _selectIpAddress();
-    advertisedHost = ipAddress;
-  }
-
-  // #275: DNS-rebinding guard が許可する追加ホスト名。HTTPS の場合は cert SAN から
-  // 選ばれた advertisedHost（peer / ブラウザが実際に到達する名前）を必ず含める。
-  // これが無いと federation や Tailscale の DNS 名アクセスが 421 で拒否される。
-  final extraAllowedHosts = <String>{
-    advertisedHost,
-    ...?(cfg?.allowedHosts),
-    ...(results['allowed-host'] as List<String>? ?? const []),
-  }.where((h) => h.isNotEmpty).toList();
-
-  stdout.writeln('');
-  stdout.writeln('LocalNode CLI Server v$_appVersion');
-  stdout.writeln('=' * 40);
-
-  // #173: アップロードトークンの決定（download-only / no-pin モードでは不要）
-  // no-pin では認証がないためトークンを発行しても意味がなく、逆に誤った安心感を与える
-  final String? uploadToken = (!noToken && !downloadOnly && !noPin)
-      ? (fixedToken ?? _generateUploadToken())
-      : null;
-
   // #227: clipboard 設定を config から読む (config.clipboard.max_items / max_text_length)
   final clipboardCfg = cfg?.clipboardRaw;
   int maxClipboardItems = 1000;
   int maxTextLength = 10000;
+  int maxBlobBytes = 32 * 1024 * 1024;
   if (clipboardCfg != null) {
     final mi = clipboardCfg['max_items'];
     if (mi is int && mi > 0 && mi <= 100000) {
       maxClipboardItems = mi;
     } else if (mi != null) {
-      stderr.writeln('Error: clipboard.max_items must be a positive integer (1-100000).');
-      exit(1);
+      throw _ConfigError('clipboard.max_items must be a positive integer (1-100000).');
     }
     final ml = clipboardCfg['max_text_length'];
     if (ml is int && ml > 0 && ml <= 1000000) {
       maxTextLength = ml;
     } else if (ml != null) {
-      stderr.writeln('Error: clipboard.max_text_length must be a positive integer (1-1000000).');
-      exit(1);
+      throw _ConfigError('clipboard.max_text_length must be a positive integer (1-1000000).');
+    }
+    final mbRaw = clipboardCfg['max_blob_size'];
+    if (mbRaw != null) {
+      final mb = _parseSizeBytes(mbRaw);
+      if (mb == null || mb < 0 || mb > 1024 * 1024 * 1024) {
+        throw _ConfigError('clipboard.max_blob_size must be a size between 0 and 1GB (e.g. 32MB; 0 disables blobs).');
+      }
+      maxBlobBytes = mb;
     }
   }
 
-  final server = _CliServer(
-    verbose: verbose,
-    maxClipboardItems: maxClipboardItems,
-    maxTextLength: maxTextLength,
-    deviceId: deviceId,
-  );
-
-  try {
-    await server.start(
-      ipAddress: ipAddress,
-      port: port,
-      storagePath: dir,
-      downloadOnly: downloadOnly,
-      authMode: authMode,
-      fixedPin: fixedPin,
-      pinLength: pinLength,         // #206
-      pinCharset: pinCharset,       // #206
-      serverName: serverName,
-      clipboardEnabled: !noClipboard,
-      httpsCertPath: httpsCertPath,
-      httpsKeyPath: httpsKeyPath,
-      uploadToken: uploadToken,
-      postActions: postActions,
+  final peers = <_FederationPeer>[];
+  if (hasFederation) {
+    if (cfg?.childrenRaw != null) {
+      for (final ch in cfg!.childrenRaw!) {
+        if (ch is Map) {
+          peers.add(_FederationPeer(
+            kind: 'child',
+            name: ch['name'] as String,
+            url: ch['url'] as String,
+            token: ch['token'] as String,
+            relation: ch['relation'] as String,
+            // #219: 親側設定。子から来るアップロードの上限
+            maxUploadSizeBytes: _parseSizeBytes(ch['max_upload_size']),
+            sync: ch['sync'] == true,
+            replicate: ch['replicate'] as String?,
+          ));
+        }
+      }
+    }
+    if (cfg?.parentRaw != null) {
+      final pr = cfg!.parentRaw!;
+      peers.add(_FederationPeer(
+        kind: 'parent',
+        name: pr['name'] as String,
+        url: pr['url'] as String,
+        token: pr['token'] as String,
+        relation: pr['relation'] as String,
+        // #219: 子側設定。trust:true で「親に転送したらローカル削除」
+        trust: pr['trust'] == true,
+        tee: pr['tee'] == true,
+        sync: pr['sync'] == true,
+        replicate: pr['replicate'] as String?,
+      ));
+    }
+  }
+
+  return _RuntimeConfig(
+    postActions: postActions,
+    mentionActions: mentionActions,
+    maxClipboardItems: maxClipboardItems,
+    maxTextLength: maxTextLength,
+    maxBlobBytes: maxBlobBytes,
+    peers: peers,
+  );
+}
+
+// =============================================================================
+// エントリポイント
+// =============================================================================
+
+Future<void> main(List<String> args) async {
+  // サブコマンド: 同じマシンで動いているサーバの状況を表示する
+  if (args.isNotEmpty && args.first == 'top') {
+    exit(await _runTop(args.sublist(1)));
+  }
+
+  final parser = _buildParser();
+
+  if (args.contains('--help') || args.contains('-h')) {
+    _printUsage(parser);
+    _flushWindowsInput();
+    exit(0);
+  }
+
+  final ArgResults results;
+  try {
+    results = parser.parse(args);
+  } catch (e) {
+    stderr.writeln('Error: $e');
+    stderr.writeln('');
+    _printUsage(parser);
+    exit(1);
+  }
+
+  // #185: --config が指定されていれば YAML を読み込む。
+  // 解決優先順位: CLI 引数 > config > 既定値
+  _LoadedConfig? cfg;
+  final String? configPath = results['config'] as String?;
+  if (configPath != null) {
+    try {
+      cfg = _loadConfig(configPath);
+    } on _ConfigError catch (e) {
+      stderr.writeln('Error: ${e.message}');
+      exit(1);
+    }
+  }
+
+  // port: CLI > config > '8080'
+  final portStr = results.wasParsed('port')
+      ? results['port'] as String
+      : (cfg?.port?.toString() ?? results['port'] as String);
+  final port = int.tryParse(portStr);
+  if (port == null || port < 1 || port > 65535) {
+    stderr.writeln('Error: Invalid port number. Must be between 1 and 65535.');
+    exit(1);
+  }
+
+  final dir = results.wasParsed('dir')
+      ? results['dir'] as String?
+      : (cfg?.dir ?? results['dir'] as String?);
+  if (dir != null && !Directory(dir).existsSync()) {
+    stderr.writeln('Error: Directory does not exist: $dir');
+    exit(1);
+  }
+
+  final specifiedIp = results.wasParsed('ip')
+      ? results['ip'] as String?
+      : (cfg?.ip ?? results['ip'] as String?);
+  // 待ち受けアドレス。--ip は表示・Host 許可用で、待ち受けは既定で全 IPv4
+  final bindStr = results.wasParsed('bind')
+      ? results['bind'] as String?
+      : cfg?.bind;
+  final bindAddress = bindStr == null ? null : InternetAddress.tryParse(bindStr);
+  if (bindStr != null && bindAddress == null) {
+    stderr.writeln('Error: --bind must be an IP address (was: $bindStr)');
+    exit(1);
+  }
+  final noClipboard = results.wasParsed('no-clipboard')
+      ? results['no-clipboard'] as bool
+      : (cfg?.noClipboard ?? results['no-clipboard'] as bool);
+  final verbose = results.wasParsed('verbose')
+      ? results['verbose'] as bool
+      : (cfg?.verbose ?? results['verbose'] as bool);
+  final modeStr = results.wasParsed('mode')
+      ? results['mode'] as String
+      : (cfg?.mode ?? results['mode'] as String);
+  if (modeStr != 'normal' && modeStr != 'download-only') {
+    stderr.writeln('Error: Invalid mode: $modeStr. Must be normal or download-only.');
+    exit(1);
+  }
+  final downloadOnly = modeStr == 'download-only';
+  final noPin = results.wasParsed('no-pin')
+      ? results['no-pin'] as bool
+      : (cfg?.noPin ?? results['no-pin'] as bool);
+  final fixedPin = results.wasParsed('pin')
+      ? results['pin'] as String?
+      : (cfg?.pin ?? results['pin'] as String?);
+  // #206
+  final pinLength = () {
+    final raw = results.wasParsed('pin-length')
+        ? results['pin-length'] as String?
+        : (cfg?.pinLength?.toString());
+    if (raw == null) return 8;
+    final n = int.tryParse(raw);
+    if (n == null || n < 8 || n > 16) {
+      stderr.writeln('Error: --pin-length must be an integer 8..16 (got "$raw").');
+      exit(1);
+    }
+    return n;
+  }();
+  final pinCharset = () {
+    const allowed = {'digits', 'alnum', 'alnum_symbols'};
+    final raw = results.wasParsed('pin-charset')
+        ? results['pin-charset'] as String?
+        : (cfg?.pinCharset ?? results['pin-charset'] as String?);
+    final v = raw ?? 'digits';
+    if (!allowed.contains(v)) {
+      stderr.writeln('Error: --pin-charset must be one of ${allowed.join("/")} (got "$v").');
+      exit(1);
+    }
+    return v;
+  }();
+  final serverName = results.wasParsed('name')
+      ? results['name'] as String
+      : (cfg?.name ?? results['name'] as String);
+  final noToken = results.wasParsed('no-token')
+      ? results['no-token'] as bool
+      : (cfg?.noToken ?? results['no-token'] as bool);
+  final fixedToken = results.wasParsed('token')
+      ? results['token'] as String?
+      : (cfg?.token ?? results['token'] as String?);
+  // #262: 直接アップロードのサイズ上限
+  final maxUploadSizeStr = results.wasParsed('max-upload-size')
+      ? results['max-upload-size'] as String?
+      : (cfg?.maxUploadSize ?? results['max-upload-size'] as String?);
+  final int? maxDirectUploadBytes = _parseSizeBytes(maxUploadSizeStr);
+  // 監視フォルダ取り込み: CLI > config
+  final watch = results.wasParsed('watch')
+      ? results['watch'] as bool
+      : (cfg?.watch ?? false);
+  final webDav = results.wasParsed('webdav')
+      ? results['webdav'] as bool
+      : (cfg?.webdav ?? false);
+  // イベントループ監視: 既定で 250ms 以上の遅れを詰まりとして記録する
+  final stallThresholdMs = () {
+    final raw = results.wasParsed('stall-threshold')
+        ? results['stall-threshold'] as String?
+        : cfg?.stallThresholdMs?.toString();
+    if (raw == null) return 250;
+    final n = int.tryParse(raw);
+    if (n == null || n < 0 || n > 60000) {
+      stderr.writeln('Error: --stall-threshold must be 0..60000 ms (got "$raw").');
+      exit(1);
+    }
+    return n;
+  }();
+  final stallProfile = results.wasParsed('stall-profile')
+      ? results['stall-profile'] as bool
+      : (cfg?.stallProfile ?? false);
+  final statsSocket = results.wasParsed('stats-socket')
+      ? results['stats-socket'] as String?
+      : cfg?.statsSocket;
+  final tracePath = results.wasParsed('trace')
+      ? results['trace'] as String?
+      : cfg?.trace;
+  final watchSettleMs = () {
+    final raw = results.wasParsed('watch-settle')
+        ? results['watch-settle'] as String?
+        : cfg?.watchSettleMs?.toString();
+    if (raw == null) return 2000;
+    final n = int.tryParse(raw);
+    if (n == null || n < 100 || n > 600000) {
+      stderr.writeln('Error: --watch-settle must be 100..600000 ms (got "$raw").');
+      exit(1);
+    }
+    return n;
+  }();
+  // 保存時圧縮: CLI > config
+  final List<String> compressPatterns = results.wasParsed('compress')
+      ? results['compress'] as List<String>
+      : (cfg?.compressPatterns ?? const []);
+
+  // #208: CLI > YAML config
+  final String? pinFile = results.wasParsed('pin-file')
+      ? results['pin-file'] as String?
+      : cfg?.pinFile;
+  final String? tokenFile = results.wasParsed('token-file')
+      ? results['token-file'] as String?
+      : cfg?.tokenFile;
+
+  final httpsCertPath = results.wasParsed('https-cert')
+      ? results['https-cert'] as String?
+      : (cfg?.httpsCert ?? results['https-cert'] as String?);
+  final httpsKeyPath = results.wasParsed('https-key')
+      ? results['https-key'] as String?
+      : (cfg?.httpsKey ?? results['https-key'] as String?);
+  if ((httpsCertPath == null) != (httpsKeyPath == null)) {
+    stderr.writeln('Error: --https-cert and --https-key must be specified together.');
+    exit(1);
+  }
+  if (httpsCertPath != null && !File(httpsCertPath).existsSync()) {
+    stderr.writeln('Error: Certificate file does not exist: $httpsCertPath');
+    exit(1);
+  }
+  if (httpsKeyPath != null && !File(httpsKeyPath).existsSync()) {
+    stderr.writeln('Error: Key file does not exist: $httpsKeyPath');
+    exit(1);
+  }
+  final bool httpsMode = httpsCertPath != null && httpsKeyPath != null;
+  // HTTP/3: QUIC は TLS 必須なので HTTPS のときだけ
+  final http3Sidecar = results.wasParsed('http3-sidecar')
+      ? results['http3-sidecar'] as String?
+      : cfg?.http3Sidecar;
+  final http3Port = () {
+    final raw = results.wasParsed('http3-port')
+        ? results['http3-port'] as String?
+        : cfg?.http3Port?.toString();
+    if (raw == null) return port;
+    final n = int.tryParse(raw);
+    if (n == null || n < 1 || n > 65535) {
+      stderr.writeln('Error: --http3-port must be between 1 and 65535 (got "$raw").');
+      exit(1);
+    }
+    return n;
+  }();
+  if (http3Sidecar != null) {
+    if (!httpsMode) {
+      stderr.writeln('Error: --http3-sidecar requires --https-cert and --https-key.');
+      exit(1);
+    }
+    if (!File(http3Sidecar).existsSync()) {
+      stderr.writeln('Error: HTTP/3 sidecar executable does not exist: $http3Sidecar');
+      exit(1);
+    }
+    // sidecar はループバックで本体へ転送し、送信元がループバックであることで
+    // sidecar 経由と判定する。LAN アドレスだけで待ち受けると届かない
+    if (bindAddress != null &&
+        !bindAddress.isLoopback &&
+        bindAddress.rawAddress.any((b) => b != 0)) {
+      stderr.writeln('Error: --http3-sidecar needs --bind to be a loopback '
+          'or any address (0.0.0.0, ::), not ${bindAddress.address}.');
+      exit(1);
+    }
+  }
+
+  final authMode = noPin
+      ? _AuthMode.noPin
+      : fixedPin != null
+          ? _AuthMode.fixedPin
+          : _AuthMode.randomPin;
+
+  // #218 / §1.11: 端末識別 UUID。federation 参加時の固定 ID として使う。
+  // #237: CLI > YAML config > デフォルト
+  final statePath = results['state-file'] as String? ?? cfg?.stateFile ?? _defaultStateFilePath();
+  final deviceId = _loadOrCreateDeviceId(statePath);
+  final shareSecret = _loadOrCreateShareSecret(statePath);
+
+  // post_actions / mention_actions / clipboard / federation (再読み込み対象)
+  final _RuntimeConfig runtime;
+  try {
+    runtime = _resolveRuntimeConfig(results, cfg,
+        httpsMode: httpsMode, noToken: noToken, fixedToken: fixedToken);
+  } on _ConfigError catch (e) {
+    stderr.writeln('Error: ${e.message}');
+    exit(1);
+  }
+  final postActions = runtime.postActions;
+  final mentionActions = runtime.mentionActions;
+  final hasFederation = runtime.peers.isNotEmpty;
+
+  // #177/#169: HTTPS モードで SAN→ホスト名→IP 解決フロー
+  String ipAddress;
+  String advertisedHost; // QR/URL に使うホスト名またはIP
+  if (httpsMode) {
+    final sanResult = await _resolveHttpsHost(
+        certPath: httpsCertPath!, specifiedIp: specifiedIp);
+    ipAddress = sanResult.bindIp;
+    advertisedHost = sanResult.advertisedHost;
+  } else {
+    ipAddress = specifiedIp ?? await _selectIpAddress();
+    advertisedHost = ipAddress;
+  }
+
+  // #275: DNS-rebinding guard が許可する追加ホスト名。HTTPS の場合は cert SAN から
+  // 選ばれた advertisedHost（peer / ブラウザが実際に到達する名前）を必ず含める。
+  // これが無いと federation や Tailscale の DNS 名アクセスが 421 で拒否される。
+  final extraAllowedHosts = <String>{
+    advertisedHost,
+    ...?(cfg?.allowedHosts),
+    ...(results['allowed-host'] as List<String>? ?? const []),
+  }.where((h) => h.isNotEmpty).toList();
+
+  stdout.writeln('');
+  stdout.writeln('LocalNode CLI Server v$_appVersion');
+  stdout.writeln('=' * 40);
+
+  // #173: アップロードトークンの決定（download-only / no-pin モードでは不要）
+  // no-pin では認証がないためトークンを発行しても意味がなく、逆に誤った安心感を与える
+  final String? uploadToken = (!noToken && !downloadOnly && !noPin)
+      ? (fixedToken ?? _generateUploadToken())
+      : null;
+
+  // 名前付き API トークン (config の api_tokens)。有効条件はアップロードトークンと同じ。
+  final apiTokens = <_ApiToken>[];
+  final loadedApiTokens = cfg?.apiTokens ?? const <_LoadedApiToken>[];
+  if (loadedApiTokens.isNotEmpty && (noToken || downloadOnly || noPin)) {
+    stderr.writeln('Warning: api_tokens are ignored with no-token, no-pin or download-only.');
+  } else {
+    final names = <String>{};
+    final values = <String>{if (uploadToken != null) uploadToken};
+    for (final t in loadedApiTokens) {
+      if (!names.add(t.name)) {
+        stderr.writeln('Error: api_tokens: duplicate name "${t.name}".');
+        exit(1);
+      }
+      if (!values.add(t.token)) {
+        stderr.writeln('Error: api_tokens[${t.name}]: token must differ from server.token and other api_tokens.');
+        exit(1);
+      }
+      apiTokens.add(_ApiToken(
+        name: t.name,
+        token: t.token,
+        rate: t.rate,
+        burst: t.burst,
+        maxBytesPerSec: t.maxBytesPerSec,
+        maxConcurrentUploads: t.maxConcurrentUploads,
+      ));
+    }
+  }
+
+  final server = _CliServer(
+    verbose: verbose,
+    maxClipboardItems: runtime.maxClipboardItems,
+    maxTextLength: runtime.maxTextLength,
+    maxBlobBytes: runtime.maxBlobBytes,
+    deviceId: deviceId,
+    shareSecret: shareSecret,
+  );
+
+  try {
+    await server.start(
+      ipAddress: ipAddress,
+      bindAddress: bindAddress,
+      port: port,
+      storagePath: dir,
+      downloadOnly: downloadOnly,
+      authMode: authMode,
+      fixedPin: fixedPin,
+      pinLength: pinLength,         // #206
+      pinCharset: pinCharset,       // #206
+      serverName: serverName,
+      clipboardEnabled: !noClipboard,
+      httpsCertPath: httpsCertPath,
+      httpsKeyPath: httpsKeyPath,
+      uploadToken: uploadToken,
+      apiTokens: apiTokens,
+      postActions: postActions,
       mentionActions: mentionActions,
       maxDirectUploadBytes: maxDirectUploadBytes, // #262
+      compressPatterns: compressPatterns,
+      compressFrameBytes: cfg?.compressFrameBytes,
       extraAllowedHosts: extraAllowedHosts,       // #275
+      webDav: webDav,
+      stallThresholdMs: stallThresholdMs,
+      stallProfile: stallProfile,
+      statsSocket: statsSocket,
+      tracePath: tracePath,
     );
   } catch (e) {
     stderr.writeln('Error: Failed to start server: $e');
@@ -724,6 +1101,25 @@ Future<void> main(List<String> args) async {
     stdout.writeln('         -d \'{"text":"hello from curl"}\' \\');
     stdout.writeln('         $serverUrl/api/clipboard');
   }
+  if (compressPatterns.isNotEmpty) {
+    stdout.writeln('  Compress: ${compressPatterns.join(', ')}');
+  }
+  if (http3Sidecar != null) {
+    stdout.writeln('  HTTP/3: udp/$http3Port via ${p.basename(http3Sidecar)}');
+  }
+  if (watch) {
+    stdout.writeln('  Watch: on (settle ${watchSettleMs}ms)');
+  }
+  if (webDav) {
+    stdout.writeln('  WebDAV: $serverUrl/dav/'
+        '${authMode != _AuthMode.noPin ? ' (any user name, PIN as password)' : ''}');
+  }
+  if (apiTokens.isNotEmpty) {
+    stdout.writeln('  API token(s):');
+    for (final t in apiTokens) {
+      stdout.writeln('    ${t.name}: ${t.describeLimits()}');
+    }
+  }
   stdout.writeln('');
   stdout.writeln('QR Code:');
   _printQrCode(serverUrl);
@@ -748,39 +1144,67 @@ Future<void> main(List<String> args) async {
     }
   }
 
+  if (http3Sidecar != null) {
+    await server.startHttp3Sidecar(
+      executable: http3Sidecar,
+      udpPort: http3Port,
+      certPath: httpsCertPath!,
+      keyPath: httpsKeyPath!,
+    );
+  }
+
   // #222: federation peer を登録してハートビート開始
   if (hasFederation) {
-    if (cfg?.childrenRaw != null) {
-      for (final ch in cfg!.childrenRaw!) {
-        if (ch is Map) {
-          server.registerFederationPeer(_FederationPeer(
-            kind: 'child',
-            name: ch['name'] as String,
-            url: ch['url'] as String,
-            token: ch['token'] as String,
-            relation: ch['relation'] as String,
-            // #219: 親側設定。子から来るアップロードの上限
-            maxUploadSizeBytes: _parseSizeBytes(ch['max_upload_size']),
-          ));
-        }
-      }
-    }
-    if (cfg?.parentRaw != null) {
-      final pr = cfg!.parentRaw!;
-      server.registerFederationPeer(_FederationPeer(
-        kind: 'parent',
-        name: pr['name'] as String,
-        url: pr['url'] as String,
-        token: pr['token'] as String,
-        relation: pr['relation'] as String,
-        // #219: 子側設定。trust:true で「親に転送したらローカル削除」
-        trust: pr['trust'] == true,
-      ));
+    for (final peer in runtime.peers) {
+      server.registerFederationPeer(peer);
     }
+    await server.startReplication(statePath: statePath);
     server._startHeartbeat();
   }
 
-  _setupSignalHandlers(server);
+  if (watch) {
+    await server.startWatchFolder(
+      statePath: statePath,
+      settle: Duration(milliseconds: watchSettleMs),
+    );
+  }
+
+  // config の再読み込み (SIGHUP / ファイル変更)。読み込みと検証を全部通った
+  // ものだけを適用し、失敗したら現在の設定のまま動き続ける。
+  // 重ならないよう 1 本の Future チェーンで順に処理する。
+  void Function(String reason)? reloadConfig;
+  if (configPath != null) {
+    var chain = Future<void>.value();
+    var previous = cfg; // 直前に読み込んだ config
+    reloadConfig = (reason) {
+      chain = chain.then((_) async {
+        try {
+          final next = _loadConfig(configPath);
+          final rc = _resolveRuntimeConfig(results, next,
+              httpsMode: httpsMode, noToken: noToken, fixedToken: fixedToken);
+          final changes =
+              await server.applyRuntimeConfig(rc, statePath: statePath);
+          stdout.writeln('Config reloaded ($reason): '
+              '${changes.isEmpty ? 'no changes' : changes.join(', ')}');
+          // 起動時と違い、かつ今回の読み込みで変わったものだけ警告する
+          // (無関係な再読み込みのたびに同じ警告を繰り返さない)
+          final changedNow =
+              _restartOnlyConfigChanges(results, previous, next).toSet();
+          for (final key in _restartOnlyConfigChanges(results, cfg, next)) {
+            if (!changedNow.contains(key)) continue;
+            stderr.writeln('Warning: $key changed in config; restart to apply.');
+          }
+          previous = next;
+        } catch (e) {
+          stderr.writeln(
+              'Warning: config reload failed; keeping the current settings: $e');
+        }
+      });
+    };
+    _watchConfigFile(configPath, () => reloadConfig!('file changed'));
+  }
+
+  _setupSignalHandlers(server, onReload: reloadConfig);
   if (!noClipboard) _startClipboardPolling(server);
   // Windows: disable echo/line-input to prevent typed chars from appearing (#139)
   // and flush residual keystrokes to prevent prompt mid-screen (#129).
@@ -805,7 +1229,11 @@ ArgParser _buildParser() {
             '(default: platform-specific user state dir, see docs)')
     ..addOption('port',
         abbr: 'p', help: 'Server port number', defaultsTo: '8080')
-    ..addOption('ip', help: 'IP address to bind (skip auto-detection)')
+    ..addOption('ip', help: 'IP address to advertise (skip auto-detection)')
+    ..addOption('bind',
+        help: 'Address to listen on (default: all IPv4 interfaces; '
+            'e.g. 127.0.0.1 for this machine only). '
+            'Use loopback or any with --http3-sidecar and "top"')
     ..addOption('pin', help: 'Fixed PIN (random if not specified)')
     // #206
     ..addOption('pin-length',
@@ -829,6 +1257,13 @@ ArgParser _buildParser() {
         abbr: 'n', help: 'Server name shown in browser tab title', defaultsTo: 'LocalNode')
     ..addOption('https-cert', help: 'Path to TLS certificate file (cert.pem)')
     ..addOption('https-key', help: 'Path to TLS private key file (key.pem)')
+    ..addOption('http3-sidecar',
+        help: 'Serve HTTP/3 (QUIC) through this Caddy binary, run as a managed '
+            'sidecar with the HTTPS cert/key, and advertise it with Alt-Svc',
+        valueHelp: 'PATH')
+    ..addOption('http3-port',
+        help: 'UDP port for the HTTP/3 sidecar (default: same as --port)',
+        valueHelp: 'PORT')
     ..addMultiOption('post-action',
         help:
             'Script to run after matching uploads: <pattern>=<script> (repeatable). '
@@ -849,6 +1284,38 @@ ArgParser _buildParser() {
     ..addOption('max-upload-size',
         help: 'Maximum size for direct file uploads, e.g. 100M, 2G (default: unlimited)',
         valueHelp: 'SIZE')
+    ..addFlag('watch',
+        help: 'Also ingest files written directly into the shared directory '
+            '(run post-actions and forward to the federation parent)',
+        negatable: false)
+    ..addOption('stall-threshold',
+        help: 'Record event-loop stalls longer than this, with the requests '
+            'in flight (0 disables the monitor, default: 250)',
+        valueHelp: 'MS')
+    ..addFlag('stall-profile',
+        help: 'Attach CPU samples to each recorded stall '
+            '(needs dart --enable-vm-service)',
+        negatable: false)
+    ..addOption('stats-socket',
+        help: 'Also serve the stats for `localnode-cli top` on this Unix '
+            'socket (mode 0600, no token needed)',
+        valueHelp: 'PATH')
+    ..addOption('trace',
+        help: 'Append a compact binary access trace (timing, route, sizes; '
+            'no bodies) to this file for tool/trace_replay.dart',
+        valueHelp: 'PATH')
+    ..addFlag('webdav',
+        help: 'Serve the shared directory over WebDAV at /dav/ so it can be '
+            'mounted as a network drive (Basic auth: any user, PIN as password)',
+        negatable: false)
+    ..addOption('watch-settle',
+        help: 'Quiet period after the last write before a watched file is '
+            'ingested, in ms (default: 2000)',
+        valueHelp: 'MS')
+    ..addMultiOption('compress',
+        help: 'Store uploads matching this glob compressed on disk (seekable, '
+            'served transparently), e.g. "*.log" (repeatable)',
+        valueHelp: 'pattern')
     // #208: daemon / systemd 連携用 — 生成値をファイルに書き出す
     ..addOption('pin-file',
         help: 'Write the generated PIN to this file on startup',
@@ -868,6 +1335,7 @@ void _printUsage(ArgParser parser) {
   stdout.writeln('LocalNode CLI - Local file & clipboard sharing server');
   stdout.writeln('');
   stdout.writeln('Usage: localnode-cli [options]');
+  stdout.writeln('       localnode-cli top [options]   (live view of a running server, see top --help)');
   stdout.writeln('');
   stdout.writeln('Options:');
   stdout.writeln(parser.usage);
@@ -970,7 +1438,9 @@ void _printQrCode(String data) {
 bool _shuttingDown = false;
 
 
-void _setupSignalHandlers(_CliServer server) {
+/// SIGHUP は --config があれば config の再読み込み、無ければ従来通り終了。
+void _setupSignalHandlers(_CliServer server,
+    {void Function(String reason)? onReload}) {
   try {
     ProcessSignal.sigint.watch().listen((_) async {
       await _shutdown(server);
@@ -978,14 +1448,98 @@ void _setupSignalHandlers(_CliServer server) {
   } catch (_) {}
 
   if (!Platform.isWindows) {
-    for (final sig in [ProcessSignal.sigterm, ProcessSignal.sighup]) {
-      try {
-        sig.watch().listen((_) async {
+    try {
+      ProcessSignal.sigterm.watch().listen((_) async {
+        await _shutdown(server);
+      });
+    } catch (_) {}
+    try {
+      ProcessSignal.sighup.watch().listen((_) async {
+        if (onReload != null) {
+          onReload('SIGHUP');
+        } else {
           await _shutdown(server);
-        });
-      } catch (_) {}
+        }
+      });
+    } catch (_) {}
+  }
+}
+
+/// config ファイルの変更を監視する。エディタの「一時ファイルに書いて rename」
+/// でも拾えるよう親ディレクトリを watch し、連続するイベントは 500ms まとめて、
+/// 内容が実際に変わったときだけ onChange を呼ぶ。
+void _watchConfigFile(String path, void Function() onChange) {
+  final abs = p.normalize(File(path).absolute.path);
+  String? digest() {
+    try {
+      return crypto.sha256.convert(File(abs).readAsBytesSync()).toString();
+    } catch (_) {
+      return null;
     }
   }
+
+  var last = digest();
+  Timer? debounce;
+  try {
+    Directory(p.dirname(abs)).watch().listen((ev) {
+      final hit = p.equals(ev.path, abs) ||
+          (ev is FileSystemMoveEvent &&
+              ev.destination != null &&
+              p.equals(ev.destination!, abs));
+      if (!hit) return;
+      debounce?.cancel();
+      debounce = Timer(const Duration(milliseconds: 500), () {
+        final d = digest();
+        if (d == null || d == last) return;
+        last = d;
+        onChange();
+      });
+    }, onError: (_) {});
+  } catch (e) {
+    stderr.writeln('Warning: could not watch config file $path: $e');
+  }
+}
+
+/// 再読み込みでは反映されない設定のうち、起動時から変わったもの。
+/// CLI 引数で指定済みの項目は config 側が変わっても効かないので除く。
+List<String> _restartOnlyConfigChanges(
+    ArgResults results, _LoadedConfig? before, _LoadedConfig after) {
+  final fields = <String, Object? Function(_LoadedConfig? c)>{
+    'port': (c) => c?.port,
+    'ip': (c) => c?.ip,
+    'bind': (c) => c?.bind,
+    'dir': (c) => c?.dir,
+    'mode': (c) => c?.mode,
+    'name': (c) => c?.name,
+    'pin': (c) => c?.pin,
+    'no-pin': (c) => c?.noPin,
+    'token': (c) => c?.token,
+    'no-token': (c) => c?.noToken,
+    'https-cert': (c) => c?.httpsCert,
+    'https-key': (c) => c?.httpsKey,
+    'http3-sidecar': (c) => c?.http3Sidecar,
+    'http3-port': (c) => c?.http3Port,
+    'max-upload-size': (c) => c?.maxUploadSize,
+    'watch': (c) => c?.watch,
+    'webdav': (c) => c?.webdav,
+    'stall-threshold': (c) => c?.stallThresholdMs,
+    'stall-profile': (c) => c?.stallProfile,
+    'stats-socket': (c) => c?.statsSocket,
+    'trace': (c) => c?.trace,
+    'compress': (c) => c?.compressPatterns?.join(','),
+    'api_tokens': (c) => c?.apiTokens
+        ?.map((t) => '${t.name}:${t.token}:${t.rate}:${t.burst}:'
+            '${t.maxBytesPerSec}:${t.maxConcurrentUploads}')
+        .join(','),
+  };
+  // config 上の位置 (CLI 引数名と同じ server.* 以外)
+  const sections = {'compress': 'storage.compress', 'api_tokens': 'api_tokens'};
+  return [
+    for (final e in fields.entries)
+      if (!(results.options.contains(e.key) && results.wasParsed(e.key)) &&
+          e.value(before) != e.value(after))
+        sections[e.key] ?? 'server.${e.key}',
+  ];
 }
 
 Future<void> _waitForQuit(_CliServer server) async {
@@ -1024,9 +1578,8 @@ void _startClipboardPolling(_CliServer server) {
     final current = server.clipboardLastModified;
     if (current != _lastClipboardModified) {
       _lastClipboardModified = current;
-      final items = server.clipboardItems;
-      if (items.isNotEmpty) {
-        final latest = items.first;
+      final latest = server.latestClipboardItem;
+      if (latest != null) {
         stdout.writeln('');
         final tagLabel = latest.tag != null ? '[${latest.tag}] ' : '';
         stdout.writeln(
@@ -1038,6 +1591,282 @@ void _startClipboardPolling(_CliServer server) {
   });
 }
 
+// =============================================================================
+// top サブコマンド
+// =============================================================================
+//
+// `localnode-cli top` は同じマシンで動いているサーバの /api/debug/stats を
+// 毎秒取り、処理中のリクエスト・クライアントごとの帯域・キュー・キャッシュ・
+// イベントループの遅れを端末に描く。レートは前回取得分との差分で出す。
+
+Future<int> _runTop(List<String> args) async {
+  final parser = ArgParser()
+    ..addOption('port',
+        abbr: 'p',
+        defaultsTo: '8080',
+        help: 'Port of the server on this machine (connects to 127.0.0.1; '
+            'the server must not --bind a LAN address only)')
+    ..addOption('socket',
+        help: 'Connect to the Unix socket given to the server with '
+            '--stats-socket instead of the TCP port',
+        valueHelp: 'PATH')
+    ..addOption('token',
+        help: 'Server token (--token of the server). Not needed with --socket')
+    ..addOption('token-file',
+        help: 'Read the server token from this file (--token-file of the server)',
+        valueHelp: 'PATH')
+    ..addFlag('https',
+        help: 'The server uses HTTPS (the certificate is not checked, '
+            'the connection stays on loopback)',
+        negatable: false)
+    ..addOption('interval',
+        defaultsTo: '1', help: 'Refresh interval in seconds', valueHelp: 'SEC')
+    ..addFlag('once', help: 'Print one snapshot and exit', negatable: false)
+    ..addFlag('help', abbr: 'h', help: 'Show this help', negatable: false);
+
+  final ArgResults results;
+  try {
+    results = parser.parse(args);
+  } catch (e) {
+    stderr.writeln('Error: $e');
+    return 1;
+  }
+  if (results['help'] as bool) {
+    stdout.writeln('Usage: localnode-cli top [options]');
+    stdout.writeln('');
+    stdout.writeln('Live view of a LocalNode server running on this machine.');
+    stdout.writeln('Press q or Ctrl+C to quit.');
+    stdout.writeln('');
+    stdout.writeln(parser.usage);
+    return 0;
+  }
+  final port = int.tryParse(results['port'] as String);
+  final interval = int.tryParse(results['interval'] as String);
+  if (port == null || port < 1 || port > 65535) {
+    stderr.writeln('Error: Invalid port number. Must be between 1 and 65535.');
+    return 1;
+  }
+  if (interval == null || interval < 1 || interval > 3600) {
+    stderr.writeln('Error: --interval must be 1..3600 seconds.');
+    return 1;
+  }
+  final socketPath = results['socket'] as String?;
+  var token = results['token'] as String?;
+  final tokenFile = results['token-file'] as String?;
+  if (token == null && tokenFile != null) {
+    try {
+      token = File(tokenFile).readAsStringSync().trim();
+    } catch (e) {
+      stderr.writeln('Error: could not read $tokenFile: $e');
+      return 1;
+    }
+  }
+
+  final client = HttpClient()..connectionTimeout = const Duration(seconds: 5);
+  final Uri uri;
+  if (socketPath != null) {
+    client.connectionFactory = (_, __, ___) => Socket.startConnect(
+        InternetAddress(socketPath, type: InternetAddressType.unix), 0);
+    uri = Uri.parse('http://localhost/api/debug/stats');
+  } else {
+    // 自己署名証明書の SAN にループバックは入っていないので検証しない
+    if (results['https'] as bool) {
+      client.badCertificateCallback = (_, __, ___) => true;
+    }
+    final scheme = results['https'] as bool ? 'https' : 'http';
+    uri = Uri.parse('$scheme://127.0.0.1:$port/api/debug/stats');
+  }
+
+  Future<StatsSnapshot> fetch() async {
+    final req = await client.getUrl(uri);
+    if (token != null && socketPath == null) {
+      req.headers.set('authorization', 'Bearer $token');
+    }
+    final res = await req.close().timeout(const Duration(seconds: 5));
+    final body = BytesBuilder(copy: false);
+    await for (final chunk in res) {
+      body.add(chunk);
+    }
+    final bytes = body.takeBytes();
+    if (res.statusCode != 200) {
+      final hint = res.statusCode == 401
+          ? ' (pass --token / --token-file, or use --socket)'
+          : '';
+      throw HttpException('HTTP ${res.statusCode}$hint: '
+          '${utf8.decode(bytes, allowMalformed: true).trim()}');
+    }
+    return StatsSnapshot.decode(bytes);
+  }
+
+  final target = socketPath ?? '127.0.0.1:$port';
+  if (results['once'] as bool) {
+    try {
+      stdout.write(_renderTop(target, await fetch(), null, 1 << 30));
+      return 0;
+    } catch (e) {
+      stderr.writeln('Error: $e');
+      return 1;
+    } finally {
+      client.close(force: true);
+    }
+  }
+
+  final tty = stdout.hasTerminal;
+  final done = Completer<void>();
+  final subs = <StreamSubscription<dynamic>>[
+    ProcessSignal.sigint.watch().listen((_) {
+      if (!done.isCompleted) done.complete();
+    }),
+  ];
+  var restoreStdin = false;
+  if (stdin.hasTerminal) {
+    try {
+      stdin
+        ..echoMode = false
+        ..lineMode = false;
+      restoreStdin = true;
+      subs.add(stdin.listen((keys) {
+        if (keys.contains(0x71) || keys.contains(0x51)) {
+          if (!done.isCompleted) done.complete();
+        }
+      }));
+    } catch (_) {}
+  }
+  if (tty) stdout.write('\x1b[?25l'); // カーソルを隠す
+
+  StatsSnapshot? prev;
+  while (!done.isCompleted) {
+    String screen;
+    try {
+      final cur = await fetch();
+      screen = _renderTop(target, cur, prev, tty ? stdout.terminalLines : 40);
+      prev = cur;
+    } catch (e) {
+      screen = 'localnode-cli top — $target\n\nError: $e\n';
+      prev = null;
+    }
+    stdout.write(tty ? '\x1b[H\x1b[2J$screen' : '$screen\n');
+    await Future.any([
+      done.future,
+      Future<void>.delayed(Duration(seconds: interval)),
+    ]);
+  }
+
+  if (tty) stdout.write('\x1b[?25h\n');
+  if (restoreStdin) {
+    stdin
+      ..lineMode = true
+      ..echoMode = true;
+  }
+  for (final s in subs) {
+    await s.cancel();
+  }
+  client.close(force: true);
+  return 0;
+}
+
+String _renderTop(
+    String target, StatsSnapshot cur, StatsSnapshot? prev, int rows) {
+  final secs = prev == null ? 0.0 : (cur.nowMs - prev.nowMs) / 1000;
+  String rate(int now, int? before) =>
+      before == null || secs <= 0 ? '-' : '${_topBytes(((now - before) / secs).round())}/s';
+
+  final b = StringBuffer();
+  final up = Duration(milliseconds: cur.nowMs - cur.startedAtMs);
+  b.writeln('localnode-cli top — $target   up ${_topDuration(up)}   '
+      'RSS ${_topBytes(cur.rssBytes)}   '
+      '${DateTime.fromMillisecondsSinceEpoch(cur.nowMs).toIso8601String().substring(11, 19)}');
+  final reqRate = prev == null || secs <= 0
+      ? '-'
+      : ((cur.requests - prev.requests) / secs).toStringAsFixed(1);
+  b.writeln('Requests $reqRate/s   in ${rate(cur.bytesIn, prev?.bytesIn)}   '
+      'out ${rate(cur.bytesOut, prev?.bytesOut)}   '
+      'total ${cur.requests}');
+  b.writeln(cur.loopEnabled
+      ? 'Event loop  lag ${cur.lagMs} ms   p99 ${cur.lagP99Ms} ms   '
+          'max(60s) ${cur.lagMaxMs} ms   stalls ${cur.stalls}'
+      : 'Event loop  monitor disabled (--stall-threshold 0)');
+  b.writeln('Queues  thumbnail ${cur.thumbQueue}   '
+      'post-action ${cur.postActionQueue}   federation ${cur.fedQueue}');
+  final hitRatios = cur.caches.map((c) {
+    final n = c.hits + c.misses;
+    return '${c.name} ${n == 0 ? '-' : '${(c.hits * 100 / n).round()}%'} ($n)';
+  });
+  b.writeln('Caches  ${hitRatios.join('   ')}');
+  final cacheMem = cur.cacheBytes.entries
+      .where((e) => e.value > 0)
+      .map((e) => '${e.key} ${_topBytes(e.value)}');
+  b.writeln('Memory  ${cacheMem.join('   ')}');
+  b.writeln();
+
+  // 残りの行をクライアントとリクエストで分ける
+  var budget = max(rows - 10, 6);
+  final prevClients = {for (final c in prev?.clients ?? const []) c.ip: c};
+  final clients = [
+    for (final c in cur.clients)
+      (
+        c: c,
+        inRate: secs <= 0 || !prevClients.containsKey(c.ip)
+            ? 0
+            : (c.bytesIn - prevClients[c.ip]!.bytesIn) / secs,
+        outRate: secs <= 0 || !prevClients.containsKey(c.ip)
+            ? 0
+            : (c.bytesOut - prevClients[c.ip]!.bytesOut) / secs,
+      ),
+  ]..sort((x, y) => (y.inRate + y.outRate).compareTo(x.inRate + x.outRate));
+  final shownClients = clients.take(min(clients.length, budget ~/ 2)).toList();
+  b.writeln('CLIENT                                   ACTIVE      IN/s     OUT/s   TOTAL IN  TOTAL OUT');
+  for (final e in shownClients) {
+    b.writeln('${_topCol(e.c.ip, 40)} ${'${e.c.active}'.padLeft(6)} '
+        '${_topBytes(e.inRate.round()).padLeft(9)} '
+        '${_topBytes(e.outRate.round()).padLeft(9)} '
+        '${_topBytes(e.c.bytesIn).padLeft(10)} '
+        '${_topBytes(e.c.bytesOut).padLeft(10)}');
+  }
+  if (clients.length > shownClients.length) {
+    b.writeln('  … ${clients.length - shownClients.length} more');
+  }
+  budget -= shownClients.length + 3;
+  b.writeln();
+
+  final active = [...cur.active]
+    ..sort((x, y) => y.elapsedMs.compareTo(x.elapsedMs));
+  b.writeln('METHOD  ROUTE     ELAPSED        IN       OUT  CLIENT           PATH');
+  for (final r in active.take(max(budget, 1))) {
+    b.writeln('${_topCol(r.method, 7)} ${_topCol(r.route, 8)} '
+        '${_topElapsed(r.elapsedMs).padLeft(8)} '
+        '${_topBytes(r.bytesIn).padLeft(9)} '
+        '${_topBytes(r.bytesOut).padLeft(9)}  '
+        '${_topCol(r.client, 16)} /${r.path}');
+  }
+  if (active.length > max(budget, 1)) {
+    b.writeln('  … ${active.length - max(budget, 1)} more');
+  }
+  return b.toString();
+}
+
+String _topCol(String s, int width) =>
+    s.length > width ? '${s.substring(0, width - 1)}…' : s.padRight(width);
+
+String _topBytes(int n) {
+  if (n >= 1024 * 1024 * 1024) {
+    return '${(n / (1024 * 1024 * 1024)).toStringAsFixed(1)}G';
+  }
+  if (n >= 1024 * 1024) return '${(n / (1024 * 1024)).toStringAsFixed(1)}M';
+  if (n >= 1024) return '${(n / 1024).toStringAsFixed(1)}K';
+  return '${n}B';
+}
+
+String _topElapsed(int ms) =>
+    ms < 10000 ? '${ms}ms' : _topDuration(Duration(milliseconds: ms));
+
+String _topDuration(Duration d) {
+  if (d.inDays > 0) return '${d.inDays}d${d.inHours % 24}h';
+  if (d.inHours > 0) return '${d.inHours}h${d.inMinutes % 60}m';
+  if (d.inMinutes > 0) return '${d.inMinutes}m${d.inSeconds % 60}s';
+  return '${d.inSeconds}s';
+}
+
 // =============================================================================
 // Windows コンソール制御（FFI）
 // =============================================================================
@@ -1265,25 +2094,29 @@ String _generateUuidV4() {
   return '${hex.substring(0, 8)}-${hex.substring(8, 12)}-${hex.substring(12, 16)}-${hex.substring(16, 20)}-${hex.substring(20)}';
 }
 
-/// state.json から `device_id` を読む。無ければ生成して書き、書いた値を返す。
-String _loadOrCreateDeviceId(String statePath) {
+/// state.json を Map として読む。無い・破損している場合は空の Map を返す。
+Map<String, dynamic> _readStateMap(String statePath) {
   final file = File(statePath);
-  if (file.existsSync()) {
-    try {
-      final raw = file.readAsStringSync();
-      final dec = json.decode(raw);
-      if (dec is Map && dec['device_id'] is String) {
-        final id = dec['device_id'] as String;
-        if (id.isNotEmpty) return id;
-      }
-    } catch (_) {
-      // 破損していたら作り直す
-    }
+  if (!file.existsSync()) return {};
+  try {
+    final dec = json.decode(file.readAsStringSync());
+    if (dec is Map) return Map<String, dynamic>.from(dec);
+  } catch (_) {
+    // 破損していたら作り直す
   }
+  return {};
+}
+
+/// state.json から `device_id` を読む。無ければ生成して書き、書いた値を返す。
+String _loadOrCreateDeviceId(String statePath) {
+  final state = _readStateMap(statePath);
+  final existing = state['device_id'];
+  if (existing is String && existing.isNotEmpty) return existing;
   final id = _generateUuidV4();
   try {
-    file.parent.createSync(recursive: true);
-    file.writeAsStringSync(json.encode({'device_id': id}), flush: true);
+    File(statePath).parent.createSync(recursive: true);
+    // 他のキー (share_secret 等) は残したまま device_id だけ足す
+    _writeSecretFile(statePath, json.encode({...state, 'device_id': id}));
   } catch (e) {
     stderr.writeln('Warning: Could not persist device_id to $statePath: $e');
     stderr.writeln('Federation pairing may not survive a restart with this server.');
@@ -1291,6 +2124,33 @@ String _loadOrCreateDeviceId(String statePath) {
   return id;
 }
 
+/// 共有リンク (/s/<token>) 署名用の HMAC 鍵を state.json から読む。
+/// 無ければ 32 バイトの乱数を生成して書く。永続化できなくても起動は続け、
+/// その場合は再起動で発行済みリンクが無効になる。
+List<int> _loadOrCreateShareSecret(String statePath) {
+  final state = _readStateMap(statePath);
+  final existing = state['share_secret'];
+  if (existing is String && existing.isNotEmpty) {
+    try {
+      final key = base64Url.decode(existing);
+      if (key.length >= 32) return key;
+    } catch (_) {
+      // 壊れていたら作り直す
+    }
+  }
+  final r = Random.secure();
+  final key = List<int>.generate(32, (_) => r.nextInt(256));
+  try {
+    File(statePath).parent.createSync(recursive: true);
+    _writeSecretFile(
+        statePath, json.encode({...state, 'share_secret': base64Url.encode(key)}));
+  } catch (e) {
+    stderr.writeln('Warning: Could not persist share_secret to $statePath: $e');
+    stderr.writeln('Share links will stop working after a restart.');
+  }
+  return key;
+}
+
 /// ランダムなアップロードトークンを生成する（32文字の16進数）
 String _generateUploadToken() {
   final r = Random.secure();
@@ -1323,130 +2183,1070 @@ void _restoreWindowsConsoleMode() {
   } catch (_) {}
 }
 
-/// Disable echo and line-input so typed characters don't appear on screen
-/// while the server is running (#139). ENABLE_PROCESSED_INPUT (0x1) is kept
-/// so that Ctrl+C continues to work.
-void _setWindowsConsoleRawMode() {
-  if (!Platform.isWindows) return;
-  try {
-    final kernel32 = DynamicLibrary.open('kernel32.dll');
-    final getHandle = kernel32.lookupFunction<IntPtr Function(Uint32),
-        int Function(int)>('GetStdHandle');
-    final setMode = kernel32.lookupFunction<Int32 Function(IntPtr, Uint32),
-        int Function(int, int)>('SetConsoleMode');
-    // ENABLE_PROCESSED_INPUT (0x1) only: disables ENABLE_LINE_INPUT and ENABLE_ECHO_INPUT
-    setMode(getHandle(0xFFFFFFF6), 0x0001);
-  } catch (_) {}
+/// Disable echo and line-input so typed characters don't appear on screen
+/// while the server is running (#139). ENABLE_PROCESSED_INPUT (0x1) is kept
+/// so that Ctrl+C continues to work.
+void _setWindowsConsoleRawMode() {
+  if (!Platform.isWindows) return;
+  try {
+    final kernel32 = DynamicLibrary.open('kernel32.dll');
+    final getHandle = kernel32.lookupFunction<IntPtr Function(Uint32),
+        int Function(int)>('GetStdHandle');
+    final setMode = kernel32.lookupFunction<Int32 Function(IntPtr, Uint32),
+        int Function(int, int)>('SetConsoleMode');
+    // ENABLE_PROCESSED_INPUT (0x1) only: disables ENABLE_LINE_INPUT and ENABLE_ECHO_INPUT
+    setMode(getHandle(0xFFFFFFF6), 0x0001);
+  } catch (_) {}
+}
+
+// =============================================================================
+// 認証モード
+// =============================================================================
+
+enum _AuthMode { randomPin, fixedPin, noPin }
+
+// =============================================================================
+// CLI サーバー（GTK/Flutter 非依存）
+// =============================================================================
+
+/// #222: federation peer の動的状態
+class _FederationPeer {
+  final String kind; // 'child' or 'parent'
+  final String name;
+  final String url;
+  final String token;
+  final String relation;
+  // #219: friendly + trust:true で「親に渡したら子側削除」 (parent peer 設定のみ意味あり)
+  final bool trust;
+  // #219: 子→親アップロードの 1 回の最大バイト数 (child peer 設定のみ意味あり)
+  final int? maxUploadSizeBytes;
+  // friendly 親へ、受信中のアップロードをディスク書き込みと同時に流す (parent 設定のみ)
+  final bool tee;
+  // equally peer と clipboard を双方向に収束させる (version vector による anti-entropy)
+  final bool sync;
+  // equally peer と双方向に複製する共有フォルダ内のフォルダ (相対パス)
+  final String? replicate;
+  String? learnedDeviceId; // /api/info から学習
+  String? learnedRelation; // heartbeat で相手から学習した relation
+  // heartbeat で学習した相手の clipboard version vector (sync peer のみ)。
+  // 全 sync peer が越えた tombstone だけを捨てるのに使う
+  Map<String, int>? clipVv;
+  // heartbeat で学習した相手の mention 一覧の版と、@list のキャッシュ
+  String? mentionsVersion;
+  ({String? version, List<Map<String, dynamic>> items})? mentionsCache;
+  String status = 'unknown'; // 'connected' / 'offline' / 'paused' / 'relation-mismatch'
+  int lastOkMs = 0;
+  int lastTryMs = 0;
+  String? lastError;
+  // #223: pause まで有効な時刻 (epoch ms)。0 なら pause していない。
+  int pauseUntilMs = 0;
+
+  /// config 由来のフィールドが同じか (再読み込みで学習状態を引き継ぐ判定)
+  bool sameConfigAs(_FederationPeer o) =>
+      kind == o.kind &&
+      name == o.name &&
+      url == o.url &&
+      token == o.token &&
+      relation == o.relation &&
+      trust == o.trust &&
+      maxUploadSizeBytes == o.maxUploadSizeBytes &&
+      tee == o.tee &&
+      sync == o.sync &&
+      replicate == o.replicate;
+
+  bool isPaused() {
+    if (pauseUntilMs == 0) return false;
+    return DateTime.now().millisecondsSinceEpoch < pauseUntilMs;
+  }
+
+  _FederationPeer({
+    required this.kind,
+    required this.name,
+    required this.url,
+    required this.token,
+    required this.relation,
+    this.trust = false,
+    this.maxUploadSizeBytes,
+    this.tee = false,
+    this.sync = false,
+    this.replicate,
+  });
+
+  Map<String, dynamic> toJson() => {
+        'kind': kind,
+        'name': name,
+        'url': url,
+        'relation': relation,
+        'trust': trust,
+        if (kind == 'parent') 'tee': tee,
+        'sync': sync,
+        if (replicate != null) 'replicate': replicate,
+        if (maxUploadSizeBytes != null) 'maxUploadSizeBytes': maxUploadSizeBytes,
+        'status': status,
+        'lastOkMs': lastOkMs,
+        'lastTryMs': lastTryMs,
+        'learnedDeviceId': learnedDeviceId,
+        'learnedRelation': learnedRelation,
+        'lastError': lastError,
+        'pauseUntilMs': pauseUntilMs,
+      };
+}
+
+/// _fanOut の期限切れを task へ伝える。onCancel で登録した後始末
+/// (HttpClientRequest.abort など) は期限切れの時点で呼ばれる。
+class _FanOutCancel {
+  final Completer<void> _done = Completer<void>();
+  final List<void Function()> _hooks = [];
+
+  bool get isCancelled => _done.isCompleted;
+  Future<void> get whenCancelled => _done.future;
+
+  void onCancel(void Function() hook) {
+    if (isCancelled) {
+      hook();
+    } else {
+      _hooks.add(hook);
+    }
+  }
+
+  void cancel() {
+    if (isCancelled) return;
+    _done.complete();
+    for (final h in _hooks) {
+      h();
+    }
+    _hooks.clear();
+  }
+
+  void check() {
+    if (isCancelled) throw TimeoutException('fan-out deadline');
+  }
+}
+
+/// 受信中のアップロードを親へ同時送信するための口 (tee)。
+/// add() は親側のソケットが詰まっている間 (ストリームが pause 中) 待つので、
+/// 遅い方の速度で受信が進む。親側で失敗したら以後のチャンクは捨て、
+/// 呼び出し側はディスク上のコピーで転送し直す。
+/// 親が接続を受けたまま読まなくなった場合は stallTimeout で fail する。
+class _TeeForward {
+  static const Duration stallTimeout = Duration(seconds: 30);
+
+  final _FederationPeer peer;
+  final _MemLease? _buffered; // 親が読み取る前のチャンク (メモリ計上用)
+  final StreamController<List<int>> _ctrl = StreamController<List<int>>();
+  Completer<void>? _writable;
+  late final Future<bool> done;
+  bool failed = false;
+  bool _cancelled = false; // 送信側が購読をやめた (接続エラー等)
+  bool _released = false; // _buffered を返却済み。以後は計上しない
+  int bytes = 0;
+  // fail 時に親への送信を打ち切る (詰まったソケットへの addStream を終わらせる)
+  void Function(Object error)? onFail;
+
+  _TeeForward(this.peer, {_MemAccounting? mem})
+      : _buffered = mem?.lease('federation') {
+    _ctrl
+      ..onListen = _wake
+      ..onResume = _wake
+      ..onCancel = () {
+        _cancelled = true;
+        _release();
+        _wake();
+      };
+  }
+
+  // fail 後もバッファ済みのチャンクは stream から流れ出るので、返却後に
+  // 差し引くと federation の計上が負になる
+  Stream<List<int>> get stream => _buffered == null
+      ? _ctrl.stream
+      : _ctrl.stream.map((chunk) {
+          if (!_released) _buffered.add(-chunk.length);
+          return chunk;
+        });
+
+  void _release() {
+    if (_released) return;
+    _released = true;
+    _buffered?.release();
+  }
+
+  void _wake() {
+    _writable?.complete();
+    _writable = null;
+  }
+
+  Future<void> add(List<int> chunk) async {
+    if (failed || _cancelled) return;
+    _ctrl.add(chunk);
+    if (!_released) _buffered?.add(chunk.length);
+    bytes += chunk.length;
+    // 購読前 (接続中) と pause 中は待つ。stallTimeout の間進まなければ諦め、
+    // 受信はローカル保存だけで続ける
+    while (!failed && !_cancelled && (!_ctrl.hasListener || _ctrl.isPaused)) {
+      try {
+        await (_writable ??= Completer<void>()).future.timeout(stallTimeout);
+      } on TimeoutException {
+        fail(TimeoutException('parent ${peer.name} stalled', stallTimeout));
+      }
+    }
+  }
+
+  /// 受信完了。親の応答を待って成否を返す。
+  Future<bool> finish() async {
+    if (!failed && !_ctrl.isClosed) await _ctrl.close();
+    return done;
+  }
+
+  void fail([Object? error]) {
+    if (failed) return;
+    failed = true;
+    _release();
+    _wake();
+    final abort = onFail;
+    onFail = null;
+    abort?.call(error ?? StateError('tee to ${peer.name} failed'));
+    if (!_ctrl.isClosed) {
+      if (error != null && _ctrl.hasListener) _ctrl.addError(error);
+      _ctrl.close();
+    }
+  }
+}
+
+/// 名前付き Bearer トークン (config の api_tokens) とそのクォータ・使用量。
+/// サーバは単一 isolate なので、カウンタは素の int で競合しない。
+class _ApiToken {
+  final String name;
+  final String token;
+  final double? rate; // リクエスト/秒。null なら無制限
+  final int burst;
+  final int? maxBytesPerSec;
+  final int? maxConcurrentUploads;
+
+  // リクエスト数はトークンバケット、帯域は GCRA (1 秒分のバーストを許す)
+  final TokenBucket? _requests;
+  final ByteRateLimiter? _bytes;
+
+  int activeUploads = 0;
+  int requests = 0;
+  int rejectedRate = 0;
+  int rejectedConcurrency = 0;
+  int bytesIn = 0;
+  int throttledMs = 0;
+  int lastUsedMs = 0;
+
+  _ApiToken({
+    required this.name,
+    required this.token,
+    this.rate,
+    int? burst,
+    this.maxBytesPerSec,
+    this.maxConcurrentUploads,
+  })  : burst = burst ?? (rate == null ? 1 : max(1, rate.ceil())),
+        _requests = rate == null ? null : TokenBucket(rate, burst: burst),
+        _bytes = maxBytesPerSec == null ? null : ByteRateLimiter(maxBytesPerSec);
+
+  /// 1 リクエスト分のトークンを取る。足りなければ次に取れるまでの秒数を返す。
+  int? takeRequest(int nowMs) => _requests?.take(nowMs);
+
+  /// len バイト送る枠を予約し、送る前に待つべき時間 (ms) を返す。
+  int reserveBytes(int len, int nowMs) => _bytes?.reserve(len, nowMs) ?? 0;
+
+  String describeLimits() {
+    final parts = <String>[
+      if (rate != null) '$rate req/s (burst $burst)',
+      if (maxBytesPerSec != null) '${maxBytesPerSec! ~/ 1024} KiB/s',
+      if (maxConcurrentUploads != null) '$maxConcurrentUploads concurrent upload(s)',
+    ];
+    return parts.isEmpty ? 'unlimited' : parts.join(', ');
+  }
+
+  Map<String, dynamic> toJson() => {
+        'name': name,
+        'limits': {
+          'rate': rate,
+          'burst': burst,
+          'maxBytesPerSec': maxBytesPerSec,
+          'maxConcurrentUploads': maxConcurrentUploads,
+        },
+        'requests': requests,
+        'rejectedRate': rejectedRate,
+        'rejectedConcurrency': rejectedConcurrency,
+        'bytesIn': bytesIn,
+        'throttledMs': throttledMs,
+        'activeUploads': activeUploads,
+        'lastUsedMs': lastUsedMs,
+      };
+}
+
+// =============================================================================
+// 双方向フォルダ複製 (equally peer の replicate: <folder>)
+// =============================================================================
+//
+// 複製フォルダ内の各ファイルに版情報 (ReplicaEntry, lib/src/replica.dart) を
+// 持たせ、状態ファイルに保存する。ローカルで内容が変わったら自分のカウンタを
+// 1 進める。
+//
+// マニフェストはディレクトリ単位の Merkle 木で、ディレクトリのハッシュは
+// 直下エントリ (名前・種類・ハッシュ) から作る。相手と根のハッシュが一致すれば
+// そこで終わり、違うサブツリーだけを降りて比較する。
+//
+// 各ノードは相手から「取る」だけ (pull)。相手側も同じ手順で取りに来るので
+// 双方向になる。並行更新 (どちらの版も相手を包含しない) は、更新時刻 →
+// 内容ハッシュの順で勝者を決め、負けた内容を name.conflict-<sha8>.ext に残す。
+// 両ノードが同じ規則で同じ名前・内容の衝突コピーを作るので、それ自体は
+// 同一ファイルとして収束する。
+
+class _ReplicaSet {
+  final String folder; // config の replicate (共有フォルダからの相対パス)
+  final String root; // 実パス (canonical)
+  final String statePath;
+  final String deviceId;
+  final Map<String, ReplicaEntry> entries = {};
+  // ディレクトリ相対パス ('' が根) → Merkle ハッシュ / 直下の名前
+  Map<String, String> _dirHashes = {};
+  Map<String, Set<String>> _dirChildren = {};
+  int _lastScanMs = 0;
+  Future<void>? _scanning;
+  bool syncing = false;
+  bool dirty = false; // 走査以外で entries を変えた (保存と木の再計算が必要)
+
+  static const Duration rescanInterval = Duration(seconds: 10);
+  // 書き込み途中のファイルを拾わないよう、直近に更新されたものは次回に回す
+  static const Duration settle = Duration(seconds: 2);
+
+  _ReplicaSet(this.folder, this.root, this.statePath, this.deviceId);
+
+  Future<void> load() async {
+    try {
+      final dec = json.decode(await File(statePath).readAsString());
+      final files = dec is Map ? dec['files'] : null;
+      if (files is Map) {
+        files.forEach((k, v) {
+          final e = ReplicaEntry.fromJson(v);
+          if (k is String && e != null) entries[k] = e;
+        });
+      }
+    } catch (_) {
+      // 無い・壊れている: 次の走査で全ファイルを自分の版として登録し直す
+    }
+  }
+
+  Future<void> save() async {
+    try {
+      final tmp = File('$statePath.tmp');
+      await tmp.parent.create(recursive: true);
+      await tmp.writeAsString(json.encode({
+        'version': 1,
+        'root': root,
+        'files': {for (final e in entries.entries) e.key: e.value.toJson()},
+      }));
+      await tmp.rename(statePath);
+    } catch (e) {
+      stderr.writeln('Warning: could not save replica state to $statePath: $e');
+    }
+  }
+
+  static bool ignored(String rel) {
+    if (p.split(rel).any((seg) => seg.startsWith('.'))) return true;
+    final name = p.basename(rel).toLowerCase();
+    return name.endsWith('.part') ||
+        name.endsWith('.partial') ||
+        name.endsWith('.crdownload') ||
+        name.endsWith('.tmp') ||
+        name.endsWith('~');
+  }
+
+  static Future<String> hashFile(File f) async =>
+      (await crypto.sha256.bind(f.openRead()).first).toString();
+
+  /// rescanInterval 以内に走査済みなら何もしない。並行呼び出しは 1 回にまとめる。
+  Future<void> scan({Set<String> busy = const {}, bool force = false}) {
+    final now = DateTime.now().millisecondsSinceEpoch;
+    if (!force && now - _lastScanMs < rescanInterval.inMilliseconds) {
+      return _scanning ?? Future.value();
+    }
+    return _scanning ??= _scan(busy).whenComplete(() => _scanning = null);
+  }
+
+  Future<void> _scan(Set<String> busy) async {
+    final now = DateTime.now();
+    final present = <String>{};
+    var changed = false;
+    final dir = Directory(root);
+    if (!await dir.exists()) await dir.create(recursive: true);
+    await for (final f in dir.list(recursive: true, followLinks: false)) {
+      if (f is! File) continue;
+      final rel = p.relative(f.path, from: root);
+      if (ignored(rel)) continue;
+      present.add(rel);
+      if (busy.contains(f.path)) continue;
+      final FileStat st;
+      try {
+        st = await f.stat();
+      } catch (_) {
+        continue;
+      }
+      final mtime = st.modified.millisecondsSinceEpoch;
+      final cur = entries[rel];
+      if (cur != null &&
+          !cur.deleted &&
+          cur.size == st.size &&
+          cur.localMtimeMs == mtime) {
+        continue;
+      }
+      if (now.difference(st.modified) < settle) continue;
+      final String sha;
+      try {
+        sha = await hashFile(f);
+      } catch (_) {
+        continue;
+      }
+      if (cur != null && !cur.deleted && cur.sha == sha) {
+        // 内容は同じ (touch 等)。版は進めない
+        cur.localMtimeMs = mtime;
+        cur.size = st.size;
+        changed = true;
+        continue;
+      }
+      final vv = Map<String, int>.from(cur?.vv ?? const {});
+      vv[deviceId] = (vv[deviceId] ?? 0) + 1;
+      entries[rel] = ReplicaEntry(
+        sha: sha,
+        size: st.size,
+        localMtimeMs: mtime,
+        modifiedMs: mtime,
+        vv: vv,
+      );
+      changed = true;
+    }
+    // 消えたファイルは tombstone にして削除を伝える
+    for (final rel in entries.keys.toList()) {
+      final cur = entries[rel]!;
+      if (cur.deleted || present.contains(rel)) continue;
+      final vv = Map<String, int>.from(cur.vv);
+      vv[deviceId] = (vv[deviceId] ?? 0) + 1;
+      entries[rel] = ReplicaEntry(
+        sha: '',
+        size: 0,
+        localMtimeMs: 0,
+        modifiedMs: now.millisecondsSinceEpoch,
+        vv: vv,
+        deleted: true,
+      );
+      changed = true;
+    }
+    _lastScanMs = DateTime.now().millisecondsSinceEpoch;
+    rebuildTree();
+    if (changed) await save();
+  }
+
+  /// エントリから Merkle 木を作り直す
+  void rebuildTree() {
+    final children = <String, Set<String>>{'': {}};
+    for (final rel in entries.keys) {
+      final segs = p.split(rel);
+      var dir = '';
+      for (var i = 0; i < segs.length; i++) {
+        (children[dir] ??= {}).add(segs[i]);
+        if (i < segs.length - 1) dir = dir.isEmpty ? segs[i] : p.join(dir, segs[i]);
+      }
+    }
+    final hashes = <String, String>{};
+    String hashDir(String dir) {
+      final names = (children[dir] ?? const <String>{}).toList()..sort();
+      final b = StringBuffer();
+      for (final n in names) {
+        final rel = dir.isEmpty ? n : p.join(dir, n);
+        final e = entries[rel];
+        final h = e != null ? e.hash : hashDir(rel);
+        b.write('$n\u0000${e != null ? 'f' : 'd'}\u0000$h\n');
+      }
+      return hashes[dir] = crypto.sha256.convert(utf8.encode(b.toString())).toString();
+    }
+
+    hashDir('');
+    _dirHashes = hashes;
+    _dirChildren = children;
+  }
+
+  String? dirHash(String dir) => _dirHashes[dir];
+
+  /// GET /api/federation/replica/tree の応答 (直下のみ)
+  Map<String, dynamic> tree(String dir) {
+    final names = (_dirChildren[dir] ?? const <String>{}).toList()..sort();
+    return {
+      'hash': _dirHashes[dir],
+      'entries': [
+        for (final n in names)
+          if (entries[dir.isEmpty ? n : p.join(dir, n)] case final e?)
+            {'name': n, 'type': 'file', 'hash': e.hash, ...e.toWire()}
+          else
+            {
+              'name': n,
+              'type': 'dir',
+              'hash': _dirHashes[dir.isEmpty ? n : p.join(dir, n)],
+            },
+      ],
+    };
+  }
+}
+
+/// replicate: の値は共有フォルダ内の相対パス ('..' や絶対パスは不可)
+bool _isValidReplicateFolder(dynamic raw) {
+  if (raw is! String || raw.trim().isEmpty) return false;
+  if (p.isAbsolute(raw) || raw.startsWith('/') || raw.startsWith(r'\')) {
+    return false;
+  }
+  return !p.split(raw).contains('..');
+}
+
+/// #219: "100MB" / "5GB" / "1024" 等を bytes に変換 (大文字小文字無視)
+int? _parseSizeBytes(dynamic raw) {
+  if (raw == null) return null;
+  if (raw is int) return raw;
+  final s = raw.toString().trim();
+  final m = RegExp(r'^(\d+(?:\.\d+)?)\s*([kmgtKMGT]?)[bB]?$').firstMatch(s);
+  if (m == null) return null;
+  final num = double.parse(m.group(1)!);
+  final unit = m.group(2)!.toUpperCase();
+  const mult = {'': 1, 'K': 1024, 'M': 1024 * 1024, 'G': 1024 * 1024 * 1024, 'T': 1024 * 1024 * 1024 * 1024};
+  return (num * mult[unit]!).toInt();
+}
+
+/// サブシステムごとのメモリ使用量 (バイト) と起動後の最大値。
+/// 持ち続けるもの (clipboard / キャッシュ) は定期的に測って set し、
+/// 一時的に抱えるもの (リクエスト本文 / 画像デコード / 転送バッファ) は
+/// 確保・解放の箇所で add / release する。値は推定で、Dart オブジェクトの
+/// ヘッダ等は含まない。
+class _MemAccounting {
+  final Map<String, int> current = {};
+  final Map<String, int> peak = {};
+
+  void add(String subsystem, int bytes) {
+    final v = (current[subsystem] ?? 0) + bytes;
+    current[subsystem] = v;
+    if (v > (peak[subsystem] ?? 0)) peak[subsystem] = v;
+  }
+
+  void release(String subsystem, int bytes) => add(subsystem, -bytes);
+
+  void set(String subsystem, int bytes) {
+    current[subsystem] = bytes;
+    if (bytes > (peak[subsystem] ?? 0)) peak[subsystem] = bytes;
+  }
+
+  /// 呼び出し側が少しずつ積み、最後にまとめて返す分
+  _MemLease lease(String subsystem) => _MemLease(this, subsystem);
+
+  Map<String, dynamic> toJson() => {
+        for (final k in current.keys)
+          k: {'bytes': current[k], 'peakBytes': peak[k] ?? 0},
+      };
+}
+
+class _MemLease {
+  final _MemAccounting owner;
+  final String subsystem;
+  int bytes = 0;
+
+  _MemLease(this.owner, this.subsystem);
+
+  void add(int n) {
+    bytes += n;
+    owner.add(subsystem, n);
+  }
+
+  void release() {
+    owner.release(subsystem, bytes);
+    bytes = 0;
+  }
+}
+
+/// VM service (JSON-RPC over WebSocket) の最小クライアント。
+/// `dart --enable-vm-service` 等で起動したときだけ繋がる (AOT の exe には無い)。
+class _VmService {
+  final WebSocket _ws;
+  final Map<String, Completer<Map<String, dynamic>>> _pending = {};
+  int _nextId = 0;
+
+  _VmService._(this._ws) {
+    _ws.listen((data) {
+      if (data is! String) return;
+      final msg = json.decode(data) as Map<String, dynamic>;
+      final c = _pending.remove('${msg['id']}');
+      if (c == null) return;
+      final err = msg['error'];
+      if (err is Map) {
+        c.completeError(StateError('${err['message']}'));
+      } else {
+        c.complete(msg['result'] as Map<String, dynamic>);
+      }
+    }, onDone: () {
+      for (final c in _pending.values) {
+        c.completeError(StateError('VM service connection closed'));
+      }
+      _pending.clear();
+    }, onError: (_) {});
+  }
+
+  static Future<_VmService?> connect() async {
+    final uri = (await developer.Service.getInfo()).serverWebSocketUri;
+    if (uri == null) return null;
+    try {
+      return _VmService._(await WebSocket.connect(uri.toString()));
+    } catch (_) {
+      return null;
+    }
+  }
+
+  static String? get isolateId =>
+      developer.Service.getIsolateId(Isolate.current);
+
+  Future<Map<String, dynamic>> call(String method,
+      [Map<String, dynamic> params = const {}]) {
+    final id = '${++_nextId}';
+    final c = Completer<Map<String, dynamic>>();
+    _pending[id] = c;
+    _ws.add(json.encode(
+        {'jsonrpc': '2.0', 'id': id, 'method': method, 'params': params}));
+    return c.future.timeout(const Duration(seconds: 30), onTimeout: () {
+      _pending.remove(id);
+      throw TimeoutException('VM service $method timed out');
+    });
+  }
+
+  Future<void> close() => _ws.close();
+
+  /// プロファイラを有効/無効にする (VM フラグ profiler は実行中に変えられる)
+  Future<void> setProfiler(bool enabled) =>
+      call('setFlag', {'name': 'profiler', 'value': '$enabled'});
+
+  static String _functionName(List functions, int i) {
+    final f = (functions[i] as Map)['function'];
+    if (f is! Map) return '$f';
+    final owner = f['owner'];
+    return owner is Map && owner['type'] == '@Class'
+        ? '${owner['name']}.${f['name']}'
+        : '${f['name']}';
+  }
+
+  /// getCpuSamples の結果を Chrome DevTools の .cpuprofile 形式にする
+  /// (DevTools の Performance パネルや speedscope で開ける)
+  static Map<String, dynamic> toCpuProfile(
+      Map<String, dynamic> res, int startUs, int endUs) {
+    final functions = (res['functions'] as List?) ?? const [];
+    final samples = ((res['samples'] as List?) ?? const []).cast<Map>().toList()
+      ..sort((a, b) => (a['timestamp'] as num).compareTo(b['timestamp'] as num));
+    Map<String, dynamic> frame(String name, String url) => {
+          'functionName': name,
+          'scriptId': '0',
+          'url': url,
+          'lineNumber': -1,
+          'columnNumber': -1,
+        };
+    final nodes = <Map<String, dynamic>>[
+      {'id': 1, 'callFrame': frame('(root)', ''), 'children': <int>[]},
+    ];
+    final childOf = <String, int>{}; // "<親 id>:<関数番号>" → ノード id
+    final sampleNodes = <int>[];
+    final deltas = <int>[];
+    var last = startUs;
+    for (final s in samples) {
+      var node = 1;
+      final stack = (s['stack'] as List?)?.cast<int>() ?? const <int>[];
+      // stack は内側が先頭なので、根から辿るために逆順に見る
+      for (final fn in stack.reversed) {
+        final key = '$node:$fn';
+        var id = childOf[key];
+        if (id == null) {
+          id = nodes.length + 1;
+          childOf[key] = id;
+          nodes.add({
+            'id': id,
+            'callFrame': frame(_functionName(functions, fn),
+                '${(functions[fn] as Map)['resolvedUrl'] ?? ''}'),
+            'children': <int>[],
+          });
+          (nodes[node - 1]['children'] as List<int>).add(id);
+        }
+        node = id;
+      }
+      final ts = (s['timestamp'] as num).toInt();
+      sampleNodes.add(node);
+      deltas.add(ts - last);
+      last = ts;
+    }
+    return {
+      'nodes': nodes,
+      'startTime': startUs,
+      'endTime': endUs,
+      'samples': sampleNodes,
+      'timeDeltas': deltas,
+    };
+  }
+
+  /// getCpuSamples の結果を、最も内側の関数ごと / 自分のコード
+  /// (localnode_cli.dart) で最も内側の関数ごとのサンプル数に畳む
+  static Map<String, dynamic> summarizeCpuSamples(Map<String, dynamic> res,
+      {int top = 8}) {
+    final functions = (res['functions'] as List?) ?? const [];
+    final samples = (res['samples'] as List?) ?? const [];
+    String nameOf(int i) => _functionName(functions, i);
+    bool isOwn(int i) =>
+        '${(functions[i] as Map)['resolvedUrl']}'.endsWith('localnode_cli.dart');
+    final leaf = <String, int>{};
+    final own = <String, int>{};
+    for (final s in samples) {
+      final stack = ((s as Map)['stack'] as List?)?.cast<int>() ?? const [];
+      if (stack.isEmpty) continue;
+      leaf.update(nameOf(stack.first), (v) => v + 1, ifAbsent: () => 1);
+      final mine = stack.firstWhere(isOwn, orElse: () => -1);
+      if (mine >= 0) own.update(nameOf(mine), (v) => v + 1, ifAbsent: () => 1);
+    }
+    List<Map<String, dynamic>> ranked(Map<String, int> m) =>
+        (m.entries.toList()..sort((a, b) => b.value - a.value))
+            .take(top)
+            .map((e) => {'function': e.key, 'samples': e.value})
+            .toList();
+    return {
+      'samples': samples.length,
+      'top': ranked(leaf),
+      'ownCode': ranked(own),
+    };
+  }
 }
 
-// =============================================================================
-// 認証モード
-// =============================================================================
+/// イベントループの遅れを測る。20ms ごとのタイマーが予定からどれだけ遅れて
+/// 発火したかを記録し、しきい値を超えたら「詰まり」としてその間に動いていた
+/// リクエストを残す。タイマーも同じ isolate で動くので、検出は詰まりが解けた
+/// 直後になる。詰まっている最中に何を実行していたかは、VM service が使える
+/// ときだけ CPU サンプルをその時間帯について取り出して補う。
+/// 時刻は CPU サンプルと揃えるため Timeline の時計 (µs) を使う。
+class _LoopMonitor {
+  static const int intervalMs = 20;
+  static const int _maxStalls = 50;
+  // lag ヒストグラムの上端 (ms)。最後のバケットは 4096ms 以上
+  static const List<int> _bucketMs = [
+    1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024, 2048, 4096
+  ];
+
+  final int stallMs;
+  final bool profile;
+  /// 指定時刻以降に動いていたリクエストの一覧 (サーバが提供する)
+  final List<Map<String, dynamic>> Function(int sinceUs) activity;
+
+  final List<int> _buckets = List.filled(_bucketMs.length + 1, 0);
+  final Int32List _secondMax = Int32List(60); // 直近 60 秒の秒ごと最大 lag (ms)
+  int _second = 0;
+  final List<Map<String, dynamic>> _stalls = [];
+  Timer? _timer;
+  int _expectedUs = 0;
+  int ticks = 0;
+  int stallCount = 0;
+  int maxLagMs = 0;
+  int lastLagMs = 0;
+  _VmService? _vm;
+  String? _profileError;
+
+  _LoopMonitor({
+    required this.stallMs,
+    required this.profile,
+    required this.activity,
+  });
 
-enum _AuthMode { randomPin, fixedPin, noPin }
+  Future<void> start() async {
+    if (profile) {
+      _vm = await _VmService.connect();
+      try {
+        await _vm?.setProfiler(true);
+      } catch (_) {
+        // 既に有効なら失敗しても構わない
+      }
+      if (_vm == null) {
+        _profileError =
+            'VM service is not enabled (run with dart --enable-vm-service)';
+        stderr.writeln('Warning: stall profiling is off: $_profileError.');
+      }
+    }
+    _arm();
+  }
 
-// =============================================================================
-// クリップボードアイテム
-// =============================================================================
+  /// 詰まりのたびに CPU サンプルを取り出しているか (プロファイラを常時使う)
+  bool get profiling => _vm != null;
 
-class _ClipboardItem {
-  final String id;
-  final String text;
-  final String? tag;
-  final DateTime createdAt;
-  // #220 / #230: @up でマーク済みの重要アイテム
-  final bool important;
-
-  _ClipboardItem({
-    required this.id,
-    required this.text,
-    this.tag,
-    required this.createdAt,
-    this.important = false,
-  });
+  Future<void> stop() async {
+    _timer?.cancel();
+    _timer = null;
+    await _vm?.close();
+    _vm = null;
+  }
+
+  // Timer.periodic は遅れを取り戻そうとするので、毎回 1 回限りで張り直す
+  void _arm() {
+    _expectedUs = developer.Timeline.now + intervalMs * 1000;
+    _timer = Timer(const Duration(milliseconds: intervalMs), _tick);
+  }
+
+  void _tick() {
+    final now = developer.Timeline.now;
+    final lagUs = max(0, now - _expectedUs);
+    final lagMs = lagUs ~/ 1000;
+    ticks++;
+    lastLagMs = lagMs;
+    if (lagMs > maxLagMs) maxLagMs = lagMs;
+    var b = 0;
+    while (b < _bucketMs.length && lagMs >= _bucketMs[b]) {
+      b++;
+    }
+    _buckets[b]++;
+    final sec = now ~/ 1000000;
+    if (sec != _second) {
+      // 詰まりで飛んだ秒は 0 に戻す
+      for (var s = sec; s > _second && sec - s < 60; s--) {
+        _secondMax[s % 60] = 0;
+      }
+      _second = sec;
+    }
+    if (lagMs > _secondMax[sec % 60]) _secondMax[sec % 60] = lagMs;
+    if (lagMs >= stallMs) _recordStall(now, lagUs);
+    _arm();
+  }
+
+  void _recordStall(int nowUs, int lagUs) {
+    stallCount++;
+    final sinceUs = nowUs - lagUs - intervalMs * 1000;
+    final requests = activity(sinceUs);
+    final stall = <String, dynamic>{
+      'at': DateTime.now()
+          .subtract(Duration(microseconds: lagUs))
+          .toIso8601String(),
+      'lagMs': lagUs ~/ 1000,
+      'requests': requests,
+    };
+    _stalls.add(stall);
+    if (_stalls.length > _maxStalls) _stalls.removeAt(0);
+    stderr.writeln('[loop] event loop stalled for ${lagUs ~/ 1000}ms '
+        '${requests.isEmpty ? '(no request in flight)' : 'during ${requests.map((r) => '${r['method']} /${r['path']}').join(', ')}'}');
+    final vm = _vm;
+    final isolateId = _VmService.isolateId;
+    if (vm == null || isolateId == null) return;
+    () async {
+      try {
+        final res = await vm.call('getCpuSamples', {
+          'isolateId': isolateId,
+          'timeOriginMicros': sinceUs,
+          'timeExtentMicros': nowUs - sinceUs,
+        });
+        stall['profile'] = _VmService.summarizeCpuSamples(res);
+      } catch (e) {
+        stall['profile'] = {'error': '$e'};
+      }
+    }();
+  }
+
+  /// 累積ヒストグラムから q 分位のバケット上端 (ms) を返す
+  int percentileMs(double q) {
+    final total = _buckets.fold<int>(0, (a, b) => a + b);
+    if (total == 0) return 0;
+    var seen = 0;
+    for (var i = 0; i < _buckets.length; i++) {
+      seen += _buckets[i];
+      if (seen >= total * q) {
+        return i < _bucketMs.length ? _bucketMs[i] : maxLagMs;
+      }
+    }
+    return maxLagMs;
+  }
+
+  static String _bucketLabel(int i) {
+    if (i == 0) return '<1';
+    if (i == _bucketMs.length) return '>=${_bucketMs.last}';
+    return '${_bucketMs[i - 1]}-${_bucketMs[i]}';
+  }
+
+  /// 直近 60 秒の秒ごと最大 lag (古い順)
+  List<int> get lastMinuteMaxMs {
+    final now = developer.Timeline.now ~/ 1000000;
+    return [
+      for (var s = now - 59; s <= now; s++)
+        s <= _second && _second - s < 60 ? _secondMax[s % 60] : 0
+    ];
+  }
 
   Map<String, dynamic> toJson() => {
-        'id': id,
-        'text': text,
-        'tag': tag,
-        'createdAt': createdAt.toUtc().toIso8601String(),
-        'important': important,
+        'intervalMs': intervalMs,
+        'stallThresholdMs': stallMs,
+        'ticks': ticks,
+        'lastLagMs': lastLagMs,
+        'maxLagMs': maxLagMs,
+        'p50Ms': percentileMs(0.5),
+        'p99Ms': percentileMs(0.99),
+        'histogram': {
+          for (var i = 0; i < _buckets.length; i++) _bucketLabel(i): _buckets[i],
+        },
+        'lastMinuteMaxMs': lastMinuteMaxMs,
+        'stalls': stallCount,
+        'profiling': profiling,
+        if (_profileError != null) 'profileError': _profileError,
+        'stallLog': _stalls.reversed.toList(),
       };
 }
 
-// =============================================================================
-// CLI サーバー（GTK/Flutter 非依存）
-// =============================================================================
+/// 応答本文を送り終えるまでのリクエスト 1 件 (top の表示用)
+class _ActiveRequest {
+  final String method;
+  final String path;
+  final String route;
+  final _ClientTraffic traffic;
+  final int startMs = DateTime.now().millisecondsSinceEpoch;
+  int bytesIn = 0;
+  int bytesOut = 0;
+
+  _ActiveRequest(this.method, this.path, this.route, this.traffic);
+}
 
-/// #222: federation peer の動的状態
-class _FederationPeer {
-  final String kind; // 'child' or 'parent'
-  final String name;
-  final String url;
-  final String token;
-  final String relation;
-  // #219: friendly + trust:true で「親に渡したら子側削除」 (parent peer 設定のみ意味あり)
-  final bool trust;
-  // #219: 子→親アップロードの 1 回の最大バイト数 (child peer 設定のみ意味あり)
-  final int? maxUploadSizeBytes;
-  String? learnedDeviceId; // /api/info から学習
-  String? learnedRelation; // heartbeat で相手から学習した relation
-  String status = 'unknown'; // 'connected' / 'offline' / 'paused' / 'relation-mismatch'
-  int lastOkMs = 0;
-  int lastTryMs = 0;
-  String? lastError;
-  // #223: pause まで有効な時刻 (epoch ms)。0 なら pause していない。
-  int pauseUntilMs = 0;
+/// クライアント (IP) ごとの累計転送量。帯域は top 側が差分から出す
+class _ClientTraffic {
+  final String ip;
+  int bytesIn = 0;
+  int bytesOut = 0;
+  int active = 0;
+  int lastSeenMs = DateTime.now().millisecondsSinceEpoch;
 
-  bool isPaused() {
-    if (pauseUntilMs == 0) return false;
-    return DateTime.now().millisecondsSinceEpoch < pauseUntilMs;
+  _ClientTraffic(this.ip);
+}
+
+/// アクセストレースの記録 (tool/trace_replay.dart で再生する)。
+/// 形式は lib/src/trace_format.dart。起動ごとにセグメント見出しを追記し、
+/// 以降は 1 件ずつ完了順に書く。
+class _TraceRecorder {
+  static const int _maxBytes = 256 * 1024 * 1024;
+
+  final IOSink _sink;
+  final int _startMs;
+  int _written = 0;
+
+  _TraceRecorder._(this._sink, this._startMs);
+
+  static Future<_TraceRecorder> open(String path, String shareRoot) async {
+    final file = File(path);
+    if (!await file.exists() && !Platform.isWindows) {
+      // パスやファイル名が残るので他ユーザーから読めないようにする
+      await file.writeAsString('');
+      _CliServer._chmodFile(file);
+    }
+    // 上限は前回までの記録を含めたファイル全体に掛ける
+    final existing = await file.exists() ? await file.length() : 0;
+    final sink = file.openWrite(mode: FileMode.append);
+    final startMs = DateTime.now().millisecondsSinceEpoch;
+    final trace = _TraceRecorder._(sink, startMs).._written = existing;
+    if (existing > _maxBytes) {
+      stderr.writeln('[trace] $path is over the size limit, not recording');
+      return trace;
+    }
+    final head = encodeTraceSegment(startMs, shareRoot);
+    trace._written += head.length;
+    sink.add(head);
+    return trace;
+  }
+
+  void record(Request req, String route,
+      {required int startMs,
+      required int headerUs,
+      required int totalUs,
+      required int status,
+      required int bytesIn,
+      required int bytesOut}) {
+    if (_written > _maxBytes) return;
+    var path = req.url.path;
+    // 自分の観測 (top / ダッシュボード) は記録しない
+    if (path.startsWith('api/debug/')) return;
+    // 共有リンクのトークンはそれ自体が資格情報
+    if (path.startsWith('s/')) path = 's/-';
+    final b = encodeTraceRecord(
+        _startMs,
+        TraceRecord(
+          startMs: startMs,
+          shareRoot: '',
+          headerUs: headerUs,
+          totalUs: totalUs,
+          status: status,
+          method: req.method,
+          route: route,
+          path: path,
+          query: req.url.query,
+          headers: {
+            for (final h in kTraceHeaders)
+              if (req.headers[h] != null) h: req.headers[h]!,
+          },
+          bytesIn: bytesIn,
+          bytesOut: bytesOut,
+        ));
+    _written += b.length;
+    _sink.add(b);
+    if (_written > _maxBytes) {
+      stderr.writeln('[trace] size limit reached, recording stopped');
+    }
   }
 
-  _FederationPeer({
-    required this.kind,
-    required this.name,
-    required this.url,
+  Future<void> close() async {
+    await _sink.flush();
+    await _sink.close();
+  }
+}
+
+/// WebDAV の LOCK (class 2)。メモリ上だけに持ち、再起動で消える。
+class _DavLock {
+  final String token; // opaquelocktoken:<uuid>
+  final String path; // 共有ルートからの相対パス ('' はルート)
+  final bool exclusive;
+  final bool deep; // Depth: infinity
+  final String? owner;
+  int timeoutSec;
+  int expiresMs;
+
+  _DavLock({
     required this.token,
-    required this.relation,
-    this.trust = false,
-    this.maxUploadSizeBytes,
-  });
+    required this.path,
+    required this.exclusive,
+    required this.deep,
+    required this.owner,
+    required this.timeoutSec,
+  }) : expiresMs = DateTime.now().millisecondsSinceEpoch + timeoutSec * 1000;
 
-  Map<String, dynamic> toJson() => {
-        'kind': kind,
-        'name': name,
-        'url': url,
-        'relation': relation,
-        'trust': trust,
-        if (maxUploadSizeBytes != null) 'maxUploadSizeBytes': maxUploadSizeBytes,
-        'status': status,
-        'lastOkMs': lastOkMs,
-        'lastTryMs': lastTryMs,
-        'learnedDeviceId': learnedDeviceId,
-        'learnedRelation': learnedRelation,
-        'lastError': lastError,
-        'pauseUntilMs': pauseUntilMs,
-      };
+  void refresh(int seconds) {
+    timeoutSec = seconds;
+    expiresMs = DateTime.now().millisecondsSinceEpoch + seconds * 1000;
+  }
 }
 
-/// #219: "100MB" / "5GB" / "1024" 等を bytes に変換 (大文字小文字無視)
-int? _parseSizeBytes(dynamic raw) {
-  if (raw == null) return null;
-  if (raw is int) return raw;
-  final s = raw.toString().trim();
-  final m = RegExp(r'^(\d+(?:\.\d+)?)\s*([kmgtKMGT]?)[bB]?$').firstMatch(s);
-  if (m == null) return null;
-  final num = double.parse(m.group(1)!);
-  final unit = m.group(2)!.toUpperCase();
-  const mult = {'': 1, 'K': 1024, 'M': 1024 * 1024, 'G': 1024 * 1024 * 1024, 'T': 1024 * 1024 * 1024 * 1024};
-  return (num * mult[unit]!).toInt();
+/// PROPFIND の 1 エントリ分。圧縮保存 (.lnz) のファイルは論理名・展開後サイズ
+class _DavEntry {
+  final String name;
+  final String storedPath;
+  final bool isDir;
+  final int size;
+  final int mtimeMs;
+
+  const _DavEntry({
+    required this.name,
+    required this.storedPath,
+    required this.isDir,
+    required this.size,
+    required this.mtimeMs,
+  });
 }
 
+/// WebDAV PUT の本文が max-upload-size を超えた
+class _DavTooLarge implements Exception {}
+
 class _CliServer {
   // #227: clipboard 件数 / 文字長は config から指定可能 (デフォルト 1000 / 10000)
-  final int _maxClipboardItems;
-  final int _maxTextLength;
+  // config の再読み込みで差し替わる (applyRuntimeConfig)
+  int _maxClipboardItems;
+  int _maxTextLength;
+  // clipboard blob 1 件の上限 (バイト)。0 なら blob を受け付けない
+  int _maxBlobBytes;
   static const int _maxFailedAttempts = 5;
   static const Duration _lockoutDuration = Duration(minutes: 5);
 
@@ -1473,10 +3273,11 @@ class _CliServer {
   Directory? _thumbnailCacheDir;
   late final Uint8List _placeholderThumbBytes = _buildPlaceholderJpeg();
 
-  final List<_ClipboardItem> _clipboardItems = [];
+  final ClipboardStore _clipboardItems = ClipboardStore();
   int _clipboardLastModified = 0;
   // #228: 削除リングバッファ。?since= で「自分が見た時刻以降」の削除を返す。
   // bound あり (200)。これより古い削除があるとクライアントは full refresh。
+  // Web UI の差分用で、sync peer への伝搬は _clipSync の tombstone が受け持つ。
   static const int _maxDeletionLog = 200;
   final List<({String id, int deletedAtMs})> _clipboardDeletes = [];
 
@@ -1490,19 +3291,127 @@ class _CliServer {
     }
   }
 
+  /// ユーザ操作による削除。複製された item (replicaKey あり) なら自分の版番号で
+  /// tombstone を記録する。sync peer が無ければ伝える先が無いので積まない。
+  void _recordUserDeletion(String id, String? replicaKey) {
+    _recordDeletion(id);
+    if (replicaKey == null || !_hasSyncPeers) return;
+    _addClipTombstone(_clipOrigin, _clipSync.nextSeq(_clipOrigin), replicaKey);
+  }
+
+  // --- clipboard anti-entropy (sync: true の equally peer 間) ---
+  //
+  // VV と tombstone のログは lib/src/clip_sync.dart の ClipSyncLog が持つ。
+  // clipboard はメモリ上にしかないため、再起動時は origin を変えて seq の
+  // 再利用を避ける。
+  final ClipSyncLog _clipSync = ClipSyncLog();
+  static const int _maxClipSyncBatch = 500;
+
+  String get _clipOrigin => '$_deviceId@$_startedAt';
+
+  // origin/seq と tombstone は sync peer があるときだけ付ける。同期しない
+  // ノードで削除のたびに tombstone が上限まで溜まらないように
+  bool get _hasSyncPeers =>
+      _deviceId.isNotEmpty && _federationPeers.any((p) => p.sync);
+
+  Iterable<Map<String, int>?> get _syncPeerVvs =>
+      _federationPeers.where((p) => p.sync).map((p) => p.clipVv);
+
+  void _addClipTombstone(String origin, int seq, String key) =>
+      _clipSync.addTombstone(origin, seq, key);
+
+  void _trimClipTombstones() => _clipSync.trim(_syncPeerVvs);
+
+  bool _isSyncPeerOrigin(String? deviceId) =>
+      deviceId != null &&
+      deviceId.isNotEmpty &&
+      _federationPeers.any((p) => p.sync && p.learnedDeviceId == deviceId);
+
+  /// 複製 key が既に存在する (または削除済み) なら true
+  bool _hasReplica(String key) =>
+      _clipSync.isDeleted(key) ||
+      _clipboardItems.indexOfReplicaKey(key) >= 0;
+
+  /// createdAt の新しい順を保って挿入する。ローカル投稿は常に先頭。
+  void _insertClipboardItem(ClipboardEntry item) {
+    var i = 0;
+    final createdMs = item.createdAt.millisecondsSinceEpoch;
+    while (i < _clipboardItems.length &&
+        _clipboardItems.createdMsAt(i) > createdMs) {
+      i++;
+    }
+    _clipboardItems.insert(i, item);
+    _retainBlob(item);
+    while (_clipboardItems.length > _maxClipboardItems) {
+      final ev = _evictClipboardItem();
+      _recordDeletion(ev.id);
+    }
+    _clipboardLastModified = DateTime.now().millisecondsSinceEpoch;
+  }
+
   // #230: クリップボード件数超過時の退避。非 important から先に削る。
   // 全部 important なら最古の important を退避（ハードピンしない）。
   // 退避した item を返す。
-  _ClipboardItem _evictClipboardItem() {
+  ClipboardEntry _evictClipboardItem() {
     // list は新しい順 (insert(0, ...)) なので末尾が最古
     // 末尾から最初に見つかった非 important を取り除く
-    for (var i = _clipboardItems.length - 1; i >= 0; i--) {
-      if (!_clipboardItems[i].important) {
-        return _clipboardItems.removeAt(i);
-      }
+    var i = _clipboardItems.length - 1;
+    while (i >= 0 && _clipboardItems.importantAt(i)) {
+      i--;
     }
     // 全て important: 最古を退避
-    return _clipboardItems.removeLast();
+    final ev = _clipboardItems.removeAt(i >= 0 ? i : _clipboardItems.length - 1);
+    _releaseBlob(ev);
+    return ev;
+  }
+
+  // --- clipboard blob (貼り付け画像・長文) ---
+  //
+  // 本体は sha256 をキーに _clipBlobDir/<sha> へ 1 つだけ置き (同じ内容を何度
+  // 貼っても 1 ファイル)、_clipboardItems にはメタデータとプレビューだけを持つ。
+  // 本体はメモリに載せず、参照する item が無くなった時点で消す。
+  // clipboard と同じく再起動で消える (起動ごとの一時ディレクトリ)。
+  Directory? _clipBlobDir;
+  final Map<String, int> _clipBlobRefs = {};
+  static const int _blobPreviewChars = 500;
+  static final RegExp _blobShaRe = RegExp(r'^[0-9a-f]{64}$');
+
+  File _blobFile(String sha) => File(p.join(_clipBlobDir!.path, sha));
+
+  void _retainBlob(ClipboardEntry item) {
+    final b = item.blob;
+    if (b != null) _holdBlob(b.sha);
+  }
+
+  void _releaseBlob(ClipboardEntry item) {
+    final b = item.blob;
+    if (b != null) _unholdBlob(b.sha);
+  }
+
+  void _holdBlob(String sha) {
+    _clipBlobRefs[sha] = (_clipBlobRefs[sha] ?? 0) + 1;
+  }
+
+  /// 参照が 0 になったら本体とサムネイルを消す。受信中の同じ内容と
+  /// 順序が入れ替わらないよう同期で消す (unlink 1 回なので軽い)。
+  void _unholdBlob(String sha) {
+    final n = (_clipBlobRefs[sha] ?? 1) - 1;
+    if (n > 0) {
+      _clipBlobRefs[sha] = n;
+      return;
+    }
+    _clipBlobRefs.remove(sha);
+    final dir = _clipBlobDir;
+    if (dir == null) return;
+    for (final path in [
+      p.join(dir.path, sha),
+      if (_thumbnailCacheDir != null)
+        p.join(_thumbnailCacheDir!.path, 'blob-$sha.jpg'),
+    ]) {
+      try {
+        File(path).deleteSync();
+      } catch (_) {}
+    }
   }
 
   // #261: token → expiry epoch (ms)
@@ -1511,40 +3420,67 @@ class _CliServer {
   static const int _maxNoPinSessions = 1000;
   // #258: DNS rebinding 対策 — 許可する Host 値のセット
   Set<String> _allowedHosts = {};
+  InternetAddress? _bindAddress;
   // #6: HTTPS 起動時は Secure 属性を付与
   bool _httpsEnabled = false;
   final Map<String, int> _failedAttempts = {};
   final Map<String, DateTime> _lockoutUntil = {};
   String? _uploadToken;
+  // 名前付き API トークン: token 文字列 → クォータ・使用量
+  Map<String, _ApiToken> _apiTokens = {};
   List<({String pattern, String script})> _postActions = [];
+  int _postActionsRunning = 0;
   Map<String, ({String script, String? description})> _mentionActions = {};
   // #206
   int _pinLength = 4;
   String _pinCharset = 'digits';
   int? _maxDirectUploadBytes; // #262: 直接アップロードのサイズ上限 (null = 無制限)
+  // 保存時圧縮の対象 glob とフレームサイズ。.lnz のシークテーブルはパスごとに
+  // (サイズ, mtime) をキーにキャッシュする
+  List<String> _compressPatterns = [];
+  int _compressFrameBytes = SeekableCompressedWriter.defaultFrameBytes;
+  final Map<String, ({int size, int mtimeMs, SeekableCompressedFile index})>
+      _compressedIndexCache = {};
+  static const int _maxCompressedIndexCache = 128;
+  // 共有リンク (/s/<token>)。トークン自体に対象・期限・範囲を持たせ、
+  // 検証はサーバ側の状態を引かずに HMAC の再計算だけで済ませる。
+  final ShareTokenCodec _shareTokens;
+  static const Duration _shareDefaultTtl = Duration(hours: 24);
+  static const Duration _shareMaxTtl = Duration(days: 30);
 
   late final Router _router;
 
   String? get pin => _pin;
-  List<_ClipboardItem> get clipboardItems => List.unmodifiable(_clipboardItems);
+  ClipboardEntry? get latestClipboardItem =>
+      _clipboardItems.isEmpty ? null : _clipboardItems[0];
   int get clipboardLastModified => _clipboardLastModified;
 
   _CliServer({
     required this.verbose,
     int maxClipboardItems = 1000,
     int maxTextLength = 10000,
+    int maxBlobBytes = 32 * 1024 * 1024,
     String? deviceId,
+    List<int>? shareSecret,
   })  : _maxClipboardItems = maxClipboardItems,
         _maxTextLength = maxTextLength,
-        _deviceId = deviceId ?? '' {
+        _maxBlobBytes = maxBlobBytes,
+        _deviceId = deviceId ?? '',
+        _shareTokens = ShareTokenCodec(shareSecret ?? _randomShareSecret()) {
     _router = Router()
       ..post('/api/auth', _authHandler)
       ..get('/api/health', _healthHandler)
       ..get('/api/info', _infoHandler)
       ..get('/api/check-auth', _checkAuthHandler)
+      // 帯域・RTT 計測 (Web UI の転送パラメータ自動調整用)
+      ..get('/api/probe', _probeDownloadHandler)
+      ..post('/api/probe', _probeUploadHandler)
       ..get('/api/files', _getFilesHandler)
       ..post('/api/upload', _uploadHandler)
       ..get('/api/download/<id>', _downloadHandler)
+      // 署名付き共有リンク。セッション不要 (_authMiddleware は api/ 以外を通す)
+      ..post('/api/share', _createShareLinkHandler)
+      ..get('/s/<token>', _shareLinkHandler)
       ..get('/api/thumbnail/<id>', _thumbnailHandler)
       ..get('/api/thumbnail-by-path', _thumbnailByPathHandler)
       ..get('/api/text-preview/<id>', _textPreviewHandler)
@@ -1555,22 +3491,614 @@ class _CliServer {
       ..get('/api/mentions', _mentionsHandler)  // #225
       ..get('/api/run/<alias>', _runActionHandler)  // #220 @run_to result
       ..post('/api/clipboard', _postClipboardHandler)
+      ..post('/api/clipboard/blob', _postClipboardBlobHandler)
+      ..get('/api/clipboard/blob/<sha>', _getClipboardBlobHandler)
+      ..get('/api/clipboard/blob/<sha>/thumbnail', _clipboardBlobThumbnailHandler)
       ..delete('/api/clipboard/<id>', _deleteClipboardItemHandler)
       ..delete('/api/clipboard', _clearClipboardHandler)
       // #222: federation 状態（peer 一覧と接続状態）
       ..get('/api/federation/status', _federationStatusHandler)
+      // 名前付き API トークンごとの使用量 (トークン値は含めない)
+      ..get('/api/tokens/usage', _apiTokenUsageHandler)
+      // イベントループの遅れと詰まりの記録
+      ..get('/api/debug/event-loop', _eventLoopHandler)
+      // サブシステムごとのメモリ計上と VM ヒープ / GC
+      ..get('/api/debug/memory', _memoryHandler)
+      // N 秒間の CPU プロファイル (.cpuprofile)。サーバ token でも可
+      ..post('/api/debug/profile', _profileHandler)
+      // ライブ性能ダッシュボードの時系列 (秒 / 分のリング)
+      ..get('/api/debug/perf', _perfHandler)
+      // `localnode-cli top` 用のバイナリ統計 (ループバックのみ)
+      ..get('/api/debug/stats', _statsHandler)
+      ..post('/api/federation/clip-sync', _clipSyncHandler)
+      ..get('/api/federation/replica/tree', _replicaTreeHandler)
+      ..get('/api/federation/replica/file', _replicaFileHandler)
       ..post('/api/federation/peers/<name>/pause', _federationPausePeerHandler)  // #223
       ..delete('/api/federation/peers/<name>/pause', _federationResumePeerHandler)  // #223
       ..delete('/api/cache/thumbnails', _clearThumbnailCacheHandler);  // #272
   }
 
+  // --- 監視フォルダ取り込み ---
+  //
+  // /api/upload を通らずに共有フォルダへ置かれたファイル (カメラ / SMB /
+  // ローカルスクリプト) を Directory.watch (Linux では inotify) で検知し、
+  // アップロードと同じく post-action と親への転送を行う。
+  // inotify の close_write は dart:io から見えないため、最後のイベントから
+  // settle 時間更新が無いことを書き込み完了とみなす。
+  // 取り込み済みファイルは (サイズ, mtime) を状態ファイルに記録し、再起動を
+  // 挟んでも二重に転送しない。初回起動時は既存ファイルを取り込み済みとして
+  // 記録するだけで転送しない。
+
+  StreamSubscription<FileSystemEvent>? _watchSub;
+  final Map<String, Timer> _watchPending = {};
+  final Map<String, ({int size, int mtimeMs})> _watchSeen = {};
+  final Set<String> _uploadsInFlight = {};
+  String? _watchStatePath;
+  String? _watchRoot; // 正規化済みの共有ルート (アップロード側のパスと揃える)
+  Timer? _watchSaveTimer;
+  Duration _watchSettle = const Duration(seconds: 2);
+
+  Future<void> startWatchFolder({
+    required String statePath,
+    Duration settle = const Duration(seconds: 2),
+  }) async {
+    if (!FileSystemEntity.isWatchSupported) {
+      stderr.writeln('Warning: file watching is not supported on this platform; --watch ignored.');
+      return;
+    }
+    _watchSettle = settle;
+    final root = await Directory(_storagePath!).resolveSymbolicLinks();
+    _watchRoot = root;
+    // 共有フォルダごとに別の状態ファイル (state.json と同じディレクトリ)
+    final dirKey = crypto.sha256
+        .convert(utf8.encode(root))
+        .toString()
+        .substring(0, 12);
+    _watchStatePath = p.join(p.dirname(statePath), 'watch-$dirKey.json');
+    final stateFile = File(_watchStatePath!);
+    final firstRun = !await stateFile.exists();
+    if (!firstRun) {
+      try {
+        final dec = json.decode(await stateFile.readAsString());
+        final files = dec is Map ? dec['files'] : null;
+        if (files is Map) {
+          files.forEach((k, v) {
+            if (k is String && v is List && v.length == 2) {
+              _watchSeen[k] = (size: v[0] as int, mtimeMs: v[1] as int);
+            }
+          });
+        }
+      } catch (_) {
+        // 壊れていたら空から (既存ファイルは下の走査で取り込み直し)
+      }
+    }
+
+    // 停止中に置かれたファイルを拾う。消えたファイルの記録は捨てる
+    final present = <String>{};
+    await for (final e
+        in Directory(_watchRoot!).list(recursive: true, followLinks: false)) {
+      if (e is! File || _watchIgnored(e.path)) continue;
+      final rel = p.relative(e.path, from: _watchRoot!);
+      present.add(rel);
+      if (firstRun) {
+        final st = await e.stat();
+        _watchSeen[rel] =
+            (size: st.size, mtimeMs: st.modified.millisecondsSinceEpoch);
+      } else {
+        _scheduleWatched(e.path);
+      }
+    }
+    _watchSeen.removeWhere((rel, _) => !present.contains(rel));
+    _saveWatchStateSoon();
+
+    _watchSub = Directory(_watchRoot!).watch(recursive: true).listen(
+      (event) {
+        if (event.isDirectory) return;
+        if (event is FileSystemMoveEvent) {
+          _forgetWatched(event.path);
+          final dest = event.destination;
+          if (dest != null) _scheduleWatched(dest);
+        } else if (event is FileSystemDeleteEvent) {
+          _forgetWatched(event.path);
+        } else {
+          _scheduleWatched(event.path);
+        }
+      },
+      onError: (Object e) => stderr.writeln('Warning: folder watch error: $e'),
+    );
+    _log('[watch] watching $_watchRoot (settle ${settle.inMilliseconds}ms)');
+  }
+
+  Future<void> _stopWatchFolder() async {
+    await _watchSub?.cancel();
+    _watchSub = null;
+    for (final t in _watchPending.values) {
+      t.cancel();
+    }
+    _watchPending.clear();
+    if (_watchSaveTimer?.isActive ?? false) {
+      _watchSaveTimer!.cancel();
+      await _saveWatchState();
+    }
+  }
+
+  // 隠しファイルや、ブラウザ・転送ツールの書きかけファイルは取り込まない
+  bool _watchIgnored(String path) {
+    final rel = p.relative(path, from: _watchRoot!);
+    if (p.split(rel).any((seg) => seg.startsWith('.'))) return true;
+    final name = p.basename(path).toLowerCase();
+    return name.endsWith('.part') ||
+        name.endsWith('.partial') ||
+        name.endsWith('.crdownload') ||
+        name.endsWith('.tmp') ||
+        name.endsWith('~');
+  }
+
+  void _scheduleWatched(String path) {
+    if (_watchIgnored(path)) return;
+    _watchPending.remove(path)?.cancel();
+    _watchPending[path] = Timer(_watchSettle, () {
+      _watchPending.remove(path);
+      _ingestWatched(path);
+    });
+  }
+
+  void _forgetWatched(String path) {
+    _watchPending.remove(path)?.cancel();
+    if (_watchSeen.remove(p.relative(path, from: _watchRoot!)) != null) {
+      _saveWatchStateSoon();
+    }
+  }
+
+  Future<void> _ingestWatched(String path) async {
+    if (_uploadsInFlight.contains(path)) return;
+    final file = File(path);
+    final FileStat stat;
+    try {
+      stat = await file.stat();
+    } catch (_) {
+      return;
+    }
+    if (stat.type != FileSystemEntityType.file) return;
+    final rel = p.relative(path, from: _watchRoot!);
+    final mtimeMs = stat.modified.millisecondsSinceEpoch;
+    if (_watchSeen[rel] == (size: stat.size, mtimeMs: mtimeMs)) return;
+    // イベントを取りこぼしても、settle 内に更新されていればまだ書き込み中とみなす
+    if (DateTime.now().difference(stat.modified) < _watchSettle) {
+      _scheduleWatched(path);
+      return;
+    }
+    _watchSeen[rel] = (size: stat.size, mtimeMs: mtimeMs);
+    _saveWatchStateSoon();
+    _log('[watch] ingest $rel (${stat.size} bytes)');
+    if (_postActions.isNotEmpty) _runPostActions(path);
+    _forwardFileToParents(file, null);
+  }
+
+  /// /api/upload 経由で受け取ったファイルは既に処理済みなので記録だけする
+  Future<void> _markWatchIngested(File file) async {
+    if (_watchStatePath == null) return;
+    try {
+      final st = await file.stat();
+      _watchSeen[p.relative(file.path, from: _watchRoot!)] =
+          (size: st.size, mtimeMs: st.modified.millisecondsSinceEpoch);
+      _saveWatchStateSoon();
+    } catch (_) {}
+  }
+
+  void _saveWatchStateSoon() {
+    if (_watchStatePath == null || (_watchSaveTimer?.isActive ?? false)) return;
+    _watchSaveTimer = Timer(const Duration(seconds: 2), _saveWatchState);
+  }
+
+  Future<void> _saveWatchState() async {
+    final path = _watchStatePath;
+    if (path == null) return;
+    try {
+      final tmp = File('$path.tmp');
+      await tmp.parent.create(recursive: true);
+      await tmp.writeAsString(json.encode({
+        'version': 1,
+        'root': _storagePath,
+        'files': {
+          for (final e in _watchSeen.entries)
+            e.key: [e.value.size, e.value.mtimeMs],
+        },
+      }));
+      await tmp.rename(path);
+    } catch (e) {
+      stderr.writeln('Warning: could not save watch state to $path: $e');
+    }
+  }
+
+  // --- 双方向フォルダ複製 (replicate: <folder>) ---
+
+  final Map<String, _ReplicaSet> _replicaSets = {};
+  static const int _replicaParallel = 4;
+
+  /// replicate を持つ peer ごとに複製フォルダを用意し、状態を読み込んで走査する。
+  Future<void> startReplication({required String statePath}) async {
+    final storage = await Directory(_storagePath!).resolveSymbolicLinks();
+    for (final peer in _federationPeers) {
+      final folder = peer.replicate;
+      if (folder == null || _replicaSets.containsKey(folder)) continue;
+      final dir = Directory(p.normalize(p.join(storage, folder)));
+      await dir.create(recursive: true);
+      final root = await dir.resolveSymbolicLinks();
+      if (root == storage || !p.isWithin(storage, root)) {
+        stderr.writeln('Warning: replicate folder "$folder" is outside the shared folder; ignored.');
+        continue;
+      }
+      final dirKey =
+          crypto.sha256.convert(utf8.encode(root)).toString().substring(0, 12);
+      final set = _ReplicaSet(folder, root,
+          p.join(p.dirname(statePath), 'replica-$dirKey.json'), _deviceId);
+      await set.load();
+      await set.scan(busy: _uploadsInFlight, force: true);
+      _replicaSets[folder] = set;
+      _log('[replica] $folder: ${set.entries.length} entries');
+    }
+  }
+
+  /// 複製 API の呼び出し元が、その folder を複製する peer か確認する
+  _ReplicaSet? _replicaSetFor(Request req) {
+    final origin = req.headers[_kFedOrigin];
+    final folder = req.requestedUri.queryParameters['folder'];
+    if (origin == null || origin.isEmpty || folder == null) return null;
+    final ok = _federationPeers.any((p) =>
+        p.replicate == folder && p.learnedDeviceId == origin);
+    return ok ? _replicaSets[folder] : null;
+  }
+
+  /// 通信上のパスは '/' 区切り。'..' や絶対パスは拒否して null。
+  static String? _replicaLocalRel(String wire) {
+    if (wire.isEmpty) return '';
+    final segs = wire.split('/');
+    if (segs.any((s) => s.isEmpty || s == '.' || s == '..' || s.contains(r'\'))) {
+      return null;
+    }
+    return p.joinAll(segs);
+  }
+
+  /// GET /api/federation/replica/tree?folder=&path=<dir>
+  Future<Response> _replicaTreeHandler(Request req) async {
+    final set = _replicaSetFor(req);
+    if (set == null) return Response.forbidden('Not a replication peer.');
+    final dir = _replicaLocalRel(req.requestedUri.queryParameters['path'] ?? '');
+    if (dir == null) return Response.badRequest(body: 'Invalid path.');
+    await set.scan(busy: _uploadsInFlight);
+    return Response.ok(json.encode(set.tree(dir)),
+        headers: {'Content-Type': 'application/json'});
+  }
+
+  /// GET /api/federation/replica/file?folder=&path=<file>
+  /// 保存されている形 (.lnz ならそのまま) で返す。
+  Future<Response> _replicaFileHandler(Request req) async {
+    final set = _replicaSetFor(req);
+    if (set == null) return Response.forbidden('Not a replication peer.');
+    final rel = _replicaLocalRel(req.requestedUri.queryParameters['path'] ?? '');
+    if (rel == null || rel.isEmpty) return Response.badRequest(body: 'Invalid path.');
+    final entry = set.entries[rel];
+    final file = File(p.join(set.root, rel));
+    if (entry == null || entry.deleted || !await file.exists()) {
+      return Response.notFound('Not found.');
+    }
+    return Response.ok(file.openRead(), headers: {
+      'Content-Type': 'application/octet-stream',
+      'Content-Length': '${await file.length()}',
+      'x-replica-sha': entry.sha,
+    });
+  }
+
+  /// heartbeat で接続が確認できた peer と複製フォルダを揃える (相手から取るだけ)。
+  Future<void> _syncReplicaWith(_FederationPeer peer) async {
+    final set = _replicaSets[peer.replicate];
+    if (set == null || set.syncing || peer.isPaused()) return;
+    set.syncing = true;
+    try {
+      await set.scan(busy: _uploadsInFlight);
+      final actions = <Future<void> Function()>[];
+      await _walkReplica(peer, set, '', actions);
+      if (actions.isEmpty) {
+        if (set.dirty) {
+          set.dirty = false;
+          set.rebuildTree();
+          await set.save();
+        }
+        return;
+      }
+      _log('[replica] ${set.folder} <- ${peer.name}: ${actions.length} changes');
+      // 変更ファイルの転送は _replicaParallel 本まで並行
+      var next = 0;
+      Future<void> worker() async {
+        while (next < actions.length) {
+          final action = actions[next++];
+          try {
+            await action();
+          } catch (e) {
+            _log('[replica] ${set.folder} action failed: $e');
+          }
+        }
+      }
+
+      await Future.wait([
+        for (var i = 0; i < min(_replicaParallel, actions.length); i++) worker(),
+      ]);
+      set.dirty = false;
+      set.rebuildTree();
+      await set.save();
+    } catch (e) {
+      _log('[replica] ${set.folder} sync with ${peer.name} failed: $e');
+    } finally {
+      set.syncing = false;
+    }
+  }
+
+  Future<Map<String, dynamic>> _fetchReplicaTree(
+      _FederationPeer peer, _ReplicaSet set, String wireDir) async {
+    final uri = Uri.parse('${peer.url}/api/federation/replica/tree').replace(
+        queryParameters: {'folder': set.folder, 'path': wireDir});
+    final req = await _heartbeatClient!.getUrl(uri);
+    req.headers.set('Authorization', 'Bearer ${peer.token}');
+    req.headers.set(_kFedOrigin, _deviceId);
+    req.headers.set(_kFedSeenBy, _deviceId);
+    final res = await req.close().timeout(const Duration(seconds: 30));
+    final body = await res.transform(utf8.decoder).join();
+    if (res.statusCode != 200) {
+      throw HttpException('tree HTTP ${res.statusCode}', uri: uri);
+    }
+    return json.decode(body) as Map<String, dynamic>;
+  }
+
+  /// ハッシュが食い違うサブツリーだけを降りて、取り込むべき変更を集める。
+  Future<void> _walkReplica(_FederationPeer peer, _ReplicaSet set,
+      String wireDir, List<Future<void> Function()> actions) async {
+    final localDir = _replicaLocalRel(wireDir)!;
+    final remote = await _fetchReplicaTree(peer, set, wireDir);
+    if (remote['hash'] == set.dirHash(localDir)) return;
+    for (final e in (remote['entries'] as List? ?? const [])) {
+      if (e is! Map || e['name'] is! String) continue;
+      final name = e['name'] as String;
+      final wire = wireDir.isEmpty ? name : '$wireDir/$name';
+      final rel = _replicaLocalRel(wire);
+      if (rel == null || _ReplicaSet.ignored(rel)) continue;
+      if (e['type'] == 'dir') {
+        if (e['hash'] != set.dirHash(rel)) {
+          await _walkReplica(peer, set, wire, actions);
+        }
+        continue;
+      }
+      final theirs = ReplicaEntry.fromJson({...e, 'deleted': e['deleted'] == true});
+      if (theirs == null) continue;
+      final mine = set.entries[rel];
+      switch (ReplicaEntry.decide(mine, theirs)) {
+        case ReplicaMerge.same:
+        case ReplicaMerge.keep: // こちらが新しい。相手が取りに来る
+          break;
+        case ReplicaMerge.adopt:
+          actions.add(() => _adoptReplica(peer, set, rel, wire, theirs, mine));
+        case ReplicaMerge.converge:
+          // 別々に同じ内容になった: 版だけ合わせる
+          mine!.vv = ReplicaEntry.merge(mine.vv, theirs.vv);
+          mine.modifiedMs = max(mine.modifiedMs, theirs.modifiedMs);
+          set.dirty = true;
+        case ReplicaMerge.conflict:
+          actions.add(
+              () => _resolveReplicaConflict(peer, set, rel, wire, theirs, mine!));
+      }
+    }
+  }
+
+  /// ローカルのファイルが最後の走査から変わっていないか (変わっていたら触らない)
+  Future<bool> _replicaUnchanged(_ReplicaSet set, String rel, ReplicaEntry? mine) async {
+    final f = File(p.join(set.root, rel));
+    if (mine == null || mine.deleted) return !await f.exists();
+    try {
+      final st = await f.stat();
+      return st.type == FileSystemEntityType.file &&
+          st.size == mine.size &&
+          st.modified.millisecondsSinceEpoch == mine.localMtimeMs;
+    } catch (_) {
+      return false;
+    }
+  }
+
+  /// 相手の版をそのまま取り込む (ダウンロード or 削除)
+  Future<void> _adoptReplica(_FederationPeer peer, _ReplicaSet set, String rel,
+      String wire, ReplicaEntry theirs, ReplicaEntry? mine,
+      {Map<String, int>? vv}) async {
+    if (!await _replicaUnchanged(set, rel, mine)) return;
+    final file = File(p.join(set.root, rel));
+    if (theirs.deleted) {
+      if (await file.exists()) await file.delete();
+      set.entries[rel] = theirs
+        ..localMtimeMs = 0
+        ..vv = vv ?? theirs.vv;
+      _log('[replica] ${set.folder}/$wire deleted by ${peer.name}');
+      return;
+    }
+    final mtime = await _downloadReplicaFile(peer, set, wire, theirs.sha, file);
+    if (mtime == null) return;
+    set.entries[rel] = theirs
+      ..localMtimeMs = mtime
+      ..vv = vv ?? theirs.vv;
+    _log('[replica] ${set.folder}/$wire <- ${peer.name} (${theirs.size} bytes)');
+  }
+
+  /// 並行更新。(更新時刻, 内容ハッシュ) の大きい方を残し、負けた内容は
+  /// 衝突コピーに退避する。両ノードとも同じ結果になる。
+  Future<void> _resolveReplicaConflict(_FederationPeer peer, _ReplicaSet set,
+      String rel, String wire, ReplicaEntry theirs, ReplicaEntry mine) async {
+    if (!await _replicaUnchanged(set, rel, mine)) return;
+    final merged = ReplicaEntry.merge(mine.vv, theirs.vv);
+    final remoteWins = ReplicaEntry.remoteWins(mine, theirs);
+    final loser = remoteWins ? mine : theirs;
+    String? copyRel;
+    if (!loser.deleted) {
+      copyRel = ReplicaEntry.conflictPath(rel, loser.sha);
+      final copy = File(p.join(set.root, copyRel));
+      if (await copy.exists()) {
+        copyRel = null; // 既に退避済み
+      } else if (remoteWins) {
+        await File(p.join(set.root, rel)).rename(copy.path);
+        final st = await copy.stat();
+        set.entries[copyRel] = ReplicaEntry(
+          sha: mine.sha,
+          size: mine.size,
+          localMtimeMs: st.modified.millisecondsSinceEpoch,
+          modifiedMs: mine.modifiedMs,
+          vv: Map.of(mine.vv),
+        );
+        await _markWatchIngested(copy);
+      } else {
+        final mtime =
+            await _downloadReplicaFile(peer, set, wire, theirs.sha, copy);
+        if (mtime == null) return;
+        set.entries[copyRel] = ReplicaEntry(
+          sha: theirs.sha,
+          size: theirs.size,
+          localMtimeMs: mtime,
+          modifiedMs: theirs.modifiedMs,
+          vv: Map.of(theirs.vv),
+        );
+      }
+    }
+    _log('[replica] ${set.folder}/$wire conflict with ${peer.name}: '
+        '${remoteWins ? 'remote' : 'local'} wins'
+        '${copyRel != null ? ', loser kept as $copyRel' : ''}');
+    if (remoteWins) {
+      // 退避済みなので、ローカルは「無い」状態から取り込む
+      final gone = mine.deleted || copyRel != null ? null : mine;
+      await _adoptReplica(peer, set, rel, wire, theirs, gone, vv: merged);
+    } else {
+      mine.vv = merged;
+    }
+  }
+
+  /// 一時ファイルに受けて sha256 を確認してから置き換える。成功時は mtime を返す。
+  Future<int?> _downloadReplicaFile(_FederationPeer peer, _ReplicaSet set,
+      String wire, String sha, File dest) async {
+    final uri = Uri.parse('${peer.url}/api/federation/replica/file').replace(
+        queryParameters: {'folder': set.folder, 'path': wire});
+    await dest.parent.create(recursive: true);
+    final tmp = File(p.join(dest.parent.path, '.lnrepl-${_generateId()}.part'));
+    try {
+      final req = await _heartbeatClient!.getUrl(uri);
+      req.headers.set('Authorization', 'Bearer ${peer.token}');
+      req.headers.set(_kFedOrigin, _deviceId);
+      req.headers.set(_kFedSeenBy, _deviceId);
+      final res = await req.close().timeout(const Duration(seconds: 30));
+      if (res.statusCode != 200) {
+        await res.drain();
+        _log('[replica] ${set.folder}/$wire HTTP ${res.statusCode}');
+        return null;
+      }
+      await res.pipe(tmp.openWrite());
+      if (await _ReplicaSet.hashFile(tmp) != sha) {
+        // 相手側で取得中に更新された。次の同期で取り直す
+        _log('[replica] ${set.folder}/$wire changed during transfer');
+        await tmp.delete();
+        return null;
+      }
+      await tmp.rename(dest.path);
+      await _markWatchIngested(dest);
+      return (await dest.stat()).modified.millisecondsSinceEpoch;
+    } catch (e) {
+      _log('[replica] ${set.folder}/$wire download failed: $e');
+      try {
+        await tmp.delete();
+      } catch (_) {}
+      return null;
+    }
+  }
+
   /// #222: federation peer を起動前に登録する
   void registerFederationPeer(_FederationPeer peer) {
     _federationPeers.add(peer);
   }
 
+  /// config 再読み込みの適用。検証済みの設定を 1 回の同期処理で差し替えるので、
+  /// 処理中のリクエストからは新旧どちらか一方の設定しか見えない。
+  /// clipboard・セッション・サムネイル等のキャッシュはそのまま。peer は定義が
+  /// 変わっていなければ同じオブジェクトを残し、学習済みの deviceId・状態・
+  /// @list キャッシュを引き継ぐ。変わった項目名の一覧を返す。
+  Future<List<String>> applyRuntimeConfig(_RuntimeConfig rc,
+      {required String statePath}) async {
+    final changes = <String>[];
+    if (json.encode(rc.postActions.map((a) => [a.pattern, a.script]).toList()) !=
+        json.encode(_postActions.map((a) => [a.pattern, a.script]).toList())) {
+      changes.add('post_actions');
+    }
+    String mentionsKey(Map<String, ({String script, String? description})> m) =>
+        json.encode([
+          for (final e in m.entries) [e.key, e.value.script, e.value.description]
+        ]);
+    if (mentionsKey(rc.mentionActions) != mentionsKey(_mentionActions)) {
+      changes.add('mention_actions');
+    }
+    if (rc.maxClipboardItems != _maxClipboardItems ||
+        rc.maxTextLength != _maxTextLength ||
+        rc.maxBlobBytes != _maxBlobBytes) {
+      changes.add('clipboard');
+    }
+    final current = {
+      for (final peer in _federationPeers) '${peer.kind}/${peer.name}': peer
+    };
+    final nextPeers = [
+      for (final peer in rc.peers)
+        current['${peer.kind}/${peer.name}']?.sameConfigAs(peer) == true
+            ? current['${peer.kind}/${peer.name}']!
+            : peer
+    ];
+    final peersChanged = nextPeers.length != _federationPeers.length ||
+        nextPeers.any((peer) => !_federationPeers.contains(peer));
+    if (peersChanged) changes.add('federation');
+
+    // --- ここから await なしで差し替える ---
+    _postActions = rc.postActions;
+    _mentionActions = rc.mentionActions;
+    _maxClipboardItems = rc.maxClipboardItems;
+    _maxTextLength = rc.maxTextLength;
+    _maxBlobBytes = rc.maxBlobBytes;
+    if (_clipboardItems.length > _maxClipboardItems) {
+      while (_clipboardItems.length > _maxClipboardItems) {
+        final ev = _evictClipboardItem();
+        _recordDeletion(ev.id);
+      }
+      _clipboardLastModified = DateTime.now().millisecondsSinceEpoch;
+    }
+    _federationPeers
+      ..clear()
+      ..addAll(nextPeers);
+    _mentionsVersionCache = null;
+    // --- ここまで ---
+
+    if (peersChanged && _federationPeers.isNotEmpty) {
+      // 新しい replicate フォルダだけ用意する (既存の複製状態はそのまま)
+      await startReplication(statePath: statePath);
+      if (_heartbeatTimer == null) _startHeartbeat();
+    }
+    return changes;
+  }
+
   // #225: mobile mention picker — structured form of `@list` content
   Response _mentionsHandler(Request _) {
+    return Response.ok(
+      json.encode({'items': _mentionItems(), 'version': _mentionsVersion}),
+      headers: {'Content-Type': 'application/json'},
+    );
+  }
+
+  /// mention 一覧の版。heartbeat で親に伝え、親側の @list キャッシュを無効化する。
+  /// 一覧は mention_actions と federation 設定だけで決まるので、config の
+  /// 再読み込みで捨てて作り直す。
+  String? _mentionsVersionCache;
+  String get _mentionsVersion => _mentionsVersionCache ??= crypto.sha256
+      .convert(utf8.encode(json.encode(_mentionItems())))
+      .toString()
+      .substring(0, 16);
+
+  List<Map<String, dynamic>> _mentionItems() {
     final items = <Map<String, dynamic>>[
       {
         'label': '@list',
@@ -1583,7 +4111,7 @@ class _CliServer {
     final hasParent = _federationPeers.any((p) => p.kind == 'parent');
     if (hasChildren) {
       items.add({
-        'label': '@list <child>',
+        'label': '@list <child|all>',
         'insert': '@list ',
         'description': "fetch a child's mention list",
       });
@@ -1612,10 +4140,7 @@ class _CliServer {
         'description': e.value.description,
       });
     }
-    return Response.ok(
-      json.encode({'items': items}),
-      headers: {'Content-Type': 'application/json'},
-    );
+    return items;
   }
 
   /// #220 @run_to: child 側でエイリアスを実行して結果を返す
@@ -1664,6 +4189,13 @@ class _CliServer {
         headers: {'Content-Type': 'application/json'},
       );
 
+  Response _apiTokenUsageHandler(Request _) => Response.ok(
+        json.encode({
+          'tokens': _apiTokens.values.map((t) => t.toJson()).toList(),
+        }),
+        headers: {'Content-Type': 'application/json', 'Cache-Control': 'no-store'},
+      );
+
   // #223: peer pause / resume
   Response _federationPausePeerHandler(Request req, String name) {
     final peer = _federationPeers.firstWhereOrNullExt((p) => p.name == name);
@@ -1699,10 +4231,21 @@ class _CliServer {
     );
   }
 
+  /// peer 宛ての HTTP クライアント。環境変数 LOCALNODE_FED_CA に PEM を指定すると
+  /// システムの CA に加えてそれも信頼する (tool/federation_bench.dart の自己署名 CA 用)。
+  static HttpClient _newFederationClient() {
+    final ca = Platform.environment['LOCALNODE_FED_CA'];
+    final ctx = (ca != null && ca.isNotEmpty)
+        ? (SecurityContext(withTrustedRoots: true)..setTrustedCertificates(ca))
+        : null;
+    return HttpClient(context: ctx)
+      ..connectionTimeout = const Duration(seconds: 10);
+  }
+
   /// #222: 全 peer に GET /api/health を投げて状態を更新
   Future<void> _heartbeatTick() async {
     if (_federationPeers.isEmpty) return;
-    _heartbeatClient ??= HttpClient()..connectionTimeout = const Duration(seconds: 10);
+    _heartbeatClient ??= _newFederationClient();
     for (final peer in _federationPeers) {
       // pause 中は heartbeat だけ続ける（生死表示用）
       try {
@@ -1720,15 +4263,38 @@ class _CliServer {
         if (res.statusCode >= 200 && res.statusCode < 300) {
           peer.lastOkMs = DateTime.now().millisecondsSinceEpoch;
           // レスポンスボディから相手の relation 設定を学習する
+          Map? peerVv;
           try {
             final body = await res.transform(utf8.decoder).join();
             final dec = json.decode(body);
             if (dec is Map && dec['relation'] is String) {
               peer.learnedRelation = dec['relation'] as String;
             }
+            if (dec is Map && dec['clipVv'] is Map) {
+              peerVv = dec['clipVv'] as Map;
+            }
+            if (dec is Map && dec['mentionsVersion'] is String) {
+              // 版が変わったら次の @list で取り直す
+              peer.mentionsVersion = dec['mentionsVersion'] as String;
+            }
           } catch (_) {
             await res.drain();
           }
+          if (peerVv != null && peer.sync) {
+            peer.clipVv = {
+              for (final e in peerVv.entries)
+                if (e.key is String && e.value is int)
+                  e.key as String: e.value as int,
+            };
+            _trimClipTombstones();
+          }
+          if (peerVv != null &&
+              peer.sync &&
+              peer.relation == 'equally' &&
+              peer.learnedRelation == peer.relation &&
+              !peer.isPaused()) {
+            await _pullClipboardFrom(peer, peerVv);
+          }
           // relation 不一致なら専用ステータスに設定
           if (peer.learnedRelation != null &&
               peer.learnedRelation != peer.relation) {
@@ -1739,6 +4305,10 @@ class _CliServer {
             peer.status = 'connected';
           }
           peer.lastError = null;
+          if (peer.replicate != null && peer.status == 'connected') {
+            // 転送に時間がかかるので heartbeat は待たない
+            _syncReplicaWith(peer);
+          }
         } else {
           await res.drain();
           peer.status = peer.isPaused() ? 'paused' : 'offline';
@@ -1772,6 +4342,248 @@ class _CliServer {
     }
   }
 
+  /// 相手の VV と自分の VV を比べ、欠けている区間だけを取りに行く。
+  Future<void> _pullClipboardFrom(_FederationPeer peer, Map peerVv) async {
+    final ranges = _clipSync.missingFrom(peerVv);
+    if (ranges.isEmpty) return;
+    try {
+      final dec = await _postClipSync(peer, {'ranges': ranges});
+      if (dec == null) return;
+      final applied = _applyClipSync(dec);
+      _log('[fed] clip-sync ${peer.name} items=${applied.items} '
+          'deletes=${applied.deletes}');
+      // 相手が tombstone を捨て済みの区間は差分では埋まらない。
+      // その origin は相手の持つ key 集合と突き合わせる
+      final resync = dec['resync'];
+      if (resync is! List || resync.isEmpty) return;
+      final rec = await _postClipSync(peer, {
+        'reconcile': {
+          for (final o in resync)
+            if (o is String) o: _clipSync.vv[o] ?? 0,
+        },
+      });
+      if (rec == null) return;
+      final r = _applyClipSync(rec);
+      _log('[fed] clip-sync ${peer.name} reconcile origins=${resync.length} '
+          'items=${r.items} deletes=${r.deletes}');
+    } catch (e) {
+      _log('[fed] clip-sync ${peer.name} fail: $e');
+    }
+  }
+
+  Future<Map?> _postClipSync(_FederationPeer peer, Map body) async {
+    final uri = Uri.parse('${peer.url}/api/federation/clip-sync');
+    final req = await _heartbeatClient!.postUrl(uri);
+    req.headers.set('Content-Type', 'application/json');
+    req.headers.set('Authorization', 'Bearer ${peer.token}');
+    req.headers.set(_kFedOrigin, _deviceId);
+    req.headers.set(_kFedSeenBy, _deviceId);
+    req.add(utf8.encode(json.encode(body)));
+    final res = await req.close().timeout(const Duration(seconds: 15));
+    if (res.statusCode != 200) {
+      await res.drain();
+      _log('[fed] clip-sync ${peer.name} HTTP ${res.statusCode}');
+      return null;
+    }
+    final dec = json.decode(await res.transform(utf8.decoder).join());
+    return dec is Map ? dec : null;
+  }
+
+  /// clip-sync 応答を取り込み、VV を進める。tombstone を先に適用するので、
+  /// 同じ応答内で削除済みの item は積まれない。
+  ///
+  /// reconcile の応答は keys / known を持つ。known[origin] までの seq で
+  /// 相手が持っていない item は、相手側で削除 (または退避) されたものとして消す。
+  ({int items, int deletes}) _applyClipSync(Map dec) {
+    var nItems = 0;
+    var nDeletes = 0;
+    final keys = dec['keys'], known = dec['known'];
+    if (keys is Map && known is Map) {
+      keys.forEach((o, seqs) {
+        final upTo = known[o];
+        if (o is! String || seqs is! List || upTo is! int) return;
+        final have = seqs.whereType<int>().toSet();
+        for (var i = _clipboardItems.length - 1; i >= 0; i--) {
+          if (_clipboardItems.originAt(i) != o ||
+              !ClipSyncLog.droppedByPeer(_clipboardItems.seqAt(i), upTo, have)) {
+            continue;
+          }
+          final removed = _clipboardItems.removeAt(i);
+          _releaseBlob(removed);
+          _recordDeletion(removed.id);
+          nDeletes++;
+        }
+      });
+    }
+    for (final d in (dec['deletes'] as List? ?? const [])) {
+      if (d is! Map) continue;
+      final o = d['origin'], q = d['seq'], key = d['key'];
+      if (o is! String || q is! int || key is! String) continue;
+      // VV 以下の版は取り込み済み
+      if (!_clipSync.isNew(o, q)) continue;
+      final idx = _clipboardItems.indexOfReplicaKey(key);
+      if (idx >= 0) {
+        final removed = _clipboardItems.removeAt(idx);
+        _releaseBlob(removed);
+        _recordDeletion(removed.id);
+      }
+      // 受け取った tombstone は自分のログにも積み、他の sync peer へ伝搬させる
+      _addClipTombstone(o, q, key);
+      nDeletes++;
+    }
+    final now = DateTime.now().millisecondsSinceEpoch;
+    final incoming = <ClipboardEntry>[];
+    for (final j in (dec['items'] as List? ?? const [])) {
+      if (j is! Map) continue;
+      final o = j['origin'], q = j['seq'], text = j['text'];
+      if (o is! String || q is! int || text is! String) continue;
+      if (text.isEmpty || text.length > _maxTextLength) continue;
+      if (_hasReplica('$o:$q')) continue;
+      final id = j['id'];
+      final tag = j['tag'];
+      incoming.add(ClipboardEntry(
+        id: id is String && id.isNotEmpty ? id : _generateId(),
+        text: text,
+        tag: tag is String ? tag : null,
+        createdAt: DateTime.tryParse('${j['createdAt']}')?.toLocal() ??
+            DateTime.fromMillisecondsSinceEpoch(now),
+        important: j['important'] == true,
+        origin: o,
+        seq: q,
+        receivedAtMs: now,
+      ));
+    }
+    // 古い順に入れると evict が新しいものを先に落とさない
+    incoming.sort((a, b) => a.createdAt.compareTo(b.createdAt));
+    for (final item in incoming) {
+      _insertClipboardItem(item);
+      nItems++;
+    }
+    final through = dec['through'];
+    if (through is Map) _clipSync.advance(through);
+    if (nDeletes > 0) {
+      _clipboardLastModified = DateTime.now().millisecondsSinceEpoch;
+    }
+    return (items: nItems, deletes: nDeletes);
+  }
+
+  /// POST /api/federation/clip-sync {ranges: {origin: [from, to]}}
+  /// (from, to] に含まれる item と tombstone を返す。件数上限で打ち切った
+  /// origin は through を途中までにし、残りは次の heartbeat で取らせる。
+  /// 退避された item の seq は欠番として扱い、through はそのまま進める。
+  /// from が捨てた tombstone より手前なら、返せない
+  /// 削除があるのでその origin は resync に入れ、through を進めない。
+  ///
+  /// {reconcile: {origin: from}} では、その origin の item の seq 一覧 (keys) と
+  /// 自分の VV (known)、seq > from の item を返す。
+  Future<Response> _clipSyncHandler(Request req) async {
+    if (!_isSyncPeerOrigin(req.headers[_kFedOrigin])) {
+      return Response.forbidden(
+        json.encode({'error': 'Not a sync peer.'}),
+        headers: {'Content-Type': 'application/json'},
+      );
+    }
+    final Map? ranges;
+    final Map? reconcile;
+    try {
+      final dec = json.decode(await _readBodyString(req)) as Map;
+      ranges = dec['ranges'] as Map?;
+      reconcile = dec['reconcile'] as Map?;
+    } catch (_) {
+      return Response.badRequest(body: 'Invalid request body.');
+    }
+    if (reconcile != null) {
+      return Response.ok(json.encode(_clipReconcile(reconcile)),
+          headers: {'Content-Type': 'application/json'});
+    }
+    if (ranges == null) return Response.badRequest(body: 'Invalid request body.');
+    final (:want, :resync) = _clipSync.plan(ranges);
+    // origin ごとに seq 昇順のイベント列を作る。item は列だけで選び、返すものだけ読み出す
+    final events = <String, List<({int seq, int row, ClipTombstone? del})>>{};
+    for (var i = 0; i < _clipboardItems.length; i++) {
+      final o = _clipboardItems.originAt(i);
+      final w = o == null ? null : want[o];
+      if (w == null) continue;
+      final q = _clipboardItems.seqAt(i);
+      if (q <= w.from || q > w.upTo) continue;
+      (events[o!] ??= []).add((seq: q, row: i, del: null));
+    }
+    for (final t in _clipSync.tombstones) {
+      final w = want[t.origin];
+      if (w == null || t.seq <= w.from || t.seq > w.upTo) continue;
+      (events[t.origin] ??= []).add((seq: t.seq, row: -1, del: t));
+    }
+    for (final list in events.values) {
+      list.sort((a, b) => a.seq.compareTo(b.seq));
+    }
+    final items = <Map<String, dynamic>>[];
+    final deletes = <Map<String, dynamic>>[];
+    final through = <String, int>{};
+    final cut = ClipSyncLog.cut(
+        want,
+        {for (final e in events.entries) e.key: [for (final x in e.value) x.seq]},
+        _maxClipSyncBatch);
+    cut.forEach((o, c) {
+      for (final e in events[o]?.take(c.take) ?? const <Never>[]) {
+        if (e.del case final t?) {
+          deletes.add({'origin': t.origin, 'seq': t.seq, 'key': t.key});
+        } else {
+          items.add(_clipboardItems[e.row].toReplicaJson());
+        }
+      }
+      through[o] = c.through;
+    });
+    return Response.ok(
+      json.encode({
+        'items': items,
+        'deletes': deletes,
+        'through': through,
+        if (resync.isNotEmpty) 'resync': resync,
+      }),
+      headers: {'Content-Type': 'application/json'},
+    );
+  }
+
+  /// clip-sync の reconcile。keys は全件、item は seq > from を件数上限まで返す
+  Map<String, dynamic> _clipReconcile(Map reconcile) {
+    final keys = <String, List<int>>{};
+    final rows = <String, List<int>>{};
+    for (var i = 0; i < _clipboardItems.length; i++) {
+      final o = _clipboardItems.originAt(i);
+      final from = o == null ? null : reconcile[o];
+      if (from is! int) continue;
+      final q = _clipboardItems.seqAt(i);
+      (keys[o!] ??= []).add(q);
+      if (q > from) (rows[o] ??= []).add(i);
+    }
+    final want = <String, ClipRange>{};
+    final known = <String, int>{};
+    reconcile.forEach((o, from) {
+      if (o is! String || from is! int) return;
+      known[o] = _clipSync.vv[o] ?? 0;
+      keys[o] ??= [];
+      want[o] = (from: from, upTo: known[o]!);
+      rows[o]?.sort((a, b) =>
+          _clipboardItems.seqAt(a).compareTo(_clipboardItems.seqAt(b)));
+    });
+    final items = <Map<String, dynamic>>[];
+    final through = <String, int>{};
+    final cut = ClipSyncLog.cut(
+        want,
+        {
+          for (final e in rows.entries)
+            e.key: [for (final i in e.value) _clipboardItems.seqAt(i)],
+        },
+        _maxClipSyncBatch);
+    cut.forEach((o, c) {
+      for (final i in rows[o]?.take(c.take) ?? const <int>[]) {
+        items.add(_clipboardItems[i].toReplicaJson());
+      }
+      through[o] = c.through;
+    });
+    return {'items': items, 'keys': keys, 'known': known, 'through': through};
+  }
+
   // #243: 起動直後だけバックオフを詰めて、Tailscale 等で初回 dial が
   //       冷えていてもユーザを 45 秒待たせない。一巡したら通常の 45 秒周期へ。
   static const List<int> _warmupDelaysSec = [5, 10, 20, 30, 45];
@@ -1814,6 +4626,9 @@ class _CliServer {
   // ---------------------------------------------------------------------------
 
   static const String _kFedEvent = 'x-fed-event';
+  // sync peer へのライブ転送で item の複製 key を伝える
+  static const String _kClipOrigin = 'x-clip-origin';
+  static const String _kClipSeq = 'x-clip-seq';
 
   bool _isUpItem(String text) => text.trimLeft().startsWith('@up ');
 
@@ -1824,7 +4639,7 @@ class _CliServer {
   /// - 受信時に federation 由来 (seen_by あり) なら再転送しない
   /// - peer.kind=='parent' のみ
   /// - relation=='equally' は `@up` 付きだけ転送
-  void _forwardClipboardToParents(_ClipboardItem item, Request originReq) {
+  void _forwardClipboardToParents(ClipboardEntry item, Request originReq) {
     if (_comesFromFederation(originReq)) return;
     if (_deviceId.isEmpty) return;
     if (_federationPeers.isEmpty) return;
@@ -1834,11 +4649,14 @@ class _CliServer {
       if (peer.kind != 'parent') continue;
       if (peer.relation == 'equally' && !isUp) continue;
       // fire-and-forget
+      _perf.fedQueued(1);
       () async {
         try {
           await _sendClipboardToPeer(peer, item, isUp);
         } catch (e) {
           _log('[fed] forward-clip ${peer.name} unexpected: $e');
+        } finally {
+          _perf.fedQueued(-1);
         }
       }();
     }
@@ -1847,19 +4665,24 @@ class _CliServer {
   /// 子→親の file upload 転送 (fire-and-forget)
   /// - friendly: 実ファイルを送信。成功 + trust なら local 削除
   /// - equally: 「@up file uploaded: <name>」を clipboard 通知のみ
-  void _forwardFileToParents(File file, Request originReq) {
-    if (_comesFromFederation(originReq)) return;
+  /// originReq が null のときは監視フォルダから取り込んだファイル。
+  /// alreadySent は tee で送信済みの親 (再送しない)。
+  void _forwardFileToParents(File file, Request? originReq,
+      {Set<_FederationPeer> alreadySent = const {}}) {
+    if (originReq != null && _comesFromFederation(originReq)) return;
     if (_deviceId.isEmpty) return;
     if (_federationPeers.isEmpty) return;
 
     for (final peer in _federationPeers) {
       if (peer.kind != 'parent') continue;
+      if (alreadySent.contains(peer)) continue;
+      _perf.fedQueued(1);
       () async {
         try {
           if (peer.relation == 'equally') {
             // 通知のみ
             final basename = p.basename(file.path);
-            final notice = _ClipboardItem(
+            final notice = ClipboardEntry(
               id: _generateId(),
               text: '@up file uploaded: $basename',
               tag: _serverName,
@@ -1880,20 +4703,21 @@ class _CliServer {
           }
         } catch (e) {
           _log('[fed] forward-file ${peer.name} unexpected: $e');
+        } finally {
+          _perf.fedQueued(-1);
         }
       }();
     }
   }
 
   Future<void> _sendClipboardToPeer(
-      _FederationPeer peer, _ClipboardItem item, bool isUp) async {
+      _FederationPeer peer, ClipboardEntry item, bool isUp) async {
     // #223: pause 中はサイレントに skip
     if (peer.isPaused()) {
       _log('[fed] paused-skip clip ${peer.name}');
       return;
     }
-    _heartbeatClient ??=
-        HttpClient()..connectionTimeout = const Duration(seconds: 10);
+    _heartbeatClient ??= _newFederationClient();
     final uri = Uri.parse('${peer.url}/api/clipboard');
 
     for (var attempt = 1; attempt <= 3; attempt++) {
@@ -1905,6 +4729,10 @@ class _CliServer {
         req.headers.set(_kFedSeenBy, _deviceId);
         req.headers.set(_kFedEvent, 'clipboard');
         req.headers.set(_kFedRelation, peer.relation);
+        if (peer.sync && item.origin != null) {
+          req.headers.set(_kClipOrigin, item.origin!);
+          req.headers.set(_kClipSeq, '${item.seq}');
+        }
         req.add(utf8.encode(json.encode({
           'text': item.text,
           // tag: 親側で「どの子から」かが分かるよう自サーバ名を入れる
@@ -1934,31 +4762,106 @@ class _CliServer {
     _log('[fed] forward-clip ${peer.name} gave-up');
   }
 
+  /// 親の /api/upload への POST を開いてヘッダまで設定する。length が null なら chunked。
+  Future<HttpClientRequest> _openPeerUpload(
+      _FederationPeer peer, String filename, int? length) async {
+    _heartbeatClient ??= _newFederationClient();
+    final pathParam = Uri.encodeComponent('children/$_serverName');
+    final uri = Uri.parse('${peer.url}/api/upload?path=$pathParam');
+    final req = await _heartbeatClient!.postUrl(uri);
+    req.headers.set('Content-Type', 'application/octet-stream');
+    req.headers.set('Authorization', 'Bearer ${peer.token}');
+    req.headers.set('x-filename', Uri.encodeComponent(filename));
+    req.headers.set(_kFedOrigin, _deviceId);
+    req.headers.set(_kFedSeenBy, _deviceId);
+    req.headers.set(_kFedEvent, 'upload');
+    req.headers.set(_kFedRelation, peer.relation);
+    if (length != null) req.contentLength = length;
+    return req;
+  }
+
+  /// tee 対象の親ごとに送信を開始する。対象が無ければ空リスト。
+  List<_TeeForward> _startTees(Request originReq, String filename, int? length) {
+    if (_comesFromFederation(originReq) || _deviceId.isEmpty) return const [];
+    final tees = <_TeeForward>[];
+    for (final peer in _federationPeers) {
+      if (peer.kind != 'parent' || !peer.tee || peer.relation != 'friendly') {
+        continue;
+      }
+      if (peer.isPaused()) continue;
+      final tee = _TeeForward(peer, mem: _mem);
+      _perf.fedQueued(1);
+      tee.done = () async {
+        HttpClientRequest? req;
+        try {
+          req = await _openPeerUpload(peer, filename, length);
+          final r = req;
+          if (tee.failed) {
+            r.abort();
+            return false;
+          }
+          tee.onFail = (e) => r.abort(e);
+          await req.addStream(tee.stream);
+          tee.onFail = null;
+          if (tee.failed) {
+            req.abort();
+            return false;
+          }
+          final res = await req.close().timeout(const Duration(minutes: 5));
+          await res.drain();
+          final ok = res.statusCode >= 200 && res.statusCode < 300;
+          _log('[fed] tee ${peer.name} ${ok ? 'ok' : 'HTTP ${res.statusCode}'} bytes=${tee.bytes}');
+          return ok;
+        } catch (e) {
+          req?.abort(e);
+          _log('[fed] tee ${peer.name} error: $e');
+          return false;
+        } finally {
+          tee.onFail = null; // 応答後に接続を切らない
+          tee.fail(); // 以降の add() を止める (成功時は既に close 済みで no-op)
+          _perf.fedQueued(-1);
+        }
+      }();
+      tees.add(tee);
+    }
+    return tees;
+  }
+
+  /// 受信完了後、tee の結果を待ってから後始末する。失敗した親にはディスク上の
+  /// コピーで通常の転送をやり直す。成功した trust 親ならローカルを削除する。
+  void _completeTees(List<_TeeForward> tees, File file, Request originReq) {
+    () async {
+      final sent = <_FederationPeer>{};
+      for (final tee in tees) {
+        if (await tee.finish()) sent.add(tee.peer);
+      }
+      _forwardFileToParents(file, originReq, alreadySent: sent);
+      if (sent.any((p) => p.trust)) {
+        try {
+          await file.delete();
+          _log('[fed] tee ok, local deleted (trust)');
+        } catch (e) {
+          _log('[fed] tee local-delete fail: $e');
+        }
+      }
+    }();
+  }
+
   Future<bool> _sendFileToPeer(_FederationPeer peer, File file) async {
     // #223: pause 中は skip
     if (peer.isPaused()) {
       _log('[fed] paused-skip file ${peer.name}');
       return false;
     }
-    _heartbeatClient ??=
-        HttpClient()..connectionTimeout = const Duration(seconds: 10);
-    final filename = p.basename(file.path);
-    final pathParam = Uri.encodeComponent('children/$_serverName');
-    final uri = Uri.parse('${peer.url}/api/upload?path=$pathParam');
+    // 圧縮保存されたファイルは展開して元の名前で送る
+    final lnz = await _openCompressed(file);
+    final filename = _logicalName(file.path, lnz);
 
     for (var attempt = 1; attempt <= 3; attempt++) {
       try {
-        final length = await file.length();
-        final req = await _heartbeatClient!.postUrl(uri);
-        req.headers.set('Content-Type', 'application/octet-stream');
-        req.headers.set('Authorization', 'Bearer ${peer.token}');
-        req.headers.set('x-filename', Uri.encodeComponent(filename));
-        req.headers.set(_kFedOrigin, _deviceId);
-        req.headers.set(_kFedSeenBy, _deviceId);
-        req.headers.set(_kFedEvent, 'upload');
-        req.headers.set(_kFedRelation, peer.relation);
-        req.contentLength = length;
-        await req.addStream(file.openRead());
+        final length = await _logicalLength(file, lnz);
+        final req = await _openPeerUpload(peer, filename, length);
+        await req.addStream(_openLogicalRead(file, lnz));
         final res = await req.close().timeout(const Duration(minutes: 5));
         await res.drain();
 
@@ -2002,7 +4905,7 @@ class _CliServer {
         // 通知: 自分の clipboard に 1 件残す (受信者側で気付けるように)
         _clipboardItems.insert(
           0,
-          _ClipboardItem(
+          ClipboardEntry(
             id: _generateId(),
             text:
                 '@up over-quota from ${peer.name}: bytes=$contentLength cap=$cap',
@@ -2029,6 +4932,7 @@ class _CliServer {
 
   Future<void> start({
     required String ipAddress,
+    InternetAddress? bindAddress, // null なら全 IPv4
     required int port,
     String? storagePath,
     bool downloadOnly = false,
@@ -2041,14 +4945,23 @@ class _CliServer {
     String? httpsCertPath,
     String? httpsKeyPath,
     String? uploadToken,
+    List<_ApiToken> apiTokens = const [],
     List<({String pattern, String script})> postActions = const [],
     Map<String, ({String script, String? description})> mentionActions = const {},
     int? maxDirectUploadBytes,    // #262
+    List<String> compressPatterns = const [],
+    int? compressFrameBytes,
     List<String> extraAllowedHosts = const [],   // #275
+    bool webDav = false,
+    int stallThresholdMs = 0,
+    bool stallProfile = false,
+    String? statsSocket,
+    String? tracePath,
   }) async {
     _authMode = authMode;
     _downloadOnly = downloadOnly;
     _uploadToken = uploadToken;
+    _apiTokens = {for (final t in apiTokens) t.token: t};
     _postActions = postActions;
     _mentionActions = mentionActions;
     _clipboardEnabled = clipboardEnabled;
@@ -2056,6 +4969,9 @@ class _CliServer {
     _pinLength = pinLength;       // #206
     _pinCharset = pinCharset;     // #206
     _maxDirectUploadBytes = maxDirectUploadBytes; // #262
+    _compressPatterns = compressPatterns;
+    _webDavEnabled = webDav;
+    if (compressFrameBytes != null) _compressFrameBytes = compressFrameBytes;
     _startedAt = DateTime.now().millisecondsSinceEpoch;
 
     switch (authMode) {
@@ -2072,6 +4988,7 @@ class _CliServer {
 
     // #258: DNS rebinding — 許可する Host 値を事前収集（IPv4 のみ。IPv6 バインド未対応）
     _allowedHosts = {'localhost', '127.0.0.1', ipAddress};
+    _bindAddress = bindAddress;
     try {
       final ifaces = await NetworkInterface.list(includeLoopback: true);
       for (final iface in ifaces) {
@@ -2094,12 +5011,25 @@ class _CliServer {
         .addMiddleware(_authMiddleware)
         .addHandler(_router.call);
     final cascade = Cascade().add(apiHandler).add(staticHandler);
+    // WebDAV は PROPFIND 等の独自メソッドを使うので Router の前で振り分ける
+    final davHandler = const Pipeline()
+        .addMiddleware(_hostGuardMiddleware)
+        .addHandler(_webDavHandler);
+    FutureOr<Response> root(Request req) =>
+        _isDavRequest(req) ? davHandler(req) : cascade.handler(req);
 
     final handler = verbose
         ? const Pipeline()
             .addMiddleware(logRequests())
-            .addHandler(cascade.handler)
-        : const Pipeline().addHandler(cascade.handler);
+            .addMiddleware(_inFlightMiddleware)
+            .addMiddleware(_perfMiddleware)
+            .addMiddleware(_altSvcMiddleware)
+            .addHandler(root)
+        : const Pipeline()
+            .addMiddleware(_inFlightMiddleware)
+            .addMiddleware(_perfMiddleware)
+            .addMiddleware(_altSvcMiddleware)
+            .addHandler(root);
 
     if (httpsCertPath != null && httpsKeyPath != null) {
       _httpsEnabled = true; // #6: Secure Cookie 付与のために記憶
@@ -2107,19 +5037,47 @@ class _CliServer {
         ..useCertificateChain(httpsCertPath)
         ..usePrivateKey(httpsKeyPath);
       _server = await shelf_io.serve(
-        handler, InternetAddress.anyIPv4, port,
+        handler, bindAddress ?? InternetAddress.anyIPv4, port,
         securityContext: secCtx,
       );
       _log('Serving at https://$ipAddress:$port');
     } else {
       _httpsEnabled = false;
-      _server = await shelf_io.serve(handler, InternetAddress.anyIPv4, port);
+      _server = await shelf_io.serve(
+          handler, bindAddress ?? InternetAddress.anyIPv4, port);
       _log('Serving at http://$ipAddress:$port');
     }
+    if (stallThresholdMs > 0) {
+      _loopMonitor = _LoopMonitor(
+        stallMs: stallThresholdMs,
+        profile: stallProfile,
+        activity: _requestsSince,
+      );
+      await _loopMonitor!.start();
+    }
+    _sampleMemory();
+    _memSampler =
+        Timer.periodic(const Duration(seconds: 5), (_) => _sampleMemory());
+    if (statsSocket != null) await _startStatsSocket(statsSocket);
+    if (tracePath != null) {
+      // ファイル ID は正規化した共有ルートからの絶対パスなので、再生時の
+      // 書き換え用にそれを残す
+      _trace = await _TraceRecorder.open(
+          tracePath, await Directory(_storagePath!).resolveSymbolicLinks());
+      _log('Recording access trace to $tracePath');
+    }
   }
 
   Future<void> stop() async {
     _stopHeartbeat();
+    await _loopMonitor?.stop();
+    _memSampler?.cancel();
+    await _stopStatsSocket();
+    await _trace?.close();
+    _trace = null;
+    await (await _debugVm)?.close();
+    await _stopHttp3Sidecar();
+    await _stopWatchFolder();
     await _server?.close(force: true);
     _server = null;
     // #242: 自分用 deploy dir を後片付け。異常終了で残った場合は
@@ -2132,14 +5090,766 @@ class _CliServer {
     } catch (_) {}
     // #271: PID ベースのサムネイルキャッシュも同様に削除
     try {
-      final t = _thumbnailCacheDir;
-      if (t != null && await t.exists()) {
-        await t.delete(recursive: true);
+      final t = _thumbnailCacheDir;
+      if (t != null && await t.exists()) {
+        await t.delete(recursive: true);
+      }
+    } catch (e) {
+      stderr.writeln(
+          'Warning: could not remove thumbnail cache ${_thumbnailCacheDir?.path}: $e');
+      stderr.writeln('  You can remove it manually.');
+    }
+    try {
+      final b = _clipBlobDir;
+      if (b != null && await b.exists()) {
+        await b.delete(recursive: true);
+      }
+    } catch (e) {
+      stderr.writeln(
+          'Warning: could not remove clipboard blobs ${_clipBlobDir?.path}: $e');
+    }
+  }
+
+  // --- HTTP/3 sidecar ---
+  //
+  // Dart の HttpServer は QUIC を話せないので、Caddy を子プロセスとして起動して
+  // UDP で HTTP/3 を受けさせ、ループバック経由でこのサーバへ reverse proxy
+  // させる。証明書は https-cert / https-key をそのまま読ませる。
+  // sidecar が生きている間だけ TCP 側の応答に Alt-Svc を付け、ブラウザを h3 へ
+  // 移らせる。落ちたらバックオフ付きで起動し直す (その間は TCP だけで動く)。
+  static const String _kH3Secret = 'x-localnode-h3';
+  static const String _kH3Client = 'x-localnode-h3-client';
+  Process? _h3Process;
+  Directory? _h3Dir;
+  String? _h3SecretValue;
+  int _h3Port = 0;
+  bool _h3Alive = false;
+  bool _h3Stopping = false;
+  Timer? _h3Restart;
+  int _h3Failures = 0;
+
+  Future<void> startHttp3Sidecar({
+    required String executable,
+    required int udpPort,
+    required String certPath,
+    required String keyPath,
+  }) async {
+    // 設定には転送用の秘密値が入るので、他の一時ディレクトリと同じく
+    // 起動ごと・他ユーザー不可の場所に置く
+    const prefix = 'localnode_cli_h3_';
+    _reapStaleDeployDirs(Directory.systemTemp, prefix);
+    _h3Dir = await Directory.systemTemp.createTemp('${prefix}${pid}_');
+    _chmodDir(_h3Dir!);
+    _h3SecretValue = _generateToken();
+    _h3Port = udpPort;
+    final configFile = File(p.join(_h3Dir!.path, 'caddy.json'));
+    await configFile.writeAsString(json.encode(_http3SidecarConfig(
+      udpPort: udpPort,
+      certPath: File(certPath).absolute.path,
+      keyPath: File(keyPath).absolute.path,
+      upstreamPort: _server!.port,
+    )));
+    _chmodFile(configFile);
+    await _spawnHttp3Sidecar(File(executable).absolute.path, configFile.path);
+  }
+
+  /// sidecar から本体への転送先。ループバックに bind していればそのアドレス、
+  /// 全アドレス (既定) なら 127.0.0.1。起動時に他の bind は弾いている。
+  String _loopbackDial(int port) {
+    final a = _bindAddress;
+    if (a == null || !a.isLoopback) return '127.0.0.1:$port';
+    return a.type == InternetAddressType.IPv6
+        ? '[${a.address}]:$port'
+        : '${a.address}:$port';
+  }
+
+  Map<String, dynamic> _http3SidecarConfig({
+    required int udpPort,
+    required String certPath,
+    required String keyPath,
+    required int upstreamPort,
+  }) =>
+      {
+        'admin': {'disabled': true},
+        'storage': {
+          'module': 'file_system',
+          'root': p.join(_h3Dir!.path, 'data'),
+        },
+        'apps': {
+          'tls': {
+            'certificates': {
+              'load_files': [
+                {'certificate': certPath, 'key': keyPath, 'tags': ['localnode']}
+              ],
+            },
+          },
+          'http': {
+            'servers': {
+              'localnode': {
+                'listen': [':$udpPort'],
+                // h3 だけを指定すると UDP だけを listen する (TCP はこのサーバ)
+                'protocols': ['h3'],
+                'automatic_https': {'disable': true},
+                'tls_connection_policies': [
+                  {
+                    'certificate_selection': {
+                      'any_tag': ['localnode']
+                    }
+                  }
+                ],
+                'routes': [
+                  {
+                    'handle': [
+                      {
+                        'handler': 'reverse_proxy',
+                        'upstreams': [
+                          {'dial': _loopbackDial(upstreamPort)}
+                        ],
+                        // アップロードや動画の Range 応答を溜めずに流す
+                        'flush_interval': -1,
+                        // クライアントが送ってきた同名ヘッダは set で上書きされる
+                        'headers': {
+                          'request': {
+                            'set': {
+                              _kH3Secret: [_h3SecretValue],
+                              _kH3Client: ['{http.request.remote.host}'],
+                            },
+                          },
+                        },
+                        // ループバックの 1 ホップ。証明書は外向きの名前用なので
+                        // 127.0.0.1 では検証が通らない
+                        'transport': {
+                          'protocol': 'http',
+                          'tls': {'insecure_skip_verify': true},
+                        },
+                      }
+                    ],
+                  }
+                ],
+              },
+            },
+          },
+        },
+      };
+
+  Future<void> _spawnHttp3Sidecar(String executable, String configPath) async {
+    if (_h3Stopping) return;
+    final Process proc;
+    try {
+      proc = await Process.start(
+        executable,
+        ['run', '--config', configPath],
+        // autosave.json 等も一時ディレクトリに閉じ込める
+        environment: {
+          'XDG_CONFIG_HOME': p.join(_h3Dir!.path, 'config'),
+          'XDG_DATA_HOME': p.join(_h3Dir!.path, 'data'),
+        },
+      );
+    } catch (e) {
+      stderr.writeln('Warning: could not start HTTP/3 sidecar: $e');
+      _scheduleHttp3Restart(executable, configPath);
+      return;
+    }
+    _h3Process = proc;
+    proc.stdout.drain<void>();
+    proc.stderr
+        .transform(utf8.decoder)
+        .transform(const LineSplitter())
+        .listen((line) => _log('[h3] $line'), onError: (_) {});
+    var exited = false;
+    proc.exitCode.then((code) {
+      exited = true;
+      if (!identical(_h3Process, proc)) return;
+      _h3Process = null;
+      _h3Alive = false;
+      if (_h3Stopping) return;
+      stderr.writeln('Warning: HTTP/3 sidecar exited (code $code); '
+          'serving TCP only until it restarts.');
+      _scheduleHttp3Restart(executable, configPath);
+    });
+    // ポート使用中などですぐ落ちる場合に Alt-Svc を出さないよう少し待つ
+    await Future.delayed(const Duration(seconds: 1));
+    if (exited || !identical(_h3Process, proc) || _h3Stopping) return;
+    _h3Alive = true;
+    _log('[h3] sidecar up on udp/$_h3Port (pid ${proc.pid})');
+    // 1 分生き延びたら起動失敗の回数を戻す (バックオフを短くする)
+    Timer(const Duration(minutes: 1), () {
+      if (identical(_h3Process, proc)) _h3Failures = 0;
+    });
+  }
+
+  void _scheduleHttp3Restart(String executable, String configPath) {
+    if (_h3Stopping) return;
+    _h3Failures++;
+    final delay = Duration(seconds: min(60, 1 << min(_h3Failures, 6)));
+    _log('[h3] restarting sidecar in ${delay.inSeconds}s');
+    _h3Restart?.cancel();
+    _h3Restart = Timer(delay, () => _spawnHttp3Sidecar(executable, configPath));
+  }
+
+  Future<void> _stopHttp3Sidecar() async {
+    _h3Stopping = true;
+    _h3Alive = false;
+    _h3Restart?.cancel();
+    final proc = _h3Process;
+    _h3Process = null;
+    if (proc != null) {
+      proc.kill();
+      try {
+        await proc.exitCode.timeout(const Duration(seconds: 3));
+      } catch (_) {
+        proc.kill(ProcessSignal.sigkill);
+      }
+    }
+    try {
+      await _h3Dir?.delete(recursive: true);
+    } catch (_) {}
+  }
+
+  bool _isFromHttp3Sidecar(Request req, HttpConnectionInfo conn) =>
+      _h3SecretValue != null &&
+      conn.remoteAddress.isLoopback &&
+      req.headers[_kH3Secret] == _h3SecretValue;
+
+  /// sidecar が動いている間、TCP 側の応答で HTTP/3 の場所を知らせる
+  Middleware get _altSvcMiddleware => (inner) {
+        return (req) async {
+          final res = await inner(req);
+          if (!_h3Alive) return res;
+          return res.change(headers: {'alt-svc': 'h3=":$_h3Port"; ma=86400'});
+        };
+      };
+
+  // --- イベントループ監視 ---
+  //
+  // 全リクエストの開始・終了を記録しておき、_LoopMonitor が詰まりを検出したら
+  // その時間帯に動いていたものを渡す。同期処理で詰まらせたハンドラは検出時点
+  // では既に終わっていることが多いので、直近に終わった分も残しておく。
+
+  _LoopMonitor? _loopMonitor;
+  int _requestSeq = 0;
+  final Map<int, ({String method, String path, String client, int startUs})>
+      _inFlight = {};
+  final List<({String method, String path, int startUs, int endUs})>
+      _recentRequests = [];
+  static const int _maxRecentRequests = 64;
+
+  Middleware get _inFlightMiddleware => (inner) {
+        return (req) async {
+          final seq = ++_requestSeq;
+          final path = req.url.path.length > 160
+              ? req.url.path.substring(0, 160)
+              : req.url.path;
+          final startUs = developer.Timeline.now;
+          _inFlight[seq] = (
+            method: req.method,
+            path: path,
+            client: _getClientIp(req),
+            startUs: startUs,
+          );
+          final body = _mem.lease('requestBodies');
+          try {
+            return await inner(req.change(context: {_kBodyLease: body}));
+          } finally {
+            body.release();
+            _inFlight.remove(seq);
+            _recentRequests.add((
+              method: req.method,
+              path: path,
+              startUs: startUs,
+              endUs: developer.Timeline.now,
+            ));
+            if (_recentRequests.length > _maxRecentRequests) {
+              _recentRequests.removeAt(0);
+            }
+          }
+        };
+      };
+
+  List<Map<String, dynamic>> _requestsSince(int sinceUs) {
+    final now = developer.Timeline.now;
+    return [
+      for (final r in _recentRequests)
+        if (r.endUs >= sinceUs)
+          {
+            'method': r.method,
+            'path': r.path,
+            'durationMs': (r.endUs - r.startUs) ~/ 1000,
+          },
+      for (final r in _inFlight.values)
+        {
+          'method': r.method,
+          'path': r.path,
+          'client': r.client,
+          'elapsedMs': (now - r.startUs) ~/ 1000,
+          'inFlight': true,
+        },
+    ];
+  }
+
+  Response _eventLoopHandler(Request req) {
+    final m = _loopMonitor;
+    if (m == null) {
+      return Response.notFound(
+          json.encode({'error': 'Event-loop monitor is disabled.'}),
+          headers: {'Content-Type': 'application/json'});
+    }
+    return Response.ok(json.encode(m.toJson()),
+        headers: {'Content-Type': 'application/json', 'Cache-Control': 'no-store'});
+  }
+
+  // --- ライブ性能ダッシュボード ---
+  //
+  // 外部の Prometheus 等が無くても、スループットとレイテンシの推移を
+  // Web UI で見られるようにする。集計は PerfStats (lib/src/perf_stats.dart) の
+  // 固定長リングだけで、
+  // /api/debug/perf はその列をそのまま返す。
+
+  final PerfStats _perf =
+      PerfStats(caches: const ['thumbnail', 'compressedIndex', 'davListing']);
+
+  // top 用: 応答本文を送り終えるまでを 1 件とした処理中のリクエストと、
+  // クライアントごとの累計転送量。_inFlight (ハンドラが返るまで) とは別に持つ
+  int _activeSeq = 0;
+  final Map<int, _ActiveRequest> _activeRequests = {};
+  final Map<String, _ClientTraffic> _clientTraffic = {};
+  // --trace 指定時のアクセストレース
+  _TraceRecorder? _trace;
+
+  Middleware get _perfMiddleware => (inner) {
+        return (req) async {
+          final route = _perfRoute(req);
+          final sw = Stopwatch()..start();
+          if (_clientTraffic.length >= 256) _pruneClientTraffic();
+          final ip = _getClientIp(req);
+          final traffic =
+              _clientTraffic.putIfAbsent(ip, () => _ClientTraffic(ip));
+          final id = ++_activeSeq;
+          final a = _ActiveRequest(req.method, req.url.path, route, traffic);
+          _activeRequests[id] = a;
+          traffic.active++;
+          final original = req;
+          var headerUs = 0;
+          var status = 500;
+          void done() {
+            if (_activeRequests.remove(id) == null) return;
+            traffic.active--;
+            traffic.lastSeenMs = DateTime.now().millisecondsSinceEpoch;
+            _trace?.record(original, route,
+                startMs: a.startMs,
+                headerUs: headerUs,
+                totalUs: sw.elapsedMicroseconds,
+                status: status,
+                bytesIn: a.bytesIn,
+                bytesOut: a.bytesOut);
+          }
+
+          if (req.contentLength != 0 &&
+              req.method != 'GET' &&
+              req.method != 'HEAD') {
+            req = req.change(
+                body: _perf.count(req.read(), (n) {
+              _perf.bytesIn(n);
+              a.bytesIn += n;
+              traffic.bytesIn += n;
+            }));
+          }
+          final Response res;
+          try {
+            res = await inner(req);
+          } catch (_) {
+            headerUs = sw.elapsedMicroseconds;
+            _perf.request(route, headerUs, error: true);
+            done();
+            rethrow;
+          }
+          headerUs = sw.elapsedMicroseconds;
+          status = res.statusCode;
+          _perf.request(route, headerUs, error: status >= 500);
+          if (req.method == 'HEAD' ||
+              res.statusCode == 204 ||
+              res.statusCode == 304 ||
+              res.contentLength == 0) {
+            done();
+            return res;
+          }
+          return res.change(
+              body: _perf.count(res.read(), (n) {
+            _perf.bytesOut(n);
+            a.bytesOut += n;
+            traffic.bytesOut += n;
+          }, onDone: done));
+        };
+      };
+
+  /// 10 分以上リクエストの無いクライアントを忘れる
+  void _pruneClientTraffic() {
+    final cutoff = DateTime.now().millisecondsSinceEpoch - 10 * 60 * 1000;
+    _clientTraffic
+        .removeWhere((_, c) => c.active == 0 && c.lastSeenMs < cutoff);
+  }
+
+  /// ダッシュボードでの経路の分類 (PerfStats.routes)
+  String _perfRoute(Request req) {
+    final path = req.url.path;
+    if (_isDavRequest(req)) return 'dav';
+    if (path.startsWith('api/federation/') || _comesFromFederation(req)) {
+      return 'fed';
+    }
+    if (path == 'api/upload') return 'upload';
+    if (path.startsWith('api/download') || path.startsWith('s/')) {
+      return 'download';
+    }
+    if (path.startsWith('api/thumbnail') || path.endsWith('/thumbnail')) {
+      return 'thumb';
+    }
+    if (path.startsWith('api/clipboard') || path == 'api/mentions') {
+      return 'clip';
+    }
+    return path.startsWith('api/') ? 'api' : 'static';
+  }
+
+  Response _perfHandler(Request req) => Response.ok(json.encode(_perf.toJson()),
+      headers: {'Content-Type': 'application/json', 'Cache-Control': 'no-store'});
+
+  // --- top 用のバイナリ統計 ---
+  //
+  // `localnode-cli top` が毎秒取りに来る。JSON を組み立てずに済むよう
+  // 固定形式 (lib/src/stats_format.dart) で返す。TCP ではループバック
+  // からだけ受け付け、--stats-socket を指定すると Unix ソケットでも出す
+  // (こちらは認証なし。ソケットファイルを 0600 にして守る)。
+
+  HttpServer? _statsServer;
+  String? _statsSocketPath;
+  Directory? _statsSocketDir;
+
+  Response _statsHandler(Request req) {
+    final conn = req.context['shelf.io.connection_info'];
+    if (conn is! HttpConnectionInfo ||
+        !conn.remoteAddress.isLoopback ||
+        _isFromHttp3Sidecar(req, conn)) {
+      return Response.forbidden('Stats are only served on loopback.');
+    }
+    return _statsResponse();
+  }
+
+  Response _statsResponse() => Response.ok(_encodeStats(), headers: {
+        'Content-Type': 'application/octet-stream',
+        'Cache-Control': 'no-store',
+      });
+
+  Future<void> _startStatsSocket(String path) async {
+    if (Platform.isWindows) {
+      throw UnsupportedError('--stats-socket is not supported on Windows');
+    }
+    // ソケットは隣に作る 0700 のディレクトリの中に bind し、path にはそこへの
+    // symlink を置く。bind 直後のソケットは umask の権限で作られるが、
+    // ディレクトリが閉じているので chmod までの間も他ユーザーからは繋げない
+    final base = Directory(p.dirname(path));
+    final prefix = '.${p.basename(path)}.';
+    _reapStaleDeployDirs(base, prefix);
+    final dir = await base.createTemp('$prefix${pid}_');
+    _chmodDir(dir);
+    _statsSocketDir = dir;
+    final sock = p.join(dir.path, 'stats.sock');
+    _statsServer = await HttpServer.bind(
+        InternetAddress(sock, type: InternetAddressType.unix), 0);
+    _chmodFile(File(sock));
+    // 前回の異常終了で残った symlink (や旧版のソケットファイル) は置き換える
+    switch (await FileSystemEntity.type(path, followLinks: false)) {
+      case FileSystemEntityType.link:
+        await Link(path).delete();
+      case FileSystemEntityType.unixDomainSock:
+        await File(path).delete();
+      default:
+        break;
+    }
+    await Link(path).create(sock);
+    _statsSocketPath = path;
+    shelf_io.serveRequests(_statsServer!, (req) {
+      if (req.method == 'GET' && req.url.path == 'api/debug/stats') {
+        return _statsResponse();
+      }
+      return Response.notFound('Not found.');
+    });
+    _log('Stats socket at $path');
+  }
+
+  Future<void> _stopStatsSocket() async {
+    await _statsServer?.close(force: true);
+    _statsServer = null;
+    final path = _statsSocketPath;
+    final dir = _statsSocketDir;
+    _statsSocketPath = null;
+    _statsSocketDir = null;
+    if (path != null && dir != null) {
+      try {
+        // 別プロセスが置き直したものは消さない
+        if (await Link(path).target() == p.join(dir.path, 'stats.sock')) {
+          await Link(path).delete();
+        }
+      } catch (_) {}
+    }
+    try {
+      await dir?.delete(recursive: true);
+    } catch (_) {}
+  }
+
+  Uint8List _encodeStats() {
+    final now = DateTime.now().millisecondsSinceEpoch;
+    final loop = _loopMonitor;
+    _pruneClientTraffic();
+    return StatsSnapshot(
+      nowMs: now,
+      startedAtMs: _startedAt,
+      rssBytes: ProcessInfo.currentRss,
+      requests: _perf.totalRequests,
+      bytesIn: _perf.totalBytesIn,
+      bytesOut: _perf.totalBytesOut,
+      loopEnabled: loop != null,
+      lagMs: loop?.lastLagMs ?? 0,
+      lagP99Ms: loop?.percentileMs(0.99) ?? 0,
+      lagMaxMs: loop?.lastMinuteMaxMs.reduce(max) ?? 0,
+      stalls: loop?.stallCount ?? 0,
+      // キュー: 生成中のサムネイル / 実行中の post-action / federation 送信待ち
+      thumbQueue:
+          _activeRequests.values.where((r) => r.route == 'thumb').length,
+      postActionQueue: _postActionsRunning,
+      fedQueue: _perf.fedQueue,
+      caches: [
+        for (var i = 0; i < _perf.caches.length; i++)
+          (
+            name: _perf.caches[i],
+            hits: _perf.cacheHits[i],
+            misses: _perf.cacheMisses[i]
+          ),
+      ],
+      cacheBytes: _cacheBytes(),
+      active: [
+        for (final r in _activeRequests.values.take(0xffff))
+          (
+            method: r.method,
+            path: r.path.length > 160 ? r.path.substring(0, 160) : r.path,
+            route: r.route,
+            client: r.traffic.ip,
+            elapsedMs: now - r.startMs,
+            bytesIn: r.bytesIn,
+            bytesOut: r.bytesOut
+          ),
+      ],
+      clients: [
+        for (final c in _clientTraffic.values.take(0xffff))
+          (ip: c.ip, bytesIn: c.bytesIn, bytesOut: c.bytesOut, active: c.active),
+      ],
+    ).encode();
+  }
+
+  // --- メモリ計上 ---
+  //
+  // 1GB 級の端末で OOM kill されたときに、どこが膨らんでいたかを追うため。
+  // requestBodies / decode / federation は確保箇所で積み、clipboard / caches は
+  // 5 秒ごとに測る (最大値はその粒度)。VM のヒープと GC の統計は VM service が
+  // 使えるときだけ付ける。
+
+  final _MemAccounting _mem = _MemAccounting();
+  Timer? _memSampler;
+  static const String _kBodyLease = 'localnode.bodyLease';
+  Future<_VmService?>? _debugVm;
+
+  void _sampleMemory() {
+    _mem.set('clipboard', _clipboardItems.approxBytes);
+    _mem.set('caches', _cacheBytes().values.fold<int>(0, (a, b) => a + b));
+  }
+
+  /// メモリ上のキャッシュ類の推定バイト数
+  Map<String, int> _cacheBytes() {
+    var dav = 0;
+    for (final l in _davListings.values) {
+      for (final e in l.entries) {
+        dav += 48 + (e.name.length + e.storedPath.length) * 2;
+      }
+    }
+    var mentions = 0;
+    for (final peer in _federationPeers) {
+      final c = peer.mentionsCache;
+      if (c != null) mentions += json.encode(c.items).length * 2;
+    }
+    var watch = 0;
+    for (final k in _watchSeen.keys) {
+      watch += 48 + k.length * 2;
+    }
+    return {
+      'compressedIndex': _compressedIndexCache.values
+          .fold<int>(0, (a, c) => a + 64 + c.index.frameOffsets.length * 8),
+      'davListings': dav,
+      'mentions': mentions,
+      'watchState': watch,
+      'sessions': (_sessions.length + _failedAttempts.length) * 64,
+      'requestLog': _recentRequests.length * 96,
+    };
+  }
+
+  /// 本文をメモリに読み切る。読んだ分はリクエストが終わるまで
+  /// requestBodies として計上する
+  Future<String> _readBodyString(Request req) async {
+    final lease = req.context[_kBodyLease];
+    final out = BytesBuilder(copy: false);
+    await for (final chunk in req.read()) {
+      out.add(chunk);
+      if (lease is _MemLease) lease.add(chunk.length);
+    }
+    return utf8.decode(out.takeBytes());
+  }
+
+  /// サムネイル用にデコードして縮小する。元データと展開後のピクセルが
+  /// 同時に載るので decode として計上する (OOM の主な候補)。
+  /// デコードできなければ null
+  Uint8List? _encodeThumbnail(Uint8List bytes) {
+    _mem.add('decode', bytes.length);
+    var decoded = 0;
+    try {
+      final image = img.decodeImage(bytes);
+      if (image == null) return null;
+      decoded = image.lengthInBytes;
+      _mem.add('decode', decoded);
+      return img.encodeJpg(img.copyResize(image, width: 120), quality: 85);
+    } finally {
+      _mem.release('decode', bytes.length + decoded);
+    }
+  }
+
+  Future<Response> _memoryHandler(Request req) async {
+    _sampleMemory();
+    Map<String, dynamic> vmStats;
+    final vm = await (_debugVm ??= _VmService.connect());
+    final isolateId = _VmService.isolateId;
+    if (vm == null || isolateId == null) {
+      vmStats = {
+        'error': 'VM service is not enabled (run with dart --enable-vm-service)'
+      };
+    } else {
+      try {
+        final usage =
+            await vm.call('getMemoryUsage', {'isolateId': isolateId});
+        vmStats = {
+          'heapUsage': usage['heapUsage'],
+          'heapCapacity': usage['heapCapacity'],
+          'externalUsage': usage['externalUsage'],
+        };
+        // GC の回数と時間は getIsolate の非公開フィールドにしか無い
+        final heaps =
+            (await vm.call('getIsolate', {'isolateId': isolateId}))['_heaps'];
+        if (heaps is Map) {
+          vmStats['gc'] = {
+            for (final e in heaps.entries)
+              if (e.value is Map)
+                '${e.key}': {
+                  'collections': e.value['collections'],
+                  'timeSec': e.value['time'],
+                  'used': e.value['used'],
+                  'capacity': e.value['capacity'],
+                },
+          };
+        }
+      } catch (e) {
+        vmStats = {'error': '$e'};
+      }
+    }
+    return Response.ok(
+        json.encode({
+          'rssBytes': ProcessInfo.currentRss,
+          'peakRssBytes': ProcessInfo.maxRss,
+          'subsystems': _mem.toJson(),
+          'caches': _cacheBytes(),
+          'vm': vmStats,
+        }),
+        headers: {'Content-Type': 'application/json', 'Cache-Control': 'no-store'});
+  }
+
+  // --- CPU プロファイル採取 ---
+  //
+  // POST /api/debug/profile?seconds=N で、この間の CPU サンプルを VM の
+  // サンプリングプロファイラから取り出し、.cpuprofile として返す。
+  // プロファイラは採取中だけ有効にする (--stall-profile 時は常時有効のまま)
+  // ので、採取していないときのオーバーヘッドは無い。
+  // VM service が必要 (dart --enable-vm-service で起動)。
+
+  bool _profiling = false;
+
+  Future<Response> _profileHandler(Request req) async {
+    const jsonHeaders = {'Content-Type': 'application/json'};
+    final seconds =
+        int.tryParse(req.requestedUri.queryParameters['seconds'] ?? '10');
+    if (seconds == null || seconds < 1 || seconds > 120) {
+      return Response.badRequest(
+          body: json.encode({'error': 'seconds must be 1..120.'}),
+          headers: jsonHeaders);
+    }
+    if (_profiling) {
+      return Response(409,
+          body: json.encode({'error': 'A profile capture is already running.'}),
+          headers: jsonHeaders);
+    }
+    // VM service への接続を待つ間に 2 本目が通らないよう、先に立てる
+    _profiling = true;
+    final _VmService? vm;
+    try {
+      vm = await (_debugVm ??= _VmService.connect());
+    } catch (_) {
+      _profiling = false;
+      rethrow;
+    }
+    final isolateId = _VmService.isolateId;
+    if (vm == null || isolateId == null) {
+      _profiling = false;
+      return Response(503,
+          body: json.encode({
+            'error': 'VM service is not enabled (run with dart --enable-vm-service).'
+          }),
+          headers: jsonHeaders);
+    }
+    final keepProfiler = _loopMonitor?.profiling ?? false;
+    try {
+      try {
+        await vm.setProfiler(true);
+      } catch (_) {
+        // 既に有効なら失敗しても構わない
       }
+      final startedAt = DateTime.now();
+      final startUs = developer.Timeline.now;
+      await Future<void>.delayed(Duration(seconds: seconds));
+      final endUs = developer.Timeline.now;
+      final res = await vm.call('getCpuSamples', {
+        'isolateId': isolateId,
+        'timeOriginMicros': startUs,
+        'timeExtentMicros': endUs - startUs,
+      });
+      _log('[profile] captured ${seconds}s, '
+          '${(res['samples'] as List?)?.length ?? 0} samples');
+      final stamp = startedAt
+          .toIso8601String()
+          .split('.')
+          .first
+          .replaceAll(RegExp(r'[-:]'), '');
+      return Response.ok(
+          json.encode(_VmService.toCpuProfile(res, startUs, endUs)),
+          headers: {
+            ...jsonHeaders,
+            'Cache-Control': 'no-store',
+            'Content-Disposition':
+                'attachment; filename="localnode-$stamp.cpuprofile"',
+          });
     } catch (e) {
-      stderr.writeln(
-          'Warning: could not remove thumbnail cache ${_thumbnailCacheDir?.path}: $e');
-      stderr.writeln('  You can remove it manually.');
+      return Response.internalServerError(
+          body: json.encode({'error': 'Profile capture failed: $e'}),
+          headers: jsonHeaders);
+    } finally {
+      if (!keepProfiler) {
+        try {
+          await vm.setProfiler(false);
+        } catch (_) {}
+      }
+      _profiling = false;
     }
   }
 
@@ -2147,7 +5857,7 @@ class _CliServer {
   //       生きていないものを削除する。長寿の常駐サーバを巻き込まないよう
   //       mtime ベースの judge は使わず、PID 生存チェック一本でいく。
   // #269: Unix のみ、ディレクトリのパーミッションを 700 に制限
-  void _chmodDir(Directory dir) {
+  static void _chmodDir(Directory dir) {
     if (Platform.isWindows) return;
     try {
       Process.runSync('chmod', ['700', dir.path], runInShell: false);
@@ -2155,7 +5865,7 @@ class _CliServer {
   }
 
   // #269: Unix のみ、ファイルのパーミッションを 600 に制限
-  void _chmodFile(File file) {
+  static void _chmodFile(File file) {
     if (Platform.isWindows) return;
     try {
       Process.runSync('chmod', ['600', file.path], runInShell: false);
@@ -2232,6 +5942,11 @@ class _CliServer {
         await Directory.systemTemp.createTemp('${thumbPrefix}${pid}_');
     // #269: 他ユーザーから読めないようにパーミッションを制限
     _chmodDir(_thumbnailCacheDir!);
+    // clipboard blob の本体置き場も同じ方式 (起動ごと・他ユーザー不可)
+    const blobPrefix = 'localnode_cli_clipblobs_';
+    _reapStaleDeployDirs(Directory.systemTemp, blobPrefix);
+    _clipBlobDir = await Directory.systemTemp.createTemp('${blobPrefix}${pid}_');
+    _chmodDir(_clipBlobDir!);
   }
 
   Future<void> _deployAssets() async {
@@ -2276,6 +5991,13 @@ class _CliServer {
     final dest = File(p.join(_webRootDir!.path, 'index.html'));
     if (src != null) {
       await src.copy(dest.path);
+      // index.html と同じ場所にある補助アセット (Service Worker 等) も展開
+      for (final name in _kWebSideAssets) {
+        final side = File(p.join(p.dirname(src.path), name));
+        if (side.existsSync()) {
+          await side.copy(p.join(_webRootDir!.path, name));
+        }
+      }
     } else {
       await dest.writeAsString(_minimalHtml());
       stderr.writeln('Warning: Web assets not found. Using minimal HTML.');
@@ -2336,9 +6058,11 @@ class _CliServer {
         if (_isValidSession(token)) return true;
       }
     }
-    if (_uploadToken != null) {
-      final auth = req.headers['authorization'] ?? '';
-      if (auth == 'Bearer $_uploadToken') return true;
+    final auth = req.headers['authorization'] ?? '';
+    if (_uploadToken != null && auth == 'Bearer $_uploadToken') return true;
+    if (auth.startsWith('Bearer ') &&
+        _apiTokens.containsKey(auth.substring('Bearer '.length))) {
+      return true;
     }
     return false;
   }
@@ -2382,9 +6106,16 @@ class _CliServer {
   // X-Forwarded-For / X-Real-IP はクライアントが自由に詐称でき、LocalNode は
   // 信頼できるリバースプロキシ配下にいる前提ではないため **使わない**。
   // shelf が握っている実 TCP リモートアドレスを使う (詐称不能)。
+  // 例外は HTTP/3 sidecar 経由のリクエストだけ。sidecar は起動ごとの秘密値と
+  // QUIC 側の実アドレスを付けてくるので、ループバックから来て秘密値が一致する
+  // ときに限りそちらを使う (でないと h3 の全クライアントが 127.0.0.1 として
+  // 1 つのロックアウト枠を共有してしまう)。
   String _getClientIp(Request req) {
     final conn = req.context['shelf.io.connection_info'];
     if (conn is HttpConnectionInfo) {
+      if (_isFromHttp3Sidecar(req, conn)) {
+        return req.headers[_kH3Client] ?? 'unknown';
+      }
       return conn.remoteAddress.address;
     }
     return 'unknown';
@@ -2409,15 +6140,78 @@ class _CliServer {
     return exts.contains(p.extension(filename).toLowerCase());
   }
 
+  // 圧縮保存された "<name>.lnz" も同名として扱い、論理名が衝突しない File を返す
   Future<File> _uniqueFile(Directory dir, String filename) async {
+    Future<bool> taken(File f) async =>
+        await f.exists() || await File('${f.path}$kCompressedSuffix').exists();
     var file = File(p.join(dir.path, filename));
-    if (!await file.exists()) return file;
+    if (!await taken(file)) return file;
     final name = p.basenameWithoutExtension(filename);
     final ext = p.extension(filename);
     for (int i = 1;; i++) {
       file = File(p.join(dir.path, '$name ($i)$ext'));
-      if (!await file.exists()) return file;
+      if (!await taken(file)) return file;
+    }
+  }
+
+  // --- 保存時圧縮 (.lnz) ---
+
+  /// 保存時圧縮の対象か。post-action に掛かるファイルはスクリプトが
+  /// 実ファイルを扱うので圧縮しない。
+  bool _shouldCompress(String filename) =>
+      _compressPatterns.any((pat) => _globMatch(pat, filename)) &&
+      !_postActions.any((a) => _globMatch(a.pattern, filename));
+
+  /// .lnz ならシークテーブルを返す (キャッシュ付き)。通常ファイルや
+  /// 形式不正なら null で、呼び出し側は素のファイルとして扱う。
+  Future<SeekableCompressedFile?> _openCompressed(File file) async {
+    if (!file.path.endsWith(kCompressedSuffix)) return null;
+    try {
+      final stat = await file.stat();
+      final mtimeMs = stat.modified.millisecondsSinceEpoch;
+      final cached = _compressedIndexCache[file.path];
+      if (cached != null && cached.size == stat.size && cached.mtimeMs == mtimeMs) {
+        _perf.cache('compressedIndex', true);
+        return cached.index;
+      }
+      _perf.cache('compressedIndex', false);
+      final index = await SeekableCompressedFile.open(file);
+      _compressedIndexCache.remove(file.path);
+      if (_compressedIndexCache.length >= _maxCompressedIndexCache) {
+        _compressedIndexCache.remove(_compressedIndexCache.keys.first);
+      }
+      _compressedIndexCache[file.path] =
+          (size: stat.size, mtimeMs: mtimeMs, index: index);
+      return index;
+    } on FormatException {
+      return null;
+    } on FileSystemException {
+      return null;
+    }
+  }
+
+  /// クライアントに見せる名前 (.lnz を外したもの)
+  String _logicalName(String path, SeekableCompressedFile? lnz) {
+    final name = p.basename(path);
+    return lnz == null
+        ? name
+        : name.substring(0, name.length - kCompressedSuffix.length);
+  }
+
+  Future<int> _logicalLength(File file, SeekableCompressedFile? lnz) async =>
+      lnz?.logicalSize ?? await file.length();
+
+  Stream<List<int>> _openLogicalRead(File file, SeekableCompressedFile? lnz,
+          [int start = 0, int? end]) =>
+      lnz != null ? lnz.openRead(start, end) : file.openRead(start, end);
+
+  Future<Uint8List> _readLogicalBytes(File file, SeekableCompressedFile? lnz,
+      [int? limit]) async {
+    final out = BytesBuilder(copy: false);
+    await for (final chunk in _openLogicalRead(file, lnz, 0, limit)) {
+      out.add(chunk);
     }
+    return out.takeBytes();
   }
 
   Response? _guardDownloadOnly() {
@@ -2591,33 +6385,50 @@ class _CliServer {
           // #173/#188: Bearer トークンによる API 認証（スコープ限定）
           //   - POST /api/upload      … ファイルアップロード（#173）
           //   - POST /api/clipboard   … クリップボードへの送信（#188）
+          //   - POST /api/clipboard/blob … 画像・長文の clipboard 送信
           //   - GET  /api/mentions    … federation @list <child> 用（#220）
+          //   - POST /api/federation/clip-sync … sync peer の anti-entropy (サーバ token のみ)
+          //   - GET  /api/federation/replica/* … フォルダ複製 (サーバ token のみ)
+          //   - POST /api/debug/profile … CPU プロファイル採取 (サーバ token のみ)
+          //   - GET  /api/debug/stats … localnode-cli top (サーバ token のみ)
           // x-fed-origin の有無でスコープを広げない。ヘッダは任意クライアントが
           // 付加できるため、列挙したエンドポイント以外への昇格には使えない。
-          if (_uploadToken != null) {
-            final authHeader = req.headers['authorization'] ?? '';
-            if (authHeader == 'Bearer $_uploadToken') {
-              if ((req.method == 'POST' &&
-                      (path == 'api/upload' || path == 'api/clipboard')) ||
-                  (req.method == 'GET' &&
-                      (path == 'api/mentions' ||
-                          path.startsWith('api/run/'))) ||
-                  (req.method == 'DELETE' &&
-                      path == 'api/cache/thumbnails')) {
-                // F10: x-fed-origin が存在する場合、既知の peer の deviceId と一致するか検証。
-                // 存在しない場合は通常の Bearer 利用（curl 等）として許可。
-                // 一致しない deviceId を使った peer 偽装を防ぐ。
-                final origin = req.headers[_kFedOrigin];
-                if (origin != null &&
-                    !_federationPeers
-                        .any((p) => p.learnedDeviceId == origin)) {
-                  return Response.forbidden(
-                    json.encode({'error': 'Unknown federation origin.'}),
-                    headers: {'Content-Type': 'application/json'},
-                  );
-                }
-                return inner(req);
+          // 名前付き API トークンも同じスコープ。こちらはクォータを適用する。
+          final authHeader = req.headers['authorization'] ?? '';
+          final apiToken = authHeader.startsWith('Bearer ')
+              ? _apiTokens[authHeader.substring('Bearer '.length)]
+              : null;
+          if (apiToken != null ||
+              (_uploadToken != null && authHeader == 'Bearer $_uploadToken')) {
+            if ((req.method == 'POST' &&
+                    (path == 'api/upload' ||
+                        path == 'api/clipboard' ||
+                        path == 'api/clipboard/blob' ||
+                        ((path == 'api/federation/clip-sync' ||
+                                path == 'api/debug/profile') &&
+                            apiToken == null))) ||
+                (req.method == 'GET' &&
+                    (path == 'api/mentions' ||
+                        path.startsWith('api/run/') ||
+                        ((path.startsWith('api/federation/replica/') ||
+                                path == 'api/debug/stats') &&
+                            apiToken == null))) ||
+                (req.method == 'DELETE' &&
+                    path == 'api/cache/thumbnails')) {
+              // F10: x-fed-origin が存在する場合、既知の peer の deviceId と一致するか検証。
+              // 存在しない場合は通常の Bearer 利用（curl 等）として許可。
+              // 一致しない deviceId を使った peer 偽装を防ぐ。
+              final origin = req.headers[_kFedOrigin];
+              if (origin != null &&
+                  !_federationPeers
+                      .any((p) => p.learnedDeviceId == origin)) {
+                return Response.forbidden(
+                  json.encode({'error': 'Unknown federation origin.'}),
+                  headers: {'Content-Type': 'application/json'},
+                );
               }
+              if (apiToken != null) return _withApiTokenQuota(apiToken, req, inner);
+              return inner(req);
             }
           }
 
@@ -2628,6 +6439,59 @@ class _CliServer {
         };
       };
 
+  /// 名前付き API トークンのクォータを適用して inner へ渡す。
+  ///   rate                    超過したら 429 + Retry-After
+  ///   max_concurrent_uploads  POST /api/upload の同時数。超過したら 429
+  ///   max_bytes_per_sec       リクエストボディの読み出しを遅らせて帯域を絞る
+  ///                           (同じトークンの並行リクエストで共有)
+  FutureOr<Response> _withApiTokenQuota(
+      _ApiToken t, Request req, Handler inner) {
+    final now = DateTime.now().millisecondsSinceEpoch;
+    t.lastUsedMs = now;
+    final retryAfter = t.takeRequest(now);
+    if (retryAfter != null) {
+      t.rejectedRate++;
+      return Response(429,
+          body: json.encode({'error': 'Rate limit exceeded.', 'token': t.name}),
+          headers: {
+            'Content-Type': 'application/json',
+            'Retry-After': '$retryAfter',
+          });
+    }
+    final isUpload = req.method == 'POST' && req.url.path == 'api/upload';
+    final maxConc = t.maxConcurrentUploads;
+    if (isUpload && maxConc != null && t.activeUploads >= maxConc) {
+      t.rejectedConcurrency++;
+      return Response(429,
+          body: json.encode({
+            'error': 'Too many concurrent uploads.',
+            'token': t.name,
+            'limit': maxConc,
+          }),
+          headers: {'Content-Type': 'application/json', 'Retry-After': '1'});
+    }
+    t.requests++;
+    final metered = req.change(body: _meterApiTokenBody(t, req.read()));
+    if (!isUpload) return inner(metered);
+    t.activeUploads++;
+    return Future.sync(() => inner(metered))
+        .whenComplete(() => t.activeUploads--);
+  }
+
+  Stream<List<int>> _meterApiTokenBody(
+      _ApiToken t, Stream<List<int>> body) async* {
+    await for (final chunk in body) {
+      t.bytesIn += chunk.length;
+      final wait =
+          t.reserveBytes(chunk.length, DateTime.now().millisecondsSinceEpoch);
+      if (wait > 0) {
+        t.throttledMs += wait;
+        await Future<void>.delayed(Duration(milliseconds: wait));
+      }
+      yield chunk;
+    }
+  }
+
   // --- ハンドラ ---
 
   Future<Response> _authHandler(Request req) async {
@@ -2655,7 +6519,7 @@ class _CliServer {
       );
     }
 
-    final body = await req.readAsString();
+    final body = await _readBodyString(req);
     try {
       final params = json.decode(body) as Map<String, dynamic>;
       if (_pin != null && _constantTimeEquals(params['pin'] as String? ?? '', _pin!)) {
@@ -2704,6 +6568,12 @@ class _CliServer {
       json.encode({
         'startedAt': _startedAt,
         if (myRelationForSender != null) 'relation': myRelationForSender,
+        if (myRelationForSender != null) 'mentionsVersion': _mentionsVersion,
+        // sync peer にだけ clipboard の version vector を見せる
+        if (_isSyncPeerOrigin(origin) &&
+            _uploadToken != null &&
+            req.headers['authorization'] == 'Bearer $_uploadToken')
+          'clipVv': _clipSync.vv,
       }),
       headers: {'Content-Type': 'application/json'},
     );
@@ -2715,6 +6585,75 @@ class _CliServer {
       Response.ok(json.encode({'ok': true}),
           headers: {'Content-Type': 'application/json'});
 
+  // --- 帯域 / RTT プローブ ---
+  //
+  // GET  /api/probe            即時応答 (RTT 計測用の echo)
+  // GET  /api/probe?bytes=N    非圧縮性の N バイトを返す (下り計測)
+  // POST /api/probe            body を読み捨て、受信バイト数と所要時間を返す (上り計測)
+  //
+  // 計測結果がキャッシュや圧縮で歪まないよう no-store + ランダムバイトを使う。
+  static const int _probeMaxBytes = 8 * 1024 * 1024;
+  static const int _probeBlockBytes = 1024 * 1024;
+  Uint8List? _probeBlock;
+
+  Response _probeDownloadHandler(Request req) {
+    const noStore = {'Cache-Control': 'no-store'};
+    final raw = req.requestedUri.queryParameters['bytes'];
+    if (raw == null) {
+      return Response.ok(
+        json.encode({'t': DateTime.now().millisecondsSinceEpoch}),
+        headers: {'Content-Type': 'application/json', ...noStore},
+      );
+    }
+    final n = int.tryParse(raw);
+    if (n == null || n < 1 || n > _probeMaxBytes) {
+      return Response.badRequest(body: 'bytes must be 1..$_probeMaxBytes');
+    }
+    // 1 MiB の乱数ブロックを使い回す (deflate の窓 32KiB より十分大きい)
+    final block = _probeBlock ??= () {
+      final rnd = Random.secure();
+      return Uint8List.fromList(
+          List<int>.generate(_probeBlockBytes, (_) => rnd.nextInt(256)));
+    }();
+    Stream<List<int>> body() async* {
+      var remaining = n;
+      while (remaining > 0) {
+        final len = remaining < block.length ? remaining : block.length;
+        yield Uint8List.sublistView(block, 0, len);
+        remaining -= len;
+      }
+    }
+    return Response.ok(body(), headers: {
+      'Content-Type': 'application/octet-stream',
+      'Content-Length': '$n',
+      ...noStore,
+    });
+  }
+
+  Future<Response> _probeUploadHandler(Request req) async {
+    final declared = req.contentLength;
+    if (declared != null && declared > _probeMaxBytes) {
+      return Response(413,
+          body: json.encode({'error': 'probe body too large'}),
+          headers: {'Content-Type': 'application/json'});
+    }
+    final sw = Stopwatch()..start();
+    var received = 0;
+    await for (final chunk in req.read()) {
+      received += chunk.length;
+      if (received > _probeMaxBytes) {
+        return Response(413,
+            body: json.encode({'error': 'probe body too large'}),
+            headers: {'Content-Type': 'application/json'});
+      }
+    }
+    sw.stop();
+    return Response.ok(
+      json.encode({'bytes': received, 'ms': sw.elapsedMilliseconds}),
+      headers: {'Content-Type': 'application/json', 'Cache-Control': 'no-store'},
+    );
+  }
+
   Response _infoHandler(Request req) {
     final authed = _isAuthenticatedRequest(req);
     return Response.ok(
@@ -2730,6 +6669,9 @@ class _CliServer {
                 : 'randomPin',
         'requiresAuth': _authMode != _AuthMode.noPin,
         'clipboardEnabled': _clipboardEnabled,
+        // Web UI が長文を blob で送るか決めるための上限
+        'clipboardMaxTextLength': _maxTextLength,
+        'clipboardMaxBlobBytes': _maxBlobBytes,
         // #265: deviceId は認証済みリクエストにのみ返す
         // federation heartbeat は Bearer トークン付きで /api/info を叩くため引き続き取得可能
         if (authed) 'deviceId': _deviceId,
@@ -2766,10 +6708,13 @@ class _CliServer {
         return {'name': p.basename(e.path), 'type': 'directory', 'id': id};
       }
       final stat = await e.stat();
+      // 圧縮保存されたファイルは論理名・展開後サイズで見せる
+      final lnz = e is File ? await _openCompressed(e) : null;
       return {
-        'name': p.basename(e.path),
+        'name': _logicalName(e.path, lnz),
         'type': 'file',
-        'size': stat.size,
+        'size': lnz?.logicalSize ?? stat.size,
+        if (lnz != null) 'storedSize': stat.size,
         'modified': stat.modified.toIso8601String(),
         'id': id,
       };
@@ -2860,23 +6805,95 @@ class _CliServer {
       return Response.forbidden('Access denied');
     }
 
-    final file = await _uniqueFile(dir, filename);
+    final logicalFile = await _uniqueFile(dir, filename);
+    if (_shouldCompress(filename)) {
+      return _receiveCompressedUpload(req, logicalFile);
+    }
+    final file = logicalFile;
+    // 監視フォルダが書き込み途中のファイルを拾わないよう、受信中は除外する
+    _uploadsInFlight.add(file.path);
     final sink = file.openWrite();
+    // tee: 親への送信をディスク書き込みと並行して進める
+    final tees = _startTees(req, p.basename(file.path), cl);
     try {
-      await for (final chunk in req.read()) {
-        sink.add(chunk);
-      }
+      await _receiveBody(req, sink.add, tees, flush: sink.flush);
       await sink.close();
+      await _markWatchIngested(file);
       if (_postActions.isNotEmpty) {
         _runPostActions(file.path);
       }
       // #219: 親への転送 (自分が子のとき、かつ受信が federation 由来でない場合)
-      _forwardFileToParents(file, req);
+      if (tees.isEmpty) {
+        _forwardFileToParents(file, req);
+      } else {
+        _completeTees(tees, file, req);
+      }
       return Response.ok('File uploaded: ${p.basename(file.path)}');
     } catch (e) {
+      for (final t in tees) {
+        t.fail(e);
+      }
       await sink.close();
       return Response.internalServerError(body: 'Upload failed: $e');
+    } finally {
+      _uploadsInFlight.remove(file.path);
+    }
+  }
+
+  /// アップロード本文を受け取り、ローカル書き込みと tee の両方へ流す。
+  /// tee は親側の詰まりで待つ。ローカル側は一定量ごとに flush して、
+  /// ディスクが遅いときも書き込みバッファを溜め込まない。
+  Future<void> _receiveBody(Request req, void Function(List<int>) write,
+      List<_TeeForward> tees, {Future<void> Function()? flush}) async {
+    const flushEvery = 4 * 1024 * 1024;
+    var unflushed = 0;
+    await for (final chunk in req.read()) {
+      write(chunk);
+      for (final t in tees) {
+        await t.add(chunk);
+      }
+      unflushed += chunk.length;
+      if (flush != null && unflushed >= flushEvery) {
+        unflushed = 0;
+        await flush();
+      }
+    }
+  }
+
+  /// 保存時圧縮の対象ファイルを受信しながら .lnz に書く。
+  Future<Response> _receiveCompressedUpload(Request req, File logicalFile) async {
+    final file = File('${logicalFile.path}$kCompressedSuffix');
+    final writer =
+        SeekableCompressedWriter(file, frameBytes: _compressFrameBytes);
+    _uploadsInFlight.add(file.path);
+    final cl = int.tryParse(req.headers['content-length'] ?? '');
+    final tees = _startTees(req, p.basename(logicalFile.path), cl);
+    try {
+      await _receiveBody(req, writer.add, tees, flush: writer.flush);
+      await writer.close();
+      await _markWatchIngested(file);
+    } catch (e) {
+      for (final t in tees) {
+        t.fail(e);
+      }
+      await writer.abort();
+      try {
+        await file.delete();
+      } catch (_) {}
+      return Response.internalServerError(body: 'Upload failed: $e');
+    } finally {
+      _uploadsInFlight.remove(file.path);
+    }
+    if (tees.isEmpty) {
+      _forwardFileToParents(file, req);
+    } else {
+      _completeTees(tees, file, req);
     }
+    final stored = await file.length();
+    final lnz = await _openCompressed(file);
+    _log('[compress] ${p.basename(logicalFile.path)} '
+        '${lnz?.logicalSize ?? '?'} -> $stored bytes');
+    return Response.ok('File uploaded: ${p.basename(logicalFile.path)}');
   }
 
   // Windows で .ps1 は powershell.exe 経由で実行
@@ -2911,6 +6928,7 @@ class _CliServer {
     final filename = p.basename(filePath);
     for (final action in _postActions) {
       if (!_globMatch(action.pattern, filename)) continue;
+      _postActionsRunning++;
       () async {
         try {
           final cmd = _buildCommand(action.script, [filePath]);
@@ -2929,6 +6947,8 @@ class _CliServer {
           }
         } catch (e) {
           stderr.writeln('[post-action] Failed to run "${action.script}": $e');
+        } finally {
+          _postActionsRunning--;
         }
       }();
     }
@@ -2945,7 +6965,7 @@ class _CliServer {
     final hasChildren = _federationPeers.any((p) => p.kind == 'child');
     final hasParent = _federationPeers.any((p) => p.kind == 'parent');
     if (hasChildren) {
-      lines.add('  @list <childname> — fetch a child\'s mention list');
+      lines.add('  @list <childname|all> — fetch a child\'s mention list');
       lines.add('  @to <childname|all> <message> — post to a child\'s clipboard');
       lines.add('  @run_to <childname> <alias> — run @run on a child');
     }
@@ -2979,7 +6999,7 @@ class _CliServer {
   }
 
   void _replyToClipboard(String text) {
-    final item = _ClipboardItem(
+    final item = ClipboardEntry(
       id: _generateId(),
       text: text,
       tag: 'mention-result',
@@ -3021,64 +7041,1070 @@ class _CliServer {
       final resolved = await _resolveSharedFile(id);
       if (resolved.error != null) return resolved.error!;
       final file = resolved.file!;
-      final filePath = file.path;
-      final mimeType = _getMimeType(p.basename(filePath));
-      final length = await file.length();
+      final lnz = await _openCompressed(file);
+      final mimeType = _getMimeType(_logicalName(file.path, lnz));
+      final length = await _logicalLength(file, lnz);
+      final modified = (await file.stat()).modified;
+      final etag = _davEtag(length, modified.millisecondsSinceEpoch);
+      final lastModified = HttpDate.format(modified);
       // #200: Range リクエスト対応 (動画サムネ生成等で部分取得を可能に)
-      final rangeHeader = req.headers['range'];
+      // 分割ダウンロードは If-Range を付けてくる。途中で差し替わっていたら全体を返す
+      final ifRange = req.headers['if-range'];
       ({int start, int end})? range;
       try {
-        range = _parseHttpRange(rangeHeader, length);
+        if (ifRange == null || ifRange == etag || ifRange == lastModified) {
+          range = _parseHttpRange(req.headers['range'], length);
+        }
       } on RangeError {
         return Response(416, body: 'Requested Range Not Satisfiable',
             headers: {'Content-Range': 'bytes */$length'});
       }
+      final headers = {
+        'Content-Type': mimeType,
+        'Accept-Ranges': 'bytes',
+        'ETag': etag,
+        'Last-Modified': lastModified,
+      };
       if (range == null) {
-        return Response.ok(file.openRead(), headers: {
-          'Content-Type': mimeType,
-          'Accept-Ranges': 'bytes',
-          'Content-Length': '$length',
+        return Response.ok(_openLogicalRead(file, lnz),
+            headers: {...headers, 'Content-Length': '$length'});
+      }
+      final contentLength = range.end - range.start + 1;
+      return Response(206,
+          body: _openLogicalRead(file, lnz, range.start, range.end + 1),
+          headers: {
+            ...headers,
+            'Content-Length': '$contentLength',
+            'Content-Range': 'bytes ${range.start}-${range.end}/$length',
+          });
+    } catch (e) {
+      return Response.internalServerError(body: 'Download failed: $e');
+    }
+  }
+
+  // #200: Range ヘッダ解析（単一範囲のみ）
+  ({int start, int end})? _parseHttpRange(String? header, int fileLength) {
+    if (header == null || header.isEmpty) return null;
+    if (!header.startsWith('bytes=')) throw RangeError('Invalid range unit');
+    final spec = header.substring('bytes='.length).trim();
+    if (spec.contains(',')) return null;
+    final dash = spec.indexOf('-');
+    if (dash < 0) throw RangeError('Invalid range spec');
+    final startStr = spec.substring(0, dash);
+    final endStr = spec.substring(dash + 1);
+    int start, end;
+    if (startStr.isEmpty) {
+      final suffix = int.tryParse(endStr);
+      if (suffix == null || suffix <= 0) throw RangeError('Invalid suffix');
+      start = (fileLength - suffix).clamp(0, fileLength);
+      end = fileLength - 1;
+    } else {
+      final s = int.tryParse(startStr);
+      if (s == null || s < 0) throw RangeError('Invalid start');
+      start = s;
+      end = endStr.isEmpty ? fileLength - 1 : (int.tryParse(endStr) ?? -1);
+      if (end < 0) throw RangeError('Invalid end');
+      if (end >= fileLength) end = fileLength - 1;
+    }
+    if (start > end || start >= fileLength) throw RangeError('Unsatisfiable');
+    return (start: start, end: end);
+  }
+
+  // --- WebDAV (/dav/) ---
+  //
+  // 共有フォルダを OS のファイルマネージャやメディアプレイヤーからマウント
+  // できるようにする (class 1 + 2)。URL は /dav/<共有ルートからの相対パス>。
+  // 認証は Basic (ユーザー名は任意、パスワードは PIN) か Web UI のセッション
+  // Cookie。PIN の失敗は /api/auth と同じロックアウト枠に数える。
+  // GET は /api/download と同じ Range 処理なので、プレイヤーはシークした分しか
+  // 読まない。PROPFIND はディレクトリ単位の stat 結果をキャッシュから返す。
+  // キャッシュはディレクトリ自身の mtime (エントリの増減で変わる) と短い TTL で
+  // 検証し、WebDAV 経由の書き込みでは即座に捨てる。
+  // Router は PROPFIND 等の独自メソッドを扱えないので、start() で前段に置く。
+
+  bool _webDavEnabled = false;
+  static const String _kDavPrefix = 'dav';
+  static const String _kDavAllow = 'OPTIONS, GET, HEAD, PUT, DELETE, MKCOL, '
+      'COPY, MOVE, PROPFIND, PROPPATCH, LOCK, UNLOCK';
+  static const int _maxDavLocks = 1024;
+  static const int _maxDavListings = 256;
+  static const int _davListingTtlMs = 5000;
+  static const int _maxDavXmlBody = 64 * 1024;
+  final Map<String, _DavLock> _davLocks = {};
+  final Map<String, ({int dirMtimeMs, int fetchedMs, List<_DavEntry> entries})>
+      _davListings = {};
+
+  bool _isDavRequest(Request req) {
+    final segs = req.url.pathSegments;
+    return _webDavEnabled && segs.isNotEmpty && segs.first == _kDavPrefix;
+  }
+
+  Future<Response> _webDavHandler(Request req) async {
+    final denied = _davAuthenticate(req);
+    if (denied != null) return denied;
+    final rel = _davRelPath(req.url.pathSegments.skip(1));
+    if (rel == null) return Response.badRequest(body: 'Invalid path.');
+    try {
+      switch (req.method) {
+        case 'OPTIONS':
+          return Response.ok('', headers: {
+            'DAV': '1, 2',
+            'Allow': _kDavAllow,
+            'MS-Author-Via': 'DAV',
+          });
+        case 'GET':
+        case 'HEAD':
+          return await _davGet(req, rel);
+        case 'PROPFIND':
+          return await _davPropfind(req, rel);
+        case 'PROPPATCH':
+          return await _davProppatch(req, rel);
+        case 'PUT':
+          return await _davPut(req, rel);
+        case 'DELETE':
+          return await _davDelete(req, rel);
+        case 'MKCOL':
+          return await _davMkcol(req, rel);
+        case 'COPY':
+        case 'MOVE':
+          return await _davCopyMove(req, rel, move: req.method == 'MOVE');
+        case 'LOCK':
+          return await _davLock(req, rel);
+        case 'UNLOCK':
+          return _davUnlock(req, rel);
+      }
+      return Response(405, headers: {'Allow': _kDavAllow});
+    } on FileSystemException catch (e) {
+      _log('[dav] ${req.method} /$rel failed: $e');
+      return Response.internalServerError(
+          body: 'WebDAV ${req.method} failed: ${e.message}');
+    }
+  }
+
+  Response? _davAuthenticate(Request req) {
+    if (_authMode == _AuthMode.noPin) return null;
+    final cookieHeader = req.headers['cookie'];
+    if (cookieHeader != null) {
+      for (final c in cookieHeader.split(';')) {
+        final t = c.trim();
+        if (t.startsWith('localnode_session=') &&
+            _isValidSession(t.substring(t.indexOf('=') + 1))) {
+          return null;
+        }
+      }
+    }
+    final unauthorized = Response.unauthorized('Authentication required.',
+        headers: {'WWW-Authenticate': 'Basic realm="LocalNode", charset="UTF-8"'});
+    final auth = req.headers['authorization'] ?? '';
+    // 最初の 1 回は資格情報なしで来るのが普通なので、失敗には数えない
+    if (!auth.toLowerCase().startsWith('basic ')) return unauthorized;
+    final clientIp = _getClientIp(req);
+    final lockout = _lockoutUntil[clientIp];
+    if (lockout != null && DateTime.now().isBefore(lockout)) {
+      final rem = lockout.difference(DateTime.now()).inSeconds;
+      return Response.forbidden('Locked out. Try again in $rem seconds.');
+    }
+    String password;
+    try {
+      final decoded = utf8.decode(base64.decode(auth.substring(6).trim()));
+      password = decoded.substring(decoded.indexOf(':') + 1);
+    } catch (_) {
+      return unauthorized;
+    }
+    if (_pin != null && _constantTimeEquals(password, _pin!)) {
+      _failedAttempts.remove(clientIp);
+      return null;
+    }
+    final attempts = (_failedAttempts[clientIp] ?? 0) + 1;
+    _failedAttempts[clientIp] = attempts;
+    if (attempts >= _maxFailedAttempts) {
+      _lockoutUntil[clientIp] = DateTime.now().add(_lockoutDuration);
+      _failedAttempts.remove(clientIp);
+      return Response.forbidden(
+          'Locked out for ${_lockoutDuration.inMinutes} minutes.');
+    }
+    return unauthorized;
+  }
+
+  /// URL のセグメント (デコード済み) を共有ルートからの相対パスにする。
+  /// '.' / '..' や区切り文字・制御文字を含むものは null
+  String? _davRelPath(Iterable<String> segments) {
+    final parts = <String>[];
+    for (final s in segments) {
+      if (s.isEmpty) continue; // コレクションの末尾スラッシュ
+      if (s == '.' ||
+          s == '..' ||
+          s.contains('/') ||
+          s.contains(r'\') ||
+          (Platform.isWindows && s.contains(':')) ||
+          s.codeUnits.any((c) => c < 32 || c == 127)) {
+        return null;
+      }
+      parts.add(s);
+    }
+    return parts.join('/');
+  }
+
+  /// 新しく作る名前として使えるか (アップロードと同じく Windows 禁止文字は拒否)
+  bool _davNameAllowed(String name) =>
+      !RegExp(r'[\\/:*?"<>|]').hasMatch(name) &&
+      !RegExp(r'^(CON|PRN|AUX|NUL|COM[1-9]|LPT[1-9])(\..+)?$',
+              caseSensitive: false)
+          .hasMatch(name);
+
+  static String _davParentRel(String rel) {
+    final i = rel.lastIndexOf('/');
+    return i < 0 ? '' : rel.substring(0, i);
+  }
+
+  static bool _davIsWithin(String parent, String child) =>
+      parent.isEmpty ? child.isNotEmpty : child.startsWith('$parent/');
+
+  String _davPath(String root, String rel) =>
+      rel.isEmpty ? root : p.joinAll([root, ...rel.split('/')]);
+
+  /// rel を実体に解決する。圧縮保存されたファイルは "<name>.lnz" を返す。
+  /// 存在しなければ entity は null。途中のシンボリックリンクも含めて解決し、
+  /// 共有ルートの外に出るもの (リンク切れを含む) は 403 (_getFilesHandler と同じ検査)。
+  Future<({FileSystemEntity? entity, Response? error})> _davLookup(
+      String root, String rel) async {
+    final denied = (entity: null, error: Response.forbidden('Access denied'));
+    final path = _davPath(root, rel);
+    var target = path;
+    var type = await FileSystemEntity.type(path);
+    if (type == FileSystemEntityType.notFound) {
+      if (await FileSystemEntity.isLink(path)) return denied;
+      target = '$path$kCompressedSuffix';
+      type = await FileSystemEntity.type(target);
+      if (rel.isEmpty || type != FileSystemEntityType.file) {
+        return (entity: null, error: null);
+      }
+    }
+    final FileSystemEntity entity;
+    if (type == FileSystemEntityType.directory) {
+      entity = Directory(target);
+    } else if (type == FileSystemEntityType.file) {
+      entity = File(target);
+    } else {
+      return denied;
+    }
+    try {
+      final canonical = await entity.resolveSymbolicLinks();
+      if (canonical != root && !p.isWithin(root, canonical)) return denied;
+    } on FileSystemException {
+      return denied;
+    }
+    return (entity: entity, error: null);
+  }
+
+  /// 作成先の親がコレクションとして存在するか
+  Future<({Directory? dir, Response? error})> _davParentDir(
+      String root, String rel) async {
+    final parent = await _davLookup(root, _davParentRel(rel));
+    if (parent.error != null) return (dir: null, error: parent.error);
+    final dir = parent.entity;
+    if (dir is! Directory) {
+      return (
+        dir: null,
+        error: Response(409, body: 'Parent collection does not exist.'),
+      );
+    }
+    return (dir: dir, error: null);
+  }
+
+  Future<_DavEntry?> _davEntry(FileSystemEntity e, String root) async {
+    if (e is Link) {
+      try {
+        final canonical = await e.resolveSymbolicLinks();
+        if (!p.isWithin(root, canonical)) return null;
+      } on FileSystemException {
+        return null;
+      }
+    }
+    final stat = await e.stat();
+    final mtimeMs = stat.modified.millisecondsSinceEpoch;
+    if (stat.type == FileSystemEntityType.directory) {
+      return _DavEntry(
+          name: p.basename(e.path),
+          storedPath: e.path,
+          isDir: true,
+          size: 0,
+          mtimeMs: mtimeMs);
+    }
+    if (stat.type != FileSystemEntityType.file) return null;
+    final lnz = await _openCompressed(File(e.path));
+    return _DavEntry(
+        name: _logicalName(e.path, lnz),
+        storedPath: e.path,
+        isDir: false,
+        size: lnz?.logicalSize ?? stat.size,
+        mtimeMs: mtimeMs);
+  }
+
+  Future<List<_DavEntry>> _davList(Directory dir, String root) async {
+    final now = DateTime.now().millisecondsSinceEpoch;
+    final dirMtimeMs = (await dir.stat()).modified.millisecondsSinceEpoch;
+    final cached = _davListings[dir.path];
+    if (cached != null &&
+        cached.dirMtimeMs == dirMtimeMs &&
+        now - cached.fetchedMs < _davListingTtlMs) {
+      _perf.cache('davListing', true);
+      return cached.entries;
+    }
+    _perf.cache('davListing', false);
+    final entries = <_DavEntry>[];
+    await for (final e in dir.list(followLinks: false)) {
+      final entry = await _davEntry(e, root);
+      if (entry != null) entries.add(entry);
+    }
+    _davListings.remove(dir.path);
+    if (_davListings.length >= _maxDavListings) {
+      _davListings.remove(_davListings.keys.first);
+    }
+    _davListings[dir.path] =
+        (dirMtimeMs: dirMtimeMs, fetchedMs: now, entries: entries);
+    return entries;
+  }
+
+  /// path (とその配下) の一覧キャッシュを捨てる
+  void _davInvalidate(String path) {
+    _davListings.removeWhere((k, _) => k == path || p.isWithin(path, k));
+  }
+
+  String _davHref(String rel, bool isDir) {
+    final segs = rel.isEmpty ? const <String>[] : rel.split('/');
+    final path = ['', _kDavPrefix, ...segs.map(Uri.encodeComponent)].join('/');
+    return isDir || rel.isEmpty ? '$path/' : path;
+  }
+
+  static String _davEtag(int size, int mtimeMs) => '"$size-$mtimeMs"';
+
+  static String _xmlText(String s) => const HtmlEscape().convert(s);
+
+  Response _davXml(int status, String body,
+          {Map<String, String> headers = const {}}) =>
+      Response(status,
+          body: '<?xml version="1.0" encoding="utf-8"?>\n$body',
+          headers: {'Content-Type': 'application/xml; charset=utf-8', ...headers});
+
+  Future<String?> _davReadXmlBody(Request req) async {
+    final cl = int.tryParse(req.headers['content-length'] ?? '');
+    if (cl != null && cl > _maxDavXmlBody) return null;
+    final lease = req.context[_kBodyLease];
+    final out = BytesBuilder(copy: false);
+    await for (final chunk in req.read()) {
+      out.add(chunk);
+      if (lease is _MemLease) lease.add(chunk.length);
+      if (out.length > _maxDavXmlBody) return null;
+    }
+    return utf8.decode(out.takeBytes(), allowMalformed: true);
+  }
+
+  Future<Response> _davGet(Request req, String rel) async {
+    final root = await Directory(_storagePath!).resolveSymbolicLinks();
+    final found = await _davLookup(root, rel);
+    if (found.error != null) return found.error!;
+    final entity = found.entity;
+    if (entity == null) return Response.notFound('Not found.');
+    if (entity is Directory) {
+      // ブラウザで開いたとき用の簡易一覧
+      final html = StringBuffer('<!DOCTYPE html><meta charset="utf-8"><ul>');
+      for (final e in await _davList(entity, root)) {
+        final href = _davHref(rel.isEmpty ? e.name : '$rel/${e.name}', e.isDir);
+        html.write('<li><a href="${_xmlText(href)}">'
+            '${_xmlText(e.name)}${e.isDir ? '/' : ''}</a></li>');
+      }
+      html.write('</ul>');
+      return Response.ok(html.toString(),
+          headers: {'Content-Type': 'text/html; charset=utf-8'});
+    }
+    final file = entity as File;
+    final lnz = await _openCompressed(file);
+    final stat = await file.stat();
+    final length = await _logicalLength(file, lnz);
+    final etag = _davEtag(length, stat.modified.millisecondsSinceEpoch);
+    final headers = {
+      'Content-Type': _getMimeType(_logicalName(file.path, lnz)),
+      'Accept-Ranges': 'bytes',
+      'ETag': etag,
+      'Last-Modified': HttpDate.format(stat.modified),
+    };
+    if (req.headers['if-none-match'] == etag) {
+      return Response.notModified(headers: {'ETag': etag});
+    }
+    // If-Range が現在の ETag と違えば (途中で差し替わった) 全体を返す
+    final ifRange = req.headers['if-range'];
+    ({int start, int end})? range;
+    try {
+      if (ifRange == null || ifRange == etag) {
+        range = _parseHttpRange(req.headers['range'], length);
+      }
+    } on RangeError {
+      return Response(416, body: 'Requested Range Not Satisfiable',
+          headers: {'Content-Range': 'bytes */$length'});
+    }
+    // HEAD ではファイルを開かない (dart:io は本文を捨てるが読みはする)
+    final head = req.method == 'HEAD';
+    if (range == null) {
+      return Response.ok(
+          head ? const Stream<List<int>>.empty() : _openLogicalRead(file, lnz),
+          headers: {...headers, 'Content-Length': '$length'});
+    }
+    return Response(206,
+        body: head
+            ? const Stream<List<int>>.empty()
+            : _openLogicalRead(file, lnz, range.start, range.end + 1),
+        headers: {
+          ...headers,
+          'Content-Length': '${range.end - range.start + 1}',
+          'Content-Range': 'bytes ${range.start}-${range.end}/$length',
         });
+  }
+
+  Future<Response> _davPropfind(Request req, String rel) async {
+    // 要求されたプロパティは見ず、常に allprop 相当を返す
+    await req.read().drain<void>();
+    final depth = req.headers['depth'] ?? 'infinity';
+    if (depth != '0' && depth != '1') {
+      return _davXml(403,
+          '<D:error xmlns:D="DAV:"><D:propfind-finite-depth/></D:error>');
+    }
+    final root = await Directory(_storagePath!).resolveSymbolicLinks();
+    final found = await _davLookup(root, rel);
+    if (found.error != null) return found.error!;
+    final entity = found.entity;
+    if (entity == null) return Response.notFound('Not found.');
+    final self = await _davEntry(entity, root);
+    if (self == null) return Response.notFound('Not found.');
+    _davExpireLocks();
+    final out = StringBuffer('<D:multistatus xmlns:D="DAV:">');
+    _davWriteResponse(out, rel, self);
+    if (depth == '1' && entity is Directory) {
+      for (final child in await _davList(entity, root)) {
+        _davWriteResponse(
+            out, rel.isEmpty ? child.name : '$rel/${child.name}', child);
+      }
+    }
+    out.write('</D:multistatus>');
+    return _davXml(207, out.toString());
+  }
+
+  void _davWriteResponse(StringBuffer out, String rel, _DavEntry e) {
+    final mtime = DateTime.fromMillisecondsSinceEpoch(e.mtimeMs, isUtc: true);
+    out
+      ..write('<D:response><D:href>${_xmlText(_davHref(rel, e.isDir))}</D:href>')
+      ..write('<D:propstat><D:prop>')
+      ..write('<D:displayname>${_xmlText(e.name)}</D:displayname>')
+      ..write('<D:creationdate>${mtime.toIso8601String()}</D:creationdate>')
+      ..write('<D:getlastmodified>${HttpDate.format(mtime)}</D:getlastmodified>');
+    if (e.isDir) {
+      out.write('<D:resourcetype><D:collection/></D:resourcetype>');
+    } else {
+      out
+        ..write('<D:resourcetype/>')
+        ..write('<D:getcontentlength>${e.size}</D:getcontentlength>')
+        ..write('<D:getcontenttype>${_getMimeType(e.name)}</D:getcontenttype>')
+        ..write('<D:getetag>${_xmlText(_davEtag(e.size, e.mtimeMs))}</D:getetag>');
+    }
+    out
+      ..write('<D:supportedlock>')
+      ..write('<D:lockentry><D:lockscope><D:exclusive/></D:lockscope>'
+          '<D:locktype><D:write/></D:locktype></D:lockentry>')
+      ..write('<D:lockentry><D:lockscope><D:shared/></D:lockscope>'
+          '<D:locktype><D:write/></D:locktype></D:lockentry>')
+      ..write('</D:supportedlock><D:lockdiscovery>');
+    for (final l in _davLocks.values) {
+      if (_davLockCovers(l, rel)) out.write(_davActiveLockXml(l));
+    }
+    out.write('</D:lockdiscovery></D:prop>'
+        '<D:status>HTTP/1.1 200 OK</D:status></D:propstat></D:response>');
+  }
+
+  /// デッドプロパティは保持しない。Windows がコピー時に送る
+  /// Win32LastModifiedTime だけファイルの mtime に反映し、他は受理したことに
+  /// して 200 を返す (403 を返すと Explorer がコピー自体を失敗扱いにする)。
+  Future<Response> _davProppatch(Request req, String rel) async {
+    final guard = _guardDownloadOnly();
+    if (guard != null) return guard;
+    final locked = _davCheckLocks(req, rel);
+    if (locked != null) return locked;
+    final body = await _davReadXmlBody(req);
+    if (body == null) return Response(413, body: 'Request body too large.');
+    final root = await Directory(_storagePath!).resolveSymbolicLinks();
+    final found = await _davLookup(root, rel);
+    if (found.error != null) return found.error!;
+    final entity = found.entity;
+    if (entity == null) return Response.notFound('Not found.');
+
+    final namespaces = {
+      for (final m
+          in RegExp(r'xmlns(?::([\w.-]+))?="([^"]*)"').allMatches(body))
+        m.group(1) ?? '': m.group(2)!,
+    };
+    final props = <({String ns, String name, String? value})>[];
+    final propBlock =
+        RegExp(r'<(?:[\w.-]+:)?prop\b[^>]*>([\s\S]*?)</(?:[\w.-]+:)?prop>');
+    final element = RegExp(
+        r'<(?:([\w.-]+):)?([\w.-]+)\b[^>]*?(?:/>|>([^<]*)</(?:[\w.-]+:)?\2>)');
+    for (final block in propBlock.allMatches(body)) {
+      for (final m in element.allMatches(block.group(1)!)) {
+        props.add((
+          ns: namespaces[m.group(1) ?? ''] ?? '',
+          name: m.group(2)!,
+          value: m.group(3),
+        ));
+      }
+    }
+    for (final prop in props) {
+      if (prop.ns == 'urn:schemas-microsoft-com:' &&
+          prop.name == 'Win32LastModifiedTime' &&
+          prop.value != null &&
+          entity is File) {
+        try {
+          await entity.setLastModified(HttpDate.parse(prop.value!.trim()));
+          _davInvalidate(entity.parent.path);
+        } on HttpException {
+          // 書式が違うものは無視する
+        }
+      }
+    }
+    final out = StringBuffer('<D:multistatus xmlns:D="DAV:"><D:response>'
+        '<D:href>${_xmlText(_davHref(rel, entity is Directory))}</D:href>'
+        '<D:propstat><D:prop>');
+    for (final prop in props) {
+      out.write(prop.ns.isEmpty
+          ? '<${prop.name} xmlns=""/>'
+          : '<x:${prop.name} xmlns:x="${_xmlText(prop.ns)}"/>');
+    }
+    out.write('</D:prop><D:status>HTTP/1.1 200 OK</D:status></D:propstat>'
+        '</D:response></D:multistatus>');
+    return _davXml(207, out.toString());
+  }
+
+  /// 本文を一時ファイルに受けてから置き換えるので、読み手が書きかけの
+  /// ファイルを見ることはない。保存時圧縮・post-action・親への転送は
+  /// /api/upload と同じ。ただし Finder 等が中身より先に作る 0 バイトの
+  /// ファイルと隠しファイル (._* / .DS_Store) は post-action と転送の対象外。
+  Future<Response> _davPut(Request req, String rel) async {
+    final guard = _guardDownloadOnly();
+    if (guard != null) return guard;
+    if (rel.isEmpty) return Response(405, headers: {'Allow': _kDavAllow});
+    final name = rel.split('/').last;
+    if (!_davNameAllowed(name)) {
+      return Response.badRequest(body: 'Invalid filename.');
+    }
+    final locked = _davCheckLocks(req, rel);
+    if (locked != null) return locked;
+    final limit = _maxDirectUploadBytes;
+    final cl = int.tryParse(req.headers['content-length'] ?? '');
+    if (limit != null && cl != null && cl > limit) {
+      return Response(413,
+          body: 'Upload exceeds server limit of $limit bytes.');
+    }
+    final root = await Directory(_storagePath!).resolveSymbolicLinks();
+    final found = await _davLookup(root, rel);
+    if (found.error != null) return found.error!;
+    final existing = found.entity;
+    if (existing is Directory) {
+      return Response(405, body: 'Cannot PUT to a collection.');
+    }
+    final parent = await _davParentDir(root, rel);
+    if (parent.error != null) return parent.error!;
+    final dir = parent.dir!;
+
+    final compress = _shouldCompress(name);
+    final stored = p.join(dir.path, compress ? '$name$kCompressedSuffix' : name);
+    final tmp = File(p.join(dir.path,
+        '.$name.${_generateId().replaceAll(RegExp(r'[^A-Za-z0-9]'), '')}.davpart'));
+    _uploadsInFlight
+      ..add(tmp.path)
+      ..add(stored);
+    final writer = compress
+        ? SeekableCompressedWriter(tmp, frameBytes: _compressFrameBytes)
+        : null;
+    final sink = writer == null ? tmp.openWrite() : null;
+    var received = 0;
+    var unflushed = 0;
+    try {
+      await for (final chunk in req.read()) {
+        received += chunk.length;
+        if (limit != null && received > limit) {
+          throw _DavTooLarge();
+        }
+        if (writer != null) {
+          writer.add(chunk);
+        } else {
+          sink!.add(chunk);
+          unflushed += chunk.length;
+          if (unflushed >= 4 * 1024 * 1024) {
+            unflushed = 0;
+            await sink.flush();
+          }
+        }
+      }
+      await writer?.close();
+      await sink?.close();
+      // 圧縮の有無が前回と変わったら古い方を消す
+      if (existing != null && existing.path != stored) {
+        await existing.delete();
+      }
+      if (Platform.isWindows && await File(stored).exists()) {
+        await File(stored).delete();
+      }
+      await tmp.rename(stored);
+    } catch (e) {
+      await writer?.abort();
+      try {
+        await sink?.close();
+      } catch (_) {}
+      try {
+        await tmp.delete();
+      } catch (_) {}
+      if (e is _DavTooLarge) {
+        return Response(413,
+            body: 'Upload exceeds server limit of $limit bytes.');
+      }
+      rethrow;
+    } finally {
+      _uploadsInFlight
+        ..remove(tmp.path)
+        ..remove(stored);
+    }
+    _davInvalidate(dir.path);
+    final thumb = File(
+        p.join(_thumbnailCacheDir!.path, '${_thumbCacheKey(stored)}.jpg'));
+    if (await thumb.exists()) await thumb.delete();
+    final file = File(stored);
+    await _markWatchIngested(file);
+    if (received > 0 && !name.startsWith('.')) {
+      if (!compress && _postActions.isNotEmpty) _runPostActions(stored);
+      _forwardFileToParents(file, req);
+    }
+    _log('[dav] PUT /$rel ($received bytes)');
+    return Response(existing == null ? 201 : 204);
+  }
+
+  Future<Response> _davDelete(Request req, String rel) async {
+    final guard = _guardDownloadOnly();
+    if (guard != null) return guard;
+    if (rel.isEmpty) return Response.forbidden('Cannot delete the share root.');
+    final locked = _davCheckLocks(req, rel, deep: true);
+    if (locked != null) return locked;
+    final root = await Directory(_storagePath!).resolveSymbolicLinks();
+    final found = await _davLookup(root, rel);
+    if (found.error != null) return found.error!;
+    final entity = found.entity;
+    if (entity == null) return Response.notFound('Not found.');
+    await _davRemove(entity);
+    _davInvalidate(entity.parent.path);
+    _davLocks.removeWhere((_, l) => l.path == rel || _davIsWithin(rel, l.path));
+    return Response(204);
+  }
+
+  Future<void> _davRemove(FileSystemEntity entity) async {
+    if (entity is Directory) {
+      await entity.delete(recursive: true);
+      _davInvalidate(entity.path);
+      return;
+    }
+    await entity.delete();
+    final thumb = File(p.join(
+        _thumbnailCacheDir!.path, '${_thumbCacheKey(entity.path)}.jpg'));
+    if (await thumb.exists()) await thumb.delete();
+  }
+
+  Future<Response> _davMkcol(Request req, String rel) async {
+    final guard = _guardDownloadOnly();
+    if (guard != null) return guard;
+    if (await req.read().any((chunk) => chunk.isNotEmpty)) {
+      return Response(415, body: 'MKCOL with a body is not supported.');
+    }
+    if (rel.isEmpty) return Response(405, headers: {'Allow': _kDavAllow});
+    if (!_davNameAllowed(rel.split('/').last)) {
+      return Response.badRequest(body: 'Invalid name.');
+    }
+    final locked = _davCheckLocks(req, rel);
+    if (locked != null) return locked;
+    final root = await Directory(_storagePath!).resolveSymbolicLinks();
+    final found = await _davLookup(root, rel);
+    if (found.error != null) return found.error!;
+    if (found.entity != null) {
+      return Response(405, body: 'Resource already exists.');
+    }
+    final parent = await _davParentDir(root, rel);
+    if (parent.error != null) return parent.error!;
+    await Directory(_davPath(root, rel)).create();
+    _davInvalidate(parent.dir!.path);
+    return Response(201);
+  }
+
+  Future<Response> _davCopyMove(Request req, String rel,
+      {required bool move}) async {
+    final guard = _guardDownloadOnly();
+    if (guard != null) return guard;
+    final destUri = Uri.tryParse(req.headers['destination'] ?? '');
+    if (destUri == null) {
+      return Response.badRequest(body: 'Destination header is required.');
+    }
+    final destSegs = destUri.pathSegments;
+    if (destSegs.isEmpty || destSegs.first != _kDavPrefix) {
+      return Response(502, body: 'Destination is outside this share.');
+    }
+    final destRel = _davRelPath(destSegs.skip(1));
+    if (destRel == null || destRel.isEmpty) {
+      return Response.badRequest(body: 'Invalid destination.');
+    }
+    if (!_davNameAllowed(destRel.split('/').last)) {
+      return Response.badRequest(body: 'Invalid destination name.');
+    }
+    if (rel.isEmpty || destRel == rel || _davIsWithin(rel, destRel)) {
+      return Response.forbidden('Cannot copy or move a collection into itself.');
+    }
+    final overwrite = (req.headers['overwrite'] ?? 'T').toUpperCase() != 'F';
+    if (move) {
+      final locked = _davCheckLocks(req, rel, deep: true);
+      if (locked != null) return locked;
+    }
+    final destLocked = _davCheckLocks(req, destRel, deep: true);
+    if (destLocked != null) return destLocked;
+
+    final root = await Directory(_storagePath!).resolveSymbolicLinks();
+    final src = await _davLookup(root, rel);
+    if (src.error != null) return src.error!;
+    final source = src.entity;
+    if (source == null) return Response.notFound('Not found.');
+    final dst = await _davLookup(root, destRel);
+    if (dst.error != null) return dst.error!;
+    final parent = await _davParentDir(root, destRel);
+    if (parent.error != null) return parent.error!;
+    final existing = dst.entity;
+    if (existing != null) {
+      if (!overwrite) {
+        return Response(412, body: 'Destination exists and Overwrite is F.');
+      }
+      await _davRemove(existing);
+    }
+
+    // 圧縮保存されたファイルは保存形式のまま (.lnz 付きで) 複製・移動する
+    final compressed = source is File && source.path.endsWith(kCompressedSuffix) &&
+        !rel.endsWith(kCompressedSuffix);
+    final destPath =
+        _davPath(root, destRel) + (compressed ? kCompressedSuffix : '');
+    if (move) {
+      await source.rename(destPath);
+      if (source is File) {
+        final thumb = File(p.join(
+            _thumbnailCacheDir!.path, '${_thumbCacheKey(source.path)}.jpg'));
+        if (await thumb.exists()) await thumb.delete();
+      }
+      _davInvalidate(source.path);
+      _davInvalidate(source.parent.path);
+      _davLocks.removeWhere(
+          (_, l) => l.path == rel || _davIsWithin(rel, l.path));
+    } else if (source is Directory) {
+      final shallow = req.headers['depth'] == '0';
+      await _davCopyTree(source, destPath, shallow: shallow);
+    } else {
+      await (source as File).copy(destPath);
+    }
+    _davInvalidate(destPath);
+    _davInvalidate(parent.dir!.path);
+    return Response(existing == null ? 201 : 204);
+  }
+
+  Future<void> _davCopyTree(Directory src, String destPath,
+      {bool shallow = false}) async {
+    await Directory(destPath).create();
+    if (shallow) return;
+    await for (final e in src.list(followLinks: false)) {
+      final target = p.join(destPath, p.basename(e.path));
+      if (e is Directory) {
+        await _davCopyTree(e, target);
+      } else if (e is File) {
+        await e.copy(target);
+      }
+      // リンクは複製しない (共有ルートの外を指しうる)
+    }
+  }
+
+  // --- WebDAV ロック ---
+
+  void _davExpireLocks() {
+    final now = DateTime.now().millisecondsSinceEpoch;
+    _davLocks.removeWhere((_, l) => l.expiresMs < now);
+  }
+
+  bool _davLockCovers(_DavLock l, String rel) =>
+      l.path == rel || (l.deep && _davIsWithin(l.path, rel));
+
+  /// rel (deep なら配下も) に掛かっているロックのうち、If ヘッダにトークンが
+  /// 無いものがあれば 423 を返す
+  Response? _davCheckLocks(Request req, String rel, {bool deep = false}) {
+    _davExpireLocks();
+    if (_davLocks.isEmpty) return null;
+    final ifHeader = req.headers['if'] ?? '';
+    for (final l in _davLocks.values) {
+      final applies =
+          _davLockCovers(l, rel) || (deep && _davIsWithin(rel, l.path));
+      if (applies && !ifHeader.contains(l.token)) {
+        return _davXml(
+            423,
+            '<D:error xmlns:D="DAV:"><D:lock-token-submitted><D:href>'
+            '${_xmlText(_davHref(l.path, false))}'
+            '</D:href></D:lock-token-submitted></D:error>');
+      }
+    }
+    return null;
+  }
+
+  /// "Second-600" / "Infinite" の候補列から選ぶ。上限 1 時間
+  static int _davTimeoutSec(String? header) {
+    for (final part in (header ?? '').split(',')) {
+      final t = part.trim().toLowerCase();
+      if (t == 'infinite') return 3600;
+      if (t.startsWith('second-')) {
+        final n = int.tryParse(t.substring('second-'.length));
+        if (n != null && n > 0) return min(n, 3600);
+      }
+    }
+    return 600;
+  }
+
+  String _davActiveLockXml(_DavLock l) =>
+      '<D:activelock><D:locktype><D:write/></D:locktype>'
+      '<D:lockscope>${l.exclusive ? '<D:exclusive/>' : '<D:shared/>'}</D:lockscope>'
+      '<D:depth>${l.deep ? 'infinity' : '0'}</D:depth>'
+      '${l.owner == null ? '' : '<D:owner>${_xmlText(l.owner!)}</D:owner>'}'
+      '<D:timeout>Second-${l.timeoutSec}</D:timeout>'
+      '<D:locktoken><D:href>${l.token}</D:href></D:locktoken>'
+      '<D:lockroot><D:href>${_xmlText(_davHref(l.path, false))}</D:href></D:lockroot>'
+      '</D:activelock>';
+
+  Future<Response> _davLock(Request req, String rel) async {
+    // 書き込めないサーバでロックを渡すと、クライアントは書けるものと思い込む
+    final guard = _guardDownloadOnly();
+    if (guard != null) return guard;
+    final body = await _davReadXmlBody(req);
+    if (body == null) return Response(413, body: 'Request body too large.');
+    final timeout = _davTimeoutSec(req.headers['timeout']);
+    _davExpireLocks();
+
+    if (body.trim().isEmpty) {
+      // 本文なし = 更新。If ヘッダで対象のロックを指定する
+      final ifHeader = req.headers['if'] ?? '';
+      final lock = _davLocks.values.firstWhereOrNullExt(
+          (l) => ifHeader.contains(l.token) && _davLockCovers(l, rel));
+      if (lock == null) return Response(412, body: 'No matching lock.');
+      lock.refresh(timeout);
+      return _davXml(200,
+          '<D:prop xmlns:D="DAV:"><D:lockdiscovery>${_davActiveLockXml(lock)}'
+          '</D:lockdiscovery></D:prop>');
+    }
+
+    final exclusive = !RegExp(r'<(?:[\w.-]+:)?shared\b').hasMatch(body);
+    final deep = (req.headers['depth'] ?? 'infinity') != '0';
+    final ownerMatch =
+        RegExp(r'<(?:[\w.-]+:)?owner\b[^>]*>([\s\S]*?)</(?:[\w.-]+:)?owner>')
+            .firstMatch(body);
+    final owner = ownerMatch?.group(1)?.replaceAll(RegExp(r'<[^>]*>'), '').trim();
+    for (final l in _davLocks.values) {
+      final overlaps = _davLockCovers(l, rel) || (deep && _davIsWithin(rel, l.path));
+      if (overlaps && (l.exclusive || exclusive)) {
+        return _davXml(423,
+            '<D:error xmlns:D="DAV:"><D:no-conflicting-lock/></D:error>');
+      }
+    }
+    if (_davLocks.length >= _maxDavLocks) {
+      return Response(503, body: 'Too many active locks.');
+    }
+
+    final root = await Directory(_storagePath!).resolveSymbolicLinks();
+    final found = await _davLookup(root, rel);
+    if (found.error != null) return found.error!;
+    var status = 200;
+    if (found.entity == null) {
+      // 存在しないパスのロックは空ファイルを作る (RFC 4918 §7.3)
+      if (!_davNameAllowed(rel.split('/').last)) {
+        return Response.badRequest(body: 'Invalid filename.');
+      }
+      final parent = await _davParentDir(root, rel);
+      if (parent.error != null) return parent.error!;
+      await File(_davPath(root, rel)).create();
+      _davInvalidate(parent.dir!.path);
+      status = 201;
+    }
+    final lock = _DavLock(
+      token: 'opaquelocktoken:${_generateUuidV4()}',
+      path: rel,
+      exclusive: exclusive,
+      deep: deep,
+      owner: owner == null || owner.isEmpty ? null : owner,
+      timeoutSec: timeout,
+    );
+    _davLocks[lock.token] = lock;
+    return _davXml(
+        status,
+        '<D:prop xmlns:D="DAV:"><D:lockdiscovery>${_davActiveLockXml(lock)}'
+        '</D:lockdiscovery></D:prop>',
+        headers: {'Lock-Token': '<${lock.token}>'});
+  }
+
+  Response _davUnlock(Request req, String rel) {
+    final token =
+        (req.headers['lock-token'] ?? '').replaceAll(RegExp(r'[<>\s]'), '');
+    final lock = _davLocks[token];
+    if (lock == null || !_davLockCovers(lock, rel)) {
+      return _davXml(409,
+          '<D:error xmlns:D="DAV:"><D:lock-token-matches-request-uri/></D:error>');
+    }
+    _davLocks.remove(token);
+    return Response(204);
+  }
+
+  // --- 署名付き共有リンク (/s/<token>) ---
+  //
+  // トークンの形式は lib/src/share_token.dart。
+  // payload: { i: ファイル id, e: 期限 (epoch 秒), s: サイズ, m: mtime (ms),
+  //            r: [start, end] (任意、配信を許すバイト範囲) }
+  // サイズと mtime を含めるので、ファイルが差し替わったリンクは 410 になり、
+  // 同じ URL が別の内容を返すことはない (immutable でキャッシュさせられる)。
+
+  static List<int> _randomShareSecret() {
+    final r = Random.secure();
+    return List<int>.generate(32, (_) => r.nextInt(256));
+  }
+
+  Future<Response> _createShareLinkHandler(Request req) async {
+    Map<String, dynamic> params;
+    try {
+      final dec = json.decode(await _readBodyString(req));
+      if (dec is! Map) throw const FormatException('not an object');
+      params = Map<String, dynamic>.from(dec);
+    } catch (_) {
+      return Response.badRequest(body: 'Invalid JSON.');
+    }
+    final id = params['id'];
+    if (id is! String || id.isEmpty) {
+      return Response.badRequest(body: 'id is required.');
+    }
+    final resolved = await _resolveSharedFile(id);
+    if (resolved.error != null) return resolved.error!;
+    final stat = await resolved.file!.stat();
+    if (stat.type != FileSystemEntityType.file) {
+      return Response.badRequest(body: 'Only files can be shared.');
+    }
+
+    final ttlRaw = params['ttlSeconds'];
+    var ttl = _shareDefaultTtl;
+    if (ttlRaw != null) {
+      if (ttlRaw is! int || ttlRaw <= 0 || ttlRaw > _shareMaxTtl.inSeconds) {
+        return Response.badRequest(
+            body: 'ttlSeconds must be 1..${_shareMaxTtl.inSeconds}.');
       }
-      final contentLength = range.end - range.start + 1;
-      return Response(206, body: file.openRead(range.start, range.end + 1),
-          headers: {
-            'Content-Type': mimeType,
-            'Accept-Ranges': 'bytes',
-            'Content-Length': '$contentLength',
-            'Content-Range': 'bytes ${range.start}-${range.end}/$length',
-          });
-    } catch (e) {
-      return Response.internalServerError(body: 'Download failed: $e');
+      ttl = Duration(seconds: ttlRaw);
+    }
+
+    final payload = <String, dynamic>{
+      'i': id,
+      'e': DateTime.now().add(ttl).millisecondsSinceEpoch ~/ 1000,
+      's': stat.size,
+      'm': stat.modified.millisecondsSinceEpoch,
+    };
+    final logicalSize = await _logicalLength(
+        resolved.file!, await _openCompressed(resolved.file!));
+    final start = params['start'];
+    final end = params['end'];
+    if (start != null || end != null) {
+      if (start is! int || end is! int ||
+          start < 0 || start > end || end >= logicalSize) {
+        return Response.badRequest(
+            body: 'start/end must satisfy 0 <= start <= end < size.');
+      }
+      payload['r'] = [start, end];
     }
+
+    final token = _shareTokens.encode(payload);
+    _log('[share] issued ${p.basename(resolved.file!.path)} ttl=${ttl.inSeconds}s'
+        '${payload['r'] != null ? ' range=$start-$end' : ''}');
+    return Response.ok(
+      json.encode({
+        'url': '/s/$token',
+        'expiresAt': (payload['e'] as int) * 1000,
+      }),
+      headers: {'Content-Type': 'application/json'},
+    );
   }
 
-  // #200: Range ヘッダ解析（単一範囲のみ）
-  ({int start, int end})? _parseHttpRange(String? header, int fileLength) {
-    if (header == null || header.isEmpty) return null;
-    if (!header.startsWith('bytes=')) throw RangeError('Invalid range unit');
-    final spec = header.substring('bytes='.length).trim();
-    if (spec.contains(',')) return null;
-    final dash = spec.indexOf('-');
-    if (dash < 0) throw RangeError('Invalid range spec');
-    final startStr = spec.substring(0, dash);
-    final endStr = spec.substring(dash + 1);
-    int start, end;
-    if (startStr.isEmpty) {
-      final suffix = int.tryParse(endStr);
-      if (suffix == null || suffix <= 0) throw RangeError('Invalid suffix');
-      start = (fileLength - suffix).clamp(0, fileLength);
-      end = fileLength - 1;
-    } else {
-      final s = int.tryParse(startStr);
-      if (s == null || s < 0) throw RangeError('Invalid start');
-      start = s;
-      end = endStr.isEmpty ? fileLength - 1 : (int.tryParse(endStr) ?? -1);
-      if (end < 0) throw RangeError('Invalid end');
-      if (end >= fileLength) end = fileLength - 1;
+  Future<Response> _shareLinkHandler(Request req, String token) async {
+    final payload = _shareTokens.decode(token);
+    if (payload == null) return Response.notFound('Invalid share link.');
+
+    final String id;
+    final int expSec, size, mtimeMs;
+    List<dynamic>? window;
+    try {
+      id = payload['i'] as String;
+      expSec = payload['e'] as int;
+      size = payload['s'] as int;
+      mtimeMs = payload['m'] as int;
+      window = payload['r'] as List<dynamic>?;
+    } catch (_) {
+      return Response.notFound('Invalid share link.');
+    }
+    final remaining = expSec - DateTime.now().millisecondsSinceEpoch ~/ 1000;
+    if (remaining <= 0) return Response(410, body: 'Share link has expired.');
+
+    final resolved = await _resolveSharedFile(id);
+    if (resolved.error != null) return resolved.error!;
+    final file = resolved.file!;
+    final stat = await file.stat();
+    if (stat.size != size || stat.modified.millisecondsSinceEpoch != mtimeMs) {
+      return Response(410, body: 'Shared file has changed.');
+    }
+
+    // 範囲付きリンクはその範囲を 1 つのリソースとして扱う
+    // (s / m は保存上のサイズ・mtime。長さは圧縮保存なら展開後で数える)
+    final lnz = await _openCompressed(file);
+    final base = window == null ? 0 : window[0] as int;
+    final length = window == null
+        ? await _logicalLength(file, lnz)
+        : (window[1] as int) - base + 1;
+    final etag = '"${size.toRadixString(36)}-${mtimeMs.toRadixString(36)}'
+        '${window == null ? '' : '-${base.toRadixString(36)}-${length.toRadixString(36)}'}"';
+    final name = _logicalName(file.path, lnz);
+    final headers = {
+      'Content-Type': _getMimeType(name),
+      'Content-Disposition':
+          "attachment; filename*=UTF-8''${Uri.encodeComponent(name)}",
+      'Accept-Ranges': 'bytes',
+      'ETag': etag,
+      'Last-Modified': HttpDate.format(stat.modified),
+      'Cache-Control': 'public, max-age=$remaining, immutable',
+      'Expires': HttpDate.format(
+          DateTime.fromMillisecondsSinceEpoch(expSec * 1000, isUtc: true)),
+    };
+    if (_etagMatches(req.headers['if-none-match'], etag)) {
+      return Response.notModified(headers: headers);
     }
-    if (start > end || start >= fileLength) throw RangeError('Unsatisfiable');
-    return (start: start, end: end);
+
+    ({int start, int end})? range;
+    try {
+      range = _parseHttpRange(req.headers['range'], length);
+    } on RangeError {
+      return Response(416, body: 'Requested Range Not Satisfiable',
+          headers: {'Content-Range': 'bytes */$length'});
+    }
+    if (range == null) {
+      return Response.ok(_openLogicalRead(file, lnz, base, base + length),
+          headers: {...headers, 'Content-Length': '$length'});
+    }
+    return Response(206,
+        body: _openLogicalRead(file, lnz, base + range.start, base + range.end + 1),
+        headers: {
+          ...headers,
+          'Content-Length': '${range.end - range.start + 1}',
+          'Content-Range': 'bytes ${range.start}-${range.end}/$length',
+        });
   }
 
   // #193: テキストファイルのインラインプレビュー
@@ -3086,20 +8112,13 @@ class _CliServer {
   //       UTF-8 として decode できないなら binary 扱い。
   //       (#244 review) 末尾でマルチバイト境界をまたいだだけの偽陰性を
   //       避けるため、末尾を最大 3 バイト削って再 decode を試す。
-  Future<bool> _sniffTextLike(File file) async {
+  Future<bool> _sniffTextLike(File file, [SeekableCompressedFile? lnz]) async {
     try {
       const sniffBytes = 8 * 1024;
-      final raf = await file.open();
-      try {
-        final size = await raf.length();
-        final n = size < sniffBytes ? size : sniffBytes;
-        if (n == 0) return true; // 空ファイルはテキスト扱い
-        final buf = await raf.read(n);
-        if (buf.contains(0)) return false; // NUL バイト → binary
-        return _utf8DecodesWithTrim(buf);
-      } finally {
-        await raf.close();
-      }
+      final buf = await _readLogicalBytes(file, lnz, sniffBytes);
+      if (buf.isEmpty) return true; // 空ファイルはテキスト扱い
+      if (buf.contains(0)) return false; // NUL バイト → binary
+      return _utf8DecodesWithTrim(buf);
     } catch (_) {
       return false;
     }
@@ -3145,7 +8164,8 @@ class _CliServer {
       // #216: 拡張子ホワイトリスト外 (例: LICENSE, Dockerfile, *.cfg) も
       //       バイナリでなければプレビューさせる。先頭 8KB を見て NUL バイトや
       //       UTF-8 不正がないかで判定する。
-      final sniff = await _sniffTextLike(file);
+      final lnz = await _openCompressed(file);
+      final sniff = await _sniffTextLike(file, lnz);
       if (!sniff) {
         return Response(415,
             body: json.encode({
@@ -3157,8 +8177,7 @@ class _CliServer {
 
       if (mode == 'head' || mode == 'tail') {
         // ファイル全体をメモリに乗せず、行をストリームで処理
-        final stream = file
-            .openRead()
+        final stream = _openLogicalRead(file, lnz)
             .transform(utf8.decoder)
             .transform(const LineSplitter());
         if (mode == 'head') {
@@ -3200,11 +8219,11 @@ class _CliServer {
       }
 
       // mode == 'full'
-      final size = await file.length();
+      final size = await _logicalLength(file, lnz);
       if (size > maxFullBytes) {
         return Response.badRequest(body: 'File too large for full preview (max 5MB).');
       }
-      final content = await file.readAsString(encoding: utf8);
+      final content = utf8.decode(await _readLogicalBytes(file, lnz));
       final totalLines = '\n'.allMatches(content).length + 1;
       return Response.ok(
         json.encode({
@@ -3243,6 +8262,15 @@ class _CliServer {
     return _thumbnailHandler(req, id);
   }
 
+  // If-None-Match は "a", "b" のような列挙や * も取り得る
+  static bool _etagMatches(String? ifNoneMatch, String etag) {
+    if (ifNoneMatch == null) return false;
+    return ifNoneMatch
+        .split(',')
+        .map((t) => t.trim())
+        .any((t) => t == '*' || t == etag || t == 'W/$etag');
+  }
+
   static Uint8List _buildPlaceholderJpeg() {
     final placeholder = img.Image(width: 120, height: 120);
     img.fill(placeholder, color: img.ColorRgb8(180, 180, 180));
@@ -3260,27 +8288,40 @@ class _CliServer {
       if (resolved.error != null) return resolved.error!;
       final src = resolved.file!;
       final filePath = src.path;
-      final filename = p.basename(filePath);
+      final lnz = await _openCompressed(src);
+      final filename = _logicalName(filePath, lnz);
       if (!_isImage(filename)) {
         return Response.badRequest(body: 'Not an image.');
       }
+      // サムネイルは元ファイルのサイズと更新時刻で決まるので、それを ETag にする。
+      // Web UI の Service Worker は If-None-Match でキャッシュを再検証する。
+      final stat = await src.stat();
+      final etag = '"${stat.size.toRadixString(36)}-'
+          '${stat.modified.millisecondsSinceEpoch.toRadixString(36)}"';
+      if (_etagMatches(req.headers['if-none-match'], etag)) {
+        return Response.notModified(headers: {'ETag': etag});
+      }
+      final thumbHeaders = {
+        'Content-Type': 'image/jpeg',
+        'ETag': etag,
+        'Cache-Control': 'private, no-cache',
+      };
       // #259: キャッシュキーに相対パスを使い、サブフォルダの同名ファイルの衝突を防ぐ
       final cache = File(p.join(_thumbnailCacheDir!.path, '${_thumbCacheKey(filePath)}.jpg'));
-      if (await cache.exists()) {
-        return Response.ok(cache.openRead(),
-            headers: {'Content-Type': 'image/jpeg'});
+      // 元ファイルが差し替えられていたら作り直す
+      if (await cache.exists() &&
+          !(await cache.lastModified()).isBefore(stat.modified)) {
+        _perf.cache('thumbnail', true);
+        return Response.ok(cache.openRead(), headers: thumbHeaders);
       }
-      final bytes = await src.readAsBytes();
-      final image = img.decodeImage(bytes);
-      if (image == null) {
-        return Response.ok(_placeholderThumbBytes,
-            headers: {'Content-Type': 'image/jpeg'});
+      _perf.cache('thumbnail', false);
+      final thumbBytes = _encodeThumbnail(await _readLogicalBytes(src, lnz));
+      if (thumbBytes == null) {
+        return Response.ok(_placeholderThumbBytes, headers: thumbHeaders);
       }
-      final thumb = img.copyResize(image, width: 120);
-      final thumbBytes = img.encodeJpg(thumb, quality: 85);
       await cache.writeAsBytes(thumbBytes);
       _chmodFile(cache); // #269
-      return Response.ok(thumbBytes, headers: {'Content-Type': 'image/jpeg'});
+      return Response.ok(thumbBytes, headers: thumbHeaders);
     } catch (e) {
       return Response.internalServerError(body: 'Thumbnail failed: $e');
     }
@@ -3311,7 +8352,17 @@ class _CliServer {
       final zipEncoder = ZipFileEncoder()..create(zipPath);
       final files = dir.listSync(followLinks: false).whereType<File>();
       for (final f in files) {
-        await zipEncoder.addFile(f, p.basename(f.path));
+        final lnz = await _openCompressed(f);
+        if (lnz == null) {
+          await zipEncoder.addFile(f, p.basename(f.path));
+          continue;
+        }
+        // 圧縮保存されたファイルは一時ディレクトリへ展開してから元の名前で格納
+        final name = _logicalName(f.path, lnz);
+        final plain = File(p.join(tempDir.path, 'lnz', name));
+        await plain.parent.create(recursive: true);
+        await _openLogicalRead(f, lnz).pipe(plain.openWrite());
+        await zipEncoder.addFile(plain, name);
       }
       await zipEncoder.close();
 
@@ -3367,7 +8418,7 @@ class _CliServer {
 
     final List<dynamic> ids;
     try {
-      final body = json.decode(await req.readAsString()) as Map<String, dynamic>;
+      final body = json.decode(await _readBodyString(req)) as Map<String, dynamic>;
       ids = body['ids'] as List<dynamic>? ?? const [];
     } catch (_) {
       return Response.badRequest(body: 'Invalid request body.');
@@ -3421,13 +8472,9 @@ class _CliServer {
 
     if (!hasQuery) {
       // 後方互換: 全件返す
-      return Response.ok(
-        json.encode({
-          'items': _clipboardItems.map((i) => i.toJson()).toList(),
-          'lastModified': _clipboardLastModified,
-        }),
-        headers: {'Content-Type': 'application/json'},
-      );
+      return _clipboardItemsResponse(
+          Iterable<int>.generate(_clipboardItems.length),
+          {'lastModified': _clipboardLastModified});
     }
 
     final since = int.tryParse(q['since'] ?? '');
@@ -3445,43 +8492,50 @@ class _CliServer {
           _clipboardDeletes.first.deletedAtMs > since) {
         refresh = true;
       }
+      // id が空のものは item 到着前に受け取った tombstone (UI には無関係)
       deletedSince = _clipboardDeletes
-          .where((d) => d.deletedAtMs > since)
+          .where((d) => d.deletedAtMs > since && d.id.isNotEmpty)
           .map((d) => d.id)
           .toList();
     }
 
-    // items は createdAt の新しい順に並んでいる（insert(0, ...) なので）
-    Iterable<_ClipboardItem> filtered = _clipboardItems;
-    if (since != null) {
-      filtered = filtered
-          .where((i) => i.createdAt.millisecondsSinceEpoch > since);
-    }
-    if (before != null) {
-      filtered = filtered
-          .where((i) => i.createdAt.millisecondsSinceEpoch < before);
+    // items は createdAt の新しい順に並んでいる。列だけを見て行番号を選ぶ
+    final rows = <int>[];
+    var hasMore = false;
+    for (var i = 0; i < _clipboardItems.length; i++) {
+      // 複製で後から届いた item も拾えるよう受信時刻で判定する
+      if (since != null && _clipboardItems.receivedMsAt(i) <= since) continue;
+      if (before != null && _clipboardItems.createdMsAt(i) >= before) continue;
+      if (limit != null && rows.length == limit) {
+        hasMore = true;
+        break;
+      }
+      rows.add(i);
     }
-    final list = filtered.toList();
-    final cap = limit ?? list.length;
-    final returned = list.length > cap ? list.sublist(0, cap) : list;
-    final hasMore = list.length > cap;
 
-    return Response.ok(
-      json.encode({
-        'items': returned.map((i) => i.toJson()).toList(),
-        'deleted': deletedSince,
-        'lastModified': _clipboardLastModified,
-        'hasMore': hasMore,
-        'refresh': refresh,
-      }),
-      headers: {'Content-Type': 'application/json'},
-    );
+    return _clipboardItemsResponse(rows, {
+      'deleted': deletedSince,
+      'lastModified': _clipboardLastModified,
+      'hasMore': hasMore,
+      'refresh': refresh,
+    });
+  }
+
+  /// {"items": [...], ...rest} を組み立てる。items はストアから直接書き出す。
+  Response _clipboardItemsResponse(Iterable<int> rows, Map<String, dynamic> rest) {
+    final out = BytesBuilder(copy: false)..add(utf8.encode('{"items":'));
+    _clipboardItems.writeJsonArray(out, rows);
+    out
+      ..addByte(0x2c) // ,
+      ..add(utf8.encode(json.encode(rest).substring(1)));
+    return Response.ok(out.takeBytes(),
+        headers: {'Content-Type': 'application/json'});
   }
 
   Future<Response> _postClipboardHandler(Request req) async {
     try {
       final params =
-          json.decode(await req.readAsString()) as Map<String, dynamic>;
+          json.decode(await _readBodyString(req)) as Map<String, dynamic>;
       var text = (params['text'] as String?)?.trim();
       final rawTag = (params['tag'] as String?)?.trim();
       final tag = (rawTag != null && rawTag.isNotEmpty) ? rawTag : null;
@@ -3515,19 +8569,38 @@ class _CliServer {
         }
       }
 
-      final item = _ClipboardItem(
+      // sync peer からのライブ転送は相手の origin/seq を引き継ぐ。
+      // anti-entropy で先に届いていれば二重に積まない。
+      String? origin;
+      int seq = 0;
+      final fedOrigin = req.headers[_kFedOrigin];
+      final clipOrigin = req.headers[_kClipOrigin];
+      final clipSeq = int.tryParse(req.headers[_kClipSeq] ?? '');
+      if (clipOrigin != null && clipSeq != null && _isSyncPeerOrigin(fedOrigin)) {
+        origin = clipOrigin;
+        seq = clipSeq;
+        if (_hasReplica('$origin:$seq')) {
+          final at = _clipboardItems.indexOfReplicaKey('$origin:$seq');
+          final existing = at >= 0 ? _clipboardItems[at] : null;
+          return Response.ok(
+              json.encode(existing?.toJson() ?? {'status': 'duplicate'}),
+              headers: {'Content-Type': 'application/json'});
+        }
+      } else if (_hasSyncPeers) {
+        origin = _clipOrigin;
+        seq = _clipSync.nextSeq(_clipOrigin);
+      }
+
+      final item = ClipboardEntry(
         id: _generateId(),
         text: text,
         tag: tag,
         createdAt: DateTime.now(),
         important: important,
+        origin: origin,
+        seq: seq,
       );
-      _clipboardItems.insert(0, item);
-      while (_clipboardItems.length > _maxClipboardItems) {
-        final ev = _evictClipboardItem();
-        _recordDeletion(ev.id);
-      }
-      _clipboardLastModified = DateTime.now().millisecondsSinceEpoch;
+      _insertClipboardItem(item);
 
       // #219: 親への転送 (自分が子のとき、かつ受信が federation 由来でない場合)
       // 注: important フラグの判定は転送時にもう一度 _isUpItem で行う。
@@ -3560,15 +8633,17 @@ class _CliServer {
   /// 親への転送ヘルパ。重要フラグも含めて転送先で `@up ` を付け直すかは
   /// 送信側で決める。
   void _forwardClipboardItemWithImportance(
-      _ClipboardItem item, Request originReq, bool important) {
+      ClipboardEntry item, Request originReq, bool important) {
     if (important) {
       // 元のテキストを `@up ` 付きで送信し直すための一時 item
-      final wireItem = _ClipboardItem(
+      final wireItem = ClipboardEntry(
         id: item.id,
         text: '@up ${item.text}',
         tag: item.tag,
         createdAt: item.createdAt,
         important: true,
+        origin: item.origin,
+        seq: item.seq,
       );
       _forwardClipboardToParents(wireItem, originReq);
     } else {
@@ -3576,6 +8651,333 @@ class _CliServer {
     }
   }
 
+  // 画像 (png/jpeg/gif/webp/bmp) と text/plain 以外はインライン表示させない
+  // (text/html や svg を同一オリジンで開かせない)
+  static const Set<String> _blobInlineMimes = {
+    'image/png',
+    'image/jpeg',
+    'image/gif',
+    'image/webp',
+    'image/bmp',
+    'text/plain',
+  };
+
+  static String _blobBaseMime(String mime) =>
+      mime.split(';').first.trim().toLowerCase();
+
+  static bool _isTextBlobMime(String mime) {
+    final m = _blobBaseMime(mime);
+    return m.startsWith('text/') || m == 'application/json';
+  }
+
+  /// POST /api/clipboard/blob
+  /// 本体は生のリクエストボディ。Content-Type / x-filename (URI エンコード) /
+  /// x-clip-tag (URI エンコード) を付ける。x-blob-sha だけを付けた空ボディは
+  /// 「この内容を既に持っていれば参照だけ追加」の意味で、持っていなければ 409
+  /// (federation 転送で同じ本体を送り直さないため)。
+  Future<Response> _postClipboardBlobHandler(Request req) async {
+    Response jsonError(int status, String error) => Response(status,
+        body: json.encode({'error': error}),
+        headers: {'Content-Type': 'application/json'});
+
+    if (_clipBlobDir == null) {
+      return Response.internalServerError(body: 'Server not initialized.');
+    }
+    if (_maxBlobBytes == 0) return jsonError(403, 'Clipboard blobs are disabled.');
+
+    final mime = (req.headers['content-type'] ?? '').trim();
+    final blobMime = mime.isEmpty || mime.length > 200
+        ? 'application/octet-stream'
+        : mime;
+    String? name;
+    final encodedName = req.headers['x-filename'];
+    if (encodedName != null && encodedName.isNotEmpty) {
+      try {
+        name = _sanitizeFilename(p.basename(Uri.decodeComponent(encodedName)));
+      } catch (_) {}
+      if (name == null) return jsonError(400, 'Invalid filename.');
+    }
+    String? tag;
+    try {
+      final t = Uri.decodeComponent(req.headers['x-clip-tag'] ?? '').trim();
+      if (t.isNotEmpty) tag = t;
+    } catch (_) {}
+    final wantSha = req.headers['x-blob-sha']?.toLowerCase();
+    if (wantSha != null && !_blobShaRe.hasMatch(wantSha)) {
+      return jsonError(400, 'Invalid x-blob-sha.');
+    }
+
+    final cl = int.tryParse(req.headers['content-length'] ?? '');
+    if (cl != null) {
+      if (cl > _maxBlobBytes) return jsonError(413, 'Blob too large.');
+      final quotaResp = _checkFederationUploadQuota(req, cl);
+      if (quotaResp != null) return quotaResp;
+    }
+
+    // 本体を確保してから item に入るまでの間に同じ内容の item が消されても
+    // 本体が消えないよう、sha が決まった時点で仮の参照を持つ (最後に外す)
+    String sha;
+    int size;
+    if (wantSha != null && (cl ?? 0) == 0) {
+      // 参照だけの追加
+      if (!_clipBlobRefs.containsKey(wantSha)) {
+        return jsonError(409, 'blob-missing');
+      }
+      sha = wantSha;
+      _holdBlob(sha);
+      size = _clipboardItems.blobBySha(sha)?.size ?? _blobFile(sha).lengthSync();
+    } else {
+      // 一時ファイルへ書きながら sha256 を取る (本体はメモリに溜めない)
+      final tmp = File(p.join(_clipBlobDir!.path, '.part-${_generateId()}'));
+      final hashIn = StreamController<List<int>>();
+      final digest = crypto.sha256.bind(hashIn.stream).first;
+      final sink = tmp.openWrite();
+      size = 0;
+      var tooLarge = false;
+      var aborted = false;
+      try {
+        await for (final chunk in req.read()) {
+          size += chunk.length;
+          if (size > _maxBlobBytes) {
+            tooLarge = true;
+            break;
+          }
+          hashIn.add(chunk);
+          sink.add(chunk);
+        }
+      } catch (_) {
+        aborted = true;
+      } finally {
+        await hashIn.close();
+        await sink.close();
+      }
+      sha = (await digest).toString();
+      if (aborted) {
+        await tmp.delete().catchError((_) => tmp);
+        return jsonError(400, 'Upload aborted.');
+      }
+      if (tooLarge || size == 0 || (wantSha != null && wantSha != sha)) {
+        await tmp.delete().catchError((_) => tmp);
+        if (tooLarge) return jsonError(413, 'Blob too large.');
+        if (size == 0) return jsonError(400, 'Body is required.');
+        return jsonError(400, 'x-blob-sha does not match the body.');
+      }
+      // 参照中の本体は同じ内容なので一時ファイルを捨てる。参照が無ければ
+      // (消し残りがあっても) 置き換える。
+      if (_clipBlobRefs.containsKey(sha)) {
+        tmp.deleteSync();
+      } else {
+        tmp.renameSync(_blobFile(sha).path);
+        _chmodFile(_blobFile(sha));
+      }
+      _holdBlob(sha);
+    }
+
+    // 表示・検索用のプレビュー: テキストは先頭、それ以外はファイル名
+    var preview = name ?? '';
+    try {
+      if (_isTextBlobMime(blobMime)) {
+        final head = await _blobFile(sha)
+            .openRead(0, _blobPreviewChars * 4)
+            .fold<List<int>>([], (a, b) => a..addAll(b));
+        final text = utf8.decode(head, allowMalformed: true);
+        preview = text.length > _blobPreviewChars
+            ? text.substring(0, _blobPreviewChars)
+            : text;
+        if (size > head.length || text.length > _blobPreviewChars) {
+          preview += '…';
+        }
+      }
+    } catch (_) {
+      _unholdBlob(sha);
+      return jsonError(500, 'Blob read failed.');
+    }
+
+    // blob は clip-sync で複製しない (origin なし)。本体を VV の交換に
+    // 載せないため。親への転送は下の _forwardBlobToParents で行う。
+    final item = ClipboardEntry(
+      id: _generateId(),
+      text: preview,
+      tag: tag,
+      createdAt: DateTime.now(),
+      blob: (sha: sha, size: size, mime: blobMime, name: name),
+    );
+    _insertClipboardItem(item);
+    _unholdBlob(sha);
+    _log('[clip] blob ${sha.substring(0, 12)} bytes=$size mime=$blobMime');
+    _forwardBlobToParents(item, req);
+
+    return Response.ok(json.encode(item.toJson()),
+        headers: {'Content-Type': 'application/json'});
+  }
+
+  /// GET /api/clipboard/blob/<sha>  (Range 対応。内容で名前が決まるので immutable)
+  Future<Response> _getClipboardBlobHandler(Request req, String sha) async {
+    final b = _clipboardItems.blobBySha(sha);
+    if (_clipBlobDir == null || !_blobShaRe.hasMatch(sha) || b == null) {
+      return Response.notFound('Blob not found.');
+    }
+    final file = _blobFile(sha);
+    if (!await file.exists()) return Response.notFound('Blob not found.');
+    final etag = '"$sha"';
+    final baseMime = _blobBaseMime(b.mime);
+    final inline = _blobInlineMimes.contains(baseMime);
+    final fname = b.name ??
+        'clipboard-${sha.substring(0, 8)}${_isTextBlobMime(b.mime) ? '.txt' : ''}';
+    final headers = {
+      'Content-Type': !inline
+          ? 'application/octet-stream'
+          : baseMime == 'text/plain'
+              ? 'text/plain; charset=utf-8'
+              : baseMime,
+      'Content-Disposition':
+          "${inline ? 'inline' : 'attachment'}; filename*=UTF-8''${Uri.encodeComponent(fname)}",
+      'Accept-Ranges': 'bytes',
+      'ETag': etag,
+      'Cache-Control': 'private, max-age=31536000, immutable',
+    };
+    if (_etagMatches(req.headers['if-none-match'], etag)) {
+      return Response.notModified(headers: headers);
+    }
+    final length = b.size;
+    ({int start, int end})? range;
+    try {
+      range = _parseHttpRange(req.headers['range'], length);
+    } on RangeError {
+      return Response(416, body: 'Requested Range Not Satisfiable',
+          headers: {'Content-Range': 'bytes */$length'});
+    }
+    if (range == null) {
+      return Response.ok(file.openRead(),
+          headers: {...headers, 'Content-Length': '$length'});
+    }
+    return Response(206,
+        body: file.openRead(range.start, range.end + 1),
+        headers: {
+          ...headers,
+          'Content-Length': '${range.end - range.start + 1}',
+          'Content-Range': 'bytes ${range.start}-${range.end}/$length',
+        });
+  }
+
+  /// GET /api/clipboard/blob/<sha>/thumbnail  (画像 blob のみ。120px 幅の JPEG)
+  Future<Response> _clipboardBlobThumbnailHandler(Request req, String sha) async {
+    final b = _clipboardItems.blobBySha(sha);
+    if (_clipBlobDir == null ||
+        _thumbnailCacheDir == null ||
+        !_blobShaRe.hasMatch(sha) ||
+        b == null) {
+      return Response.notFound('Blob not found.');
+    }
+    if (!_blobInlineMimes.contains(_blobBaseMime(b.mime)) ||
+        !_blobBaseMime(b.mime).startsWith('image/')) {
+      return Response.badRequest(body: 'Not an image.');
+    }
+    final etag = '"t-$sha"';
+    final thumbHeaders = {
+      'Content-Type': 'image/jpeg',
+      'ETag': etag,
+      'Cache-Control': 'private, max-age=31536000, immutable',
+    };
+    if (_etagMatches(req.headers['if-none-match'], etag)) {
+      return Response.notModified(headers: thumbHeaders);
+    }
+    try {
+      final cache = File(p.join(_thumbnailCacheDir!.path, 'blob-$sha.jpg'));
+      if (await cache.exists()) {
+        return Response.ok(cache.openRead(), headers: thumbHeaders);
+      }
+      final thumbBytes = _encodeThumbnail(await _blobFile(sha).readAsBytes());
+      if (thumbBytes == null) {
+        return Response.ok(_placeholderThumbBytes, headers: thumbHeaders);
+      }
+      await cache.writeAsBytes(thumbBytes);
+      _chmodFile(cache);
+      return Response.ok(thumbBytes, headers: thumbHeaders);
+    } catch (e) {
+      return Response.internalServerError(body: 'Thumbnail failed: $e');
+    }
+  }
+
+  /// 子→friendly 親への blob 転送 (fire-and-forget)。
+  /// 先に x-blob-sha だけで参照追加を試み、親が持っていなければ (409) 本体を送る。
+  /// equally 親には送らない (テキストの clipboard と同様、@up 以外は共有しない)。
+  void _forwardBlobToParents(ClipboardEntry item, Request originReq) {
+    if (_comesFromFederation(originReq)) return;
+    if (_deviceId.isEmpty) return;
+    for (final peer in _federationPeers) {
+      if (peer.kind != 'parent' || peer.relation != 'friendly') continue;
+      _perf.fedQueued(1);
+      () async {
+        try {
+          await _sendBlobToPeer(peer, item);
+        } catch (e) {
+          _log('[fed] forward-blob ${peer.name} unexpected: $e');
+        } finally {
+          _perf.fedQueued(-1);
+        }
+      }();
+    }
+  }
+
+  Future<void> _sendBlobToPeer(_FederationPeer peer, ClipboardEntry item) async {
+    if (peer.isPaused()) {
+      _log('[fed] paused-skip blob ${peer.name}');
+      return;
+    }
+    final b = item.blob!;
+    _heartbeatClient ??= _newFederationClient();
+    final uri = Uri.parse('${peer.url}/api/clipboard/blob');
+    var withBody = false;
+    for (var attempt = 1; attempt <= 3; attempt++) {
+      try {
+        final req = await _heartbeatClient!.postUrl(uri);
+        req.headers.set('Content-Type', b.mime);
+        req.headers.set('Authorization', 'Bearer ${peer.token}');
+        req.headers.set(_kFedOrigin, _deviceId);
+        req.headers.set(_kFedSeenBy, _deviceId);
+        req.headers.set(_kFedEvent, 'clipboard');
+        req.headers.set(_kFedRelation, peer.relation);
+        req.headers.set('x-blob-sha', b.sha);
+        req.headers.set('x-clip-tag', Uri.encodeComponent(_serverName));
+        if (b.name != null) {
+          req.headers.set('x-filename', Uri.encodeComponent(b.name!));
+        }
+        if (withBody) {
+          final file = _blobFile(b.sha);
+          // 送信前に item が消えていれば本体も無い
+          if (!await file.exists()) return;
+          req.contentLength = await file.length();
+          await req.addStream(file.openRead());
+        } else {
+          req.contentLength = 0;
+        }
+        final res = await req.close().timeout(const Duration(seconds: 60));
+        await res.drain();
+        if (res.statusCode == 409 && !withBody) {
+          withBody = true;
+          continue;
+        }
+        if (res.statusCode >= 200 && res.statusCode < 300) {
+          _log('[fed] forward-blob ${peer.name} ok body=$withBody');
+          return;
+        }
+        _log('[fed] forward-blob ${peer.name} HTTP ${res.statusCode} attempt=$attempt');
+        if (res.statusCode >= 400 &&
+            res.statusCode < 500 &&
+            res.statusCode != 408) {
+          break;
+        }
+      } catch (e) {
+        _log('[fed] forward-blob ${peer.name} error attempt=$attempt: $e');
+      }
+      if (attempt < 3) {
+        await Future.delayed(Duration(seconds: 2 * attempt));
+      }
+    }
+    _log('[fed] forward-blob ${peer.name} gave-up');
+  }
+
   /// #220: clipboard 投稿に含まれるメンションコマンドを処理
   Future<void> _handleMentionInClipboard(String text) async {
     // @list (自分)
@@ -3617,76 +9019,171 @@ class _CliServer {
     }
   }
 
-  /// 子に `@list` を投げる。子側で `@list` の結果が自分の clipboard に
-  /// 子の /api/mentions を直接 GET して結果を自分の clipboard に投稿する。
-  /// friendly/equally 問わず動作する（転送に依存しない）。
-  void _dispatchListToChild(String childName) {
-    final peer = _federationPeers.firstWhereOrNullExt(
-        (p) => p.kind == 'child' && p.name == childName);
-    if (peer == null) {
-      _replyToClipboard('@list $childName: child not found');
-      return;
+  // --- 親→子のファンアウト ---
+  //
+  // @to all / @list all のように複数の子へ同じ要求を出すときは、同時実行数を
+  // _fanOutConcurrency に抑え、子ごとに期限を切り、結果を 1 件の返信にまとめる。
+  static const int _fanOutConcurrency = 8;
+
+  /// peers に task を並行実行する (最大 _fanOutConcurrency 本)。
+  /// 結果は peers と同じ順。期限切れ・例外は error に入る。
+  /// 期限が来たら cancel を発火し、task が通信を打ち切って戻るまで枠を返さない
+  /// (待つのをやめるだけだと裏で接続とリトライが残り、同時数が上限を超える)。
+  Future<List<({_FederationPeer peer, T? value, Object? error})>> _fanOut<T>(
+      List<_FederationPeer> peers,
+      Future<T> Function(_FederationPeer peer, _FanOutCancel cancel) task,
+      {required Duration deadline}) async {
+    final results =
+        List<({_FederationPeer peer, T? value, Object? error})?>.filled(
+            peers.length, null);
+    var next = 0;
+    Future<void> worker() async {
+      while (next < peers.length) {
+        final i = next++;
+        final peer = peers[i];
+        final cancel = _FanOutCancel();
+        final timer = Timer(deadline, cancel.cancel);
+        try {
+          final v = await task(peer, cancel);
+          results[i] = (peer: peer, value: v, error: null);
+        } catch (e) {
+          results[i] = (
+            peer: peer,
+            value: null,
+            error: cancel.isCancelled ? TimeoutException(null, deadline) : e,
+          );
+        } finally {
+          timer.cancel();
+        }
+      }
     }
+
+    await Future.wait([
+      for (var i = 0; i < min(_fanOutConcurrency, peers.length); i++) worker(),
+    ]);
+    return results.cast<({_FederationPeer peer, T? value, Object? error})>();
+  }
+
+  static String _fanOutError(Object? e) => switch (e) {
+        TimeoutException() => 'timeout',
+        HttpException(:final message) => message,
+        StateError(:final message) => message,
+        _ => 'dispatch failed',
+      };
+
+  /// 子を名前 (または all) で引く。見つからなければ返信して null。
+  List<_FederationPeer>? _resolveChildren(String command, String target) {
+    if (target == 'all') {
+      final all = _federationPeers.where((p) => p.kind == 'child').toList();
+      if (all.isEmpty) {
+        _replyToClipboard('$command all: no children configured');
+        return null;
+      }
+      return all;
+    }
+    final t = _federationPeers.firstWhereOrNullExt(
+        (p) => p.kind == 'child' && p.name == target);
+    if (t == null) {
+      _replyToClipboard('$command $target: child not found');
+      return null;
+    }
+    return [t];
+  }
+
+  /// 子の mention 一覧。heartbeat で学習した版と一致するキャッシュがあれば使う。
+  Future<List<Map<String, dynamic>>> _fetchChildMentions(
+      _FederationPeer peer, _FanOutCancel cancel) async {
+    final cached = peer.mentionsCache;
+    if (cached != null &&
+        cached.version != null &&
+        cached.version == peer.mentionsVersion) {
+      return cached.items;
+    }
+    _heartbeatClient ??= _newFederationClient();
+    final uri = Uri.parse('${peer.url}/api/mentions');
+    final req = await _heartbeatClient!.getUrl(uri);
+    cancel.onCancel(req.abort);
+    req.headers.set('Authorization', 'Bearer ${peer.token}');
+    final res = await req.close();
+    if (res.statusCode != 200) {
+      await res.drain();
+      throw HttpException('HTTP ${res.statusCode}', uri: uri);
+    }
+    final body = await res.transform(utf8.decoder).join();
+    final data = json.decode(body) as Map<String, dynamic>;
+    final items = (data['items'] as List? ?? []).cast<Map<String, dynamic>>();
+    final version = data['version'] as String?;
+    peer.mentionsCache = (version: version, items: items);
+    // heartbeat より先に取れた版も覚えておく (次回からキャッシュが効く)
+    peer.mentionsVersion ??= version;
+    return items;
+  }
+
+  /// `@list <child|all>`: 子の /api/mentions を取得して 1 件にまとめて返信する。
+  /// friendly/equally 問わず動作する（転送に依存しない）。
+  void _dispatchListToChild(String target) {
+    final peers = _resolveChildren('@list', target);
+    if (peers == null) return;
     () async {
-      try {
-        _heartbeatClient ??=
-            HttpClient()..connectionTimeout = const Duration(seconds: 10);
-        final uri = Uri.parse('${peer.url}/api/mentions');
-        final req = await _heartbeatClient!.getUrl(uri);
-        req.headers.set('Authorization', 'Bearer ${peer.token}');
-        final res = await req.close().timeout(const Duration(seconds: 10));
-        if (res.statusCode == 200) {
-          final body = await res.transform(utf8.decoder).join();
-          final data = json.decode(body) as Map<String, dynamic>;
-          final items =
-              (data['items'] as List? ?? []).cast<Map<String, dynamic>>();
-          final lines = <String>['[$childName] Mention commands:'];
-          for (final item in items) {
-            final label = item['label'] as String? ?? '';
-            final desc = item['description'] as String? ?? '';
-            lines.add(desc.isNotEmpty ? '  $label — $desc' : '  $label');
-          }
-          _replyToClipboard(lines.join('\n'));
-          if (peer.relation == 'equally') {
-            _replyToClipboard(
-                '[$childName] Note: @run_to results will not be forwarded from equally-relation child');
-          }
-          _log('[fed] @list $childName ok (${items.length} items)');
-        } else {
-          await res.drain();
-          _replyToClipboard('@list $childName: failed (HTTP ${res.statusCode})');
+      final results = await _fanOut(peers, _fetchChildMentions,
+          deadline: const Duration(seconds: 10));
+      final lines = <String>[];
+      final failed = <String>[];
+      for (final r in results) {
+        final items = r.value;
+        if (items == null) {
+          failed.add('${r.peer.name} (${_fanOutError(r.error)})');
+          _log('[fed] @list ${r.peer.name} fail: ${r.error}');
+          continue;
         }
-      } catch (e) {
-        _log('[fed] @list $childName fail: $e');
-        _replyToClipboard('@list $childName: dispatch failed');
+        if (lines.isNotEmpty) lines.add('');
+        lines.add('[${r.peer.name}] Mention commands:');
+        for (final item in items) {
+          final label = item['label'] as String? ?? '';
+          final desc = item['description'] as String? ?? '';
+          lines.add(desc.isNotEmpty ? '  $label — $desc' : '  $label');
+        }
+        if (r.peer.relation == 'equally') {
+          lines.add(
+              '[${r.peer.name}] Note: @run_to results will not be forwarded from equally-relation child');
+        }
+        _log('[fed] @list ${r.peer.name} ok (${items.length} items)');
       }
+      if (failed.isNotEmpty) {
+        if (lines.isNotEmpty) lines.add('');
+        lines.add('@list $target: failed: ${failed.join(', ')}');
+      }
+      _replyToClipboard(lines.join('\n'));
     }();
   }
 
-  /// `@to <name|all> <message>` を解決して送信
+  /// `@to <name|all> <message>` を解決して送信。
+  /// all のときは配送結果を 1 件にまとめて返信する。単体宛は失敗時のみ返信。
   void _dispatchToChild(String target, String message) {
-    final List<_FederationPeer> targets;
-    if (target == 'all') {
-      targets = _federationPeers.where((p) => p.kind == 'child').toList();
-    } else {
-      final t = _federationPeers.firstWhereOrNullExt(
-          (p) => p.kind == 'child' && p.name == target);
-      if (t == null) {
-        _replyToClipboard('@to $target: child not found');
-        return;
-      }
-      targets = [t];
-    }
-    for (final peer in targets) {
-      () async {
-        try {
-          await _sendBareTextToPeer(peer, message);
-          _log('[fed] @to ${peer.name} ok');
-        } catch (e) {
-          _log('[fed] @to ${peer.name} fail: $e');
+    final targets = _resolveChildren('@to', target);
+    if (targets == null) return;
+    () async {
+      final results = await _fanOut(
+          targets, (peer, cancel) =>
+              _sendBareTextToPeer(peer, message, cancel: cancel),
+          deadline: const Duration(seconds: 30));
+      final failed = <String>[];
+      for (final r in results) {
+        if (r.error == null) {
+          _log('[fed] @to ${r.peer.name} ok');
+        } else {
+          _log('[fed] @to ${r.peer.name} fail: ${r.error}');
+          failed.add('${r.peer.name} (${_fanOutError(r.error)})');
         }
-      }();
-    }
+      }
+      if (target == 'all') {
+        final ok = results.length - failed.length;
+        _replyToClipboard('@to all: delivered $ok/${results.length}'
+            '${failed.isEmpty ? '' : '; failed: ${failed.join(', ')}'}');
+      } else if (failed.isNotEmpty) {
+        _replyToClipboard('@to $target: failed: ${failed.single}');
+      }
+    }();
   }
 
   /// `@run_to <name> <alias>` を解決して子の /api/run/<alias> を直接 GET し結果を自分の clipboard に投稿する
@@ -3699,8 +9196,7 @@ class _CliServer {
     }
     () async {
       try {
-        _heartbeatClient ??=
-            HttpClient()..connectionTimeout = const Duration(seconds: 10);
+        _heartbeatClient ??= _newFederationClient();
         final uri = Uri.parse(
             '${peer.url}/api/run/${Uri.encodeComponent(alias)}');
         final req = await _heartbeatClient!.getUrl(uri);
@@ -3727,18 +9223,21 @@ class _CliServer {
     }();
   }
 
-  /// 任意のテキストを peer の /api/clipboard に送る (リトライ込み)
-  Future<void> _sendBareTextToPeer(_FederationPeer peer, String text) async {
+  /// 任意のテキストを peer の /api/clipboard に送る (リトライ込み)。
+  /// cancel が発火したら送信中の要求を abort し、以降のリトライもしない。
+  Future<void> _sendBareTextToPeer(_FederationPeer peer, String text,
+      {_FanOutCancel? cancel}) async {
     if (peer.isPaused()) {
       _log('[fed] paused-skip text ${peer.name}');
       throw StateError('peer paused');
     }
-    _heartbeatClient ??=
-        HttpClient()..connectionTimeout = const Duration(seconds: 10);
+    _heartbeatClient ??= _newFederationClient();
     final uri = Uri.parse('${peer.url}/api/clipboard');
     for (var attempt = 1; attempt <= 3; attempt++) {
+      cancel?.check();
       try {
         final r = await _heartbeatClient!.postUrl(uri);
+        cancel?.onCancel(r.abort);
         r.headers.set('Content-Type', 'application/json');
         r.headers.set('Authorization', 'Bearer ${peer.token}');
         r.headers.set(_kFedOrigin, _deviceId);
@@ -3746,7 +9245,12 @@ class _CliServer {
         r.headers.set(_kFedEvent, 'clipboard');
         r.headers.set(_kFedRelation, peer.relation);
         r.add(utf8.encode(json.encode({'text': text, 'tag': _serverName})));
-        final res = await r.close().timeout(const Duration(seconds: 15));
+        // 試行ごとの期限でも要求は打ち切る (次の試行と重ならないように)
+        final res = await r.close().timeout(const Duration(seconds: 15),
+            onTimeout: () {
+          r.abort();
+          throw TimeoutException('clipboard send', const Duration(seconds: 15));
+        });
         await res.drain();
         if (res.statusCode >= 200 && res.statusCode < 300) return;
         if (res.statusCode >= 400 &&
@@ -3755,20 +9259,24 @@ class _CliServer {
           throw HttpException('HTTP ${res.statusCode}');
         }
       } catch (e) {
-        if (attempt == 3) rethrow;
+        if (attempt == 3 || (cancel?.isCancelled ?? false)) rethrow;
       }
-      await Future.delayed(Duration(seconds: 2 * attempt));
+      await Future.any([
+        Future<void>.delayed(Duration(seconds: 2 * attempt)),
+        if (cancel != null) cancel.whenCancelled,
+      ]);
     }
   }
 
   Response _deleteClipboardItemHandler(Request req, String id) {
-    final idx = _clipboardItems.indexWhere((i) => i.id == id);
+    final idx = _clipboardItems.indexOfId(id);
     if (idx == -1) {
       return Response.notFound(json.encode({'error': 'Item not found.'}),
           headers: {'Content-Type': 'application/json'});
     }
     final removed = _clipboardItems.removeAt(idx);
-    _recordDeletion(removed.id);
+    _recordUserDeletion(removed.id, removed.replicaKey);
+    _releaseBlob(removed);
     _clipboardLastModified = DateTime.now().millisecondsSinceEpoch;
     return Response.ok(json.encode({'status': 'deleted'}),
         headers: {'Content-Type': 'application/json'});
@@ -3776,9 +9284,16 @@ class _CliServer {
 
   Response _clearClipboardHandler(Request req) {
     final count = _clipboardItems.length;
-    for (final it in _clipboardItems) {
-      _recordDeletion(it.id);
-    }
+    // 本文は読まない (列と id だけで足りる)
+    for (var i = 0; i < count; i++) {
+      final id = _clipboardItems.idAt(i);
+      final o = _clipboardItems.originAt(i);
+      _recordUserDeletion(id, o == null ? null : '$o:${_clipboardItems.seqAt(i)}');
+      final b = _clipboardItems.blobOf(id);
+      if (b != null) _unholdBlob(b.sha);
+    }
+    // tombstone は全件積んでから 1 回だけ peer の VV と突き合わせる
+    if (count > 0) _trimClipTombstones();
     _clipboardItems.clear();
     _clipboardLastModified = DateTime.now().millisecondsSinceEpoch;
     return Response.ok(json.encode({'status': 'cleared', 'count': count}),
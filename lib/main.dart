@@ -717,6 +717,7 @@ enum DisplayMode {
 enum ServerTab {
   connection, // 接続情報
   clipboard, // クリップボード共有
+  perf, // ライブ性能ダッシュボード
 }
 
 class HomePage extends ConsumerStatefulWidget {
@@ -836,6 +837,11 @@ class _HomePageState extends ConsumerState<HomePage> {
           label: Text('クリップボード'),
           icon: Icon(Icons.content_paste),
         ),
+        ButtonSegment<ServerTab>(
+          value: ServerTab.perf,
+          label: Text('性能'),
+          icon: Icon(Icons.show_chart),
+        ),
       ],
       selected: {_currentTab},
       onSelectionChanged: (Set<ServerTab> newSelection) {
@@ -929,6 +935,8 @@ class _HomePageState extends ConsumerState<HomePage> {
                           serverState.storagePath),
                     if (_currentTab == ServerTab.clipboard)
                       _buildClipboardSection(context),
+                    if (_currentTab == ServerTab.perf)
+                      _PerfPanel(service: ref.read(serverServiceProvider)),
                   ],
 
                   if (serverState.status == ServerStatus.stopped)
@@ -1653,6 +1661,246 @@ class _HomePageState extends ConsumerState<HomePage> {
   }
 }
 
+// ライブ性能ダッシュボード。ServerService の集計を 1 秒ごとに取り直して描く
+// (Web UI の「性能」タブと同じ内容)
+class _PerfPanel extends StatefulWidget {
+  final ServerService service;
+
+  const _PerfPanel({required this.service});
+
+  @override
+  State<_PerfPanel> createState() => _PerfPanelState();
+}
+
+class _PerfPanelState extends State<_PerfPanel> {
+  static const Map<String, Color> _routeColors = {
+    'api': Colors.blueGrey,
+    'download': Colors.blue,
+    'upload': Colors.green,
+    'thumb': Colors.orange,
+    'clip': Colors.purple,
+    'dav': Colors.teal,
+    'static': Colors.grey,
+    'fed': Colors.red,
+  };
+
+  Timer? _timer;
+  Map<String, dynamic>? _data;
+  bool _minutes = false;
+
+  @override
+  void initState() {
+    super.initState();
+    _data = widget.service.perfSnapshot;
+    _timer = Timer.periodic(const Duration(seconds: 1), (_) {
+      setState(() => _data = widget.service.perfSnapshot);
+    });
+  }
+
+  @override
+  void dispose() {
+    _timer?.cancel();
+    super.dispose();
+  }
+
+  static String _bytes(num n) {
+    if (n >= 1024 * 1024 * 1024) {
+      return '${(n / (1024 * 1024 * 1024)).toStringAsFixed(1)} GB';
+    }
+    if (n >= 1024 * 1024) return '${(n / (1024 * 1024)).toStringAsFixed(1)} MB';
+    if (n >= 1024) return '${(n / 1024).toStringAsFixed(1)} KB';
+    return '$n B';
+  }
+
+  // 最後の区間は集計途中なので、「現在値」はその 1 つ前を使う
+  static num _last(List<dynamic> values) =>
+      values.length >= 2 ? values[values.length - 2] as num : 0;
+
+  static int _sum(List<dynamic> values) =>
+      values.fold<int>(0, (a, v) => a + (v as int));
+
+  Widget _chartCard(String title, String now, List<_Series> series,
+      String Function(num) format) {
+    return Card(
+      child: Padding(
+        padding: const EdgeInsets.all(12),
+        child: Column(
+          crossAxisAlignment: CrossAxisAlignment.start,
+          children: [
+            Text(title, style: TextStyle(fontSize: 13, color: Colors.grey[700])),
+            if (now.isNotEmpty)
+              Text(now, style: const TextStyle(fontSize: 12)),
+            const SizedBox(height: 4),
+            SizedBox(
+              height: 64,
+              width: double.infinity,
+              child: CustomPaint(
+                  painter: _SparklinePainter(series, format)),
+            ),
+          ],
+        ),
+      ),
+    );
+  }
+
+  @override
+  Widget build(BuildContext context) {
+    final data = _data;
+    final ring = data?[_minutes ? 'minutes' : 'seconds'] as Map<String, dynamic>?;
+    if (data == null || ring == null) return const SizedBox.shrink();
+    final unit = _minutes ? '分' : '秒';
+    List<dynamic> col(String key) => ring[key] as List<dynamic>;
+    final latency = ring['latencyMs'] as Map<String, dynamic>;
+    final caches = ring['cache'] as Map<String, dynamic>;
+
+    return Column(
+      crossAxisAlignment: CrossAxisAlignment.stretch,
+      children: [
+        SegmentedButton<bool>(
+          segments: const [
+            ButtonSegment(value: false, label: Text('直近 2 分')),
+            ButtonSegment(value: true, label: Text('直近 1 時間')),
+          ],
+          selected: {_minutes},
+          onSelectionChanged: (s) => setState(() => _minutes = s.first),
+        ),
+        const SizedBox(height: 8),
+        _chartCard(
+          'リクエスト数',
+          '${_last(col('requests'))} /$unit (エラー ${_last(col('errors'))}) • '
+              '期間合計 ${_sum(col('requests'))}',
+          [
+            _Series(col('requests'), Colors.teal),
+            _Series(col('errors'), Colors.red),
+          ],
+          (v) => '$v',
+        ),
+        _chartCard(
+          '転送量 (受信 / 送信)',
+          '受信 ${_bytes(_last(col('bytesIn')))}/$unit • '
+              '送信 ${_bytes(_last(col('bytesOut')))}/$unit',
+          [
+            _Series(col('bytesIn'), Colors.green),
+            _Series(col('bytesOut'), Colors.blue),
+          ],
+          _bytes,
+        ),
+        _chartCard(
+          '転送中 / federation 送信待ち',
+          '転送中 ${data['active']} • 送信待ち ${data['fedQueue']}',
+          [
+            _Series(col('active'), Colors.blue),
+            _Series(col('fedQueue'), Colors.red),
+          ],
+          (v) => '$v',
+        ),
+        _chartCard(
+          'p99 レイテンシ (応答ヘッダまで)',
+          latency.entries.map((e) {
+            final p50 = (e.value['p50'] as List<dynamic>)
+                .lastWhere((v) => v != null, orElse: () => null);
+            final p99 = (e.value['p99'] as List<dynamic>)
+                .lastWhere((v) => v != null, orElse: () => null);
+            return '${e.key}: p50≤$p50 p99≤$p99 ms';
+          }).join(' • '),
+          [
+            for (final e in latency.entries)
+              _Series(e.value['p99'] as List<dynamic>,
+                  _routeColors[e.key] ?? Colors.black),
+          ],
+          (v) => '$v ms',
+        ),
+        Card(
+          child: Padding(
+            padding: const EdgeInsets.all(12),
+            child: Column(
+              crossAxisAlignment: CrossAxisAlignment.start,
+              children: [
+                Text('キャッシュヒット率 (期間内)',
+                    style: TextStyle(fontSize: 13, color: Colors.grey[700])),
+                for (final e in caches.entries)
+                  Builder(builder: (context) {
+                    final hits = _sum(e.value['hits'] as List<dynamic>);
+                    final misses = _sum(e.value['misses'] as List<dynamic>);
+                    final ratio = hits + misses > 0
+                        ? '${(hits * 100 / (hits + misses)).round()}%'
+                        : '-';
+                    return Text('${e.key}: $ratio (ヒット $hits / ミス $misses)',
+                        style: const TextStyle(fontSize: 12));
+                  }),
+              ],
+            ),
+          ),
+        ),
+      ],
+    );
+  }
+}
+
+class _Series {
+  final List<dynamic> values;
+  final Color color;
+
+  const _Series(this.values, this.color);
+}
+
+// 折れ線 1 本以上を枠いっぱいに描く。null の区間は線を切る
+class _SparklinePainter extends CustomPainter {
+  final List<_Series> series;
+  final String Function(num) format;
+
+  _SparklinePainter(this.series, this.format);
+
+  @override
+  void paint(Canvas canvas, Size size) {
+    num top = 1;
+    for (final s in series) {
+      for (final v in s.values) {
+        if (v is num && v > top) top = v;
+      }
+    }
+    canvas.drawLine(Offset(0, size.height - 0.5),
+        Offset(size.width, size.height - 0.5), Paint()..color = Colors.grey[300]!);
+    for (final s in series) {
+      final n = s.values.length;
+      if (n < 2) continue;
+      final path = Path();
+      var drawing = false;
+      for (var i = 0; i < n; i++) {
+        final v = s.values[i];
+        if (v is! num) {
+          drawing = false;
+          continue;
+        }
+        final x = i / (n - 1) * size.width;
+        final y = size.height - 2 - v / top * (size.height - 14);
+        if (drawing) {
+          path.lineTo(x, y);
+        } else {
+          path.moveTo(x, y);
+        }
+        drawing = true;
+      }
+      canvas.drawPath(
+          path,
+          Paint()
+            ..color = s.color
+            ..style = PaintingStyle.stroke
+            ..strokeWidth = 1.5);
+    }
+    final label = TextPainter(
+      text: TextSpan(
+          text: format(top),
+          style: TextStyle(fontSize: 10, color: Colors.grey[600])),
+      textDirection: TextDirection.ltr,
+    )..layout();
+    label.paint(canvas, Offset.zero);
+  }
+
+  @override
+  bool shouldRepaint(_SparklinePainter oldDelegate) => true;
+}
+
 // クリップボード入力フィールドウィジェット
 class _ClipboardInputField extends StatefulWidget {
   final Function(String) onSubmit;
@@ -21,6 +21,8 @@ import 'package:shelf_router/shelf_router.dart';
 import 'package:shelf_static/shelf_static.dart';
 import 'package:wakelock_plus/wakelock_plus.dart';
 
+import 'src/perf_stats.dart';
+
 /// 動作モード
 enum OperationMode { normal, downloadOnly }
 
@@ -67,6 +69,10 @@ class ServerService {
   static const _safPlatform = MethodChannel('com.ictglab.localnode/saf_storage');
   static const _folderPlatform = MethodChannel('com.ictglab.localnode/folder');
   static const _storagePlatform = MethodChannel('com.ictglab.localnode/storage');
+
+  // index.html と一緒に webroot へ展開する補助アセット (Service Worker 等)
+  static const List<String> _webSideAssets = ['sw.js', 'resize-worker.js'];
+
   String? _safDirectoryUri; // 選択されたSAFディレクトリURI
   HttpServer? _server;
   String? _httpsCertPath;
@@ -125,6 +131,11 @@ class ServerService {
 
   // クリップボードアイテムへの外部アクセス用ゲッター
   List<ClipboardItem> get clipboardItems => List.unmodifiable(_clipboardItems);
+
+  // ライブ性能ダッシュボード (/api/debug/perf と GUI の性能タブ)
+  // GUI 版のサーバにあるキャッシュはサムネイルだけ
+  final PerfStats _perf = PerfStats(caches: const ['thumbnail']);
+  Map<String, dynamic> get perfSnapshot => _perf.toJson();
   int get clipboardLastModified => _clipboardLastModified;
 
   // ブルートフォース保護用
@@ -260,6 +271,8 @@ class ServerService {
     _router.get('/api/health', _healthHandler);
     _router.get('/api/info', _infoHandler);
     _router.get('/api/check-auth', _checkAuthHandler);
+    _router.get('/api/probe', _probeDownloadHandler);
+    _router.post('/api/probe', _probeUploadHandler);
     _router.get('/api/files', _getFilesHandler);
     _router.post('/api/upload', _uploadHandler);
     _router.get('/api/download/<id>', _downloadHandler);
@@ -274,6 +287,7 @@ class ServerService {
     _router.post('/api/clipboard', _postClipboardHandler);
     _router.delete('/api/clipboard/<id>', _deleteClipboardItemHandler);
     _router.delete('/api/clipboard', _clearClipboardHandler);
+    _router.get('/api/debug/perf', _perfHandler);
   }
 
   Future<void> _init() async {
@@ -341,6 +355,16 @@ class ServerService {
       print('ERROR: Failed to deploy web assets: $e');
       rethrow;
     }
+    // 補助アセット (Service Worker 等) は無くても UI は動くので失敗は無視
+    for (final name in _webSideAssets) {
+      try {
+        final byteData = await rootBundle.load('assets/web/$name');
+        await File(p.join(_webRootDir!.path, name))
+            .writeAsBytes(byteData.buffer.asUint8List());
+      } catch (e) {
+        _log('Web side asset not deployed: $name ($e)');
+      }
+    }
   }
 
   // === Handlers ===
@@ -456,6 +480,67 @@ class ServerService {
         headers: {'Content-Type': 'application/json'});
   }
 
+  // === 帯域 / RTT プローブ (Web UI の転送パラメータ自動調整用) ===
+  //
+  // GET  /api/probe            即時応答 (RTT 計測用の echo)
+  // GET  /api/probe?bytes=N    非圧縮性の N バイトを返す (下り計測)
+  // POST /api/probe            body を読み捨て、受信バイト数と所要時間を返す (上り計測)
+  static const int _probeMaxBytes = 8 * 1024 * 1024;
+  static const int _probeBlockBytes = 1024 * 1024;
+  Uint8List? _probeBlock;
+
+  Response _probeDownloadHandler(Request request) {
+    const noStore = {'Cache-Control': 'no-store'};
+    final raw = request.requestedUri.queryParameters['bytes'];
+    if (raw == null) {
+      return Response.ok(
+        json.encode({'t': DateTime.now().millisecondsSinceEpoch}),
+        headers: {'Content-Type': 'application/json', ...noStore},
+      );
+    }
+    final n = int.tryParse(raw);
+    if (n == null || n < 1 || n > _probeMaxBytes) {
+      return Response.badRequest(body: 'bytes must be 1..$_probeMaxBytes');
+    }
+    final block = _probeBlock ??= () {
+      final rnd = Random.secure();
+      return Uint8List.fromList(
+          List<int>.generate(_probeBlockBytes, (_) => rnd.nextInt(256)));
+    }();
+    Stream<List<int>> body() async* {
+      var remaining = n;
+      while (remaining > 0) {
+        final len = remaining < block.length ? remaining : block.length;
+        yield Uint8List.sublistView(block, 0, len);
+        remaining -= len;
+      }
+    }
+    return Response.ok(body(), headers: {
+      'Content-Type': 'application/octet-stream',
+      'Content-Length': '$n',
+      ...noStore,
+    });
+  }
+
+  Future<Response> _probeUploadHandler(Request request) async {
+    final tooLarge = Response(413,
+        body: json.encode({'error': 'probe body too large'}),
+        headers: {'Content-Type': 'application/json'});
+    final declared = request.contentLength;
+    if (declared != null && declared > _probeMaxBytes) return tooLarge;
+    final sw = Stopwatch()..start();
+    var received = 0;
+    await for (final chunk in request.read()) {
+      received += chunk.length;
+      if (received > _probeMaxBytes) return tooLarge;
+    }
+    sw.stop();
+    return Response.ok(
+      json.encode({'bytes': received, 'ms': sw.elapsedMilliseconds}),
+      headers: {'Content-Type': 'application/json', 'Cache-Control': 'no-store'},
+    );
+  }
+
   Response _infoHandler(Request request) {
     final info = {
       'version': _appVersion,
@@ -795,27 +880,35 @@ class ServerService {
 
   Future<Response> _maybeRangeResponseFromFile(
       Request request, File file, String mimeType) async {
-    final length = await file.length();
-    final rangeHeader = request.headers['range'];
+    final stat = await file.stat();
+    final length = stat.size;
+    final etag = '"$length-${stat.modified.millisecondsSinceEpoch}"';
+    final lastModified = HttpDate.format(stat.modified);
+    // 分割ダウンロードの If-Range。途中で差し替わっていたら全体を返す
+    final ifRange = request.headers['if-range'];
     ({int start, int end})? range;
     try {
-      range = _parseRange(rangeHeader, length);
+      if (ifRange == null || ifRange == etag || ifRange == lastModified) {
+        range = _parseRange(request.headers['range'], length);
+      }
     } on RangeError {
       return Response(416, body: 'Requested Range Not Satisfiable',
           headers: {'Content-Range': 'bytes */$length'});
     }
+    final headers = {
+      'Content-Type': mimeType,
+      'Accept-Ranges': 'bytes',
+      'ETag': etag,
+      'Last-Modified': lastModified,
+    };
     if (range == null) {
-      return Response.ok(file.openRead(), headers: {
-        'Content-Type': mimeType,
-        'Accept-Ranges': 'bytes',
-        'Content-Length': '$length',
-      });
+      return Response.ok(file.openRead(),
+          headers: {...headers, 'Content-Length': '$length'});
     }
     final contentLength = range.end - range.start + 1;
     return Response(206, body: file.openRead(range.start, range.end + 1),
         headers: {
-          'Content-Type': mimeType,
-          'Accept-Ranges': 'bytes',
+          ...headers,
           'Content-Length': '$contentLength',
           'Content-Range': 'bytes ${range.start}-${range.end}/$length',
         });
@@ -943,8 +1036,10 @@ class ServerService {
       final cacheFile = File(p.join(_thumbnailCacheDir!.path, '$filename.jpg'));
 
       if (await cacheFile.exists()) {
+        _perf.cache('thumbnail', true);
         return Response.ok(cacheFile.openRead(), headers: {'Content-Type': 'image/jpeg'});
       }
+      _perf.cache('thumbnail', false);
       
       Uint8List? imageBytes;
 
@@ -1735,6 +1830,54 @@ class ServerService {
 
   // === Middleware ===
 
+  // ライブ性能ダッシュボードの集計。CLI の _perfMiddleware と同じ
+  Middleware get _perfMiddleware => (innerHandler) {
+        return (request) async {
+          final route = _perfRoute(request);
+          final sw = Stopwatch()..start();
+          if (request.contentLength != 0 &&
+              request.method != 'GET' &&
+              request.method != 'HEAD') {
+            request = request.change(
+                body: _perf.count(request.read(), _perf.bytesIn));
+          }
+          final Response response;
+          try {
+            response = await innerHandler(request);
+          } catch (_) {
+            _perf.request(route, sw.elapsedMicroseconds, error: true);
+            rethrow;
+          }
+          _perf.request(route, sw.elapsedMicroseconds,
+              error: response.statusCode >= 500);
+          if (request.method == 'HEAD' ||
+              response.statusCode == 204 ||
+              response.statusCode == 304 ||
+              response.contentLength == 0) {
+            return response;
+          }
+          return response.change(
+              body: _perf.count(response.read(), _perf.bytesOut));
+        };
+      };
+
+  String _perfRoute(Request request) {
+    final path = request.url.path;
+    if (path.startsWith('api/federation/') ||
+        request.headers[_kFedSeenBy] != null) {
+      return 'fed';
+    }
+    if (path == 'api/upload') return 'upload';
+    if (path.startsWith('api/download')) return 'download';
+    if (path.startsWith('api/thumbnail')) return 'thumb';
+    if (path.startsWith('api/clipboard')) return 'clip';
+    return path.startsWith('api/') ? 'api' : 'static';
+  }
+
+  Response _perfHandler(Request request) => Response.ok(
+      json.encode(_perf.toJson()),
+      headers: {'Content-Type': 'application/json', 'Cache-Control': 'no-store'});
+
   // #221: federation ループ防止
   static const String _kFedOrigin = 'x-fed-origin';
   static const String _kFedSeenBy = 'x-fed-seen-by';
@@ -1894,6 +2037,12 @@ class ServerService {
     if (sourceFile != null) {
       final destinationFile = File(p.join(_webRootDir!.path, 'index.html'));
       await sourceFile.copy(destinationFile.path);
+      for (final name in _webSideAssets) {
+        final side = File(p.join(p.dirname(sourceFile.path), name));
+        if (await side.exists()) {
+          await side.copy(p.join(_webRootDir!.path, name));
+        }
+      }
     } else {
       // アセットが見つからない場合は最小限のHTMLを生成
       final destinationFile = File(p.join(_webRootDir!.path, 'index.html'));
@@ -1983,8 +2132,11 @@ class ServerService {
       // verbose時のみリクエストログ出力、通常は無し
       final pipeline = const Pipeline();
       final handler = verboseLogging
-          ? pipeline.addMiddleware(logRequests()).addHandler(cascade.handler)
-          : pipeline.addHandler(cascade.handler);
+          ? pipeline
+              .addMiddleware(logRequests())
+              .addMiddleware(_perfMiddleware)
+              .addHandler(cascade.handler)
+          : pipeline.addMiddleware(_perfMiddleware).addHandler(cascade.handler);
 
       if (isHttpsMode) {
         final secCtx = SecurityContext()
@@ -2061,8 +2213,10 @@ class ServerService {
 
       final cascade = Cascade().add(apiHandler).add(staticHandler);
 
-      final handler =
-          const Pipeline().addMiddleware(logRequests()).addHandler(cascade.handler);
+      final handler = const Pipeline()
+          .addMiddleware(logRequests())
+          .addMiddleware(_perfMiddleware)
+          .addHandler(cascade.handler);
 
       if (isHttpsMode) {
         final secCtx = SecurityContext()
@@ -0,0 +1,148 @@
+// clipboard anti-entropy (sync: true の equally peer 間) の版管理。
+//
+// 各ノードは起動ごとの origin ("deviceId@startedAt") と連番 seq を持ち、
+// 追加と削除 (tombstone) にそれぞれ seq を振る。vv[origin] は
+// 「その origin の seq をここまで全て取り込んだ」値 (version vector)。
+// heartbeat で相手の VV を受け取り、自分より進んでいる origin の区間
+// (mine, theirs] だけを /api/federation/clip-sync で取りに行く。
+//
+// item 本体は呼び出し側 (lib/src/clipboard_store.dart の ClipboardStore) が持ち、
+// ここは VV と tombstone のログ、区間の決め方だけを持つ。
+
+import 'dart:collection';
+
+/// sync peer へ伝搬する削除。origin/seq は削除操作そのものの版番号、
+/// key は削除された item の replicaKey ("origin:seq")。
+typedef ClipTombstone = ({String origin, int seq, String key});
+
+/// clip-sync の 1 origin 分の区間 (from, upTo]
+typedef ClipRange = ({int from, int upTo});
+
+class ClipSyncLog {
+  // clipboard.max_items の上限 (100000) を全消去しても収まる大きさ
+  static const int defaultMaxTombstones = 200000;
+
+  /// 全 sync peer の VV がその seq を越えた tombstone だけを捨てる。届かない
+  /// peer がいて maxTombstones を超えたら古い順に捨てる。
+  final int maxTombstones;
+  final Map<String, int> vv = {};
+  final ListQueue<ClipTombstone> _tombstones = ListQueue();
+  final Set<String> _tombstoneKeys = {};
+  // 捨てた tombstone の seq の最大値 (origin ごと)。これより手前からの区間は
+  // 返せない削除を含むので、resync で key 集合の突き合わせに切り替えさせる
+  final Map<String, int> _floor = {};
+
+  ClipSyncLog({this.maxTombstones = defaultMaxTombstones});
+
+  Iterable<ClipTombstone> get tombstones => _tombstones;
+  int get tombstoneCount => _tombstones.length;
+
+  /// 自分の origin の次の seq を振り、VV も進める
+  int nextSeq(String origin) => vv[origin] = (vv[origin] ?? 0) + 1;
+
+  /// key の item が削除済みとして記録されているか
+  bool isDeleted(String key) => _tombstoneKeys.contains(key);
+
+  /// (origin, seq) をまだ取り込んでいないか
+  bool isNew(String origin, int seq) => seq > (vv[origin] ?? 0);
+
+  /// tombstone を積む。上限を超えた分を先頭から捨てるだけで、peer の VV との
+  /// 突き合わせ (trim) はしない。まとめて積むときは最後に 1 回 trim を呼ぶ。
+  void addTombstone(String origin, int seq, String key) {
+    _tombstones.add((origin: origin, seq: seq, key: key));
+    _tombstoneKeys.add(key);
+    while (_tombstones.length > maxTombstones) {
+      _drop(_tombstones.removeFirst());
+    }
+  }
+
+  /// 全 sync peer の VV が越えた tombstone を捨てる。件数に比例するので、
+  /// heartbeat で VV を学習したときと、まとめて積んだ後に 1 回だけ呼ぶ。
+  /// peerVvs は sync peer ごとの最後に見た VV (未学習なら null)。
+  void trim(Iterable<Map<String, int>?> peerVvs) {
+    final peers = peerVvs.toList();
+    if (peers.isNotEmpty) {
+      _tombstones.removeWhere((t) {
+        final passed = peers.every((vv) => (vv?[t.origin] ?? 0) >= t.seq);
+        if (passed) _drop(t);
+        return passed;
+      });
+    }
+    while (_tombstones.length > maxTombstones) {
+      _drop(_tombstones.removeFirst());
+    }
+  }
+
+  void _drop(ClipTombstone t) {
+    _tombstoneKeys.remove(t.key);
+    if (t.seq > (_floor[t.origin] ?? 0)) _floor[t.origin] = t.seq;
+  }
+
+  /// 相手の VV と比べ、こちらに欠けている区間 {origin: [mine, theirs]}
+  Map<String, List<int>> missingFrom(Map peerVv) {
+    final ranges = <String, List<int>>{};
+    peerVv.forEach((o, v) {
+      if (o is! String || v is! int) return;
+      final mine = vv[o] ?? 0;
+      if (v > mine) ranges[o] = [mine, v];
+    });
+    return ranges;
+  }
+
+  /// 要求された区間 {origin: [from, to]} のうち返せるものを決める。to は自分の
+  /// VV までに切り詰める。from が捨てた tombstone より手前なら resync に入れる。
+  ({Map<String, ClipRange> want, List<String> resync}) plan(Map ranges) {
+    final want = <String, ClipRange>{};
+    final resync = <String>[];
+    ranges.forEach((o, r) {
+      if (o is! String || r is! List || r.length != 2) return;
+      final from = r[0], to = r[1];
+      if (from is! int || to is! int || to <= from) return;
+      final known = vv[o] ?? 0;
+      final upTo = to < known ? to : known;
+      if (upTo <= from) return;
+      if (from < (_floor[o] ?? 0)) {
+        resync.add(o);
+        return;
+      }
+      want[o] = (from: from, upTo: upTo);
+    });
+    return (want: want, resync: resync);
+  }
+
+  /// 応答の through を取り込み、VV を進める (戻さない)
+  void advance(Map through) {
+    through.forEach((o, v) {
+      if (o is String && v is int && v > (vv[o] ?? 0)) vv[o] = v;
+    });
+  }
+
+  /// 返すイベントを件数上限 budget で切る。seqs[origin] は区間内のイベントの seq
+  /// (昇順)。origin ごとに先頭から返す件数 take と、相手が VV に入れてよい
+  /// through を返す。打ち切った origin は返さなかった最初の seq の手前まで。
+  /// 区間内の欠番 (退避された item) は through をそのまま進める。
+  static Map<String, ({int take, int through})> cut(
+      Map<String, ClipRange> want, Map<String, List<int>> seqs, int budget) {
+    final out = <String, ({int take, int through})>{};
+    want.forEach((o, w) {
+      final list = seqs[o] ?? const <int>[];
+      var upTo = w.upTo;
+      var take = 0;
+      for (final q in list) {
+        if (budget == 0) {
+          upTo = q - 1;
+          break;
+        }
+        take++;
+        budget--;
+      }
+      if (upTo > w.from) out[o] = (take: take, through: upTo);
+    });
+    return out;
+  }
+
+  /// reconcile 応答の keys / known による判定。相手が known まで取り込んだ上で
+  /// 持っていない seq の item は、相手側で削除 (または退避) されたもの。
+  static bool droppedByPeer(int seq, int known, Set<int> peerHas) =>
+      seq <= known && !peerHas.contains(seq);
+}
@@ -0,0 +1,431 @@
+// clipboard 履歴のストア。
+//
+// 本文と id は UTF-8 のままバイトアリーナに、時刻やフラグは typed data の列に
+// 持ち、一覧の JSON はアリーナから直接書き出す。item は読み出しのたびに作る
+// ClipboardEntry で返す (GUI 版の ClipboardItem とは別物)。
+
+import 'dart:convert';
+import 'dart:typed_data';
+
+class ClipboardEntry {
+  final String id;
+  final String text;
+  final String? tag;
+  final DateTime createdAt;
+  // #220 / #230: @up でマーク済みの重要アイテム
+  final bool important;
+  // sync peer との複製用。作成したノードの origin と、その origin 内の連番。
+  // origin が null のものはローカル専用 (mention 結果・通知など) で複製しない。
+  final String? origin;
+  final int seq;
+  // このノードに入った時刻 (epoch ms)。?since= の差分判定に使う。
+  // 複製で後から届いた古い item も差分に載せるため createdAt とは分ける。
+  final int receivedAtMs;
+  // 貼り付け画像・長文など本体を別ファイル (content-addressed) に置く item。
+  // text には表示・検索用のプレビュー (長文の先頭やファイル名) だけを持つ。
+  final ({String sha, int size, String mime, String? name})? blob;
+
+  ClipboardEntry({
+    required this.id,
+    required this.text,
+    this.tag,
+    required this.createdAt,
+    this.important = false,
+    this.origin,
+    this.seq = 0,
+    int? receivedAtMs,
+    this.blob,
+  }) : receivedAtMs = receivedAtMs ?? createdAt.millisecondsSinceEpoch;
+
+  /// 複製の一意キー ("origin:seq")。ローカル専用 item は null。
+  String? get replicaKey => origin == null ? null : '$origin:$seq';
+
+  Map<String, dynamic> toJson() => {
+        'id': id,
+        'text': text,
+        'tag': tag,
+        'createdAt': createdAt.toUtc().toIso8601String(),
+        'important': important,
+        if (blob != null) 'blob': blobJson(blob!),
+      };
+
+  static Map<String, dynamic> blobJson(
+          ({String sha, int size, String mime, String? name}) b) =>
+      {'sha': b.sha, 'size': b.size, 'mime': b.mime, 'name': b.name};
+
+  /// clip-sync で peer に渡す形式
+  Map<String, dynamic> toReplicaJson() => {
+        ...toJson(),
+        'origin': origin,
+        'seq': seq,
+      };
+}
+
+/// clipboard 履歴の列指向ストア。並びは新しい順 (index 0 が最新)。
+///
+/// max_items は 100000 件、本文は 1 件 1,000,000 文字まで取れるため、item ごとに
+/// String / DateTime / Map を持つとヒープの大半がオブジェクトと GC の走査対象に
+/// なる。ここでは
+///   - 本文と id は UTF-8 のままチャンク化したバイトアリーナに詰める
+///   - タグと origin は intern して番号だけを持つ
+///   - 時刻・seq・フラグは typed data の列に持つ
+/// JSON はアリーナのバイト列から直接組み立てる (本文を String に戻さない)。
+/// ClipboardEntry は読み出しのたびに作る値で、ストアは保持しない。
+/// 削除で空いたアリーナ領域は、生きている量以上にゴミが溜まった時点で詰め直す。
+class ClipboardStore extends Iterable<ClipboardEntry> {
+  static const int chunkBytes = 256 * 1024;
+  static const int _minCompactGarbage = 4 * chunkBytes;
+
+  // --- バイトアリーナ。番地は (チャンク番号 << 32) | オフセット ---
+  final List<Uint8List> _chunks = [];
+  int _chunkUsed = 0; // 最後のチャンクの使用済みバイト数
+  int _arenaUsed = 0; // 割り当て済みの合計 (削除済みの分を含む)
+  int _arenaLive = 0; // 生きている行が参照している合計
+
+  // --- intern 表 (タグと origin で共用)。参照数が 0 になった番号は再利用する ---
+  final List<String?> _atoms = [];
+  final List<int> _atomRefs = [];
+  final List<List<int>?> _atomJson = []; // JSON 文字列リテラルとしてエンコード済み
+  final Map<String, int> _atomIndex = {};
+  final List<int> _freeAtoms = [];
+
+  // --- 列。先頭 _len 行が有効 ---
+  int _len = 0;
+  Int64List _created = Int64List(0);
+  Int64List _received = Int64List(0);
+  Int64List _seq = Int64List(0);
+  Int64List _textAddr = Int64List(0);
+  Int32List _textLen = Int32List(0);
+  Int64List _idAddr = Int64List(0);
+  Int32List _idLen = Int32List(0);
+  Int32List _tag = Int32List(0); // -1 = タグなし
+  Int32List _origin = Int32List(0); // -1 = ローカル専用
+  Uint8List _important = Uint8List(0);
+  // blob item は少数なので id で引く疎な表にする
+  final Map<String, ({String sha, int size, String mime, String? name})>
+      _blobs = {};
+
+  @override
+  int get length => _len;
+
+  @override
+  bool get isEmpty => _len == 0;
+
+  @override
+  bool get isNotEmpty => _len != 0;
+
+  @override
+  Iterator<ClipboardEntry> get iterator =>
+      Iterable<ClipboardEntry>.generate(_len, (i) => this[i]).iterator;
+
+  @override
+  ClipboardEntry elementAt(int index) => this[index];
+
+  int createdMsAt(int i) => _created[i];
+  int receivedMsAt(int i) => _received[i];
+  bool importantAt(int i) => _important[i] != 0;
+  String? originAt(int i) => _origin[i] < 0 ? null : _atoms[_origin[i]];
+  int seqAt(int i) => _seq[i];
+  String idAt(int i) => _readString(_idAddr[i], _idLen[i]);
+  ({String sha, int size, String mime, String? name})? blobOf(String id) =>
+      _blobs[id];
+
+  /// アリーナ・列・intern 表が確保しているおおよそのバイト数 (メモリ計上用)
+  int get approxBytes {
+    final columns = <TypedData>[
+      _created, _received, _seq, _textAddr, _textLen,
+      _idAddr, _idLen, _tag, _origin, _important,
+    ].fold<int>(0, (a, c) => a + c.lengthInBytes);
+    var atoms = 0;
+    for (var i = 0; i < _atoms.length; i++) {
+      atoms += (_atoms[i]?.length ?? 0) * 2 + (_atomJson[i]?.length ?? 0);
+    }
+    return arenaBytes.reserved + columns + atoms + _blobs.length * 160;
+  }
+
+  /// 本文・id が使っているバイト数と、アリーナとして確保済みのバイト数
+  ({int live, int reserved}) get arenaBytes =>
+      (live: _arenaLive, reserved: _chunks.fold(0, (a, c) => a + c.length));
+
+  ClipboardEntry operator [](int i) {
+    RangeError.checkValidIndex(i, this, 'index', _len);
+    final id = _readString(_idAddr[i], _idLen[i]);
+    return ClipboardEntry(
+      id: id,
+      text: _readString(_textAddr[i], _textLen[i]),
+      tag: _tag[i] < 0 ? null : _atoms[_tag[i]],
+      createdAt: DateTime.fromMillisecondsSinceEpoch(_created[i]),
+      important: _important[i] != 0,
+      origin: originAt(i),
+      seq: _seq[i],
+      receivedAtMs: _received[i],
+      blob: _blobs[id],
+    );
+  }
+
+  void insert(int i, ClipboardEntry item) {
+    RangeError.checkValueInInterval(i, 0, _len, 'index');
+    if (_len == _created.length) _grow();
+    _shift(i, _len, i + 1);
+    _len++;
+    final text = utf8.encode(item.text);
+    final id = utf8.encode(item.id);
+    _textAddr[i] = _alloc(text);
+    _textLen[i] = text.length;
+    _idAddr[i] = _alloc(id);
+    _idLen[i] = id.length;
+    _created[i] = item.createdAt.millisecondsSinceEpoch;
+    _received[i] = item.receivedAtMs;
+    _seq[i] = item.seq;
+    _tag[i] = item.tag == null ? -1 : _intern(item.tag!);
+    _origin[i] = item.origin == null ? -1 : _intern(item.origin!);
+    _important[i] = item.important ? 1 : 0;
+    if (item.blob != null) _blobs[item.id] = item.blob!;
+  }
+
+  ClipboardEntry removeAt(int i) {
+    final item = this[i];
+    _arenaLive -= _textLen[i] + _idLen[i];
+    _unintern(_tag[i]);
+    _unintern(_origin[i]);
+    _blobs.remove(item.id);
+    _shift(i + 1, _len, i);
+    _len--;
+    _maybeCompact();
+    return item;
+  }
+
+  ClipboardEntry removeLast() => removeAt(_len - 1);
+
+  void clear() {
+    _len = 0;
+    _chunks.clear();
+    _chunkUsed = 0;
+    _arenaUsed = 0;
+    _arenaLive = 0;
+    _atoms.clear();
+    _atomRefs.clear();
+    _atomJson.clear();
+    _atomIndex.clear();
+    _freeAtoms.clear();
+    _blobs.clear();
+  }
+
+  int indexOfId(String id) {
+    final want = utf8.encode(id);
+    for (var i = 0; i < _len; i++) {
+      if (_idLen[i] == want.length && _bytesEqual(_idAddr[i], want)) return i;
+    }
+    return -1;
+  }
+
+  /// replicaKey ("origin:seq") の行。origin は intern 表に無ければ即 -1
+  int indexOfReplicaKey(String key) {
+    final sep = key.lastIndexOf(':');
+    if (sep < 0) return -1;
+    final o = _atomIndex[key.substring(0, sep)];
+    final s = int.tryParse(key.substring(sep + 1));
+    if (o == null || s == null) return -1;
+    for (var i = 0; i < _len; i++) {
+      if (_origin[i] == o && _seq[i] == s) return i;
+    }
+    return -1;
+  }
+
+  ({String sha, int size, String mime, String? name})? blobBySha(String sha) {
+    for (final b in _blobs.values) {
+      if (b.sha == sha) return b;
+    }
+    return null;
+  }
+
+  static final List<int> _kJsonId = utf8.encode('{"id":');
+  static final List<int> _kJsonText = utf8.encode(',"text":');
+  static final List<int> _kJsonTag = utf8.encode(',"tag":');
+  static final List<int> _kJsonNull = utf8.encode('null');
+  static final List<int> _kJsonCreated = utf8.encode(',"createdAt":"');
+  static final List<int> _kJsonImportant = utf8.encode('","important":true');
+  static final List<int> _kJsonNotImportant =
+      utf8.encode('","important":false');
+
+  /// rows の行を ClipboardEntry.toJson と同じ形の JSON 配列として out に書く
+  void writeJsonArray(BytesBuilder out, Iterable<int> rows) {
+    out.addByte(0x5b); // [
+    var first = true;
+    for (final i in rows) {
+      if (!first) out.addByte(0x2c); // ,
+      first = false;
+      out.add(_kJsonId);
+      _writeJsonString(out, _idAddr[i], _idLen[i]);
+      out.add(_kJsonText);
+      _writeJsonString(out, _textAddr[i], _textLen[i]);
+      out.add(_kJsonTag);
+      out.add(_tag[i] < 0 ? _kJsonNull : _atomJson[_tag[i]]!);
+      out.add(_kJsonCreated);
+      out.add(DateTime.fromMillisecondsSinceEpoch(_created[i], isUtc: true)
+          .toIso8601String()
+          .codeUnits);
+      out.add(_important[i] != 0 ? _kJsonImportant : _kJsonNotImportant);
+      if (_blobs.isNotEmpty) {
+        final b = _blobs[_readString(_idAddr[i], _idLen[i])];
+        if (b != null) {
+          out.add(utf8.encode(',"blob":${json.encode(ClipboardEntry.blobJson(b))}'));
+        }
+      }
+      out.addByte(0x7d); // }
+    }
+    out.addByte(0x5d); // ]
+  }
+
+  // --- 内部 ---
+
+  void _grow() {
+    final cap = _created.length < 64 ? 64 : _created.length * 2;
+    Int64List g64(Int64List a) => Int64List(cap)..setRange(0, _len, a);
+    Int32List g32(Int32List a) => Int32List(cap)..setRange(0, _len, a);
+    _created = g64(_created);
+    _received = g64(_received);
+    _seq = g64(_seq);
+    _textAddr = g64(_textAddr);
+    _textLen = g32(_textLen);
+    _idAddr = g64(_idAddr);
+    _idLen = g32(_idLen);
+    _tag = g32(_tag);
+    _origin = g32(_origin);
+    _important = Uint8List(cap)..setRange(0, _len, _important);
+  }
+
+  /// 全列の [from, to) を dest へ移す (範囲の重なりは setRange が扱う)
+  void _shift(int from, int to, int dest) {
+    if (from >= to) return;
+    final n = to - from;
+    for (final List<int> col in <List<int>>[
+      _created, _received, _seq, _textAddr, _textLen,
+      _idAddr, _idLen, _tag, _origin, _important,
+    ]) {
+      col.setRange(dest, dest + n, col, from);
+    }
+  }
+
+  int _alloc(Uint8List bytes) {
+    final n = bytes.length;
+    if (n == 0) return 0;
+    _arenaUsed += n;
+    _arenaLive += n;
+    if (n > chunkBytes) {
+      // 大きい本文は専用チャンク。後続の割り当ては新しいチャンクから始める
+      _chunks.add(Uint8List.fromList(bytes));
+      _chunkUsed = n;
+      return (_chunks.length - 1) << 32;
+    }
+    if (_chunks.isEmpty || _chunkUsed + n > _chunks.last.length) {
+      _chunks.add(Uint8List(chunkBytes));
+      _chunkUsed = 0;
+    }
+    final addr = ((_chunks.length - 1) << 32) | _chunkUsed;
+    _chunks.last.setRange(_chunkUsed, _chunkUsed + n, bytes);
+    _chunkUsed += n;
+    return addr;
+  }
+
+  static Uint8List _view(List<Uint8List> chunks, int addr, int len) {
+    final off = addr & 0xffffffff;
+    return Uint8List.sublistView(chunks[addr >> 32], off, off + len);
+  }
+
+  String _readString(int addr, int len) =>
+      len == 0 ? '' : utf8.decode(_view(_chunks, addr, len));
+
+  bool _bytesEqual(int addr, List<int> want) {
+    if (want.isEmpty) return true;
+    final chunk = _chunks[addr >> 32];
+    final off = addr & 0xffffffff;
+    for (var j = 0; j < want.length; j++) {
+      if (chunk[off + j] != want[j]) return false;
+    }
+    return true;
+  }
+
+  void _maybeCompact() {
+    final garbage = _arenaUsed - _arenaLive;
+    if (garbage < _minCompactGarbage || garbage < _arenaLive) return;
+    final old = List.of(_chunks);
+    _chunks.clear();
+    _chunkUsed = 0;
+    _arenaUsed = 0;
+    _arenaLive = 0;
+    for (var i = 0; i < _len; i++) {
+      if (_textLen[i] > 0) {
+        _textAddr[i] = _alloc(_view(old, _textAddr[i], _textLen[i]));
+      }
+      if (_idLen[i] > 0) {
+        _idAddr[i] = _alloc(_view(old, _idAddr[i], _idLen[i]));
+      }
+    }
+  }
+
+  int _intern(String s) {
+    final hit = _atomIndex[s];
+    if (hit != null) {
+      _atomRefs[hit]++;
+      return hit;
+    }
+    final enc = utf8.encode(json.encode(s));
+    final int idx;
+    if (_freeAtoms.isNotEmpty) {
+      idx = _freeAtoms.removeLast();
+      _atoms[idx] = s;
+      _atomRefs[idx] = 1;
+      _atomJson[idx] = enc;
+    } else {
+      idx = _atoms.length;
+      _atoms.add(s);
+      _atomRefs.add(1);
+      _atomJson.add(enc);
+    }
+    _atomIndex[s] = idx;
+    return idx;
+  }
+
+  void _unintern(int a) {
+    if (a < 0) return;
+    if (--_atomRefs[a] > 0) return;
+    _atomIndex.remove(_atoms[a]);
+    _atoms[a] = null;
+    _atomJson[a] = null;
+    _freeAtoms.add(a);
+  }
+
+  static List<int> _jsonEscape(int c) => switch (c) {
+        0x22 => const [0x5c, 0x22], // \"
+        0x5c => const [0x5c, 0x5c], // \\
+        0x08 => const [0x5c, 0x62], // \b
+        0x0c => const [0x5c, 0x66], // \f
+        0x0a => const [0x5c, 0x6e], // \n
+        0x0d => const [0x5c, 0x72], // \r
+        0x09 => const [0x5c, 0x74], // \t
+        _ => '\\u${c.toRadixString(16).padLeft(4, '0')}'.codeUnits,
+      };
+
+  /// UTF-8 のバイト列をそのまま JSON 文字列リテラルとして書く。
+  /// エスケープが要るのは " と \ と制御文字だけで、どれも 1 バイト文字。
+  /// 書き方は json.encode に合わせる (\b \f なども同じ綴りにする)。
+  void _writeJsonString(BytesBuilder out, int addr, int len) {
+    out.addByte(0x22);
+    if (len > 0) {
+      final chunk = _chunks[addr >> 32];
+      final start = addr & 0xffffffff;
+      final end = start + len;
+      var run = start;
+      for (var j = start; j < end; j++) {
+        final c = chunk[j];
+        if (c >= 0x20 && c != 0x22 && c != 0x5c) continue;
+        if (j > run) out.add(Uint8List.sublistView(chunk, run, j));
+        out.add(_jsonEscape(c));
+        run = j + 1;
+      }
+      if (end > run) out.add(Uint8List.sublistView(chunk, run, end));
+    }
+    out.addByte(0x22);
+  }
+}
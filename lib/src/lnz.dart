@@ -0,0 +1,147 @@
+// 保存時圧縮 (.lnz) の読み書き。
+//
+// 論理データを frameBytes ごとに独立した raw deflate フレームへ圧縮し、末尾に
+// シークテーブルを置く。任意オフセットの読み出しは該当フレームだけを展開すれば
+// よいので、Range / tail プレビューでもファイル全体を展開しない。
+//
+//   [frame 0][frame 1]...[frame n-1]
+//   [seek table: 各フレームの圧縮後サイズ u32 LE × n]
+//   [footer 24B: 'LNZ1' | frameBytes u32 | n u32 | reserved u32 | logicalSize u64]
+//
+// zstd の seekable format と同じ構成だが、追加依存なしで使える dart:io の
+// deflate を使う。
+
+import 'dart:io';
+import 'dart:math';
+import 'dart:typed_data';
+
+const String kCompressedSuffix = '.lnz';
+
+class SeekableCompressedWriter {
+  static const int defaultFrameBytes = 256 * 1024;
+
+  final IOSink _sink;
+  final int frameBytes;
+  final ZLibEncoder _encoder = ZLibEncoder(raw: true, level: 6);
+  final BytesBuilder _pending = BytesBuilder(copy: false);
+  final List<int> _frameSizes = [];
+  int _logicalSize = 0;
+
+  SeekableCompressedWriter(File file, {this.frameBytes = defaultFrameBytes})
+      : _sink = file.openWrite();
+
+  void add(List<int> chunk) {
+    _pending.add(chunk);
+    _logicalSize += chunk.length;
+    if (_pending.length < frameBytes) return;
+    final bytes = _pending.takeBytes();
+    var off = 0;
+    for (; off + frameBytes <= bytes.length; off += frameBytes) {
+      _writeFrame(Uint8List.sublistView(bytes, off, off + frameBytes));
+    }
+    if (off < bytes.length) _pending.add(Uint8List.sublistView(bytes, off));
+  }
+
+  void _writeFrame(List<int> raw) {
+    final compressed = _encoder.convert(raw);
+    _frameSizes.add(compressed.length);
+    _sink.add(compressed);
+  }
+
+  /// 書き終えたフレームをファイルへ流す。frameBytes に満たない分は
+  /// 次のフレームのために手元に残す。
+  Future<void> flush() => _sink.flush();
+
+  Future<void> close() async {
+    if (_pending.isNotEmpty) _writeFrame(_pending.takeBytes());
+    final table = ByteData(_frameSizes.length * 4 + 24);
+    for (var i = 0; i < _frameSizes.length; i++) {
+      table.setUint32(i * 4, _frameSizes[i], Endian.little);
+    }
+    final f = _frameSizes.length * 4;
+    table
+      ..setUint32(f, SeekableCompressedFile.magic, Endian.little)
+      ..setUint32(f + 4, frameBytes, Endian.little)
+      ..setUint32(f + 8, _frameSizes.length, Endian.little)
+      ..setUint32(f + 12, 0, Endian.little)
+      ..setUint64(f + 16, _logicalSize, Endian.little);
+    _sink.add(table.buffer.asUint8List());
+    await _sink.close();
+  }
+
+  /// 書き込み途中で失敗したときに使う。中途半端なファイルは呼び出し側で消す。
+  Future<void> abort() async {
+    try {
+      await _sink.close();
+    } catch (_) {}
+  }
+}
+
+class SeekableCompressedFile {
+  static const int magic = 0x315A4E4C; // 'LNZ1' (LE)
+
+  final File file;
+  final int frameBytes;
+  final int logicalSize;
+  // frameOffsets[i] = フレーム i の開始位置。末尾要素はシークテーブルの位置
+  final List<int> frameOffsets;
+
+  SeekableCompressedFile._(
+      this.file, this.frameBytes, this.logicalSize, this.frameOffsets);
+
+  /// フッタとシークテーブルを読む。.lnz 形式でなければ FormatException。
+  static Future<SeekableCompressedFile> open(File file) async {
+    final raf = await file.open();
+    try {
+      final len = await raf.length();
+      if (len < 24) throw const FormatException('not a seekable archive');
+      await raf.setPosition(len - 24);
+      final footer = ByteData.sublistView(await raf.read(24));
+      if (footer.getUint32(0, Endian.little) != magic) {
+        throw const FormatException('not a seekable archive');
+      }
+      final frameBytes = footer.getUint32(4, Endian.little);
+      final count = footer.getUint32(8, Endian.little);
+      final logicalSize = footer.getUint64(16, Endian.little);
+      final tablePos = len - 24 - count * 4;
+      if (frameBytes == 0 || tablePos < 0) {
+        throw const FormatException('corrupt seek table');
+      }
+      await raf.setPosition(tablePos);
+      final table = ByteData.sublistView(await raf.read(count * 4));
+      final offsets = List<int>.filled(count + 1, 0);
+      for (var i = 0; i < count; i++) {
+        offsets[i + 1] = offsets[i] + table.getUint32(i * 4, Endian.little);
+      }
+      if (offsets[count] != tablePos ||
+          logicalSize > count * frameBytes ||
+          (count > 0 && logicalSize <= (count - 1) * frameBytes)) {
+        throw const FormatException('corrupt seek table');
+      }
+      return SeekableCompressedFile._(file, frameBytes, logicalSize, offsets);
+    } finally {
+      await raf.close();
+    }
+  }
+
+  /// 論理オフセット [start, end) を展開して流す。File.openRead と同じ引数の意味。
+  Stream<List<int>> openRead([int start = 0, int? end]) async* {
+    final stop = min(end ?? logicalSize, logicalSize);
+    if (start >= stop) return;
+    final raf = await file.open();
+    try {
+      final decoder = ZLibDecoder(raw: true);
+      for (var i = start ~/ frameBytes; i * frameBytes < stop; i++) {
+        await raf.setPosition(frameOffsets[i]);
+        final raw = decoder
+            .convert(await raf.read(frameOffsets[i + 1] - frameOffsets[i]));
+        final base = i * frameBytes;
+        final from = max(start - base, 0);
+        final to = min(stop - base, raw.length);
+        yield (from == 0 && to == raw.length) ? raw : raw.sublist(from, to);
+      }
+    } finally {
+      await raf.close();
+    }
+  }
+}
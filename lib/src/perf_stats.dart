@@ -0,0 +1,224 @@
+// ライブ性能ダッシュボードの時系列。
+//
+// 1 秒刻み 120 区間と 1 分刻み 60 区間のリングに同じ値を積む。レイテンシは
+// 経路の種類ごとに log2 ヒストグラム (ms) で持ち、出力時に p50 / p99
+// (バケット上端) にする。転送中の本数と federation の送信待ちはゲージで、
+// 区間内の最大値を残す。CLI と GUI 版のサーバで同じ形の JSON を返し、
+// 違うのはキャッシュの種類だけ。
+
+import 'dart:math';
+import 'dart:typed_data';
+
+class PerfStats {
+  static const List<String> routes = [
+    'api', 'download', 'upload', 'thumb', 'clip', 'dav', 'static', 'fed'
+  ];
+
+  /// ヒット率を数えるキャッシュの名前 (cache() に渡す)
+  final List<String> caches;
+  final int Function() _nowMs;
+  final PerfRing perSecond;
+  final PerfRing perMinute;
+  int active = 0;
+  int fedQueue = 0;
+  // 起動後の累計 (top はこの差分でレートを出す)
+  int totalRequests = 0;
+  int totalBytesIn = 0;
+  int totalBytesOut = 0;
+  final List<int> cacheHits;
+  final List<int> cacheMisses;
+
+  /// nowMs はテスト用の時計 (省略時は現在時刻)
+  PerfStats({required this.caches, int Function()? nowMs})
+      : _nowMs = nowMs ?? (() => DateTime.now().millisecondsSinceEpoch),
+        perSecond = PerfRing(120, 1000, caches.length),
+        perMinute = PerfRing(60, 60 * 1000, caches.length),
+        cacheHits = List.filled(caches.length, 0),
+        cacheMisses = List.filled(caches.length, 0);
+
+  void _each(void Function(PerfSlot s) f) {
+    final now = _nowMs();
+    f(perSecond.at(now, active, fedQueue));
+    f(perMinute.at(now, active, fedQueue));
+  }
+
+  /// 応答ヘッダを返すまでの時間を記録する
+  void request(String route, int latencyUs, {required bool error}) {
+    final i = routes.indexOf(route) * PerfSlot.buckets + PerfSlot.bucketOf(latencyUs);
+    totalRequests++;
+    _each((s) {
+      s.requests++;
+      if (error) s.errors++;
+      s.latency[i]++;
+    });
+  }
+
+  void bytesIn(int n) {
+    totalBytesIn += n;
+    _each((s) => s.bytesIn += n);
+  }
+
+  void bytesOut(int n) {
+    totalBytesOut += n;
+    _each((s) => s.bytesOut += n);
+  }
+
+  void cache(String name, bool hit) {
+    final i = caches.indexOf(name);
+    hit ? cacheHits[i]++ : cacheMisses[i]++;
+    _each((s) => hit ? s.hits[i]++ : s.misses[i]++);
+  }
+
+  void transfer(int delta) {
+    active += delta;
+    _each((s) => s.active = max(s.active, active));
+  }
+
+  void fedQueued(int delta) {
+    fedQueue += delta;
+    _each((s) => s.fedQueue = max(s.fedQueue, fedQueue));
+  }
+
+  /// 本文を流しながら onBytes で数える。流れている間は転送中として数える
+  /// (読まれなかった本文は数えない)
+  Stream<List<int>> count(
+      Stream<List<int>> body, void Function(int bytes) onBytes,
+      {void Function()? onDone}) async* {
+    transfer(1);
+    try {
+      await for (final chunk in body) {
+        onBytes(chunk.length);
+        yield chunk;
+      }
+    } finally {
+      transfer(-1);
+      onDone?.call();
+    }
+  }
+
+  Map<String, dynamic> toJson() {
+    final now = _nowMs();
+    return {
+      'routes': routes,
+      'caches': caches,
+      'active': active,
+      'fedQueue': fedQueue,
+      'seconds': perSecond.toJson(now, active, fedQueue, caches),
+      'minutes': perMinute.toJson(now, active, fedQueue, caches),
+    };
+  }
+}
+
+class PerfSlot {
+  // [0,1) [1,2) [2,4) ... ms。最後のバケットは 16384ms 以上
+  static const int buckets = 16;
+
+  int requests = 0;
+  int errors = 0;
+  int bytesIn = 0;
+  int bytesOut = 0;
+  int active = 0;
+  int fedQueue = 0;
+  final Int32List latency = Int32List(PerfStats.routes.length * buckets);
+  final Int32List hits;
+  final Int32List misses;
+
+  PerfSlot(int cacheCount)
+      : hits = Int32List(cacheCount),
+        misses = Int32List(cacheCount);
+
+  /// レイテンシ (µs) のバケット番号
+  static int bucketOf(int latencyUs) {
+    final ms = latencyUs ~/ 1000;
+    return min(ms <= 0 ? 0 : ms.bitLength, buckets - 1);
+  }
+
+  void reset(int active, int fedQueue) {
+    requests = errors = bytesIn = bytesOut = 0;
+    this.active = active;
+    this.fedQueue = fedQueue;
+    latency.fillRange(0, latency.length, 0);
+    hits.fillRange(0, hits.length, 0);
+    misses.fillRange(0, misses.length, 0);
+  }
+
+  /// route の q 分位点 (ms, バケット上端)。サンプルが無ければ null
+  int? percentileMs(int route, double q) {
+    final base = route * buckets;
+    var total = 0;
+    for (var b = 0; b < buckets; b++) {
+      total += latency[base + b];
+    }
+    if (total == 0) return null;
+    final target = (total * q).ceil();
+    var seen = 0;
+    for (var b = 0; b < buckets; b++) {
+      seen += latency[base + b];
+      if (seen >= target) return 1 << b;
+    }
+    return 1 << (buckets - 1);
+  }
+}
+
+class PerfRing {
+  final int spanMs;
+  final List<PerfSlot> _slots;
+  int _period = -1; // 最新区間の番号 (epoch ms ~/ spanMs)
+
+  PerfRing(int length, this.spanMs, int cacheCount)
+      : _slots = List.generate(length, (_) => PerfSlot(cacheCount));
+
+  /// 現在の区間。進んだ分 (アイドルで飛んだ区間も) を空にする。
+  /// ゲージはその間変わっていないので今の値で埋める
+  PerfSlot at(int nowMs, int active, int fedQueue) {
+    final period = nowMs ~/ spanMs;
+    if (period > _period) {
+      final from = _period < 0 || period - _period > _slots.length
+          ? period - _slots.length + 1
+          : _period + 1;
+      for (var i = from; i <= period; i++) {
+        _slots[i % _slots.length].reset(active, fedQueue);
+      }
+      _period = period;
+    }
+    return _slots[_period % _slots.length];
+  }
+
+  /// 古い順の列で返す。最後の区間は集計途中
+  Map<String, dynamic> toJson(
+      int nowMs, int active, int fedQueue, List<String> caches) {
+    at(nowMs, active, fedQueue);
+    final order = [
+      for (var i = _period - _slots.length + 1; i <= _period; i++)
+        _slots[i % _slots.length],
+    ];
+    List<T> col<T>(T Function(PerfSlot s) f) => [for (final s in order) f(s)];
+    final latency = <String, dynamic>{};
+    for (var r = 0; r < PerfStats.routes.length; r++) {
+      final p50 = col((s) => s.percentileMs(r, 0.5));
+      if (p50.every((v) => v == null)) continue; // 期間中に来ていない経路は省く
+      latency[PerfStats.routes[r]] = {
+        'p50': p50,
+        'p99': col((s) => s.percentileMs(r, 0.99)),
+      };
+    }
+    return {
+      'spanMs': spanMs,
+      'endMs': (_period + 1) * spanMs,
+      'requests': col((s) => s.requests),
+      'errors': col((s) => s.errors),
+      'bytesIn': col((s) => s.bytesIn),
+      'bytesOut': col((s) => s.bytesOut),
+      'active': col((s) => s.active),
+      'fedQueue': col((s) => s.fedQueue),
+      'latencyMs': latency,
+      'cache': {
+        for (var c = 0; c < caches.length; c++)
+          caches[c]: {
+            'hits': col((s) => s.hits[c]),
+            'misses': col((s) => s.misses[c]),
+          },
+      },
+    };
+  }
+}
@@ -0,0 +1,50 @@
+// API トークンのクォータに使う流量制御。
+//
+// リクエスト数はトークンバケット、バイト数は GCRA (仮想スケジューリング) で
+// 制限する。どちらも時刻は呼び出し側から ms で渡す (テストで時計を差し替える
+// ため)。サーバは単一 isolate なので状態は素の数値で持つ。
+
+import 'dart:math';
+
+/// rate 個/秒で補充され、最大 burst 個まで貯まるトークンバケット。
+class TokenBucket {
+  final double rate;
+  final int burst;
+  double _tokens;
+  int _refilledAtMs = 0;
+
+  /// burst を省略すると 1 秒分 (最低 1)。最初は満杯。
+  TokenBucket(this.rate, {int? burst})
+      : burst = burst ?? max(1, rate.ceil()),
+        _tokens = (burst ?? max(1, rate.ceil())).toDouble();
+
+  /// 1 個取る。足りなければ次に取れるまでの秒数 (切り上げ) を返す。
+  int? take(int nowMs) {
+    if (_refilledAtMs != 0) {
+      _tokens = min(burst.toDouble(), _tokens + (nowMs - _refilledAtMs) * rate / 1000);
+    }
+    _refilledAtMs = nowMs;
+    if (_tokens >= 1) {
+      _tokens -= 1;
+      return null;
+    }
+    return ((1 - _tokens) / rate).ceil();
+  }
+}
+
+/// bytesPerSec の帯域制御 (GCRA)。burstMs 分は待たずに送れる。
+class ByteRateLimiter {
+  final int bytesPerSec;
+  final int burstMs;
+  // 次に送ってよい理論時刻 (ms)
+  double _tatMs = 0;
+
+  ByteRateLimiter(this.bytesPerSec, {this.burstMs = 1000});
+
+  /// len バイト送る枠を予約し、送る前に待つべき時間 (ms) を返す。
+  int reserve(int len, int nowMs) {
+    _tatMs = max(_tatMs, nowMs.toDouble()) + len * 1000 / bytesPerSec;
+    final wait = (_tatMs - nowMs - burstMs).ceil();
+    return wait > 0 ? wait : 0;
+  }
+}
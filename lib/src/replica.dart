@@ -0,0 +1,122 @@
+// 双方向フォルダ複製の版情報と取り込み規則。
+//
+// 複製フォルダ内の各ファイルに版情報 (ReplicaEntry) を持たせる。版は
+// deviceId ごとの更新回数 (version vector)。削除も tombstone として版を持つ。
+// 相手のエントリをどう扱うかは ReplicaEntry.decide が決め、並行更新の勝者は
+// ReplicaEntry.remoteWins が決める。両ノードが同じ規則で判定するので、衝突
+// コピーを含めて同じ状態に収束する。
+
+import 'dart:convert';
+
+import 'package:crypto/crypto.dart' as crypto;
+import 'package:path/path.dart' as p;
+
+/// 相手のエントリに対してすること
+enum ReplicaMerge {
+  same, // 同じ版。何もしない
+  adopt, // 相手が新しい (またはこちらに無い)。そのまま取り込む
+  keep, // こちらが新しい。相手が取りに来る
+  converge, // 並行更新だが同じ内容。版だけ合わせる
+  conflict, // 並行更新。remoteWins で勝者を決め、負けた内容を退避する
+}
+
+class ReplicaEntry {
+  String sha; // 内容の sha256 (tombstone は '')
+  int size;
+  int localMtimeMs; // 変更検出用 (このノードのファイルシステム上の mtime)
+  int modifiedMs; // この版が作られた時刻。衝突時の勝者判定に使い、複製でも引き継ぐ
+  Map<String, int> vv;
+  bool deleted;
+
+  ReplicaEntry({
+    required this.sha,
+    required this.size,
+    required this.localMtimeMs,
+    required this.modifiedMs,
+    required this.vv,
+    this.deleted = false,
+  });
+
+  /// Merkle 木の葉のハッシュ。ノードごとに違う localMtimeMs は含めない。
+  String get hash {
+    final keys = vv.keys.toList()..sort();
+    final v = keys.map((k) => '$k=${vv[k]}').join(',');
+    return crypto.sha256
+        .convert(utf8.encode('$sha|$size|$modifiedMs|$deleted|$v'))
+        .toString();
+  }
+
+  Map<String, dynamic> toJson() => {
+        'sha': sha,
+        'size': size,
+        'mtime': localMtimeMs,
+        'modified': modifiedMs,
+        'vv': vv,
+        if (deleted) 'deleted': true,
+      };
+
+  /// 相手に見せる形 (localMtimeMs は意味がないので含めない)
+  Map<String, dynamic> toWire() => {
+        'sha': sha,
+        'size': size,
+        'modified': modifiedMs,
+        'vv': vv,
+        'deleted': deleted,
+      };
+
+  static ReplicaEntry? fromJson(dynamic j) {
+    if (j is! Map) return null;
+    final sha = j['sha'], size = j['size'], modified = j['modified'];
+    final vv = j['vv'];
+    if (sha is! String || size is! int || modified is! int || vv is! Map) {
+      return null;
+    }
+    return ReplicaEntry(
+      sha: sha,
+      size: size,
+      localMtimeMs: j['mtime'] is int ? j['mtime'] as int : 0,
+      modifiedMs: modified,
+      vv: {
+        for (final e in vv.entries)
+          if (e.key is String && e.value is int) e.key as String: e.value as int,
+      },
+      deleted: j['deleted'] == true,
+    );
+  }
+
+  /// a の版が b を包含するか (全カウンタが以上)
+  static bool covers(Map<String, int> a, Map<String, int> b) =>
+      b.entries.every((e) => (a[e.key] ?? 0) >= e.value);
+
+  static Map<String, int> merge(Map<String, int> a, Map<String, int> b) => {
+        ...a,
+        for (final e in b.entries)
+          e.key: (a[e.key] ?? 0) > e.value ? a[e.key]! : e.value,
+      };
+
+  /// 相手のエントリ theirs を、こちらのエントリ mine (無ければ null) に対して
+  /// どう取り込むか。
+  static ReplicaMerge decide(ReplicaEntry? mine, ReplicaEntry theirs) {
+    if (mine != null && mine.hash == theirs.hash) return ReplicaMerge.same;
+    if (mine == null || covers(theirs.vv, mine.vv)) return ReplicaMerge.adopt;
+    if (covers(mine.vv, theirs.vv)) return ReplicaMerge.keep;
+    if (mine.deleted == theirs.deleted && mine.sha == theirs.sha) {
+      return ReplicaMerge.converge;
+    }
+    return ReplicaMerge.conflict;
+  }
+
+  /// 並行更新の勝者。(更新時刻, 内容ハッシュ) の大きい方が勝つ。
+  /// 引数を入れ替えると結果も反転するので、両ノードで同じ側が残る。
+  static bool remoteWins(ReplicaEntry mine, ReplicaEntry theirs) =>
+      theirs.modifiedMs != mine.modifiedMs
+          ? theirs.modifiedMs > mine.modifiedMs
+          : theirs.sha.compareTo(mine.sha) > 0;
+
+  /// 衝突で負けた内容の置き場所。両ノードで同じ名前になるよう内容ハッシュから作る。
+  static String conflictPath(String rel, String sha) {
+    final ext = p.extension(rel);
+    final base = rel.substring(0, rel.length - ext.length);
+    return '$base.conflict-${sha.substring(0, 8)}$ext';
+  }
+}
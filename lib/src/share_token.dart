@@ -0,0 +1,53 @@
+// 署名付き共有リンク (/s/<token>) のトークン。
+//
+// token = base64url(payload JSON) + '.' + base64url(HMAC-SHA256(payload))
+// (どちらも '=' なし)。payload の中身は呼び出し側が決める。検証はサーバ側の
+// 状態を引かずに HMAC の再計算だけで済み、署名が合うまではデコードも JSON
+// 解析もしない。
+
+import 'dart:convert';
+
+import 'package:crypto/crypto.dart' as crypto;
+
+class ShareTokenCodec {
+  final crypto.Hmac _hmac;
+
+  ShareTokenCodec(List<int> secret) : _hmac = crypto.Hmac(crypto.sha256, secret);
+
+  String encode(Map<String, dynamic> payload) {
+    final encoded = _b64NoPad(utf8.encode(json.encode(payload)));
+    return '$encoded.${_sign(encoded)}';
+  }
+
+  /// 署名が正しければ payload を返す。形式違い・署名不一致・壊れた payload は null。
+  Map<dynamic, dynamic>? decode(String token) {
+    final dot = token.indexOf('.');
+    if (dot <= 0 || dot != token.lastIndexOf('.')) return null;
+    final encoded = token.substring(0, dot);
+    if (!_constantTimeEquals(token.substring(dot + 1), _sign(encoded))) {
+      return null;
+    }
+    try {
+      final payload =
+          json.decode(utf8.decode(base64Url.decode(base64Url.normalize(encoded))));
+      return payload is Map ? payload : null;
+    } catch (_) {
+      return null;
+    }
+  }
+
+  String _sign(String encodedPayload) =>
+      _b64NoPad(_hmac.convert(utf8.encode(encodedPayload)).bytes);
+
+  static String _b64NoPad(List<int> bytes) =>
+      base64Url.encode(bytes).replaceAll('=', '');
+
+  static bool _constantTimeEquals(String a, String b) {
+    if (a.length != b.length) return false;
+    var result = 0;
+    for (var i = 0; i < a.length; i++) {
+      result |= a.codeUnitAt(i) ^ b.codeUnitAt(i);
+    }
+    return result == 0;
+  }
+}
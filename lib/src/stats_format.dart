@@ -0,0 +1,270 @@
+// `localnode-cli top` が読む /api/debug/stats のバイナリ形式。
+//
+// JSON を組み立てずに毎秒返せるよう、先頭 4 バイトの "LNS1" に続けて
+// 整数はリトルエンディアンの固定幅、文字列は長さ (u16) 付き UTF-8 で並べる。
+// 並びは StatsSnapshot.encode と decode の 2 か所だけが知っている。
+// StatsWriter / StatsReader はアクセストレース (--trace) の記録にも使う。
+
+import 'dart:convert';
+import 'dart:typed_data';
+
+/// リトルエンディアンの固定幅整数と長さ付き UTF-8 文字列を詰める
+class StatsWriter {
+  final BytesBuilder _out = BytesBuilder();
+  final ByteData _tmp = ByteData(8);
+
+  void bytes(List<int> b) => _out.add(b);
+  void u8(int v) => _out.addByte(v);
+
+  void u16(int v) {
+    _tmp.setUint16(0, v, Endian.little);
+    _out.add(_tmp.buffer.asUint8List(0, 2));
+  }
+
+  void u32(int v) {
+    _tmp.setUint32(0, v, Endian.little);
+    _out.add(_tmp.buffer.asUint8List(0, 4));
+  }
+
+  void u64(int v) {
+    _tmp.setUint64(0, v, Endian.little);
+    _out.add(_tmp.buffer.asUint8List(0, 8));
+  }
+
+  void str(String s) {
+    var b = utf8.encode(s);
+    if (b.length > 0xffff) b = b.sublist(0, 0xffff);
+    u16(b.length);
+    _out.add(b);
+  }
+
+  /// 符号なし LEB128 (トレース用。小さい値が多いので固定幅より詰まる)
+  void varint(int v) {
+    while (v >= 0x80) {
+      _out.addByte((v & 0x7f) | 0x80);
+      v >>= 7;
+    }
+    _out.addByte(v);
+  }
+
+  Uint8List takeBytes() => _out.takeBytes();
+}
+
+/// StatsWriter の逆。足りないバイトを読もうとすると RangeError
+class StatsReader {
+  final ByteData _data;
+  int _offset = 0;
+
+  StatsReader(Uint8List bytes) : _data = ByteData.sublistView(bytes);
+
+  int get offset => _offset;
+  int get remaining => _data.lengthInBytes - _offset;
+
+  int u8() => _data.getUint8(_offset++);
+
+  int u16() {
+    final v = _data.getUint16(_offset, Endian.little);
+    _offset += 2;
+    return v;
+  }
+
+  int u32() {
+    final v = _data.getUint32(_offset, Endian.little);
+    _offset += 4;
+    return v;
+  }
+
+  int u64() {
+    final v = _data.getUint64(_offset, Endian.little);
+    _offset += 8;
+    return v;
+  }
+
+  String str() => utf8.decode(bytes(u16()), allowMalformed: true);
+
+  int varint() {
+    var v = 0;
+    for (var shift = 0;; shift += 7) {
+      final b = u8();
+      v |= (b & 0x7f) << shift;
+      if (b < 0x80) return v;
+    }
+  }
+
+  List<int> bytes(int n) {
+    if (n > remaining) throw RangeError.range(n, 0, remaining, 'length');
+    final b = Uint8List.sublistView(_data, _offset, _offset + n);
+    _offset += n;
+    return b;
+  }
+}
+
+/// /api/debug/stats 1 回分
+class StatsSnapshot {
+  /// 先頭 4 バイト。形式を変えたら末尾の数字を上げる
+  static const List<int> magic = [0x4c, 0x4e, 0x53, 0x31]; // "LNS1"
+
+  final int nowMs;
+  final int startedAtMs;
+  final int rssBytes;
+  final int requests;
+  final int bytesIn;
+  final int bytesOut;
+  final bool loopEnabled;
+  final int lagMs;
+  final int lagP99Ms;
+  final int lagMaxMs;
+  final int stalls;
+  final int thumbQueue;
+  final int postActionQueue;
+  final int fedQueue;
+  final List<({String name, int hits, int misses})> caches;
+  final Map<String, int> cacheBytes;
+  final List<
+      ({
+        String method,
+        String path,
+        String route,
+        String client,
+        int elapsedMs,
+        int bytesIn,
+        int bytesOut
+      })> active;
+  final List<({String ip, int bytesIn, int bytesOut, int active})> clients;
+
+  StatsSnapshot({
+    required this.nowMs,
+    required this.startedAtMs,
+    required this.rssBytes,
+    required this.requests,
+    required this.bytesIn,
+    required this.bytesOut,
+    required this.loopEnabled,
+    required this.lagMs,
+    required this.lagP99Ms,
+    required this.lagMaxMs,
+    required this.stalls,
+    required this.thumbQueue,
+    required this.postActionQueue,
+    required this.fedQueue,
+    required this.caches,
+    required this.cacheBytes,
+    required this.active,
+    required this.clients,
+  });
+
+  /// 件数は u8 / u16 に収まる分だけ書く
+  Uint8List encode() {
+    final w = StatsWriter()
+      ..bytes(magic)
+      ..u64(nowMs)
+      ..u64(startedAtMs)
+      ..u64(rssBytes)
+      ..u64(requests)
+      ..u64(bytesIn)
+      ..u64(bytesOut)
+      ..u8(loopEnabled ? 1 : 0)
+      ..u32(lagMs)
+      ..u32(lagP99Ms)
+      ..u32(lagMaxMs)
+      ..u32(stalls)
+      ..u16(thumbQueue)
+      ..u16(postActionQueue)
+      ..u16(fedQueue);
+
+    final cs = caches.take(0xff).toList();
+    w.u8(cs.length);
+    for (final c in cs) {
+      w
+        ..str(c.name)
+        ..u64(c.hits)
+        ..u64(c.misses);
+    }
+    final cb = cacheBytes.entries.take(0xff).toList();
+    w.u8(cb.length);
+    for (final e in cb) {
+      w
+        ..str(e.key)
+        ..u64(e.value);
+    }
+
+    final rs = active.take(0xffff).toList();
+    w.u16(rs.length);
+    for (final r in rs) {
+      w
+        ..str(r.method)
+        ..str(r.path)
+        ..str(r.route)
+        ..str(r.client)
+        ..u32(r.elapsedMs)
+        ..u64(r.bytesIn)
+        ..u64(r.bytesOut);
+    }
+
+    final cl = clients.take(0xffff).toList();
+    w.u16(cl.length);
+    for (final c in cl) {
+      w
+        ..str(c.ip)
+        ..u64(c.bytesIn)
+        ..u64(c.bytesOut)
+        ..u16(c.active);
+    }
+    return w.takeBytes();
+  }
+
+  /// 形式が違う (サーバの版が違う) か途中で切れていれば FormatException
+  factory StatsSnapshot.decode(Uint8List bytes) {
+    final r = StatsReader(bytes);
+    try {
+      final head = r.bytes(magic.length);
+      for (var i = 0; i < magic.length; i++) {
+        if (head[i] != magic[i]) {
+          throw const FormatException(
+              'Unknown stats format (server version differs?)');
+        }
+      }
+      return StatsSnapshot(
+        nowMs: r.u64(),
+        startedAtMs: r.u64(),
+        rssBytes: r.u64(),
+        requests: r.u64(),
+        bytesIn: r.u64(),
+        bytesOut: r.u64(),
+        loopEnabled: r.u8() != 0,
+        lagMs: r.u32(),
+        lagP99Ms: r.u32(),
+        lagMaxMs: r.u32(),
+        stalls: r.u32(),
+        thumbQueue: r.u16(),
+        postActionQueue: r.u16(),
+        fedQueue: r.u16(),
+        caches: [
+          for (var i = r.u8(); i > 0; i--)
+            (name: r.str(), hits: r.u64(), misses: r.u64()),
+        ],
+        cacheBytes: {
+          for (var i = r.u8(); i > 0; i--) r.str(): r.u64(),
+        },
+        active: [
+          for (var i = r.u16(); i > 0; i--)
+            (
+              method: r.str(),
+              path: r.str(),
+              route: r.str(),
+              client: r.str(),
+              elapsedMs: r.u32(),
+              bytesIn: r.u64(),
+              bytesOut: r.u64(),
+            ),
+        ],
+        clients: [
+          for (var i = r.u16(); i > 0; i--)
+            (ip: r.str(), bytesIn: r.u64(), bytesOut: r.u64(), active: r.u16()),
+        ],
+      );
+    } on RangeError {
+      throw const FormatException('Truncated stats response');
+    }
+  }
+}
@@ -0,0 +1,194 @@
+// アクセストレース (--trace) のファイル形式。
+//
+// ファイルは起動ごとのセグメントの連なりで、各セグメントは
+// "LNT1" + 開始時刻 (epoch ms) + 共有ルート、続いて 1 件ごとに
+// タグ 0x01 + 開始のずれ (ms) + 応答ヘッダ / 完了までの時間 (µs) + 状態 +
+// メソッド + 経路の種類 + パス + クエリ + ヘッダ + 受信 / 送信バイト数。
+// 整数は LEB128、文字列は長さ (u16) 付き UTF-8。
+//
+// 異常終了で書きかけの 1 件が残ったまま次の起動が追記すると、その 1 件は
+// 次のセグメント見出しを食い込んで読めてしまう。読む側は見出しをまたいだ
+// 記録を捨て、見出しから読み直す。
+
+import 'dart:convert';
+import 'dart:math';
+import 'dart:typed_data';
+
+import 'perf_stats.dart';
+import 'stats_format.dart';
+
+/// ファイルの先頭と、追記のたびに入るセグメント見出しの 4 バイト
+const List<int> kTraceMagic = [0x4c, 0x4e, 0x54, 0x31]; // "LNT1"
+
+/// 再生に要る分だけのリクエストヘッダ (本文は記録しない)
+const List<String> kTraceHeaders = [
+  'content-type', 'range', 'if-range', 'if-none-match', 'depth', 'destination'
+];
+
+const int _kRecordTag = 0x01;
+
+/// トレース 1 件。route は PerfStats.routes のどれか
+class TraceRecord {
+  final int startMs; // epoch ms
+  final String shareRoot;
+  final int headerUs;
+  final int totalUs;
+  final int status;
+  final String method;
+  final String route;
+  final String path;
+  final String query;
+  final Map<String, String> headers;
+  final int bytesIn;
+  final int bytesOut;
+
+  TraceRecord({
+    required this.startMs,
+    required this.shareRoot,
+    required this.headerUs,
+    required this.totalUs,
+    required this.status,
+    required this.method,
+    required this.route,
+    required this.path,
+    this.query = '',
+    this.headers = const {},
+    required this.bytesIn,
+    required this.bytesOut,
+  });
+}
+
+/// セグメント見出し。起動ごとに 1 回、追記の先頭に書く
+Uint8List encodeTraceSegment(int startMs, String shareRoot) => (StatsWriter()
+      ..bytes(kTraceMagic)
+      ..varint(startMs)
+      ..str(shareRoot))
+    .takeBytes();
+
+/// 1 件分。segmentStartMs はそのセグメントの見出しに書いた時刻
+/// (r.shareRoot は見出し側にあるので書かない)
+Uint8List encodeTraceRecord(int segmentStartMs, TraceRecord r) {
+  final route = PerfStats.routes.indexOf(r.route);
+  final headers = StringBuffer();
+  r.headers.forEach((k, v) => headers.write('$k: $v\n'));
+  return (StatsWriter()
+        ..u8(_kRecordTag)
+        ..varint(max(0, r.startMs - segmentStartMs))
+        ..varint(r.headerUs)
+        ..varint(r.totalUs)
+        ..varint(r.status)
+        ..str(r.method)
+        ..u8(route < 0 ? 0xff : route)
+        ..str(r.path)
+        ..str(r.query)
+        ..str(headers.toString())
+        ..varint(r.bytesIn)
+        ..varint(r.bytesOut))
+      .takeBytes();
+}
+
+/// ファイル順 (= 完了順) に全セグメントの記録を返す。末尾の書きかけと、
+/// 次のセグメント見出しで途切れた記録は捨てる
+List<TraceRecord> readTrace(Uint8List bytes) {
+  if (bytes.isNotEmpty && _segmentAt(bytes, 0, 0) == null) {
+    throw const FormatException('Not a LocalNode trace (bad magic)');
+  }
+  final out = <TraceRecord>[];
+  var pos = 0;
+  var minStartMs = 0;
+  while (pos < bytes.length) {
+    // 記録の切れ目にある見出しは時計が戻っていても受け入れる
+    final seg = _segmentAt(bytes, pos, 0);
+    if (seg == null) {
+      // 知らないタグ: 次のセグメントまで読み飛ばす
+      pos = _nextSegment(bytes, pos + 1, bytes.length, minStartMs) ?? bytes.length;
+      continue;
+    }
+    minStartMs = seg.startMs;
+    pos = seg.end;
+    while (pos < bytes.length && bytes[pos] == _kRecordTag) {
+      final rec = _recordAt(bytes, pos, seg.startMs, seg.root);
+      final cut =
+          _nextSegment(bytes, pos + 1, rec?.end ?? bytes.length, minStartMs);
+      if (rec == null || cut != null) {
+        pos = cut ?? bytes.length;
+        break;
+      }
+      out.add(rec.record);
+      pos = rec.end;
+    }
+  }
+  return out;
+}
+
+/// pos から読めるセグメント見出し。開始時刻が前のセグメントより前 (か
+/// 2100 年代) なら、記録の途中にたまたま "LNT1" があっただけとみなす
+({int startMs, String root, int end})? _segmentAt(
+    Uint8List bytes, int pos, int minStartMs) {
+  if (bytes.length - pos < kTraceMagic.length) return null;
+  for (var i = 0; i < kTraceMagic.length; i++) {
+    if (bytes[pos + i] != kTraceMagic[i]) return null;
+  }
+  final r = StatsReader(Uint8List.sublistView(bytes, pos + kTraceMagic.length));
+  try {
+    final startMs = r.varint();
+    if (startMs < minStartMs || startMs >= 1 << 42) return null;
+    final root = r.str();
+    return (startMs: startMs, root: root, end: pos + kTraceMagic.length + r.offset);
+  } on RangeError {
+    return null;
+  }
+}
+
+/// [from, to) にある最初のセグメント見出しの位置
+int? _nextSegment(Uint8List bytes, int from, int to, int minStartMs) {
+  for (var i = from; i < to; i++) {
+    if (bytes[i] == kTraceMagic[0] && _segmentAt(bytes, i, minStartMs) != null) {
+      return i;
+    }
+  }
+  return null;
+}
+
+({TraceRecord record, int end})? _recordAt(
+    Uint8List bytes, int pos, int segStartMs, String root) {
+  final r = StatsReader(Uint8List.sublistView(bytes, pos + 1));
+  try {
+    final offsetMs = r.varint();
+    final headerUs = r.varint();
+    final totalUs = r.varint();
+    final status = r.varint();
+    final method = r.str();
+    final routeIndex = r.u8();
+    final path = r.str();
+    final query = r.str();
+    final headers = <String, String>{};
+    for (final line in const LineSplitter().convert(r.str())) {
+      final i = line.indexOf(': ');
+      if (i > 0) headers[line.substring(0, i)] = line.substring(i + 2);
+    }
+    final bytesIn = r.varint();
+    final bytesOut = r.varint();
+    return (
+      record: TraceRecord(
+        startMs: segStartMs + offsetMs,
+        shareRoot: root,
+        headerUs: headerUs,
+        totalUs: totalUs,
+        status: status,
+        method: method,
+        route: routeIndex < PerfStats.routes.length
+            ? PerfStats.routes[routeIndex]
+            : 'api',
+        path: path,
+        query: query,
+        headers: headers,
+        bytesIn: bytesIn,
+        bytesOut: bytesOut,
+      ),
+      end: pos + 1 + r.offset,
+    );
+  } on RangeError {
+    return null;
+  }
+}
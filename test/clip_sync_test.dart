@@ -0,0 +1,165 @@
+import 'package:flutter_test/flutter_test.dart';
+import 'package:localnode/src/clip_sync.dart';
+
+void main() {
+  group('version vector', () {
+    test('nextSeq numbers our own origin and advances the VV', () {
+      final log = ClipSyncLog();
+      expect(log.nextSeq('a@1'), 1);
+      expect(log.nextSeq('a@1'), 2);
+      expect(log.vv, {'a@1': 2});
+      expect(log.isNew('a@1', 2), isFalse);
+      expect(log.isNew('a@1', 3), isTrue);
+      expect(log.isNew('b@1', 1), isTrue);
+    });
+
+    test('advance only moves forward', () {
+      final log = ClipSyncLog()..advance({'a': 5, 'b': 2});
+      log.advance({'a': 3, 'b': 4, 7: 9, 'c': 'x'});
+      expect(log.vv, {'a': 5, 'b': 4});
+    });
+
+    test('missingFrom asks only for origins the peer is ahead on', () {
+      final log = ClipSyncLog()..advance({'a': 5, 'b': 2});
+      expect(log.missingFrom({'a': 5, 'b': 6, 'c': 1, 'd': 'x'}), {
+        'b': [2, 6],
+        'c': [0, 1],
+      });
+    });
+  });
+
+  group('tombstones', () {
+    test('are kept until every sync peer has passed them', () {
+      final log = ClipSyncLog();
+      log.addTombstone('a', 3, 'x:1');
+      log.addTombstone('a', 4, 'x:2');
+      expect(log.isDeleted('x:1'), isTrue);
+
+      log.trim([{'a': 3}, {'a': 2}]);
+      expect(log.tombstoneCount, 2);
+      log.trim([{'a': 3}, {'a': 3}]);
+      expect(log.tombstones.map((t) => t.key), ['x:2']);
+      expect(log.isDeleted('x:1'), isFalse);
+      expect(log.isDeleted('x:2'), isTrue);
+    });
+
+    test('a peer whose VV is unknown holds every tombstone', () {
+      final log = ClipSyncLog();
+      log.addTombstone('a', 1, 'x:1');
+      log.trim([{'a': 9}, null]);
+      expect(log.tombstoneCount, 1);
+    });
+
+    test('a bulk clear appends in constant time and trims once', () {
+      // 全消去の経路: 1 件ずつ積み、最後に 1 回だけ trim する
+      final log = ClipSyncLog();
+      const n = 100000;
+      final peers = [
+        {'a': n ~/ 2},
+        {'a': n},
+      ];
+      final sw = Stopwatch()..start();
+      for (var i = 1; i <= n; i++) {
+        log.addTombstone('a', i, 'x:$i');
+      }
+      expect(log.tombstoneCount, n);
+      log.trim(peers);
+      sw.stop();
+      expect(log.tombstoneCount, n ~/ 2);
+      expect(log.tombstones.first.seq, n ~/ 2 + 1);
+      expect(log.isDeleted('x:${n ~/ 2}'), isFalse);
+      expect(log.isDeleted('x:$n'), isTrue);
+      // O(n^2) なら数十秒かかる。遅いマシンでも十分余裕のある上限
+      expect(sw.elapsed, lessThan(const Duration(seconds: 5)));
+      // 捨てた位置より手前からの区間は resync になる
+      log.advance({'a': n});
+      expect(log.plan({
+        'a': [0, n],
+      }).resync, ['a']);
+    });
+
+    test('the cap drops the oldest first', () {
+      final log = ClipSyncLog(maxTombstones: 2);
+      for (var i = 1; i <= 3; i++) {
+        log.addTombstone('a', i, 'x:$i');
+      }
+      expect(log.tombstones.map((t) => t.seq), [2, 3]);
+      expect(log.isDeleted('x:1'), isFalse);
+    });
+  });
+
+  group('plan', () {
+    test('clamps the range to what we have', () {
+      final log = ClipSyncLog()..advance({'a': 10});
+      final plan = log.plan({
+        'a': [2, 50],
+        'b': [0, 3], // 何も持っていない
+        'c': [5, 5], // 空
+        'd': 'bad',
+      });
+      expect(plan.want, {'a': (from: 2, upTo: 10)});
+      expect(plan.resync, isEmpty);
+    });
+
+    test('asks for a resync when the range starts before a dropped tombstone', () {
+      final log = ClipSyncLog(maxTombstones: 1)..advance({'a': 10});
+      log.addTombstone('a', 4, 'x:1');
+      log.addTombstone('a', 6, 'x:2'); // seq 4 は捨てられる
+      final plan = log.plan({
+        'a': [3, 10],
+      });
+      expect(plan.want, isEmpty);
+      expect(plan.resync, ['a']);
+      // 捨てた位置以降からなら差分で返せる
+      expect(log.plan({
+        'a': [4, 10],
+      }).want, {'a': (from: 4, upTo: 10)});
+    });
+  });
+
+  group('cut', () {
+    test('returns everything and the full range within budget', () {
+      final cut = ClipSyncLog.cut(
+          {'a': (from: 0, upTo: 10)}, {'a': [2, 5, 9]}, 500);
+      // 欠番 (退避された item) があっても through は区間の終わりまで進む
+      expect(cut, {'a': (take: 3, through: 10)});
+    });
+
+    test('stops through just before the first event not sent', () {
+      final cut = ClipSyncLog.cut({
+        'a': (from: 0, upTo: 10),
+        'b': (from: 3, upTo: 8),
+      }, {
+        'a': [2, 5, 9],
+        'b': [4, 6],
+      }, 4);
+      expect(cut, {
+        'a': (take: 3, through: 10),
+        'b': (take: 1, through: 5),
+      });
+    });
+
+    test('omits an origin it could not advance at all', () {
+      final cut = ClipSyncLog.cut({
+        'a': (from: 0, upTo: 10),
+        'b': (from: 3, upTo: 8),
+      }, {
+        'a': [1, 2],
+        'b': [4],
+      }, 2);
+      expect(cut, {'a': (take: 2, through: 10)});
+    });
+
+    test('an empty range still advances to its end', () {
+      expect(ClipSyncLog.cut({'a': (from: 2, upTo: 7)}, {}, 0),
+          {'a': (take: 0, through: 7)});
+    });
+  });
+
+  test('reconcile drops only items the peer has passed and no longer holds', () {
+    expect(ClipSyncLog.droppedByPeer(3, 5, {1, 2}), isTrue);
+    expect(ClipSyncLog.droppedByPeer(2, 5, {1, 2}), isFalse);
+    // 相手がまだ知らない seq は消さない
+    expect(ClipSyncLog.droppedByPeer(6, 5, {1, 2}), isFalse);
+  });
+}
@@ -0,0 +1,180 @@
+import 'dart:convert';
+import 'dart:typed_data';
+
+import 'package:flutter_test/flutter_test.dart';
+import 'package:localnode/src/clipboard_store.dart';
+
+void main() {
+  ClipboardEntry entry(String id, String text,
+          {String? tag, String? origin, int seq = 0, bool important = false}) =>
+      ClipboardEntry(
+        id: id,
+        text: text,
+        tag: tag,
+        createdAt: DateTime.fromMillisecondsSinceEpoch(1700000000123),
+        important: important,
+        origin: origin,
+        seq: seq,
+      );
+
+  String jsonOf(ClipboardStore store) {
+    final out = BytesBuilder();
+    store.writeJsonArray(out, [for (var i = 0; i < store.length; i++) i]);
+    return utf8.decode(out.takeBytes());
+  }
+
+  String encoded(ClipboardStore store) =>
+      json.encode([for (final e in store) e.toJson()]);
+
+  group('writeJsonArray', () {
+    test('matches json.encode of toJson byte for byte', () {
+      final control = String.fromCharCodes(List.generate(0x20, (c) => c));
+      final store = ClipboardStore()
+        ..insert(0, entry('a"b\\c', 'quote " backslash \\ slash /', tag: 'x"y'))
+        ..insert(0, entry('ctl', control, tag: 'tab\there'))
+        ..insert(0, entry('wide', '日本語 😀 \u2028\u2029 \u007f', important: true))
+        ..insert(0, entry('empty', ''))
+        ..insert(
+            0,
+            ClipboardEntry(
+              id: 'blob',
+              text: 'image.png',
+              createdAt: DateTime.fromMillisecondsSinceEpoch(0),
+              blob: (sha: 'ab' * 32, size: 10, mime: 'image/png', name: null),
+            ));
+      expect(jsonOf(store), encoded(store));
+      expect(json.decode(jsonOf(store))[3]['text'], control);
+    });
+
+    test('writes only the rows asked for, in that order', () {
+      final store = ClipboardStore();
+      for (var i = 0; i < 4; i++) {
+        store.insert(0, entry('$i', 'text $i'));
+      }
+      final out = BytesBuilder();
+      store.writeJsonArray(out, [2, 0]);
+      final rows = json.decode(utf8.decode(out.takeBytes())) as List;
+      expect(rows.map((r) => r['id']), ['1', '3']);
+      store.writeJsonArray(out, const []);
+      expect(utf8.decode(out.takeBytes()), '[]');
+    });
+
+    test('an unpaired surrogate is stored as U+FFFD on both paths', () {
+      final store = ClipboardStore()..insert(0, entry('s', 'a\uD800b'));
+      expect(store[0].text, 'a\uFFFDb');
+      expect(jsonOf(store), encoded(store));
+    });
+  });
+
+  group('arena', () {
+    // 1 件 100,000 バイト強。1 チャンク (256KB) に 2 件ずつ入る
+    String body(int i) => '$i:'.padRight(100000, String.fromCharCode(0x41 + i % 26));
+
+    test('removeAt keeps rows across chunk boundaries and compacts', () {
+      final store = ClipboardStore();
+      for (var i = 0; i < 40; i++) {
+        store.insert(0, entry('id$i', body(i)));
+      }
+      final before = store.arenaBytes;
+      expect(before.reserved, greaterThan(10 * ClipboardStore.chunkBytes));
+
+      // 古い方 (末尾) から 30 件消す。20 件目でゴミが生きている量に並んで詰め直す
+      for (var i = 0; i < 30; i++) {
+        expect(store.removeLast().id, 'id$i');
+      }
+      expect(store.length, 10);
+      final after = store.arenaBytes;
+      expect(after.live, 10 * (100000 + 'id30'.length));
+      expect(after.reserved, lessThanOrEqualTo(before.reserved ~/ 2));
+      for (var k = 0; k < 10; k++) {
+        final i = 39 - k;
+        expect(store[k].id, 'id$i');
+        expect(store[k].text, body(i));
+      }
+      expect(store.indexOfId('id35'), 4);
+      expect(store.indexOfId('id5'), -1);
+
+      // 中ほどの行を抜いても前後は崩れない
+      store.removeAt(3);
+      expect([for (var k = 0; k < store.length; k++) store.idAt(k)],
+          ['id39', 'id38', 'id37', 'id35', 'id34', 'id33', 'id32', 'id31', 'id30']);
+      expect(jsonOf(store), encoded(store));
+    });
+
+    test('an item larger than a chunk gets its own chunk', () {
+      const chunk = ClipboardStore.chunkBytes;
+      final big = 'あ' * 100000; // 300,000 バイト
+      final store = ClipboardStore()
+        ..insert(0, entry('small1', 'one'))
+        ..insert(0, entry('big', big))
+        ..insert(0, entry('small2', 'two'));
+      // small1 のチャンク、big 専用、big の id 以降の新しいチャンク
+      expect(store.arenaBytes.reserved, 2 * chunk + 300000);
+      expect(store[1].text, big);
+      expect(store[0].text, 'two');
+      expect(store[2].text, 'one');
+      expect(jsonOf(store), encoded(store));
+
+      store.removeAt(1);
+      expect(store.arenaBytes.live, 'small1one'.length + 'small2two'.length);
+      expect(store.map((e) => e.text), ['two', 'one']);
+    });
+
+    test('large items survive compaction', () {
+      final store = ClipboardStore();
+      for (var i = 0; i < 5; i++) {
+        store.insert(0, entry('big$i', '$i'.padRight(300000, 'z')));
+      }
+      // 4 件目を消した時点でゴミ 1.2MB > 生存 0.3MB かつ下限 1MB 超え
+      for (var i = 0; i < 4; i++) {
+        store.removeLast();
+      }
+      expect(store.arenaBytes.reserved,
+          300000 + ClipboardStore.chunkBytes); // 本文専用 + id のチャンク
+      expect(store.single.text, '4'.padRight(300000, 'z'));
+      expect(store.single.id, 'big4');
+    });
+  });
+
+  group('atoms', () {
+    test('tags and origins are shared and released with their rows', () {
+      final store = ClipboardStore()
+        ..insert(0, entry('1', 'a', tag: 't', origin: 'dev@1', seq: 5))
+        ..insert(0, entry('2', 'b', tag: 't', origin: 'dev@1', seq: 6));
+      expect(store.indexOfReplicaKey('dev@1:5'), 1);
+      expect(store.indexOfReplicaKey('dev@1:7'), -1);
+      expect(store.indexOfReplicaKey('other:5'), -1);
+      expect(store.indexOfReplicaKey('nocolon'), -1);
+
+      store.removeAt(1);
+      expect(store[0].tag, 't');
+      expect(store[0].replicaKey, 'dev@1:6');
+      store.removeAt(0);
+      expect(store.indexOfReplicaKey('dev@1:6'), -1);
+
+      // 解放された番号を使い回しても別の文字列が混ざらない
+      store.insert(0, entry('3', 'c', tag: 'u', origin: 'dev@2', seq: 1));
+      expect(store[0].tag, 'u');
+      expect(store[0].origin, 'dev@2');
+      expect(jsonOf(store), encoded(store));
+    });
+
+    test('blobBySha finds the blob by its hash', () {
+      final blob = (sha: 'cd' * 32, size: 3, mime: 'text/plain', name: 'a.txt');
+      final store = ClipboardStore()
+        ..insert(
+            0,
+            ClipboardEntry(
+              id: 'b',
+              text: 'a.txt',
+              createdAt: DateTime.fromMillisecondsSinceEpoch(0),
+              blob: blob,
+            ));
+      expect(store.blobBySha('cd' * 32), blob);
+      expect(store.blobBySha('00' * 32), isNull);
+      store.clear();
+      expect(store.blobBySha('cd' * 32), isNull);
+      expect(store, isEmpty);
+    });
+  });
+}
@@ -0,0 +1,146 @@
+import 'dart:io';
+import 'dart:typed_data';
+
+import 'package:flutter_test/flutter_test.dart';
+import 'package:localnode/src/lnz.dart';
+
+// 圧縮が効きすぎないよう、繰り返しの少ないデータにする
+Uint8List _data(int n) {
+  final b = Uint8List(n);
+  var x = 0x12345678;
+  for (var i = 0; i < n; i++) {
+    x = (x * 1103515245 + 12345) & 0x7fffffff;
+    b[i] = (x >> 16) & 0xff;
+  }
+  return b;
+}
+
+Future<List<int>> _read(SeekableCompressedFile f, [int start = 0, int? end]) async {
+  final out = <int>[];
+  await for (final chunk in f.openRead(start, end)) {
+    out.addAll(chunk);
+  }
+  return out;
+}
+
+void main() {
+  late Directory dir;
+
+  setUp(() async {
+    dir = await Directory.systemTemp.createTemp('lnz_test');
+  });
+
+  tearDown(() async {
+    await dir.delete(recursive: true);
+  });
+
+  Future<File> write(List<int> data, {int frameBytes = 1000, int chunk = 333}) async {
+    final file = File('${dir.path}/a$kCompressedSuffix');
+    final w = SeekableCompressedWriter(file, frameBytes: frameBytes);
+    for (var i = 0; i < data.length; i += chunk) {
+      w.add(data.sublist(i, i + chunk > data.length ? data.length : i + chunk));
+    }
+    await w.close();
+    return file;
+  }
+
+  test('round-trips data spanning several frames', () async {
+    final data = _data(4500);
+    final f = await SeekableCompressedFile.open(await write(data));
+    expect(f.frameBytes, 1000);
+    expect(f.logicalSize, 4500);
+    expect(f.frameOffsets.length, 5 + 1);
+    expect(await _read(f), data);
+  });
+
+  test('flush writes finished frames and keeps the partial one', () async {
+    final data = _data(2500);
+    final file = File('${dir.path}/f$kCompressedSuffix');
+    final w = SeekableCompressedWriter(file, frameBytes: 1000)..add(data);
+    await w.flush();
+    final flushed = await file.length();
+    expect(flushed, greaterThan(0));
+    w.add(const []);
+    await w.flush();
+    expect(await file.length(), flushed); // 残りの 500 バイトはまだ書かない
+    await w.close();
+    final f = await SeekableCompressedFile.open(file);
+    expect(f.frameOffsets[2], flushed);
+    expect(await _read(f), data);
+  });
+
+  test('reads arbitrary ranges across frame boundaries', () async {
+    final data = _data(4500);
+    final f = await SeekableCompressedFile.open(await write(data));
+    for (final (start, end) in [(0, 1), (999, 1001), (1500, 3700), (4499, 4500), (0, 4500)]) {
+      expect(await _read(f, start, end), data.sublist(start, end),
+          reason: 'range $start-$end');
+    }
+    // 末尾を越える end は切り詰め、空の範囲は何も返さない
+    expect(await _read(f, 4000, 9999), data.sublist(4000));
+    expect(await _read(f, 4500), isEmpty);
+    expect(await _read(f, 10, 10), isEmpty);
+  });
+
+  test('writes the documented footer and seek table', () async {
+    final data = _data(2500);
+    final bytes = await (await write(data)).readAsBytes();
+    final footer = ByteData.sublistView(bytes, bytes.length - 24);
+    expect(String.fromCharCodes(bytes.sublist(bytes.length - 24, bytes.length - 20)), 'LNZ1');
+    expect(footer.getUint32(0, Endian.little), SeekableCompressedFile.magic);
+    expect(footer.getUint32(4, Endian.little), 1000);
+    expect(footer.getUint32(8, Endian.little), 3);
+    expect(footer.getUint32(12, Endian.little), 0);
+    expect(footer.getUint64(16, Endian.little), 2500);
+
+    // シークテーブルの各サイズで切り出したフレームは単独で展開できる
+    final table = ByteData.sublistView(bytes, bytes.length - 24 - 3 * 4, bytes.length - 24);
+    var off = 0;
+    for (var i = 0; i < 3; i++) {
+      final size = table.getUint32(i * 4, Endian.little);
+      final raw = ZLibDecoder(raw: true).convert(bytes.sublist(off, off + size));
+      final end = (i + 1) * 1000 > 2500 ? 2500 : (i + 1) * 1000;
+      expect(raw, data.sublist(i * 1000, end), reason: 'frame $i');
+      off += size;
+    }
+    expect(off, bytes.length - 24 - 3 * 4);
+  });
+
+  test('an exact multiple of the frame size has no trailing partial frame', () async {
+    final f = await SeekableCompressedFile.open(await write(_data(3000), chunk: 1000));
+    expect(f.frameOffsets.length, 3 + 1);
+    expect(f.logicalSize, 3000);
+  });
+
+  test('an empty file is a valid archive with no frames', () async {
+    final f = await SeekableCompressedFile.open(await write(const []));
+    expect(f.logicalSize, 0);
+    expect(f.frameOffsets, [0]);
+    expect(await _read(f), isEmpty);
+  });
+
+  test('rejects files that are not .lnz archives', () async {
+    final plain = File('${dir.path}/plain.txt')..writeAsBytesSync(_data(100));
+    await expectLater(SeekableCompressedFile.open(plain), throwsFormatException);
+    final tiny = File('${dir.path}/tiny')..writeAsBytesSync([1, 2, 3]);
+    await expectLater(SeekableCompressedFile.open(tiny), throwsFormatException);
+  });
+
+  test('rejects a footer that disagrees with the seek table', () async {
+    final file = await write(_data(2500));
+    final bytes = await file.readAsBytes();
+    final footer = ByteData.sublistView(bytes, bytes.length - 24);
+
+    // フレーム数を 1 つ多く申告 → テーブル位置がフレームの合計と合わない
+    footer.setUint32(8, 4, Endian.little);
+    await file.writeAsBytes(bytes);
+    await expectLater(SeekableCompressedFile.open(file), throwsFormatException);
+
+    // 論理サイズがフレーム数と矛盾する
+    footer
+      ..setUint32(8, 3, Endian.little)
+      ..setUint64(16, 3001, Endian.little);
+    await file.writeAsBytes(bytes);
+    await expectLater(SeekableCompressedFile.open(file), throwsFormatException);
+  });
+}
@@ -0,0 +1,129 @@
+import 'package:flutter_test/flutter_test.dart';
+import 'package:localnode/src/perf_stats.dart';
+
+void main() {
+  var now = 0;
+  PerfStats stats() {
+    now = 1000000; // 1 秒区間の境目
+    return PerfStats(caches: const ['thumbnail', 'other'], nowMs: () => now);
+  }
+
+  List<int> seconds(PerfStats s, String key) =>
+      ((s.toJson()['seconds'] as Map)[key] as List).cast<int>();
+
+  group('latency buckets', () {
+    test('are log2 of the milliseconds', () {
+      expect(PerfSlot.bucketOf(0), 0);
+      expect(PerfSlot.bucketOf(999), 0); // 1ms 未満
+      expect(PerfSlot.bucketOf(1000), 1); // [1,2)
+      expect(PerfSlot.bucketOf(3999), 2); // [2,4)
+      expect(PerfSlot.bucketOf(4000), 3); // [4,8)
+      expect(PerfSlot.bucketOf(16383 * 1000), 14);
+      expect(PerfSlot.bucketOf(16384 * 1000), 15);
+      expect(PerfSlot.bucketOf(3600 * 1000 * 1000), PerfSlot.buckets - 1);
+    });
+
+    test('p50 and p99 report the upper edge of the bucket', () {
+      final slot = PerfSlot(0);
+      expect(slot.percentileMs(0, 0.5), isNull);
+      // api: 98 件が 2-4ms, 2 件が 512-1024ms
+      for (var i = 0; i < 98; i++) {
+        slot.latency[PerfSlot.bucketOf(3000)]++;
+      }
+      slot.latency[PerfSlot.bucketOf(600000)] += 2;
+      expect(slot.percentileMs(0, 0.5), 4);
+      expect(slot.percentileMs(0, 0.98), 4);
+      expect(slot.percentileMs(0, 0.99), 1024);
+      // 他の経路には影響しない
+      expect(slot.percentileMs(1, 0.5), isNull);
+    });
+  });
+
+  group('rings', () {
+    test('record into the current one-second slot', () {
+      final s = stats();
+      s.request('download', 5000, error: false);
+      s.request('download', 5000, error: true);
+      s.bytesOut(300);
+      final requests = seconds(s, 'requests');
+      expect(requests.length, 120);
+      expect(requests.last, 2);
+      expect(requests.take(119).every((v) => v == 0), isTrue);
+      expect(seconds(s, 'errors').last, 1);
+      expect(seconds(s, 'bytesOut').last, 300);
+      expect(s.totalRequests, 2);
+      final lat = (s.toJson()['seconds'] as Map)['latencyMs'] as Map;
+      expect(lat.keys, ['download']); // 来ていない経路は省く
+      expect((lat['download'] as Map)['p50'].last, 8);
+    });
+
+    test('rotate forward and clear the slots skipped while idle', () {
+      final s = stats();
+      s.request('api', 0, error: false);
+      now += 3000;
+      s.request('api', 0, error: false);
+      final requests = seconds(s, 'requests');
+      expect(requests.sublist(116), [1, 0, 0, 1]);
+      final json = s.toJson()['seconds'] as Map;
+      expect(json['endMs'], now + 1000);
+
+      // 1 周以上アイドルなら全部空になる
+      now += 200 * 1000;
+      expect(seconds(s, 'requests').every((v) => v == 0), isTrue);
+      // 分のリングには残っている
+      final minutes = (s.toJson()['minutes'] as Map)['requests'] as List;
+      expect(minutes.reduce((a, b) => a + b), 2);
+    });
+
+    test('a reused slot does not keep old counts', () {
+      final s = stats();
+      s.request('api', 0, error: false);
+      now += 120 * 1000; // 同じ位置に戻る
+      s.request('api', 0, error: false);
+      expect(seconds(s, 'requests').last, 1);
+    });
+
+    test('gauges keep the maximum within a slot and carry over idle slots', () {
+      final s = stats();
+      s.transfer(1);
+      s.transfer(1);
+      s.transfer(-1);
+      expect(seconds(s, 'active').last, 2);
+      now += 2000;
+      expect(seconds(s, 'active').sublist(118), [1, 1]);
+    });
+  });
+
+  test('caches are counted by the names given', () {
+    final s = stats();
+    s.cache('other', true);
+    s.cache('other', false);
+    s.cache('thumbnail', true);
+    expect(s.cacheHits, [1, 1]);
+    expect(s.cacheMisses, [0, 1]);
+    final json = s.toJson();
+    expect(json['caches'], ['thumbnail', 'other']);
+    final cache = (json['seconds'] as Map)['cache'] as Map;
+    expect((cache['other'] as Map)['misses'].last, 1);
+  });
+
+  test('count tracks bytes and the transfer gauge while streaming', () async {
+    final s = stats();
+    var bytes = 0;
+    var done = false;
+    final out = s.count(Stream.fromIterable([
+      [1, 2],
+      [3],
+    ]), (n) => bytes += n, onDone: () => done = true);
+    expect(s.active, 0); // 読まれるまでは数えない
+    final chunks = await out.toList();
+    expect(chunks, [
+      [1, 2],
+      [3],
+    ]);
+    expect(bytes, 3);
+    expect(done, isTrue);
+    expect(s.active, 0);
+    expect(seconds(s, 'active').last, 1);
+  });
+}
@@ -0,0 +1,61 @@
+import 'package:flutter_test/flutter_test.dart';
+import 'package:localnode/src/rate_limit.dart';
+
+void main() {
+  group('TokenBucket', () {
+    test('starts full and defaults burst to one second of rate', () {
+      final b = TokenBucket(2.5);
+      expect(b.burst, 3);
+      for (var i = 0; i < 3; i++) {
+        expect(b.take(1000), isNull);
+      }
+      expect(b.take(1000), isNotNull);
+    });
+
+    test('a sub-1 rate still allows one request', () {
+      final b = TokenBucket(0.1);
+      expect(b.burst, 1);
+      expect(b.take(1000), isNull);
+      // 次の 1 個は 10 秒後
+      expect(b.take(1000), 10);
+    });
+
+    test('refills at rate and reports the wait in whole seconds', () {
+      final b = TokenBucket(1, burst: 1);
+      expect(b.take(1000), isNull);
+      expect(b.take(1000), 1);
+      expect(b.take(1400), 1); // 0.4 個。残り 0.6 秒 → 切り上げ
+      expect(b.take(2000), isNull);
+    });
+
+    test('does not accumulate beyond burst while idle', () {
+      final b = TokenBucket(10, burst: 2);
+      expect(b.take(1000), isNull);
+      expect(b.take(100000), isNull);
+      expect(b.take(100000), isNull);
+      expect(b.take(100000), isNotNull);
+    });
+  });
+
+  group('ByteRateLimiter', () {
+    test('lets one second of burst through without waiting', () {
+      final l = ByteRateLimiter(1000);
+      expect(l.reserve(1000, 0), 0);
+      // 2 秒分予約済み → 1 秒のバーストを超えた分だけ待つ
+      expect(l.reserve(1000, 0), 1000);
+    });
+
+    test('the schedule drains in real time', () {
+      final l = ByteRateLimiter(1000);
+      expect(l.reserve(2000, 0), 1000);
+      expect(l.reserve(500, 1500), 0);
+      expect(l.reserve(1000, 1500), 1000);
+    });
+
+    test('idle time does not bank extra burst', () {
+      final l = ByteRateLimiter(1000);
+      expect(l.reserve(100, 0), 0);
+      expect(l.reserve(2000, 60000), 1000);
+    });
+  });
+}
@@ -0,0 +1,108 @@
+import 'package:flutter_test/flutter_test.dart';
+import 'package:localnode/src/replica.dart';
+
+ReplicaEntry _entry(Map<String, int> vv,
+        {String sha = 'aaaaaaaaaaaa', int modified = 1000, bool deleted = false}) =>
+    ReplicaEntry(
+      sha: deleted ? '' : sha,
+      size: deleted ? 0 : 10,
+      localMtimeMs: 0,
+      modifiedMs: modified,
+      vv: vv,
+      deleted: deleted,
+    );
+
+void main() {
+  group('version vectors', () {
+    test('covers requires every counter to be at least as large', () {
+      expect(ReplicaEntry.covers({'a': 2, 'b': 1}, {'a': 1}), isTrue);
+      expect(ReplicaEntry.covers({'a': 1}, {'a': 1}), isTrue);
+      expect(ReplicaEntry.covers({'a': 2}, {'a': 1, 'b': 1}), isFalse);
+      expect(ReplicaEntry.covers({}, {}), isTrue);
+    });
+
+    test('merge takes the per-device maximum', () {
+      expect(ReplicaEntry.merge({'a': 3, 'b': 1}, {'b': 4, 'c': 2}),
+          {'a': 3, 'b': 4, 'c': 2});
+    });
+  });
+
+  group('decide', () {
+    test('a missing local entry adopts the remote one', () {
+      expect(ReplicaEntry.decide(null, _entry({'b': 1})), ReplicaMerge.adopt);
+    });
+
+    test('identical versions are left alone', () {
+      expect(ReplicaEntry.decide(_entry({'a': 1}), _entry({'a': 1})),
+          ReplicaMerge.same);
+    });
+
+    test('the hash ignores the local mtime', () {
+      final mine = _entry({'a': 1})..localMtimeMs = 42;
+      expect(ReplicaEntry.decide(mine, _entry({'a': 1})), ReplicaMerge.same);
+    });
+
+    test('a newer remote version is adopted, including deletions', () {
+      expect(ReplicaEntry.decide(_entry({'a': 1}), _entry({'a': 1, 'b': 1}, sha: 'b' * 12)),
+          ReplicaMerge.adopt);
+      expect(ReplicaEntry.decide(_entry({'a': 1}), _entry({'a': 1, 'b': 1}, deleted: true)),
+          ReplicaMerge.adopt);
+    });
+
+    test('a newer local version is kept for the peer to pull', () {
+      expect(ReplicaEntry.decide(_entry({'a': 2}), _entry({'a': 1}, sha: 'b' * 12)),
+          ReplicaMerge.keep);
+    });
+
+    test('concurrent edits to the same content only merge versions', () {
+      expect(ReplicaEntry.decide(_entry({'a': 1}), _entry({'b': 1}, modified: 2000)),
+          ReplicaMerge.converge);
+      expect(
+          ReplicaEntry.decide(_entry({'a': 1}, deleted: true),
+              _entry({'b': 1}, deleted: true, modified: 2000)),
+          ReplicaMerge.converge);
+    });
+
+    test('concurrent edits to different content conflict', () {
+      expect(ReplicaEntry.decide(_entry({'a': 1}), _entry({'b': 1}, sha: 'b' * 12)),
+          ReplicaMerge.conflict);
+      expect(ReplicaEntry.decide(_entry({'a': 1}), _entry({'b': 1}, deleted: true)),
+          ReplicaMerge.conflict);
+    });
+  });
+
+  group('conflicts', () {
+    test('the later modification wins', () {
+      final mine = _entry({'a': 1}, modified: 1000);
+      final theirs = _entry({'b': 1}, sha: 'b' * 12, modified: 2000);
+      expect(ReplicaEntry.remoteWins(mine, theirs), isTrue);
+      expect(ReplicaEntry.remoteWins(theirs, mine), isFalse);
+    });
+
+    test('equal times fall back to the content hash on both sides', () {
+      final low = _entry({'a': 1}, sha: '1' * 12);
+      final high = _entry({'b': 1}, sha: '2' * 12);
+      expect(ReplicaEntry.remoteWins(low, high), isTrue);
+      expect(ReplicaEntry.remoteWins(high, low), isFalse);
+    });
+
+    test('the conflict copy name depends only on the path and content', () {
+      expect(ReplicaEntry.conflictPath('docs/a.txt', '0123456789abcdef'),
+          'docs/a.conflict-01234567.txt');
+      expect(ReplicaEntry.conflictPath('Makefile', '0123456789abcdef'),
+          'Makefile.conflict-01234567');
+    });
+  });
+
+  test('entries round-trip through the state file and the wire', () {
+    final e = _entry({'a': 2, 'b': 1})..localMtimeMs = 99;
+    final back = ReplicaEntry.fromJson(e.toJson())!;
+    expect(back.localMtimeMs, 99);
+    expect(back.hash, e.hash);
+    final wire = ReplicaEntry.fromJson(e.toWire())!;
+    expect(wire.localMtimeMs, 0);
+    expect(wire.hash, e.hash);
+    expect(ReplicaEntry.fromJson({'sha': 'x'}), isNull);
+    expect(ReplicaEntry.fromJson('nope'), isNull);
+  });
+}
@@ -0,0 +1,66 @@
+import 'dart:convert';
+
+import 'package:crypto/crypto.dart' as crypto;
+import 'package:flutter_test/flutter_test.dart';
+import 'package:localnode/src/share_token.dart';
+
+void main() {
+  final secret = List<int>.generate(32, (i) => i);
+  final codec = ShareTokenCodec(secret);
+  const payload = {
+    'i': 'abc',
+    'e': 1700000000,
+    's': 10,
+    'm': 5,
+    'r': [0, 3],
+  };
+
+  test('round-trips the payload', () {
+    expect(codec.decode(codec.encode(payload)), payload);
+  });
+
+  test('is base64url JSON and an HMAC-SHA256 over it, without padding', () {
+    final token = codec.encode(payload);
+    expect(token, isNot(contains('=')));
+    final [body, sig] = token.split('.');
+    expect(json.decode(utf8.decode(base64Url.decode(base64Url.normalize(body)))),
+        payload);
+    final mac = crypto.Hmac(crypto.sha256, secret).convert(utf8.encode(body));
+    expect(sig, base64Url.encode(mac.bytes).replaceAll('=', ''));
+  });
+
+  test('rejects a token signed with another secret', () {
+    final other = ShareTokenCodec(List<int>.filled(32, 7));
+    expect(codec.decode(other.encode(payload)), isNull);
+  });
+
+  test('rejects a tampered payload or signature', () {
+    final token = codec.encode(payload);
+    final [body, sig] = token.split('.');
+    final forged = base64Url
+        .encode(utf8.encode(json.encode({...payload, 'e': 9999999999})))
+        .replaceAll('=', '');
+    expect(codec.decode('$forged.$sig'), isNull);
+    final flipped = sig.substring(0, sig.length - 1) + (sig.endsWith('A') ? 'B' : 'A');
+    expect(codec.decode('$body.$flipped'), isNull);
+  });
+
+  test('rejects malformed tokens', () {
+    for (final t in ['', 'abc', '.sig', 'a.b.c', 'a.']) {
+      expect(codec.decode(t), isNull, reason: t);
+    }
+  });
+
+  test('rejects a correctly signed payload that is not a JSON object', () {
+    // 署名は正しいが中身が壊れている (鍵の漏洩時でも例外にしない)
+    final body = base64Url.encode(utf8.encode('[1,2]')).replaceAll('=', '');
+    final mac = crypto.Hmac(crypto.sha256, secret).convert(utf8.encode(body));
+    final sig = base64Url.encode(mac.bytes).replaceAll('=', '');
+    expect(codec.decode('$body.$sig'), isNull);
+    const junk = 'not-base64!';
+    final junkSig = base64Url
+        .encode(crypto.Hmac(crypto.sha256, secret).convert(utf8.encode(junk)).bytes)
+        .replaceAll('=', '');
+    expect(codec.decode('$junk.$junkSig'), isNull);
+  });
+}
@@ -0,0 +1,131 @@
+import 'dart:typed_data';
+
+import 'package:flutter_test/flutter_test.dart';
+import 'package:localnode/src/stats_format.dart';
+
+StatsSnapshot _snapshot({bool loop = true}) => StatsSnapshot(
+      nowMs: 1700000000123,
+      startedAtMs: 1699999000000,
+      rssBytes: 5 << 30, // 32 bit を超える値
+      requests: 12345,
+      bytesIn: 1 << 40,
+      bytesOut: 7,
+      loopEnabled: loop,
+      lagMs: 3,
+      lagP99Ms: 40,
+      lagMaxMs: 250,
+      stalls: 2,
+      thumbQueue: 1,
+      postActionQueue: 0,
+      fedQueue: 65535,
+      caches: [
+        (name: 'thumbnail', hits: 10, misses: 3),
+        (name: 'davListing', hits: 0, misses: 0),
+      ],
+      cacheBytes: {'thumbnail': 1 << 20, 'mentions': 0},
+      active: [
+        (
+          method: 'GET',
+          path: 'api/files/写真.jpg',
+          route: 'download',
+          client: '192.168.1.20',
+          elapsedMs: 1500,
+          bytesIn: 0,
+          bytesOut: 3 << 32,
+        ),
+      ],
+      clients: [
+        (ip: '192.168.1.20', bytesIn: 100, bytesOut: 3 << 32, active: 1),
+        (ip: '::1', bytesIn: 0, bytesOut: 0, active: 0),
+      ],
+    );
+
+void _expectSame(StatsSnapshot a, StatsSnapshot b) {
+  expect(
+      [
+        a.nowMs, a.startedAtMs, a.rssBytes, a.requests, a.bytesIn, a.bytesOut,
+        a.loopEnabled, a.lagMs, a.lagP99Ms, a.lagMaxMs, a.stalls,
+        a.thumbQueue, a.postActionQueue, a.fedQueue,
+      ],
+      [
+        b.nowMs, b.startedAtMs, b.rssBytes, b.requests, b.bytesIn, b.bytesOut,
+        b.loopEnabled, b.lagMs, b.lagP99Ms, b.lagMaxMs, b.stalls,
+        b.thumbQueue, b.postActionQueue, b.fedQueue,
+      ]);
+  expect(a.caches, b.caches);
+  expect(a.cacheBytes, b.cacheBytes);
+  expect(a.active, b.active);
+  expect(a.clients, b.clients);
+}
+
+void main() {
+  test('round-trips a snapshot', () {
+    final s = _snapshot();
+    final bytes = s.encode();
+    expect(bytes.sublist(0, 4), 'LNS1'.codeUnits);
+    _expectSame(StatsSnapshot.decode(bytes), s);
+    _expectSame(StatsSnapshot.decode(_snapshot(loop: false).encode()),
+        _snapshot(loop: false));
+  });
+
+  test('round-trips an idle server', () {
+    final s = StatsSnapshot(
+      nowMs: 1,
+      startedAtMs: 0,
+      rssBytes: 0,
+      requests: 0,
+      bytesIn: 0,
+      bytesOut: 0,
+      loopEnabled: false,
+      lagMs: 0,
+      lagP99Ms: 0,
+      lagMaxMs: 0,
+      stalls: 0,
+      thumbQueue: 0,
+      postActionQueue: 0,
+      fedQueue: 0,
+      caches: const [],
+      cacheBytes: const {},
+      active: const [],
+      clients: const [],
+    );
+    _expectSame(StatsSnapshot.decode(s.encode()), s);
+  });
+
+  test('rejects another format version', () {
+    final bytes = _snapshot().encode();
+    bytes[3] = 0x32; // "LNS2"
+    expect(() => StatsSnapshot.decode(bytes), throwsFormatException);
+  });
+
+  test('a truncated response is a FormatException, not a RangeError', () {
+    final bytes = _snapshot().encode();
+    for (final n in [0, 3, 4, 20, bytes.length - 1]) {
+      expect(() => StatsSnapshot.decode(Uint8List.sublistView(bytes, 0, n)),
+          throwsFormatException,
+          reason: '$n bytes');
+    }
+  });
+
+  group('primitives', () {
+    test('varint round-trips LEB128', () {
+      const values = [0, 1, 127, 128, 300, 1 << 21, 1700000000123];
+      final w = StatsWriter();
+      for (final v in values) {
+        w.varint(v);
+      }
+      final bytes = w.takeBytes();
+      expect(bytes.sublist(0, 5), [0, 1, 127, 0x80, 0x01]);
+      final r = StatsReader(bytes);
+      expect([for (final _ in values) r.varint()], values);
+      expect(r.remaining, 0);
+    });
+
+    test('str truncates to the u16 length limit', () {
+      final w = StatsWriter()..str('a' * 70000);
+      final r = StatsReader(w.takeBytes());
+      expect(r.str().length, 0xffff);
+      expect(r.remaining, 0);
+    });
+  });
+}
@@ -0,0 +1,107 @@
+import 'dart:typed_data';
+
+import 'package:flutter_test/flutter_test.dart';
+import 'package:localnode/src/trace_format.dart';
+
+const int _t0 = 1700000000000;
+
+TraceRecord _rec(int startMs, String path,
+        {String route = 'download', String root = '/srv/share'}) =>
+    TraceRecord(
+      startMs: startMs,
+      shareRoot: root,
+      headerUs: 1200,
+      totalUs: 350000,
+      status: 206,
+      method: 'GET',
+      route: route,
+      path: path,
+      query: 'w=256',
+      headers: const {'range': 'bytes=0-99', 'if-range': '"abc"'},
+      bytesIn: 0,
+      bytesOut: 100,
+    );
+
+Uint8List _file(List<List<int>> parts) =>
+    Uint8List.fromList([for (final p in parts) ...p]);
+
+void _expectRecord(TraceRecord a, TraceRecord b) {
+  expect(
+      [a.startMs, a.shareRoot, a.headerUs, a.totalUs, a.status, a.method,
+          a.route, a.path, a.query, a.headers, a.bytesIn, a.bytesOut],
+      [b.startMs, b.shareRoot, b.headerUs, b.totalUs, b.status, b.method,
+          b.route, b.path, b.query, b.headers, b.bytesIn, b.bytesOut]);
+}
+
+void main() {
+  test('round-trips records across segments', () {
+    final first = [_rec(_t0 + 5, 'api/files/a.txt'), _rec(_t0 + 2, '写真.jpg')];
+    final second = [
+      _rec(_t0 + 90000, 'api/clipboard', route: 'clip', root: '/mnt/other'),
+    ];
+    final bytes = _file([
+      encodeTraceSegment(_t0, '/srv/share'),
+      for (final r in first) encodeTraceRecord(_t0, r),
+      encodeTraceSegment(_t0 + 60000, '/mnt/other'),
+      for (final r in second) encodeTraceRecord(_t0 + 60000, r),
+    ]);
+    expect(bytes.sublist(0, 4), 'LNT1'.codeUnits);
+    final read = readTrace(bytes);
+    expect(read.length, 3);
+    for (var i = 0; i < 3; i++) {
+      _expectRecord(read[i], [...first, ...second][i]);
+    }
+  });
+
+  test('an empty file has no records and anything else must start with LNT1', () {
+    expect(readTrace(Uint8List(0)), isEmpty);
+    expect(() => readTrace(Uint8List.fromList('LNS1xxxx'.codeUnits)),
+        throwsFormatException);
+  });
+
+  test('drops a record cut short at the end of the file', () {
+    final last = encodeTraceRecord(_t0, _rec(_t0 + 9, 'b'));
+    final bytes = _file([
+      encodeTraceSegment(_t0, '/srv/share'),
+      encodeTraceRecord(_t0, _rec(_t0 + 1, 'a')),
+      last.sublist(0, last.length - 3),
+    ]);
+    expect(readTrace(bytes).map((r) => r.path), ['a']);
+  });
+
+  test('resyncs at the next segment after a crash left half a record', () {
+    // 書きかけの 1 件の直後に、再起動したサーバの見出しが続く
+    for (final cut in [1, 5, 12, 30]) {
+      final torn = encodeTraceRecord(_t0, _rec(_t0 + 9, 'torn'));
+      final bytes = _file([
+        encodeTraceSegment(_t0, '/srv/share'),
+        encodeTraceRecord(_t0, _rec(_t0 + 1, 'before')),
+        torn.sublist(0, cut),
+        encodeTraceSegment(_t0 + 60000, '/srv/share'),
+        encodeTraceRecord(_t0 + 60000, _rec(_t0 + 60001, 'after1')),
+        encodeTraceRecord(_t0 + 60000, _rec(_t0 + 60002, 'after2')),
+      ]);
+      final read = readTrace(bytes);
+      expect(read.map((r) => r.path), ['before', 'after1', 'after2'],
+          reason: 'cut at $cut');
+      expect(read[1].startMs, _t0 + 60001);
+    }
+  });
+
+  test('LNT1 inside a path is not taken for a segment', () {
+    final bytes = _file([
+      encodeTraceSegment(_t0, '/srv/share'),
+      encodeTraceRecord(_t0, _rec(_t0 + 1, 'logs/LNT1/LNT1.txt')),
+      encodeTraceRecord(_t0, _rec(_t0 + 2, 'next')),
+    ]);
+    expect(readTrace(bytes).map((r) => r.path), ['logs/LNT1/LNT1.txt', 'next']);
+  });
+
+  test('an unknown route reads back as api', () {
+    final bytes = _file([
+      encodeTraceSegment(_t0, ''),
+      encodeTraceRecord(_t0, _rec(_t0, 'x', route: 'nope')),
+    ]);
+    expect(readTrace(bytes).single.route, 'api');
+  });
+}
@@ -0,0 +1,797 @@
+// LocalNode federation シミュレータ / ベンチマーク
+//
+// 実機を何台も並べずに federation の挙動を測るための道具。ループバック上に
+// localnode-cli を N+1 個 (親 1 + 子 N) 起動し、peer 間の通信はすべて
+// このプロセス内の TCP プロキシを経由させて遅延・損失・帯域を注入する。
+//
+//   dart run tool/federation_bench.dart --children 3 --latency-ms 40 \
+//       --loss 0.01 --bandwidth 2MB --file-size 16MB
+//
+// 測定項目:
+//   - clipboard 伝搬遅延 (子に POST → 親の /api/clipboard に現れるまで)
+//   - ファイル転送スループット (子に upload → 親の children/<name>/ に揃うまで)
+//   - heartbeat の通信量 (無操作で --idle-secs 待つ間にプロキシを流れたバイト数)
+//   - 分断からの復旧 (子 1 台のリンクを --partition-secs 切り、親が offline を
+//     検知するまで / 復旧後 connected に戻るまで。--sync なら分断中の
+//     clipboard が収束するまで)
+//
+// 必要なもの: PATH 上の openssl (自己署名 CA とノード証明書の生成に使う)。
+// ノードは LOCALNODE_FED_CA でこの CA を信頼する。--exe を省略すると
+// bin/localnode_cli.dart を一時ディレクトリにコンパイルしてから使う。
+//
+// heartbeat は起動直後 5/10/20/30/45 秒、以後 45 秒周期なので、分断の検知・
+// 復旧はその粒度でしか進まない。全体で数分かかる。
+
+import 'dart:async';
+import 'dart:convert';
+import 'dart:io';
+import 'dart:math';
+
+import 'package:args/args.dart';
+import 'package:path/path.dart' as p;
+
+Future<void> main(List<String> args) async {
+  final parser = ArgParser()
+    ..addOption('children', defaultsTo: '3', help: 'Number of child nodes')
+    ..addOption('relation',
+        defaultsTo: 'friendly', allowed: ['friendly', 'equally'])
+    ..addFlag('sync',
+        negatable: false,
+        help: 'Enable clipboard anti-entropy (implies --relation equally)')
+    ..addOption('latency-ms', defaultsTo: '20', help: 'One-way link latency')
+    ..addOption('jitter-ms', defaultsTo: '0', help: 'Uniform extra latency 0..N')
+    ..addOption('loss',
+        defaultsTo: '0',
+        help: 'Per-chunk loss probability (0..1); a lost chunk is delayed by '
+            'a retransmission timeout, as TCP would')
+    ..addOption('rto-ms', defaultsTo: '200', help: 'Retransmission penalty')
+    ..addOption('bandwidth',
+        help: 'Per-link, per-direction bandwidth (e.g. 512KB, 2MB). '
+            'Unlimited if omitted')
+    ..addOption('samples', defaultsTo: '20', help: 'Clipboard samples per child')
+    ..addOption('file-size', defaultsTo: '8MB', help: 'Forwarded file size')
+    ..addOption('idle-secs', defaultsTo: '60', help: 'Heartbeat overhead window')
+    ..addOption('partition-secs',
+        defaultsTo: '60', help: 'Partition length (0 to skip)')
+    ..addOption('exe', help: 'Prebuilt localnode-cli (skips compilation)')
+    ..addFlag('json', negatable: false, help: 'Print results as JSON')
+    ..addFlag('keep', negatable: false, help: 'Keep the work directory')
+    ..addFlag('help', abbr: 'h', negatable: false);
+  final ArgResults opts;
+  try {
+    opts = parser.parse(args);
+  } on FormatException catch (e) {
+    stderr.writeln('Error: ${e.message}\n\n${parser.usage}');
+    exit(64);
+  }
+  if (opts['help'] as bool) {
+    stdout.writeln('Usage: dart run tool/federation_bench.dart [options]\n');
+    stdout.writeln(parser.usage);
+    return;
+  }
+
+  final sync = opts['sync'] as bool;
+  final cfg = _BenchConfig(
+    children: int.parse(opts['children'] as String),
+    relation: sync ? 'equally' : opts['relation'] as String,
+    sync: sync,
+    shape: _Shape(
+      latencyMs: double.parse(opts['latency-ms'] as String),
+      jitterMs: double.parse(opts['jitter-ms'] as String),
+      loss: double.parse(opts['loss'] as String),
+      rtoMs: double.parse(opts['rto-ms'] as String),
+      bytesPerSec: opts['bandwidth'] == null
+          ? null
+          : _parseSize(opts['bandwidth'] as String),
+    ),
+    samples: int.parse(opts['samples'] as String),
+    fileBytes: _parseSize(opts['file-size'] as String),
+    idle: Duration(seconds: int.parse(opts['idle-secs'] as String)),
+    partition: Duration(seconds: int.parse(opts['partition-secs'] as String)),
+  );
+  if (cfg.children < 1) {
+    stderr.writeln('Error: --children must be >= 1');
+    exit(64);
+  }
+
+  final work = await Directory.systemTemp.createTemp('localnode-bench-');
+  final bench = _Bench(cfg, work);
+  var code = 0;
+  try {
+    await bench.setUp(exe: opts['exe'] as String?);
+    final results = await bench.run();
+    if (opts['json'] as bool) {
+      stdout.writeln(const JsonEncoder.withIndent('  ').convert(results));
+    } else {
+      _printReport(cfg, results);
+    }
+  } catch (e, st) {
+    stderr.writeln('Error: $e');
+    stderr.writeln(st);
+    code = 1;
+  } finally {
+    await bench.tearDown();
+    if (opts['keep'] as bool) {
+      stderr.writeln('Work directory kept: ${work.path}');
+    } else {
+      await work.delete(recursive: true);
+    }
+  }
+  exit(code);
+}
+
+class _BenchConfig {
+  final int children;
+  final String relation;
+  final bool sync;
+  final _Shape shape;
+  final int samples;
+  final int fileBytes;
+  final Duration idle;
+  final Duration partition;
+
+  _BenchConfig({
+    required this.children,
+    required this.relation,
+    required this.sync,
+    required this.shape,
+    required this.samples,
+    required this.fileBytes,
+    required this.idle,
+    required this.partition,
+  });
+}
+
+int _parseSize(String raw) {
+  final m = RegExp(r'^(\d+(?:\.\d+)?)\s*([kmgKMG]?)[bB]?$').firstMatch(raw.trim());
+  if (m == null) throw FormatException('Invalid size: $raw');
+  const mult = {'': 1, 'K': 1024, 'M': 1024 * 1024, 'G': 1024 * 1024 * 1024};
+  return (double.parse(m.group(1)!) * mult[m.group(2)!.toUpperCase()]!).round();
+}
+
+// =============================================================================
+// リンクの模擬 (TCP プロキシ)
+// =============================================================================
+
+class _Shape {
+  final double latencyMs;
+  final double jitterMs;
+  final double loss;
+  final double rtoMs;
+  final int? bytesPerSec;
+
+  const _Shape({
+    required this.latencyMs,
+    required this.jitterMs,
+    required this.loss,
+    required this.rtoMs,
+    required this.bytesPerSec,
+  });
+
+  Map<String, dynamic> toJson() => {
+        'latencyMs': latencyMs,
+        'jitterMs': jitterMs,
+        'loss': loss,
+        'rtoMs': rtoMs,
+        'bytesPerSec': bytesPerSec,
+      };
+}
+
+/// peer 間の片側のリンク。ローカルポートで待ち受けて宛先ノードへ中継する。
+/// TLS はそのまま素通しするので、ノードから見れば普通の https 接続。
+class _Link {
+  final String name;
+  final int targetPort;
+  final _Shape shape;
+  final Random _rng = Random();
+  late final ServerSocket _server;
+  final Set<Socket> _sockets = {};
+  bool partitioned = false;
+  int bytes = 0;
+  int connections = 0;
+
+  _Link(this.name, this.targetPort, this.shape);
+
+  int get port => _server.port;
+
+  Future<void> start() async {
+    _server = await ServerSocket.bind(InternetAddress.loopbackIPv4, 0);
+    _server.listen(_accept);
+  }
+
+  Future<void> stop() async {
+    await _server.close();
+    for (final s in _sockets.toList()) {
+      s.destroy();
+    }
+  }
+
+  /// 既存の接続を切り、新規接続も即座に切る
+  void partition() {
+    partitioned = true;
+    for (final s in _sockets.toList()) {
+      s.destroy();
+    }
+    _sockets.clear();
+  }
+
+  void heal() => partitioned = false;
+
+  void resetCounters() {
+    bytes = 0;
+    connections = 0;
+  }
+
+  Future<void> _accept(Socket client) async {
+    if (partitioned) {
+      client.destroy();
+      return;
+    }
+    connections++;
+    final Socket upstream;
+    try {
+      upstream =
+          await Socket.connect(InternetAddress.loopbackIPv4, targetPort);
+    } catch (_) {
+      client.destroy();
+      return;
+    }
+    _sockets
+      ..add(client)
+      ..add(upstream);
+    void closeBoth() {
+      client.destroy();
+      upstream.destroy();
+      _sockets
+        ..remove(client)
+        ..remove(upstream);
+    }
+
+    _ShapedPipe(client, upstream, this, closeBoth);
+    _ShapedPipe(upstream, client, this, closeBoth);
+  }
+
+  /// 1 チャンクの伝搬遅延 (ms)。損失したチャンクは再送タイムアウト分遅れる。
+  double delayMs() {
+    var d = shape.latencyMs + shape.jitterMs * _rng.nextDouble();
+    while (shape.loss > 0 && _rng.nextDouble() < shape.loss) {
+      d += shape.rtoMs;
+    }
+    return d;
+  }
+}
+
+/// 片方向の中継。帯域は送出時刻の直列化で、遅延はチャンクごとのタイマーで
+/// 表現する。到着順は保つ (TCP なので追い越しは起きない)。
+class _ShapedPipe {
+  static const int _maxQueued = 1024 * 1024;
+  static final Stopwatch _clock = Stopwatch()..start();
+
+  final Socket _to;
+  final _Link _link;
+  final void Function() _close;
+  late final StreamSubscription<List<int>> _sub;
+  double _busyUntilMs = 0;
+  double _lastDeliverMs = 0;
+  int _queued = 0;
+
+  _ShapedPipe(Socket from, this._to, this._link, this._close) {
+    _sub = from.listen(_onChunk,
+        onDone: () => _after(_close), onError: (_) => _close());
+  }
+
+  double get _nowMs => _clock.elapsedMicroseconds / 1000;
+
+  void _onChunk(List<int> chunk) {
+    if (_link.partitioned) {
+      _close();
+      return;
+    }
+    _link.bytes += chunk.length;
+    final now = _nowMs;
+    final bw = _link.shape.bytesPerSec;
+    final txMs = bw == null ? 0.0 : chunk.length * 1000 / bw;
+    _busyUntilMs = max(now, _busyUntilMs) + txMs;
+    _lastDeliverMs = max(_busyUntilMs + _link.delayMs(), _lastDeliverMs);
+    _queued += chunk.length;
+    if (_queued > _maxQueued && !_sub.isPaused) _sub.pause();
+    _after(() {
+      try {
+        _to.add(chunk);
+      } catch (_) {
+        _close();
+      }
+      _queued -= chunk.length;
+      if (_queued <= _maxQueued ~/ 2 && _sub.isPaused) _sub.resume();
+    });
+  }
+
+  /// 直前に積んだチャンクの到着時刻に合わせて実行する
+  void _after(void Function() fn) {
+    final waitUs = ((_lastDeliverMs - _nowMs) * 1000).round();
+    Timer(Duration(microseconds: max(0, waitUs)), fn);
+  }
+}
+
+// =============================================================================
+// ノードの起動と操作
+// =============================================================================
+
+class _Node {
+  final String name;
+  final int port;
+  final String token;
+  final Directory dir;
+  Process? process;
+  final List<String> log = [];
+
+  _Node(this.name, this.port, this.token, this.dir);
+
+  String get share => p.join(dir.path, 'share');
+  String get base => 'https://127.0.0.1:$port';
+}
+
+class _Bench {
+  final _BenchConfig cfg;
+  final Directory work;
+  late final String _caPem;
+  late final String _certPem;
+  late final String _keyPem;
+  late final HttpClient _http;
+  late final _Node hub;
+  final List<_Node> children = [];
+  // 子ごとのリンク: up = 子→親, down = 親→子
+  final Map<String, ({_Link up, _Link down})> links = {};
+
+  _Bench(this.cfg, this.work);
+
+  Iterable<_Link> get allLinks =>
+      links.values.expand((l) => [l.up, l.down]);
+
+  Future<void> setUp({String? exe}) async {
+    await _makeCertificates();
+    _http = HttpClient(
+        context: SecurityContext(withTrustedRoots: false)
+          ..setTrustedCertificates(_caPem))
+      ..connectionTimeout = const Duration(seconds: 10);
+    final binary = exe ?? await _compile();
+
+    hub = _Node('hub', await _freePort(), _randomToken(),
+        Directory(p.join(work.path, 'hub')));
+    for (var i = 1; i <= cfg.children; i++) {
+      children.add(_Node('child-$i', await _freePort(), _randomToken(),
+          Directory(p.join(work.path, 'child-$i'))));
+    }
+    for (final c in children) {
+      final up = _Link('${c.name}->hub', hub.port, cfg.shape);
+      final down = _Link('hub->${c.name}', c.port, cfg.shape);
+      await up.start();
+      await down.start();
+      links[c.name] = (up: up, down: down);
+    }
+
+    await _writeConfig(hub, {
+      'children': [
+        for (final c in children)
+          {
+            'name': c.name,
+            'url': 'https://127.0.0.1:${links[c.name]!.down.port}',
+            'token': c.token,
+            'relation': cfg.relation,
+            if (cfg.sync) 'sync': true,
+          },
+      ],
+    });
+    for (final c in children) {
+      await _writeConfig(c, {
+        'parent': {
+          'name': hub.name,
+          'url': 'https://127.0.0.1:${links[c.name]!.up.port}',
+          'token': hub.token,
+          'relation': cfg.relation,
+          if (cfg.sync) 'sync': true,
+        },
+      });
+    }
+    for (final n in [hub, ...children]) {
+      await _launch(binary, n);
+    }
+    await Future.wait([hub, ...children].map(_waitHealthy));
+    // 親が全ての子の deviceId を学習するまでは転送を受け付けない
+    stderr.writeln('[bench] waiting for the first heartbeat round...');
+    await _waitFor(const Duration(seconds: 90), () async {
+      final peers = await _peersOf(hub);
+      return peers.length == children.length &&
+          peers.every((pe) =>
+              pe['status'] == 'connected' && pe['learnedDeviceId'] != null);
+    });
+  }
+
+  Future<void> tearDown() async {
+    for (final n in [hub, ...children]) {
+      n.process?.kill(ProcessSignal.sigterm);
+    }
+    for (final n in [hub, ...children]) {
+      await n.process?.exitCode.timeout(const Duration(seconds: 5),
+          onTimeout: () {
+        n.process?.kill(ProcessSignal.sigkill);
+        return -1;
+      });
+    }
+    for (final l in allLinks) {
+      await l.stop();
+    }
+    _http.close(force: true);
+  }
+
+  Future<Map<String, dynamic>> run() async {
+    final results = <String, dynamic>{
+      'children': cfg.children,
+      'relation': cfg.relation,
+      'sync': cfg.sync,
+      'link': cfg.shape.toJson(),
+    };
+    results['clipboard'] = await _measureClipboard();
+    results['fileForward'] = await _measureFileForward();
+    results['heartbeat'] = await _measureHeartbeat();
+    if (cfg.partition > Duration.zero) {
+      results['partition'] = await _measurePartition();
+    }
+    return results;
+  }
+
+  // --- 測定 ---
+
+  Future<Map<String, dynamic>> _measureClipboard() async {
+    stderr.writeln('[bench] clipboard propagation (${cfg.samples} x ${children.length})');
+    final latencies = <double>[];
+    var lost = 0;
+    // equally では @up 付きだけが即時転送される
+    final prefix = cfg.relation == 'equally' ? '@up ' : '';
+    for (var n = 0; n < cfg.samples; n++) {
+      await Future.wait(children.map((c) async {
+        final marker = 'bench-${c.name}-$n-${_randomToken().substring(0, 6)}';
+        final sw = Stopwatch()..start();
+        await _postClipboard(c, '$prefix$marker');
+        final ok = await _waitFor(const Duration(seconds: 30),
+            () async => (await _clipboardTexts(hub)).contains(marker),
+            poll: const Duration(milliseconds: 10), throwOnTimeout: false);
+        if (ok) {
+          latencies.add(sw.elapsedMicroseconds / 1000);
+        } else {
+          lost++;
+        }
+      }));
+    }
+    return {'ms': _summary(latencies), 'lost': lost};
+  }
+
+  Future<Map<String, dynamic>> _measureFileForward() async {
+    if (cfg.relation != 'friendly') {
+      // equally は通知のみでファイル本体は流れない
+      return {'skipped': 'relation ${cfg.relation} does not forward files'};
+    }
+    stderr.writeln('[bench] file forward (${cfg.fileBytes} bytes x ${children.length})');
+    final payload = File(p.join(work.path, 'payload.bin'));
+    final rng = Random(1);
+    final sink = payload.openWrite();
+    const block = 64 * 1024;
+    for (var left = cfg.fileBytes; left > 0; left -= block) {
+      sink.add(List<int>.generate(min(block, left), (_) => rng.nextInt(256)));
+    }
+    await sink.close();
+
+    final perChild = <String, dynamic>{};
+    final sw = Stopwatch()..start();
+    await Future.wait(children.map((c) async {
+      final name = 'bench-${c.name}.bin';
+      final t = Stopwatch()..start();
+      await _upload(c, payload, name);
+      final uploadMs = t.elapsedMilliseconds;
+      final dest = File(p.join(hub.share, 'children', c.name, name));
+      final ok = await _waitFor(const Duration(minutes: 10), () async {
+        return await dest.exists() && await dest.length() == cfg.fileBytes;
+      }, poll: const Duration(milliseconds: 20), throwOnTimeout: false);
+      final totalMs = t.elapsedMilliseconds;
+      perChild[c.name] = {
+        'uploadMs': uploadMs,
+        'deliveredMs': ok ? totalMs : null,
+        'mbPerSec': ok ? _mbps(cfg.fileBytes, totalMs) : null,
+      };
+    }));
+    final wallMs = sw.elapsedMilliseconds;
+    return {
+      'bytes': cfg.fileBytes,
+      'perChild': perChild,
+      'aggregateMbPerSec': _mbps(cfg.fileBytes * children.length, wallMs),
+    };
+  }
+
+  Future<Map<String, dynamic>> _measureHeartbeat() async {
+    stderr.writeln('[bench] idle heartbeat traffic (${cfg.idle.inSeconds}s)');
+    for (final l in allLinks) {
+      l.resetCounters();
+    }
+    await Future.delayed(cfg.idle);
+    final secs = cfg.idle.inMilliseconds / 1000;
+    final total = allLinks.fold<int>(0, (a, l) => a + l.bytes);
+    final conns = allLinks.fold<int>(0, (a, l) => a + l.connections);
+    return {
+      'windowSec': secs,
+      'bytesPerSec': total / secs,
+      'bytesPerSecPerLink': total / secs / allLinks.length,
+      'connections': conns,
+      'perLink': {
+        for (final l in allLinks)
+          l.name: {'bytes': l.bytes, 'connections': l.connections},
+      },
+    };
+  }
+
+  Future<Map<String, dynamic>> _measurePartition() async {
+    final victim = children.first;
+    final l = links[victim.name]!;
+    stderr.writeln('[bench] partition ${victim.name} for ${cfg.partition.inSeconds}s');
+    final result = <String, dynamic>{'child': victim.name};
+    final sw = Stopwatch()..start();
+    l.up.partition();
+    l.down.partition();
+
+    // 分断中に子へ書いた clipboard は、即時転送だけなら失われる
+    final marker = 'bench-partition-${_randomToken().substring(0, 6)}';
+    await _postClipboard(
+        victim, cfg.relation == 'equally' ? '@up $marker' : marker);
+
+    final detected = await _waitFor(cfg.partition, () async {
+      final pe = (await _peersOf(hub)).firstWhere((x) => x['name'] == victim.name);
+      return pe['status'] == 'offline';
+    }, throwOnTimeout: false);
+    result['offlineDetectedMs'] = detected ? sw.elapsedMilliseconds : null;
+    final rest = cfg.partition - sw.elapsed;
+    if (rest > Duration.zero) await Future.delayed(rest);
+
+    l.up.heal();
+    l.down.heal();
+    final healed = Stopwatch()..start();
+    final back = await _waitFor(const Duration(minutes: 3), () async {
+      final pe = (await _peersOf(hub)).firstWhere((x) => x['name'] == victim.name);
+      return pe['status'] == 'connected';
+    }, throwOnTimeout: false);
+    result['reconnectedMs'] = back ? healed.elapsedMilliseconds : null;
+    final converged = await _waitFor(
+        Duration(minutes: cfg.sync ? 3 : 0, seconds: cfg.sync ? 0 : 5),
+        () async => (await _clipboardTexts(hub)).contains(marker),
+        throwOnTimeout: false);
+    result['clipboardRecoveredMs'] = converged ? healed.elapsedMilliseconds : null;
+    return result;
+  }
+
+  // --- ノード操作 ---
+
+  Future<void> _postClipboard(_Node n, String text) async {
+    final req = await _http.postUrl(Uri.parse('${n.base}/api/clipboard'));
+    req.headers.set('Authorization', 'Bearer ${n.token}');
+    req.headers.contentType = ContentType.json;
+    req.add(utf8.encode(json.encode({'text': text})));
+    final res = await req.close();
+    await res.drain();
+    if (res.statusCode != 200) {
+      throw HttpException('POST clipboard on ${n.name}: HTTP ${res.statusCode}');
+    }
+  }
+
+  Future<Set<String>> _clipboardTexts(_Node n) async {
+    final dec = await _getJson(n, '/api/clipboard?limit=2000');
+    return {
+      for (final i in (dec['items'] as List)) (i as Map)['text'] as String,
+    }.map((t) => t.startsWith('@up ') ? t.substring(4) : t).toSet();
+  }
+
+  Future<void> _upload(_Node n, File f, String name) async {
+    final req = await _http.postUrl(Uri.parse('${n.base}/api/upload'));
+    req.headers.set('Authorization', 'Bearer ${n.token}');
+    req.headers.set('x-filename', Uri.encodeComponent(name));
+    req.contentLength = await f.length();
+    await req.addStream(f.openRead());
+    final res = await req.close();
+    await res.drain();
+    if (res.statusCode != 200) {
+      throw HttpException('upload on ${n.name}: HTTP ${res.statusCode}');
+    }
+  }
+
+  Future<List<Map>> _peersOf(_Node n) async =>
+      ((await _getJson(n, '/api/federation/status'))['peers'] as List)
+          .cast<Map>();
+
+  Future<Map<String, dynamic>> _getJson(_Node n, String path) async {
+    final req = await _http.getUrl(Uri.parse('${n.base}$path'));
+    final res = await req.close();
+    final body = await res.transform(utf8.decoder).join();
+    if (res.statusCode != 200) {
+      throw HttpException('GET $path on ${n.name}: HTTP ${res.statusCode}');
+    }
+    return json.decode(body) as Map<String, dynamic>;
+  }
+
+  // --- 準備 ---
+
+  Future<void> _makeCertificates() async {
+    final dir = p.join(work.path, 'certs');
+    await Directory(dir).create();
+    _caPem = p.join(dir, 'ca.pem');
+    _certPem = p.join(dir, 'node.pem');
+    _keyPem = p.join(dir, 'node-key.pem');
+    final caKey = p.join(dir, 'ca-key.pem');
+    final csr = p.join(dir, 'node.csr');
+    final ext = p.join(dir, 'san.ext');
+    await File(ext).writeAsString(
+        'subjectAltName=IP:127.0.0.1,DNS:localhost\n');
+    Future<void> openssl(List<String> a) async {
+      final r = await Process.run('openssl', a);
+      if (r.exitCode != 0) {
+        throw ProcessException('openssl', a, '${r.stderr}', r.exitCode);
+      }
+    }
+
+    await openssl(['req', '-x509', '-newkey', 'rsa:2048', '-nodes',
+        '-keyout', caKey, '-out', _caPem, '-days', '1',
+        '-subj', '/CN=localnode-bench-ca']);
+    await openssl(['req', '-newkey', 'rsa:2048', '-nodes',
+        '-keyout', _keyPem, '-out', csr, '-subj', '/CN=127.0.0.1']);
+    await openssl(['x509', '-req', '-in', csr, '-CA', _caPem,
+        '-CAkey', caKey, '-CAcreateserial', '-out', _certPem,
+        '-days', '1', '-extfile', ext]);
+  }
+
+  Future<String> _compile() async {
+    final out = p.join(work.path, Platform.isWindows ? 'localnode-cli.exe' : 'localnode-cli');
+    stderr.writeln('[bench] compiling bin/localnode_cli.dart...');
+    final r = await Process.run(Platform.resolvedExecutable,
+        ['compile', 'exe', 'bin/localnode_cli.dart', '-o', out]);
+    if (r.exitCode != 0) {
+      throw ProcessException(
+          Platform.resolvedExecutable, ['compile', 'exe'], '${r.stderr}', r.exitCode);
+    }
+    return out;
+  }
+
+  Future<void> _writeConfig(_Node n, Map<String, dynamic> federation) async {
+    await Directory(n.share).create(recursive: true);
+    final server = {
+      'port': n.port,
+      'ip': '127.0.0.1',
+      'name': n.name,
+      'dir': n.share,
+      'no-pin': true,
+      'https-cert': _certPem,
+      'https-key': _keyPem,
+      'token': n.token,
+    };
+    // YAML は JSON の上位互換なので JSON で書けば足りる
+    await File(p.join(n.dir.path, 'config.yaml')).writeAsString(
+        json.encode({'server': server, ...federation}));
+  }
+
+  Future<void> _launch(String binary, _Node n) async {
+    final proc = await Process.start(binary, [
+      '--config', p.join(n.dir.path, 'config.yaml'),
+      '--state-file', p.join(n.dir.path, 'state.json'),
+      '--verbose',
+    ], environment: {'LOCALNODE_FED_CA': _caPem});
+    n.process = proc;
+    void keep(String line) {
+      n.log.add(line);
+      if (n.log.length > 200) n.log.removeAt(0);
+    }
+
+    proc.stdout.transform(utf8.decoder).transform(const LineSplitter()).listen(keep);
+    proc.stderr.transform(utf8.decoder).transform(const LineSplitter()).listen(keep);
+    unawaited(proc.exitCode.then((c) {
+      if (c != 0 && c != -15) {
+        stderr.writeln('[bench] ${n.name} exited $c:\n  ${n.log.join('\n  ')}');
+      }
+    }));
+  }
+
+  Future<void> _waitHealthy(_Node n) async {
+    await _waitFor(const Duration(seconds: 30), () async {
+      try {
+        await _getJson(n, '/api/health');
+        return true;
+      } catch (_) {
+        return false;
+      }
+    });
+  }
+
+  Future<bool> _waitFor(Duration limit, Future<bool> Function() check,
+      {Duration poll = const Duration(milliseconds: 250),
+      bool throwOnTimeout = true}) async {
+    final sw = Stopwatch()..start();
+    while (true) {
+      try {
+        if (await check()) return true;
+      } catch (_) {}
+      if (sw.elapsed >= limit) {
+        if (throwOnTimeout) throw TimeoutException('bench wait', limit);
+        return false;
+      }
+      await Future.delayed(poll);
+    }
+  }
+}
+
+Future<int> _freePort() async {
+  final s = await ServerSocket.bind(InternetAddress.loopbackIPv4, 0);
+  final port = s.port;
+  await s.close();
+  return port;
+}
+
+String _randomToken() {
+  final r = Random.secure();
+  return List.generate(16, (_) => r.nextInt(256).toRadixString(16).padLeft(2, '0'))
+      .join();
+}
+
+double _mbps(int bytes, int ms) =>
+    ms == 0 ? 0 : bytes / (1024 * 1024) / (ms / 1000);
+
+Map<String, dynamic> _summary(List<double> xs) {
+  if (xs.isEmpty) return {'n': 0};
+  final s = [...xs]..sort();
+  double q(double f) => s[min(s.length - 1, (f * s.length).floor())];
+  return {
+    'n': s.length,
+    'min': s.first,
+    'p50': q(0.5),
+    'p90': q(0.9),
+    'p99': q(0.99),
+    'max': s.last,
+  };
+}
+
+void _printReport(_BenchConfig cfg, Map<String, dynamic> r) {
+  String f(num? v, [int digits = 1]) => v == null ? '-' : v.toStringAsFixed(digits);
+  final s = cfg.shape;
+  stdout.writeln('LocalNode federation bench');
+  stdout.writeln('  topology : hub + ${cfg.children} children, relation=${cfg.relation}'
+      '${cfg.sync ? ' (sync)' : ''}');
+  stdout.writeln('  link     : ${f(s.latencyMs)}ms +0..${f(s.jitterMs)}ms, '
+      'loss ${f(s.loss * 100, 2)}%, '
+      '${s.bytesPerSec == null ? 'unlimited' : '${f(s.bytesPerSec! / 1024, 0)} KB/s'}');
+
+  final clip = r['clipboard'] as Map;
+  final ms = clip['ms'] as Map;
+  stdout.writeln('\nclipboard propagation (child -> hub)');
+  stdout.writeln('  n=${ms['n']} p50=${f(ms['p50'])}ms p90=${f(ms['p90'])}ms '
+      'p99=${f(ms['p99'])}ms max=${f(ms['max'])}ms lost=${clip['lost']}');
+
+  final ff = r['fileForward'] as Map;
+  stdout.writeln('\nfile forward (child -> hub)');
+  if (ff['skipped'] != null) {
+    stdout.writeln('  skipped: ${ff['skipped']}');
+  } else {
+    (ff['perChild'] as Map).forEach((name, v) {
+      stdout.writeln('  $name: upload ${v['uploadMs']}ms, delivered '
+          '${v['deliveredMs'] ?? '-'}ms, ${f(v['mbPerSec'] as num?, 2)} MB/s');
+    });
+    stdout.writeln('  aggregate: ${f(ff['aggregateMbPerSec'] as num, 2)} MB/s');
+  }
+
+  final hb = r['heartbeat'] as Map;
+  stdout.writeln('\nheartbeat overhead (idle ${f(hb['windowSec'] as num, 0)}s)');
+  stdout.writeln('  ${f(hb['bytesPerSec'] as num)} B/s total, '
+      '${f(hb['bytesPerSecPerLink'] as num)} B/s per link, '
+      '${hb['connections']} connections');
+
+  final pt = r['partition'] as Map?;
+  if (pt != null) {
+    stdout.writeln('\npartition recovery (${pt['child']}, ${cfg.partition.inSeconds}s)');
+    stdout.writeln('  offline detected after ${pt['offlineDetectedMs'] ?? '-'}ms');
+    stdout.writeln('  reconnected ${pt['reconnectedMs'] ?? '-'}ms after heal');
+    stdout.writeln('  clipboard written during partition: '
+        '${pt['clipboardRecoveredMs'] == null ? 'not recovered' : 'recovered ${pt['clipboardRecoveredMs']}ms after heal'}');
+  }
+}
@@ -0,0 +1,522 @@
+// LocalNode アクセストレースの再生ツール
+//
+// localnode-cli --trace で記録した実際のアクセスの並びを、共有フォルダの
+// コピーで起動した localnode-cli に流し直し、経路の種類ごとのレイテンシ分布を
+// 出す。--exe-b を付けると同じトレースを 2 つのビルドに順に流して比べる。
+//
+//   dart run tool/trace_replay.dart --trace access.lntrace --share /srv/share
+//   dart run tool/trace_replay.dart --trace access.lntrace --share /srv/share \
+//       --exe ./old/localnode-cli --exe-b ./new/localnode-cli --speed 4
+//   dart run tool/trace_replay.dart --compare old.json new.json
+//
+// --speed は 1 で記録どおりの間隔、N で N 倍速、0 で間隔を無視して
+// --concurrency 本ずつ詰めて流す。記録の切れ目 (サーバ停止中など) で
+// --max-gap より長く空いたところは詰める。
+//
+// 本文は記録していないので、アップロードや clipboard はサイズだけ合わせた
+// 合成データを送る。共有リンク (/s/) と federation の経路は再現できないので
+// 飛ばす。ファイル ID (正規化した共有ルートからの絶対パスの base64url) は
+// コピー先のパスに書き換える。コピーは実行ごとに作り直すので、削除や
+// アップロードを含むトレースでも各ビルドは同じ状態から始まる。記録開始時点の
+// 共有フォルダを残しておくと、記録時と同じ応答 (状態コード) になりやすい。
+//
+// --exe を省略すると bin/localnode_cli.dart を一時ディレクトリにコンパイルする。
+
+import 'dart:async';
+import 'dart:convert';
+import 'dart:io';
+import 'dart:math';
+import 'dart:typed_data';
+
+import 'package:args/args.dart';
+import 'package:localnode/src/perf_stats.dart';
+import 'package:localnode/src/trace_format.dart';
+import 'package:path/path.dart' as p;
+
+Future<void> main(List<String> args) async {
+  final parser = ArgParser()
+    ..addOption('trace', help: 'Trace file written by localnode-cli --trace')
+    ..addOption('share', help: 'Directory to copy as the shared folder')
+    ..addOption('exe', help: 'Build to replay against (compiles bin/ if omitted)')
+    ..addOption('exe-b', help: 'Second build; replays the same trace and compares')
+    ..addOption('speed',
+        defaultsTo: '1',
+        help: 'Replay speed: 1 = recorded timing, N = N times faster, '
+            '0 = as fast as possible')
+    ..addOption('concurrency',
+        defaultsTo: '8', help: 'Requests in flight with --speed 0')
+    ..addOption('connections',
+        defaultsTo: '16', help: 'Connections the client opens to the server')
+    ..addOption('max-gap',
+        defaultsTo: '10', help: 'Idle gaps longer than this (seconds) are cut')
+    ..addOption('limit', help: 'Replay only the first N requests')
+    ..addOption('out', help: 'Write the result (first build) as JSON')
+    ..addOption('out-b', help: 'Write the result of --exe-b as JSON')
+    ..addMultiOption('compare',
+        help: 'Compare two JSON results written by --out (give it twice)',
+        valueHelp: 'FILE')
+    ..addFlag('json', negatable: false, help: 'Print results as JSON')
+    ..addFlag('keep', negatable: false, help: 'Keep the work directory')
+    ..addFlag('help', abbr: 'h', negatable: false);
+  final ArgResults opts;
+  try {
+    opts = parser.parse(args);
+  } on FormatException catch (e) {
+    stderr.writeln('Error: ${e.message}\n\n${parser.usage}');
+    exit(64);
+  }
+  if (opts['help'] as bool) {
+    stdout.writeln('Usage: dart run tool/trace_replay.dart [options]\n');
+    stdout.writeln(parser.usage);
+    return;
+  }
+
+  final compare = opts['compare'] as List<String>;
+  if (compare.isNotEmpty) {
+    if (compare.length != 2) {
+      stderr.writeln('Error: --compare needs exactly two files');
+      exit(64);
+    }
+    final a = json.decode(await File(compare[0]).readAsString()) as Map;
+    final b = json.decode(await File(compare[1]).readAsString()) as Map;
+    _printComparison(a.cast(), b.cast());
+    return;
+  }
+
+  final tracePath = opts['trace'] as String?;
+  final share = opts['share'] as String?;
+  if (tracePath == null || share == null) {
+    stderr.writeln('Error: --trace and --share are required\n\n${parser.usage}');
+    exit(64);
+  }
+  final cfg = _ReplayConfig(
+    speed: double.parse(opts['speed'] as String),
+    concurrency: int.parse(opts['concurrency'] as String),
+    connections: int.parse(opts['connections'] as String),
+    maxGap: Duration(seconds: int.parse(opts['max-gap'] as String)),
+  );
+  if (cfg.speed < 0 || cfg.concurrency < 1 || cfg.connections < 1) {
+    stderr.writeln('Error: --speed must be >= 0, --concurrency and '
+        '--connections >= 1');
+    exit(64);
+  }
+
+  final work = await Directory.systemTemp.createTemp('localnode-replay-');
+  var code = 0;
+  try {
+    var records = _readTrace(await File(tracePath).readAsBytes(), cfg.maxGap);
+    final limit = opts['limit'] as String?;
+    if (limit != null) records = records.take(int.parse(limit)).toList();
+    stderr.writeln('[replay] ${records.length} requests, '
+        '${_fmtDuration(records.isEmpty ? 0 : records.last.atMs)} of traffic');
+
+    final builds = [
+      (opts['exe'] as String?) ?? await _compile(work),
+      if (opts['exe-b'] != null) opts['exe-b'] as String,
+    ];
+    final outs = [opts['out'] as String?, opts['out-b'] as String?];
+    final results = <Map<String, dynamic>>[];
+    for (var i = 0; i < builds.length; i++) {
+      final run = _Replay(cfg, records, Directory(p.join(work.path, 'run$i')));
+      stderr.writeln('[replay] ${builds[i]}');
+      final r = await run.run(builds[i], share);
+      results.add(r);
+      if (outs[i] != null) {
+        await File(outs[i]!)
+            .writeAsString(const JsonEncoder.withIndent('  ').convert(r));
+      }
+    }
+    if (opts['json'] as bool) {
+      stdout.writeln(const JsonEncoder.withIndent('  ').convert(
+          results.length == 1 ? results.first : results));
+    } else if (results.length == 2) {
+      _printComparison(results[0], results[1]);
+    } else {
+      _printResult(results.first);
+    }
+  } catch (e, st) {
+    stderr.writeln('Error: $e');
+    stderr.writeln(st);
+    code = 1;
+  } finally {
+    if (opts['keep'] as bool) {
+      stderr.writeln('Work directory kept: ${work.path}');
+    } else {
+      await work.delete(recursive: true);
+    }
+  }
+  exit(code);
+}
+
+class _ReplayConfig {
+  final double speed;
+  final int concurrency;
+  final int connections;
+  final Duration maxGap;
+
+  _ReplayConfig({
+    required this.speed,
+    required this.concurrency,
+    required this.connections,
+    required this.maxGap,
+  });
+}
+
+/// トレース 1 件。atMs は先頭からの (切れ目を詰めた) 時刻
+class _TraceRecord {
+  final int atMs;
+  final String shareRoot;
+  final int headerUs;
+  final int totalUs;
+  final int status;
+  final String method;
+  final String route;
+  final String path;
+  final String query;
+  final Map<String, String> headers;
+  final int bytesIn;
+  final int bytesOut;
+
+  _TraceRecord(this.atMs, this.shareRoot, this.headerUs, this.totalUs,
+      this.status, this.method, this.route, this.path, this.query,
+      this.headers, this.bytesIn, this.bytesOut);
+}
+
+/// セグメント (サーバの起動ごと) をまたいで時刻順に並べ、maxGap より長い
+/// 空きを詰める
+List<_TraceRecord> _readTrace(Uint8List bytes, Duration maxGap) {
+  // 記録は完了順なので開始時刻で並べ直す
+  final raw = readTrace(bytes)..sort((a, b) => a.startMs.compareTo(b.startMs));
+  final out = <_TraceRecord>[];
+  var at = 0;
+  var prevMs = raw.isEmpty ? 0 : raw.first.startMs;
+  for (final x in raw) {
+    at += min(x.startMs - prevMs, maxGap.inMilliseconds);
+    prevMs = x.startMs;
+    out.add(_TraceRecord(at, x.shareRoot, x.headerUs, x.totalUs, x.status,
+        x.method, x.route, x.path, x.query, x.headers, x.bytesIn, x.bytesOut));
+  }
+  return out;
+}
+
+class _Replay {
+  final _ReplayConfig cfg;
+  final List<_TraceRecord> records;
+  final Directory dir;
+  late final HttpClient _http = HttpClient()
+    ..maxConnectionsPerHost = cfg.connections
+    ..idleTimeout = const Duration(seconds: 30);
+  final Random _random = Random(1); // 合成本文はビルド間で同じにする
+
+  _Replay(this.cfg, this.records, this.dir);
+
+  Future<Map<String, dynamic>> run(String binary, String share) async {
+    await dir.create(recursive: true);
+    final copy = Directory(p.join(dir.path, 'share'));
+    stderr.writeln('[replay] copying $share...');
+    await _copyTree(Directory(share), copy);
+    final copyRoot = await copy.resolveSymbolicLinks();
+    final port = await _freePort();
+    final log = <String>[];
+    final proc = await Process.start(binary, [
+      '--dir', copyRoot,
+      '--port', '$port',
+      // --no-pin で書き込みもできるコピーなので、LAN には出さない
+      '--bind', '127.0.0.1',
+      '--ip', '127.0.0.1',
+      '--no-pin',
+      '--name', 'replay',
+      '--state-file', p.join(dir.path, 'state.json'),
+      if (records.any((r) => r.route == 'dav')) '--webdav',
+    ]);
+    void keep(String line) {
+      log.add(line);
+      if (log.length > 200) log.removeAt(0);
+    }
+
+    proc.stdout.transform(utf8.decoder).transform(const LineSplitter()).listen(keep);
+    proc.stderr.transform(utf8.decoder).transform(const LineSplitter()).listen(keep);
+    final base = 'http://127.0.0.1:$port';
+    try {
+      await _waitHealthy(base, proc, log);
+      return await _drive(base, copyRoot, binary);
+    } finally {
+      proc.kill();
+      await proc.exitCode;
+      _http.close(force: true);
+    }
+  }
+
+  Future<Map<String, dynamic>> _drive(
+      String base, String copyRoot, String binary) async {
+    final header = <String, List<double>>{};
+    final total = <String, List<double>>{};
+    final recordedHeader = <String, List<double>>{};
+    var skipped = 0;
+    var failed = 0;
+    var mismatched = 0;
+    var inFlight = 0;
+    final idle = <Completer<void>>[];
+
+    Future<void> one(_TraceRecord rec) async {
+      inFlight++;
+      try {
+        final sw = Stopwatch()..start();
+        final req = await _http.openUrl(
+            rec.method, _rewriteUri(base, rec, copyRoot));
+        req.followRedirects = false;
+        _applyHeaders(req, rec, base, copyRoot);
+        final body = _syntheticBody(rec);
+        if (body != null) {
+          req.contentLength = body.length;
+          req.add(body);
+        }
+        final res = await req.close();
+        final headerMs = sw.elapsedMicroseconds / 1000;
+        await res.drain<void>();
+        final totalMs = sw.elapsedMicroseconds / 1000;
+        (header[rec.route] ??= []).add(headerMs);
+        (total[rec.route] ??= []).add(totalMs);
+        (recordedHeader[rec.route] ??= []).add(rec.headerUs / 1000);
+        if (res.statusCode ~/ 100 != rec.status ~/ 100) mismatched++;
+      } catch (_) {
+        failed++;
+      } finally {
+        inFlight--;
+        if (idle.isNotEmpty) idle.removeAt(0).complete();
+      }
+    }
+
+    final pending = <Future<void>>[];
+    final wall = Stopwatch()..start();
+    for (final rec in records) {
+      if (rec.route == 'fed' || rec.path == 's/-') {
+        skipped++;
+        continue;
+      }
+      if (cfg.speed == 0) {
+        while (inFlight >= cfg.concurrency) {
+          final c = Completer<void>();
+          idle.add(c);
+          await c.future;
+        }
+      } else {
+        final dueMs = rec.atMs / cfg.speed;
+        final waitMs = dueMs - wall.elapsedMilliseconds;
+        if (waitMs > 0) {
+          await Future<void>.delayed(Duration(milliseconds: waitMs.round()));
+        }
+      }
+      pending.add(one(rec));
+    }
+    await Future.wait(pending);
+    wall.stop();
+
+    return {
+      'build': binary,
+      'speed': cfg.speed,
+      'requests': records.length,
+      'skipped': skipped,
+      'failed': failed,
+      'statusMismatch': mismatched,
+      'wallMs': wall.elapsedMilliseconds,
+      'routes': {
+        for (final route in PerfStats.routes)
+          if (header.containsKey(route))
+            route: {
+              'headerMs': _summary(header[route]!),
+              'totalMs': _summary(total[route]!),
+              'recordedHeaderMs': _summary(recordedHeader[route]!),
+            },
+      },
+    };
+  }
+
+  /// 記録時の共有ルートを指すファイル ID (パス要素 / クエリ値) をコピー先に置き換える
+  Uri _rewriteUri(String base, _TraceRecord rec, String copyRoot) {
+    String fix(String v) => _rewriteId(v, rec.shareRoot, copyRoot) ?? v;
+    final path = rec.path.split('/').map((s) {
+      final fixed = _rewriteId(s, rec.shareRoot, copyRoot);
+      return fixed ?? s;
+    }).join('/');
+    final query = rec.query.isEmpty
+        ? ''
+        : '?${Uri.splitQueryString(rec.query).entries.map((e) => '${Uri.encodeQueryComponent(e.key)}=${Uri.encodeQueryComponent(fix(e.value))}').join('&')}';
+    return Uri.parse('$base/$path$query');
+  }
+
+  static String? _rewriteId(String v, String from, String to) {
+    if (from.isEmpty || v.length < 8 || !RegExp(r'^[A-Za-z0-9_-]+=*$').hasMatch(v)) {
+      return null;
+    }
+    try {
+      final decoded = utf8.decode(base64Url.decode(base64Url.normalize(v)));
+      if (decoded != from && !p.isWithin(from, decoded)) return null;
+      return base64Url.encode(utf8.encode(to + decoded.substring(from.length)));
+    } catch (_) {
+      return null;
+    }
+  }
+
+  void _applyHeaders(
+      HttpClientRequest req, _TraceRecord rec, String base, String copyRoot) {
+    rec.headers.forEach((name, value) {
+      if (name == 'destination') {
+        // WebDAV の COPY / MOVE 先。ホストは再生先に付け替える
+        final dest = Uri.tryParse(value);
+        if (dest != null) req.headers.set(name, '$base${dest.path}');
+        return;
+      }
+      req.headers.set(name, value);
+    });
+    if (rec.route == 'upload' ||
+        (rec.route == 'clip' && rec.path == 'api/clipboard/blob')) {
+      req.headers.set('x-filename', Uri.encodeComponent(
+          'replay-${rec.atMs}-${_random.nextInt(1 << 30)}.bin'));
+    }
+  }
+
+  /// 記録されたサイズに合わせた本文。clipboard のテキストは JSON にする
+  List<int>? _syntheticBody(_TraceRecord rec) {
+    if (rec.bytesIn == 0 && rec.method != 'POST' && rec.method != 'PUT') {
+      return null;
+    }
+    if (rec.path == 'api/clipboard' && rec.method == 'POST') {
+      final n = min(max(rec.bytesIn - 12, 1), 10000);
+      return utf8.encode(json.encode({'text': 'r' * n}));
+    }
+    if ((rec.headers['content-type'] ?? '').contains('json')) {
+      return utf8.encode('{}');
+    }
+    final b = Uint8List(rec.bytesIn);
+    for (var i = 0; i < b.length; i += 4096) {
+      b[i] = _random.nextInt(256); // 圧縮で潰れすぎないように散らす
+    }
+    return b;
+  }
+
+  Future<void> _waitHealthy(String base, Process proc, List<String> log) async {
+    final sw = Stopwatch()..start();
+    var exited = false;
+    unawaited(proc.exitCode.then((_) => exited = true));
+    while (sw.elapsed < const Duration(seconds: 60)) {
+      if (exited) {
+        throw StateError('server exited:\n  ${log.join('\n  ')}');
+      }
+      try {
+        final req = await _http.getUrl(Uri.parse('$base/api/health'));
+        final res = await req.close();
+        await res.drain<void>();
+        if (res.statusCode == 200) return;
+      } catch (_) {}
+      await Future<void>.delayed(const Duration(milliseconds: 250));
+    }
+    throw TimeoutException('server did not become healthy');
+  }
+}
+
+/// 更新時刻も写す (サムネイルの ETag はサイズと更新時刻で決まる)
+Future<void> _copyTree(Directory from, Directory to) async {
+  await to.create(recursive: true);
+  await for (final e in from.list(followLinks: false)) {
+    final target = p.join(to.path, p.basename(e.path));
+    if (e is Directory) {
+      await _copyTree(e, Directory(target));
+    } else if (e is File) {
+      final copy = await e.copy(target);
+      await copy.setLastModified(await e.lastModified());
+    }
+  }
+}
+
+Future<String> _compile(Directory work) async {
+  final out = p.join(work.path, Platform.isWindows ? 'localnode-cli.exe' : 'localnode-cli');
+  stderr.writeln('[replay] compiling bin/localnode_cli.dart...');
+  final r = await Process.run(Platform.resolvedExecutable,
+      ['compile', 'exe', 'bin/localnode_cli.dart', '-o', out]);
+  if (r.exitCode != 0) {
+    throw ProcessException(
+        Platform.resolvedExecutable, ['compile', 'exe'], '${r.stderr}', r.exitCode);
+  }
+  return out;
+}
+
+Future<int> _freePort() async {
+  final s = await ServerSocket.bind(InternetAddress.loopbackIPv4, 0);
+  final port = s.port;
+  await s.close();
+  return port;
+}
+
+Map<String, dynamic> _summary(List<double> xs) {
+  if (xs.isEmpty) return {'n': 0};
+  final s = [...xs]..sort();
+  double q(double f) => s[min(s.length - 1, (f * s.length).floor())];
+  return {
+    'n': s.length,
+    'min': s.first,
+    'p50': q(0.5),
+    'p90': q(0.9),
+    'p99': q(0.99),
+    'max': s.last,
+  };
+}
+
+String _fmtDuration(int ms) {
+  final d = Duration(milliseconds: ms);
+  if (d.inHours > 0) return '${d.inHours}h${d.inMinutes % 60}m';
+  if (d.inMinutes > 0) return '${d.inMinutes}m${d.inSeconds % 60}s';
+  return '${(ms / 1000).toStringAsFixed(1)}s';
+}
+
+void _printResult(Map<String, dynamic> r) {
+  String f(num? v) => v == null ? '-' : v.toStringAsFixed(1);
+  stdout.writeln('LocalNode trace replay');
+  stdout.writeln('  build    : ${r['build']}');
+  stdout.writeln('  speed    : ${r['speed'] == 0 ? 'max' : '${r['speed']}x'}'
+      '   wall ${_fmtDuration(r['wallMs'] as int)}');
+  stdout.writeln('  requests : ${r['requests']} (skipped ${r['skipped']}, '
+      'failed ${r['failed']}, status differs from trace ${r['statusMismatch']})');
+  stdout.writeln('');
+  stdout.writeln('  route        n   header p50    p90    p99   total p99   recorded p99');
+  final routes = (r['routes'] as Map).cast<String, dynamic>();
+  for (final e in routes.entries) {
+    final h = (e.value['headerMs'] as Map).cast<String, dynamic>();
+    final t = (e.value['totalMs'] as Map).cast<String, dynamic>();
+    final rec = (e.value['recordedHeaderMs'] as Map).cast<String, dynamic>();
+    stdout.writeln('  ${e.key.padRight(8)} ${'${h['n']}'.padLeft(6)} '
+        '${f(h['p50']).padLeft(11)} ${f(h['p90']).padLeft(6)} '
+        '${f(h['p99']).padLeft(6)} ${f(t['p99']).padLeft(11)} '
+        '${f(rec['p99']).padLeft(14)}');
+  }
+  stdout.writeln('  (ms; header = until response headers, total = body drained)');
+}
+
+void _printComparison(Map<String, dynamic> a, Map<String, dynamic> b) {
+  String f(num? v) => v == null ? '-' : v.toStringAsFixed(1);
+  String delta(num? x, num? y) {
+    if (x == null || y == null || x == 0) return '';
+    final d = (y - x) / x * 100;
+    return '${d >= 0 ? '+' : ''}${d.toStringAsFixed(0)}%';
+  }
+
+  stdout.writeln('LocalNode trace replay — A vs B');
+  stdout.writeln('  A: ${a['build']}  (failed ${a['failed']}, '
+      'status differs ${a['statusMismatch']}, wall ${_fmtDuration(a['wallMs'] as int)})');
+  stdout.writeln('  B: ${b['build']}  (failed ${b['failed']}, '
+      'status differs ${b['statusMismatch']}, wall ${_fmtDuration(b['wallMs'] as int)})');
+  stdout.writeln('');
+  stdout.writeln('  route        n     p50 A→B            p90 A→B            p99 A→B');
+  final ra = (a['routes'] as Map).cast<String, dynamic>();
+  final rb = (b['routes'] as Map).cast<String, dynamic>();
+  for (final route in PerfStats.routes) {
+    if (!ra.containsKey(route) && !rb.containsKey(route)) continue;
+    final ha = ((ra[route]?['headerMs'] ?? const {}) as Map).cast<String, dynamic>();
+    final hb = ((rb[route]?['headerMs'] ?? const {}) as Map).cast<String, dynamic>();
+    String cell(String k) =>
+        '${f(ha[k])}→${f(hb[k])} ${delta(ha[k], hb[k])}'.padRight(18);
+    stdout.writeln('  ${route.padRight(8)} ${'${ha['n'] ?? hb['n']}'.padLeft(6)}  '
+        '${cell('p50')} ${cell('p90')} ${cell('p99')}');
+  }
+  stdout.writeln('  (ms until response headers)');
+}